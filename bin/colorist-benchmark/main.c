@@ -7,6 +7,8 @@
 
 #include "colorist/colorist.h"
 
+#include "suite.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,23 +20,21 @@
     }                                                                 \
     arg = argv[++argIndex]
 
-static void clContextSilentLog(clContext * C, const char * section, int indent, const char * format, va_list args)
-{
-    COLORIST_UNUSED(C);
-    COLORIST_UNUSED(section);
-    COLORIST_UNUSED(indent);
-    COLORIST_UNUSED(format);
-    COLORIST_UNUSED(args);
-}
-static void clContextSilentLogError(clContext * C, const char * format, va_list args)
-{
-    COLORIST_UNUSED(C);
-    COLORIST_UNUSED(format);
-    COLORIST_UNUSED(args);
-}
-
 int main(int argc, char * argv[])
 {
+    clContextSystem silentSystem;
+    silentSystem.alloc = clContextDefaultAlloc;
+    silentSystem.free = clContextDefaultFree;
+    silentSystem.log = clContextSilentLog;
+    silentSystem.error = clContextSilentLogError;
+
+    if ((argc > 1) && !strcmp(argv[1], "--suite")) {
+        clContext * C = clContextCreate(&silentSystem);
+        int ret = benchmarkSuite(C, argc, argv, 2);
+        clContextDestroy(C);
+        return ret;
+    }
+
     const char * inputFilename = NULL;
     const char * readCodec = NULL;
     int attempts = 1;
@@ -66,17 +66,12 @@ int main(int argc, char * argv[])
 
     if (!inputFilename) {
         printf("colorist-benchmark [options] [input image filename] [optional attempts]\n");
+        printf("colorist-benchmark --suite [suite options] (see --suite --help)\n");
         printf("Options:\n");
         printf("    -c CODEC : pick which AV1 codec to use, if reading an AVIF\n");
         return 1;
     }
 
-    clContextSystem silentSystem;
-    silentSystem.alloc = clContextDefaultAlloc;
-    silentSystem.free = clContextDefaultFree;
-    silentSystem.log = clContextSilentLog;
-    silentSystem.error = clContextSilentLogError;
-
     clContext * C = clContextCreate(&silentSystem);
     struct clImage * image = NULL;
 
@@ -0,0 +1,865 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "suite.h"
+
+#include "colorist/raw.h"
+#include "colorist/transform.h"
+
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every image the scenarios work on comes from an image string, so the suite needs no assets and
+// runs the same everywhere. Gradients in all three channels (plus a translucent one for blending)
+// keep encoders and transforms away from their trivial flat-color paths.
+#define SOURCE_IMAGE_STRING "#ff0000..#00ff00,#00ff00..#0000ff,#0000ff..#ffffff,#ffffff..#000000,cw"
+#define COMPOSITE_IMAGE_STRING "#ffff0080..#00ffff20,#00ffff20..#ff00ffc0"
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_ITERATIONS 10
+#define DEFAULT_TOLERANCE 10.0f // percent
+
+typedef enum BenchProfile
+{
+    BENCH_PROFILE_SRGB = 0,
+    BENCH_PROFILE_LINEAR,    // BT.709, gamma 1.0
+    BENCH_PROFILE_P3_G22,    // P3, gamma 2.2
+    BENCH_PROFILE_BT2020_PQ, // BT.2020, PQ, 10000 nits
+    BENCH_PROFILE_BT2020_HLG, // BT.2020, HLG, 1000 nits
+
+    BENCH_PROFILE_COUNT
+} BenchProfile;
+
+typedef enum BenchInput
+{
+    BENCH_INPUT_SDR8 = 0, // 8-bit sRGB
+    BENCH_INPUT_SDR16,    // 16-bit sRGB
+    BENCH_INPUT_HDR16,    // 16-bit BT.2020 PQ
+
+    BENCH_INPUT_COUNT
+} BenchInput;
+
+// Everything the scenarios share. Inputs and profiles are made once up front; whatever a scenario
+// builds in setup() lives in the scratch fields until it is done.
+typedef struct Bench
+{
+    clContext * C;
+    int width;
+    int height;
+    int jobs;
+    clProfile * profiles[BENCH_PROFILE_COUNT];
+    clImage * inputs[BENCH_INPUT_COUNT];
+
+    // Scratch
+    clImage * image;
+    clImage * otherImage;
+    clTransform * transform;
+    float * srcPixels;
+    float * dstPixels;
+    clRaw raw;
+    clRaw output;
+    clWriteParams writeParams;
+    int pixelCount; // Pixels one run() works through, for MPix/s
+} Bench;
+
+typedef struct Scenario Scenario;
+typedef clBool (*ScenarioFunc)(Bench * bench, const Scenario * scenario);
+
+struct Scenario
+{
+    const char * name;
+    ScenarioFunc setup; // Untimed, optional. Scratch is freed once the scenario is done.
+    ScenarioFunc reset; // Untimed, before every run(), optional
+    ScenarioFunc run;   // Timed
+
+    // Meaning depends on the scenario
+    int a;
+    int b;
+    const char * s;
+};
+
+typedef struct ScenarioResult
+{
+    const Scenario * scenario;
+    clBool failed;
+    int pixelCount;
+    double minSeconds;
+    double medianSeconds;
+    double p99Seconds;
+    double mpixPerSecond; // From the median
+} ScenarioResult;
+
+// ---------------------------------------------------------------------------
+// Helpers
+
+static clProfile * createProfile(clContext * C,
+                                 const char * primariesName,
+                                 clProfileCurveType curveType,
+                                 float gamma,
+                                 int luminance)
+{
+    clProfilePrimaries primaries;
+    if (!clContextGetStockPrimaries(C, primariesName, &primaries)) {
+        return NULL;
+    }
+    clProfileCurve curve;
+    curve.type = curveType;
+    curve.implicitScale = 1.0f;
+    curve.gamma = gamma;
+    char * description = clGenerateDescription(C, &primaries, &curve, luminance);
+    clProfile * profile = clProfileCreate(C, &primaries, &curve, luminance, description);
+    clFree(description);
+    return profile;
+}
+
+static clImage * createImage(Bench * bench, const char * colors, int width, int height, int depth, clProfile * profile)
+{
+    clContext * C = bench->C;
+    char imageString[256];
+    snprintf(imageString, sizeof(imageString), "%dx%d,%s", width, height, colors);
+    return clImageParseString(C, imageString, depth, profile);
+}
+
+static void freeScratch(Bench * bench)
+{
+    clContext * C = bench->C;
+    if (bench->image) {
+        clImageDestroy(C, bench->image);
+        bench->image = NULL;
+    }
+    if (bench->otherImage) {
+        clImageDestroy(C, bench->otherImage);
+        bench->otherImage = NULL;
+    }
+    if (bench->transform) {
+        clTransformDestroy(C, bench->transform);
+        bench->transform = NULL;
+    }
+    if (bench->srcPixels) {
+        clFree(bench->srcPixels);
+        bench->srcPixels = NULL;
+    }
+    if (bench->dstPixels) {
+        clFree(bench->dstPixels);
+        bench->dstPixels = NULL;
+    }
+    clRawFree(C, &bench->raw);
+    clRawFree(C, &bench->output);
+    C->inputRaw = NULL;
+    C->outputRaw = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Transform kernels: a = src BenchProfile, b = dst BenchProfile
+
+static clBool setupTransform(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    bench->pixelCount = bench->width * bench->height;
+    bench->transform =
+        clTransformCreate(C, bench->profiles[scenario->a], CL_XF_RGBA, bench->profiles[scenario->b], CL_XF_RGBA, CL_TONEMAP_AUTO);
+    if (!bench->transform) {
+        return clFalse;
+    }
+    clTransformPrepare(C, bench->transform);
+
+    // Any spread of values will do, the kernels don't branch on content
+    clImage * input = bench->inputs[BENCH_INPUT_SDR16];
+    clImagePrepareReadPixels(C, input, CL_PIXELFORMAT_F32);
+    size_t bytes = sizeof(float) * CL_CHANNELS_PER_PIXEL * bench->pixelCount;
+    bench->srcPixels = clAllocate(bytes);
+    bench->dstPixels = clAllocate(bytes);
+    memcpy(bench->srcPixels, input->pixelsF32, bytes);
+    return clTrue;
+}
+
+static clBool runTransform(Bench * bench, const Scenario * scenario)
+{
+    COLORIST_UNUSED(scenario);
+    clTransformRun(bench->C, bench->transform, bench->srcPixels, bench->dstPixels, bench->pixelCount);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Image conversion (pixel format in, transform, pixel format out): a = BenchInput, b = dst depth.
+// SDR inputs convert to BT.2020 PQ, HDR ones to sRGB.
+
+static clBool runConvert(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    clImage * input = bench->inputs[scenario->a];
+    clProfile * dstProfile = bench->profiles[(scenario->a == BENCH_INPUT_HDR16) ? BENCH_PROFILE_SRGB : BENCH_PROFILE_BT2020_PQ];
+    clTonemapParams tonemapParams;
+    clTonemapParamsSetDefaults(C, &tonemapParams);
+    clImage * converted = clImageConvert(C, input, scenario->b, dstProfile, CL_TONEMAP_AUTO, &tonemapParams);
+    if (!converted) {
+        return clFalse;
+    }
+    clImageDestroy(C, converted);
+    return clTrue;
+}
+
+static clBool setupConvert(Bench * bench, const Scenario * scenario)
+{
+    COLORIST_UNUSED(scenario);
+    bench->pixelCount = bench->width * bench->height;
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Pixel format conversion: a = source clPixelFormat, b = destination clPixelFormat
+
+static clBool setupPixels(Bench * bench, const Scenario * scenario)
+{
+    COLORIST_UNUSED(scenario);
+    bench->pixelCount = bench->width * bench->height;
+    bench->image = createImage(bench, SOURCE_IMAGE_STRING, bench->width, bench->height, 16, bench->profiles[BENCH_PROFILE_SRGB]);
+    return bench->image ? clTrue : clFalse;
+}
+
+static clBool resetPixels(Bench * bench, const Scenario * scenario)
+{
+    // Leave only the source format behind, so the timed read has to convert
+    clImagePrepareWritePixels(bench->C, bench->image, (clPixelFormat)scenario->a);
+    return clTrue;
+}
+
+static clBool runPixels(Bench * bench, const Scenario * scenario)
+{
+    clImagePrepareReadPixels(bench->C, bench->image, (clPixelFormat)scenario->b);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Resize: a = clFilter, b = percentage of the source size
+
+static clBool setupResize(Bench * bench, const Scenario * scenario)
+{
+    COLORIST_UNUSED(scenario);
+    bench->pixelCount = bench->width * bench->height;
+    return clTrue;
+}
+
+static clBool runResize(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    int width = CL_MAX(bench->width * scenario->b / 100, 1);
+    int height = CL_MAX(bench->height * scenario->b / 100, 1);
+    clImage * resized = clImageResize(C, bench->inputs[BENCH_INPUT_SDR16], width, height, (clFilter)scenario->a);
+    if (!resized) {
+        return clFalse;
+    }
+    clImageDestroy(C, resized);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Hald CLUT: a = cube root of the CLUT image's width (its dims are a^2)
+
+static clBool setupHald(Bench * bench, const Scenario * scenario)
+{
+    bench->pixelCount = bench->width * bench->height;
+    int haldWidth = scenario->a * scenario->a * scenario->a;
+    bench->otherImage = createImage(bench, SOURCE_IMAGE_STRING, haldWidth, haldWidth, 16, bench->profiles[BENCH_PROFILE_SRGB]);
+    return bench->otherImage ? clTrue : clFalse;
+}
+
+static clBool runHald(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    clImage * applied = clImageApplyHALD(C, bench->inputs[BENCH_INPUT_SDR16], bench->otherImage, scenario->a * scenario->a);
+    if (!applied) {
+        return clFalse;
+    }
+    clImageDestroy(C, applied);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Blend: a = BenchInput underneath the translucent composite
+
+static clBool setupBlend(Bench * bench, const Scenario * scenario)
+{
+    clImage * input = bench->inputs[scenario->a];
+    bench->pixelCount = bench->width * bench->height;
+    bench->otherImage = createImage(bench, COMPOSITE_IMAGE_STRING, bench->width, bench->height, input->depth, input->profile);
+    return bench->otherImage ? clTrue : clFalse;
+}
+
+static clBool runBlend(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    clBlendParams blendParams;
+    clBlendParamsSetDefaults(C, &blendParams);
+    clImage * blended = clImageBlend(C, bench->inputs[scenario->a], bench->otherImage, &blendParams);
+    if (!blended) {
+        return clFalse;
+    }
+    clImageDestroy(C, blended);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Color grading: a = BenchInput, b = dst depth
+
+static clBool setupGrade(Bench * bench, const Scenario * scenario)
+{
+    bench->pixelCount = bench->width * bench->height;
+    clImagePrepareReadPixels(bench->C, bench->inputs[scenario->a], CL_PIXELFORMAT_F32);
+    return clTrue;
+}
+
+static clBool runGrade(Bench * bench, const Scenario * scenario)
+{
+    int luminance = 0;
+    float gamma = 0.0f;
+    clImageColorGrade(bench->C, bench->inputs[scenario->a], scenario->b, &luminance, &gamma, clFalse);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Highlight, the whole action (decode, analysis, PNG encode) from and to memory: a = BenchInput
+
+static clBool setupHighlight(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    bench->pixelCount = bench->width * bench->height;
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    C->outputRaw = &bench->raw;
+    clBool encoded = clContextWrite(C, bench->inputs[scenario->a], "bench.png", "png", &writeParams);
+    C->outputRaw = NULL;
+    if (!encoded) {
+        return clFalse;
+    }
+
+    const char * argv[] = { "colorist-benchmark", "highlight", "bench.png", "bench_highlight.png" };
+    clBool parsed = clContextParseArgs(C, (int)(sizeof(argv) / sizeof(argv[0])), argv);
+    C->jobs = bench->jobs;
+    return parsed;
+}
+
+static clBool runHighlight(Bench * bench, const Scenario * scenario)
+{
+    COLORIST_UNUSED(scenario);
+    clContext * C = bench->C;
+    C->inputRaw = &bench->raw;
+    C->outputRaw = &bench->output;
+    int ret = clContextHighlight(C);
+    C->inputRaw = NULL;
+    C->outputRaw = NULL;
+    return (ret == 0) ? clTrue : clFalse;
+}
+
+// ---------------------------------------------------------------------------
+// Encoders and decoders, to and from memory: s = format, a = quality, b = speed (AVIF), PNG
+// compression level (PNG) or method (WebP), -1 for the default
+
+static clBool setupEncode(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    bench->pixelCount = bench->width * bench->height;
+    clWriteParamsSetDefaults(C, &bench->writeParams);
+    bench->writeParams.quality = scenario->a;
+    if (scenario->b >= 0) {
+        if (!strcmp(scenario->s, "avif")) {
+            bench->writeParams.speed = scenario->b;
+        } else if (!strcmp(scenario->s, "png")) {
+            bench->writeParams.pngCompressionLevel = scenario->b;
+        } else if (!strcmp(scenario->s, "webp")) {
+            bench->writeParams.webpMethod = scenario->b;
+        }
+    }
+    return clTrue;
+}
+
+static clBool runEncode(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    C->outputRaw = &bench->output;
+    clBool ret = clContextWrite(C, bench->inputs[BENCH_INPUT_SDR8], "bench", scenario->s, &bench->writeParams);
+    C->outputRaw = NULL;
+    return ret;
+}
+
+static clBool setupDecode(Bench * bench, const Scenario * scenario)
+{
+    if (!setupEncode(bench, scenario) || !runEncode(bench, scenario)) {
+        return clFalse;
+    }
+    // Keep the encoded image, reads reuse it every run
+    memcpy(&bench->raw, &bench->output, sizeof(clRaw));
+    memset(&bench->output, 0, sizeof(clRaw));
+    return clTrue;
+}
+
+static clBool runDecode(Bench * bench, const Scenario * scenario)
+{
+    clContext * C = bench->C;
+    char filename[32];
+    snprintf(filename, sizeof(filename), "bench.%s", scenario->s);
+    clImage * image = clContextReadRaw(C, &bench->raw, filename, NULL, NULL, NULL);
+    if (!image) {
+        return clFalse;
+    }
+    clImageDestroy(C, image);
+    return clTrue;
+}
+
+// ---------------------------------------------------------------------------
+// Registry
+
+#define TRANSFORM(NAME, SRC, DST) { "transform." NAME, setupTransform, NULL, runTransform, SRC, DST, NULL }
+#define CONVERT(NAME, INPUT, DEPTH) { "convert." NAME, setupConvert, NULL, runConvert, INPUT, DEPTH, NULL }
+#define PIXELS(NAME, SRC, DST) { "pixels." NAME, setupPixels, resetPixels, runPixels, SRC, DST, NULL }
+#define RESIZE(NAME, FILTER, PERCENT) { "resize." NAME, setupResize, NULL, runResize, FILTER, PERCENT, NULL }
+#define CODEC(NAME, FORMAT, QUALITY, SPEED)                                         \
+    { "encode." NAME, setupEncode, NULL, runEncode, QUALITY, SPEED, FORMAT },     \
+    {                                                                               \
+        "decode." NAME, setupDecode, NULL, runDecode, QUALITY, SPEED, FORMAT        \
+    }
+
+static const Scenario scenarios[] = {
+    TRANSFORM("srgb-to-srgb", BENCH_PROFILE_SRGB, BENCH_PROFILE_SRGB),
+    TRANSFORM("srgb-to-linear", BENCH_PROFILE_SRGB, BENCH_PROFILE_LINEAR),
+    TRANSFORM("linear-to-srgb", BENCH_PROFILE_LINEAR, BENCH_PROFILE_SRGB),
+    TRANSFORM("srgb-to-p3g22", BENCH_PROFILE_SRGB, BENCH_PROFILE_P3_G22),
+    TRANSFORM("srgb-to-pq", BENCH_PROFILE_SRGB, BENCH_PROFILE_BT2020_PQ),
+    TRANSFORM("pq-to-srgb", BENCH_PROFILE_BT2020_PQ, BENCH_PROFILE_SRGB),
+    TRANSFORM("hlg-to-srgb", BENCH_PROFILE_BT2020_HLG, BENCH_PROFILE_SRGB),
+    TRANSFORM("pq-to-hlg", BENCH_PROFILE_BT2020_PQ, BENCH_PROFILE_BT2020_HLG),
+
+    CONVERT("srgb8-to-pq16", BENCH_INPUT_SDR8, 16),
+    CONVERT("srgb16-to-pq10", BENCH_INPUT_SDR16, 10),
+    CONVERT("pq16-to-srgb8", BENCH_INPUT_HDR16, 8),
+
+    PIXELS("u8-to-f32", CL_PIXELFORMAT_U8, CL_PIXELFORMAT_F32),
+    PIXELS("u16-to-f32", CL_PIXELFORMAT_U16, CL_PIXELFORMAT_F32),
+    PIXELS("f32-to-u8", CL_PIXELFORMAT_F32, CL_PIXELFORMAT_U8),
+    PIXELS("f32-to-u16", CL_PIXELFORMAT_F32, CL_PIXELFORMAT_U16),
+    PIXELS("u16-to-u8", CL_PIXELFORMAT_U16, CL_PIXELFORMAT_U8),
+    PIXELS("u8-to-u16", CL_PIXELFORMAT_U8, CL_PIXELFORMAT_U16),
+
+    RESIZE("box-half", CL_FILTER_BOX, 50),
+    RESIZE("triangle-half", CL_FILTER_TRIANGLE, 50),
+    RESIZE("cubicbspline-half", CL_FILTER_CUBICBSPLINE, 50),
+    RESIZE("catmullrom-half", CL_FILTER_CATMULLROM, 50),
+    RESIZE("mitchell-half", CL_FILTER_MITCHELL, 50),
+    RESIZE("nearest-half", CL_FILTER_NEAREST, 50),
+    RESIZE("catmullrom-double", CL_FILTER_CATMULLROM, 200),
+
+    { "hald.16", setupHald, NULL, runHald, 4, 0, NULL },
+    { "hald.64", setupHald, NULL, runHald, 8, 0, NULL },
+
+    { "blend.srgb8", setupBlend, NULL, runBlend, BENCH_INPUT_SDR8, 0, NULL },
+    { "blend.pq16", setupBlend, NULL, runBlend, BENCH_INPUT_HDR16, 0, NULL },
+
+    { "grade.srgb16-to-8", setupGrade, NULL, runGrade, BENCH_INPUT_SDR16, 8, NULL },
+    { "grade.pq16-to-10", setupGrade, NULL, runGrade, BENCH_INPUT_HDR16, 10, NULL },
+
+    { "highlight.srgb16", setupHighlight, NULL, runHighlight, BENCH_INPUT_SDR16, 0, NULL },
+    { "highlight.pq16", setupHighlight, NULL, runHighlight, BENCH_INPUT_HDR16, 0, NULL },
+
+    CODEC("jpg.q50", "jpg", 50, -1),
+    CODEC("jpg.q90", "jpg", 90, -1),
+    CODEC("png.level1", "png", 100, 1),
+    CODEC("png.level6", "png", 100, 6),
+    CODEC("png.level9", "png", 100, 9),
+    CODEC("webp.q75.method4", "webp", 75, 4),
+    CODEC("webp.q75.method0", "webp", 75, 0),
+    CODEC("webp.lossless", "webp", 100, 4),
+    CODEC("avif.q60.speed10", "avif", 60, 10),
+    CODEC("avif.q60.speed6", "avif", 60, 6),
+    CODEC("avif.q90.speed6", "avif", 90, 6),
+    CODEC("jp2.q90", "jp2", 90, -1),
+    CODEC("tiff", "tiff", 100, -1),
+};
+static const int scenarioCount = (int)(sizeof(scenarios) / sizeof(scenarios[0]));
+
+// ---------------------------------------------------------------------------
+// Running
+
+static int compareSeconds(const void * a, const void * b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double * sorted, int count, int percent)
+{
+    int rank = (percent * count + 99) / 100; // ceil(percent/100 * count)
+    return sorted[CL_CLAMP(rank, 1, count) - 1];
+}
+
+static void runScenario(Bench * bench, const Scenario * scenario, int iterations, ScenarioResult * result)
+{
+    clContext * C = bench->C;
+    memset(result, 0, sizeof(ScenarioResult));
+    result->scenario = scenario;
+    bench->pixelCount = 0;
+
+    if (scenario->setup && !scenario->setup(bench, scenario)) {
+        result->failed = clTrue;
+    }
+
+    // One untimed run first to fault in buffers, warm caches and catch failures
+    double * samples = clAllocate(sizeof(double) * iterations);
+    for (int i = -1; !result->failed && (i < iterations); ++i) {
+        if (scenario->reset && !scenario->reset(bench, scenario)) {
+            result->failed = clTrue;
+            break;
+        }
+        Timer t;
+        timerStart(&t);
+        if (!scenario->run(bench, scenario)) {
+            result->failed = clTrue;
+            break;
+        }
+        double seconds = timerElapsedSeconds(&t);
+        if (i >= 0) {
+            samples[i] = seconds;
+        }
+    }
+
+    freeScratch(bench);
+
+    if (!result->failed) {
+        qsort(samples, iterations, sizeof(double), compareSeconds);
+        result->pixelCount = bench->pixelCount;
+        result->minSeconds = samples[0];
+        result->medianSeconds = (iterations & 1) ? samples[iterations / 2]
+                                                 : ((samples[(iterations / 2) - 1] + samples[iterations / 2]) * 0.5);
+        result->p99Seconds = percentile(samples, iterations, 99);
+        if (result->medianSeconds > 0.0) {
+            result->mpixPerSecond = ((double)result->pixelCount / 1000000.0) / result->medianSeconds;
+        }
+    }
+    clFree(samples);
+}
+
+static clBool createInputs(Bench * bench)
+{
+    clContext * C = bench->C;
+    bench->profiles[BENCH_PROFILE_SRGB] = clProfileCreateStock(C, CL_PS_SRGB);
+    bench->profiles[BENCH_PROFILE_LINEAR] = createProfile(C, "bt709", CL_PCT_GAMMA, 1.0f, CL_LUMINANCE_UNSPECIFIED);
+    bench->profiles[BENCH_PROFILE_P3_G22] = createProfile(C, "p3", CL_PCT_GAMMA, 2.2f, CL_LUMINANCE_UNSPECIFIED);
+    bench->profiles[BENCH_PROFILE_BT2020_PQ] = createProfile(C, "bt2020", CL_PCT_PQ, 1.0f, 10000);
+    bench->profiles[BENCH_PROFILE_BT2020_HLG] = createProfile(C, "bt2020", CL_PCT_HLG, 1.0f, 1000);
+    for (int i = 0; i < BENCH_PROFILE_COUNT; ++i) {
+        if (!bench->profiles[i]) {
+            fprintf(stderr, "ERROR: Failed to create benchmark profile %d\n", i);
+            return clFalse;
+        }
+    }
+
+    bench->inputs[BENCH_INPUT_SDR8] =
+        createImage(bench, SOURCE_IMAGE_STRING, bench->width, bench->height, 8, bench->profiles[BENCH_PROFILE_SRGB]);
+    bench->inputs[BENCH_INPUT_SDR16] =
+        createImage(bench, SOURCE_IMAGE_STRING, bench->width, bench->height, 16, bench->profiles[BENCH_PROFILE_SRGB]);
+    bench->inputs[BENCH_INPUT_HDR16] =
+        createImage(bench, SOURCE_IMAGE_STRING, bench->width, bench->height, 16, bench->profiles[BENCH_PROFILE_BT2020_PQ]);
+    for (int i = 0; i < BENCH_INPUT_COUNT; ++i) {
+        if (!bench->inputs[i]) {
+            fprintf(stderr, "ERROR: Failed to create %dx%d benchmark image %d\n", bench->width, bench->height, i);
+            return clFalse;
+        }
+    }
+    return clTrue;
+}
+
+static void destroyInputs(Bench * bench)
+{
+    clContext * C = bench->C;
+    for (int i = 0; i < BENCH_INPUT_COUNT; ++i) {
+        if (bench->inputs[i]) {
+            clImageDestroy(C, bench->inputs[i]);
+        }
+    }
+    for (int i = 0; i < BENCH_PROFILE_COUNT; ++i) {
+        if (bench->profiles[i]) {
+            clProfileDestroy(C, bench->profiles[i]);
+        }
+    }
+}
+
+// Scenarios match if their name contains any of filter's comma separated pieces
+static clBool matchesFilter(const char * name, const char * filter)
+{
+    if (!filter || !filter[0]) {
+        return clTrue;
+    }
+    const char * piece = filter;
+    while (*piece) {
+        const char * end = strchr(piece, ',');
+        size_t len = end ? (size_t)(end - piece) : strlen(piece);
+        if (len > 0) {
+            for (const char * p = name; *p; ++p) {
+                if (!strncmp(p, piece, len)) {
+                    return clTrue;
+                }
+            }
+        }
+        if (!end) {
+            break;
+        }
+        piece = end + 1;
+    }
+    return clFalse;
+}
+
+static cJSON * resultToJSON(const ScenarioResult * result)
+{
+    cJSON * json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "name", result->scenario->name);
+    cJSON_AddBoolToObject(json, "error", result->failed);
+    if (!result->failed) {
+        cJSON_AddNumberToObject(json, "pixels", result->pixelCount);
+        cJSON_AddNumberToObject(json, "min", result->minSeconds);
+        cJSON_AddNumberToObject(json, "median", result->medianSeconds);
+        cJSON_AddNumberToObject(json, "p99", result->p99Seconds);
+        cJSON_AddNumberToObject(json, "mpixPerSec", result->mpixPerSecond);
+    }
+    return json;
+}
+
+// ---------------------------------------------------------------------------
+// Baseline comparison
+
+static cJSON * readJSONFile(clContext * C, const char * filename)
+{
+    clRaw raw = CL_RAW_EMPTY;
+    if (!clRawReadFile(C, &raw, filename)) {
+        return NULL;
+    }
+    char * text = clAllocate(raw.size + 1);
+    memcpy(text, raw.ptr, raw.size);
+    text[raw.size] = 0;
+    clRawFree(C, &raw);
+    cJSON * json = cJSON_Parse(text);
+    clFree(text);
+    return json;
+}
+
+// Compares MPix/s (so baselines taken at another --size still line up) against the baseline's
+// scenarios of the same name. Returns the number of regressions: scenarios slower than tolerance
+// percent, or failing where the baseline succeeded.
+static int compareToBaseline(const ScenarioResult * results, int resultCount, cJSON * baseline, float tolerance)
+{
+    int regressions = 0;
+    cJSON * baselineScenarios = cJSON_GetObjectItem(baseline, "scenarios");
+    for (int i = 0; i < resultCount; ++i) {
+        const ScenarioResult * result = &results[i];
+        cJSON * match = NULL;
+        for (cJSON * item = baselineScenarios ? baselineScenarios->child : NULL; item != NULL; item = item->next) {
+            cJSON * name = cJSON_GetObjectItem(item, "name");
+            if (cJSON_IsString(name) && !strcmp(name->valuestring, result->scenario->name)) {
+                match = item;
+                break;
+            }
+        }
+        if (!match || cJSON_IsTrue(cJSON_GetObjectItem(match, "error"))) {
+            fprintf(stderr, "  %-32s no baseline\n", result->scenario->name);
+            continue;
+        }
+        if (result->failed) {
+            fprintf(stderr, "  %-32s REGRESSION: failed, baseline succeeded\n", result->scenario->name);
+            ++regressions;
+            continue;
+        }
+
+        cJSON * baselineRate = cJSON_GetObjectItem(match, "mpixPerSec");
+        double before = cJSON_IsNumber(baselineRate) ? baselineRate->valuedouble : 0.0;
+        if (before <= 0.0) {
+            fprintf(stderr, "  %-32s no baseline\n", result->scenario->name);
+            continue;
+        }
+        double change = ((result->mpixPerSecond / before) - 1.0) * 100.0;
+        clBool regressed = (change < -tolerance) ? clTrue : clFalse;
+        fprintf(stderr,
+                "  %-32s %9.2f -> %9.2f MPix/s (%+.1f%%)%s\n",
+                result->scenario->name,
+                before,
+                result->mpixPerSecond,
+                change,
+                regressed ? "  REGRESSION" : "");
+        if (regressed) {
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+// ---------------------------------------------------------------------------
+// Entry point
+
+static void printSuiteUsage(void)
+{
+    printf("colorist-benchmark --suite [options]\n");
+    printf("Options:\n");
+    printf("    -b,--baseline FILE   : Compare against the JSON from an earlier run, failing on regressions\n");
+    printf("    -f,--filter NAMES    : Only run scenarios whose names contain one of these (comma separated)\n");
+    printf("    -j,--jobs JOBS       : Number of jobs to use. 0 for as many as possible (default)\n");
+    printf("    -l,--list            : List the scenarios and exit\n");
+    printf("    -n,--iterations N    : Timed runs per scenario (default: %d, after an untimed warmup)\n", DEFAULT_ITERATIONS);
+    printf("    -o,--output FILE     : Also write the JSON results to FILE (for use as a later --baseline)\n");
+    printf("    -s,--size WxH        : Synthetic image size (default: %dx%d)\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    printf("    -t,--tolerance PCT   : Slowdown (in MPix/s) allowed before --baseline reports a regression (default: %g)\n",
+           DEFAULT_TOLERANCE);
+}
+
+int benchmarkSuite(clContext * C, int argc, char * argv[], int firstArg)
+{
+    const char * baselineFilename = NULL;
+    const char * outputFilename = NULL;
+    const char * filter = NULL;
+    int iterations = DEFAULT_ITERATIONS;
+    int jobs = 0;
+    int width = DEFAULT_WIDTH;
+    int height = DEFAULT_HEIGHT;
+    float tolerance = DEFAULT_TOLERANCE;
+    clBool list = clFalse;
+
+    for (int argIndex = firstArg; argIndex < argc; ++argIndex) {
+        const char * arg = argv[argIndex];
+        clBool takesValue = (!strcmp(arg, "-b") || !strcmp(arg, "--baseline") || !strcmp(arg, "-f") || !strcmp(arg, "--filter") ||
+                             !strcmp(arg, "-j") || !strcmp(arg, "--jobs") || !strcmp(arg, "-n") || !strcmp(arg, "--iterations") ||
+                             !strcmp(arg, "-o") || !strcmp(arg, "--output") || !strcmp(arg, "-s") || !strcmp(arg, "--size") ||
+                             !strcmp(arg, "-t") || !strcmp(arg, "--tolerance"));
+        if (takesValue) {
+            if ((argIndex + 1) == argc) {
+                fprintf(stderr, "%s requires an argument.\n", arg);
+                return 1;
+            }
+            const char * value = argv[++argIndex];
+            if (!strcmp(arg, "-b") || !strcmp(arg, "--baseline")) {
+                baselineFilename = value;
+            } else if (!strcmp(arg, "-f") || !strcmp(arg, "--filter")) {
+                filter = value;
+            } else if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+                jobs = atoi(value);
+            } else if (!strcmp(arg, "-n") || !strcmp(arg, "--iterations")) {
+                iterations = CL_MAX(atoi(value), 1);
+            } else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+                outputFilename = value;
+            } else if (!strcmp(arg, "-s") || !strcmp(arg, "--size")) {
+                if ((sscanf(value, "%dx%d", &width, &height) != 2) || (width < 1) || (height < 1)) {
+                    fprintf(stderr, "Invalid size (expected WxH): %s\n", value);
+                    return 1;
+                }
+            } else {
+                tolerance = (float)atof(value);
+            }
+        } else if (!strcmp(arg, "-l") || !strcmp(arg, "--list")) {
+            list = clTrue;
+        } else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            printSuiteUsage();
+            return 0;
+        } else {
+            fprintf(stderr, "Unknown suite option: %s\n", arg);
+            printSuiteUsage();
+            return 1;
+        }
+    }
+
+    if (list) {
+        for (int i = 0; i < scenarioCount; ++i) {
+            if (matchesFilter(scenarios[i].name, filter)) {
+                printf("%s\n", scenarios[i].name);
+            }
+        }
+        return 0;
+    }
+
+    cJSON * baseline = NULL;
+    if (baselineFilename) {
+        baseline = readJSONFile(C, baselineFilename);
+        if (!baseline) {
+            fprintf(stderr, "ERROR: Can't read baseline: %s\n", baselineFilename);
+            return 1;
+        }
+    }
+
+    C->jobs = (jobs > 0) ? CL_MIN(jobs, clTaskLimit()) : clTaskLimit();
+
+    Bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.C = C;
+    bench.jobs = C->jobs;
+    bench.width = width;
+    bench.height = height;
+
+    int failures = 0;
+    ScenarioResult * results = clAllocate(sizeof(ScenarioResult) * scenarioCount);
+    int resultCount = 0;
+    if (createInputs(&bench)) {
+        for (int i = 0; i < scenarioCount; ++i) {
+            if (!matchesFilter(scenarios[i].name, filter)) {
+                continue;
+            }
+            ScenarioResult * result = &results[resultCount++];
+            runScenario(&bench, &scenarios[i], iterations, result);
+            if (result->failed) {
+                // Usually a codec missing from this build; only fails the suite as a baseline regression
+                fprintf(stderr, "  %-32s FAILED\n", scenarios[i].name);
+            } else {
+                fprintf(stderr,
+                        "  %-32s min %8.3f ms, median %8.3f ms, p99 %8.3f ms, %9.2f MPix/s\n",
+                        scenarios[i].name,
+                        result->minSeconds * 1000.0,
+                        result->medianSeconds * 1000.0,
+                        result->p99Seconds * 1000.0,
+                        result->mpixPerSecond);
+            }
+        }
+    } else {
+        ++failures;
+    }
+    destroyInputs(&bench);
+
+    cJSON * json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "width", width);
+    cJSON_AddNumberToObject(json, "height", height);
+    cJSON_AddNumberToObject(json, "jobs", C->jobs);
+    cJSON_AddNumberToObject(json, "iterations", iterations);
+    cJSON * jsonScenarios = cJSON_AddArrayToObject(json, "scenarios");
+    for (int i = 0; i < resultCount; ++i) {
+        cJSON_AddItemToArray(jsonScenarios, resultToJSON(&results[i]));
+    }
+    char * text = cJSON_Print(json);
+    printf("%s\n", text);
+    if (outputFilename) {
+        FILE * f = fopen(outputFilename, "wb");
+        if (f) {
+            fprintf(f, "%s\n", text);
+            fclose(f);
+        } else {
+            fprintf(stderr, "ERROR: Can't write results: %s\n", outputFilename);
+            ++failures;
+        }
+    }
+    free(text);
+    cJSON_Delete(json);
+
+    int regressions = 0;
+    if (baseline) {
+        fprintf(stderr, "Comparing against baseline: %s (tolerance %g%%)\n", baselineFilename, tolerance);
+        regressions = compareToBaseline(results, resultCount, baseline, tolerance);
+        if (regressions > 0) {
+            fprintf(stderr, "ERROR: %d scenario(s) regressed against %s\n", regressions, baselineFilename);
+        }
+        cJSON_Delete(baseline);
+    }
+    clFree(results);
+    return ((failures > 0) || (regressions > 0)) ? 1 : 0;
+}
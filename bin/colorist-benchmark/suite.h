@@ -0,0 +1,18 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#ifndef COLORIST_BENCHMARK_SUITE_H
+#define COLORIST_BENCHMARK_SUITE_H
+
+#include "colorist/colorist.h"
+
+// Runs the registered scenarios on synthetic images, printing their timings as JSON. argv[firstArg]
+// onward are the suite's own options. Returns nonzero if the suite couldn't run, or if a scenario
+// regressed against the baseline (--baseline).
+int benchmarkSuite(clContext * C, int argc, char * argv[], int firstArg);
+
+#endif // ifndef COLORIST_BENCHMARK_SUITE_H
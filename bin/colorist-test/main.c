@@ -57,20 +57,6 @@ void setRGBA16_3(uint16_t c[3], uint16_t v0, uint16_t v1, uint16_t v2)
 }
 
 clContextSystem silentSystem;
-static void clContextSilentLog(clContext * C, const char * section, int indent, const char * format, va_list args)
-{
-    COLORIST_UNUSED(C);
-    COLORIST_UNUSED(section);
-    COLORIST_UNUSED(indent);
-    COLORIST_UNUSED(format);
-    COLORIST_UNUSED(args);
-}
-static void clContextSilentLogError(clContext * C, const char * format, va_list args)
-{
-    COLORIST_UNUSED(C);
-    COLORIST_UNUSED(format);
-    COLORIST_UNUSED(args);
-}
 
 // --------------------------------------------------------------------------------------
 // Unity stubs
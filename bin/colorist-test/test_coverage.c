@@ -7,6 +7,12 @@
 
 #include "main.h"
 
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 // ------------------------------------------------------------------------------------------------
 // The tests in here are to attempt to hit 100% code coverage (when running scripts/coverage.sh).
 // colorist-test shouldn't have to run any other test suites but test_coverage() to achieve this.
@@ -46,6 +52,8 @@ static void test_clAction(void)
     TEST_ASSERT_EQUAL_INT(CL_ACTION_CALC, clActionFromString(C, "calc"));
     TEST_ASSERT_EQUAL_INT(CL_ACTION_CONVERT, clActionFromString(C, "convert"));
     TEST_ASSERT_EQUAL_INT(CL_ACTION_MODIFY, clActionFromString(C, "modify"));
+    TEST_ASSERT_EQUAL_INT(CL_ACTION_BATCH, clActionFromString(C, "batch"));
+    TEST_ASSERT_EQUAL_INT(CL_ACTION_SERVE, clActionFromString(C, "serve"));
     TEST_ASSERT_EQUAL_INT(CL_ACTION_ERROR, clActionFromString(C, "derp"));
 
     TEST_ASSERT_EQUAL_STRING("--", clActionToString(C, CL_ACTION_NONE));
@@ -54,6 +62,8 @@ static void test_clAction(void)
     TEST_ASSERT_EQUAL_STRING("calc", clActionToString(C, CL_ACTION_CALC));
     TEST_ASSERT_EQUAL_STRING("convert", clActionToString(C, CL_ACTION_CONVERT));
     TEST_ASSERT_EQUAL_STRING("modify", clActionToString(C, CL_ACTION_MODIFY));
+    TEST_ASSERT_EQUAL_STRING("batch", clActionToString(C, CL_ACTION_BATCH));
+    TEST_ASSERT_EQUAL_STRING("serve", clActionToString(C, CL_ACTION_SERVE));
     TEST_ASSERT_EQUAL_STRING("unknown", clActionToString(C, CL_ACTION_ERROR));
     TEST_ASSERT_EQUAL_STRING("unknown", clActionToString(C, (clAction)555));
 
@@ -74,6 +84,19 @@ static void test_clFormat(void)
     TEST_ASSERT_EQUAL_STRING("png", clFormatDetect(C, "../test/red_png_no_ext"));
     TEST_ASSERT_EQUAL_STRING("png", clFormatDetect(C, "../test/red_png.txt"));
 
+    // Detecting from bytes already in memory, without reopening the file
+    clRaw input = CL_RAW_EMPTY;
+    TEST_ASSERT_TRUE(clRawReadFile(C, &input, "../test/red_png_no_ext"));
+    TEST_ASSERT_EQUAL_STRING("png", clFormatDetectRaw(C, NULL, &input));
+    TEST_ASSERT_EQUAL_STRING("png", clFormatDetectRaw(C, "not_a_file_but_it_has_no_extension", &input));
+    TEST_ASSERT_EQUAL_STRING("png", clFormatDetectRaw(C, "not_a_file.txt", &input));
+    TEST_ASSERT_EQUAL_STRING("jpg", clFormatDetectRaw(C, "not_a_file.jpg", &input)); // The extension wins
+    clImage * image = clContextReadRaw(C, &input, NULL, NULL, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(image);
+    clImageDestroy(C, image);
+    clRawFree(C, &input);
+    TEST_ASSERT_NULL(clFormatDetectRaw(C, NULL, &input));
+
     TEST_ASSERT_EQUAL_INT(8, clFormatMaxDepth(C, "txt")); // this will error, but return 8
     TEST_ASSERT_EQUAL_INT(8, clFormatMaxDepth(C, "jpg"));
     TEST_ASSERT_EQUAL_INT(10, clFormatMaxDepth(C, "bmp"));
@@ -125,6 +148,29 @@ static void test_clFilter(void)
     clContextDestroy(C);
 }
 
+static void test_clChromaUpsampling(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_AUTO, C->params.upsampling);
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_AUTO, clChromaUpsamplingFromString(C, "auto"));
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_FASTEST, clChromaUpsamplingFromString(C, "fastest"));
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_BEST, clChromaUpsamplingFromString(C, "best"));
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_NEAREST, clChromaUpsamplingFromString(C, "nearest"));
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_BILINEAR, clChromaUpsamplingFromString(C, "bilinear"));
+    TEST_ASSERT_EQUAL_INT(CL_CHROMAUPSAMPLING_INVALID, clChromaUpsamplingFromString(C, "derp"));
+
+    TEST_ASSERT_EQUAL_STRING("auto", clChromaUpsamplingToString(C, CL_CHROMAUPSAMPLING_AUTO));
+    TEST_ASSERT_EQUAL_STRING("fastest", clChromaUpsamplingToString(C, CL_CHROMAUPSAMPLING_FASTEST));
+    TEST_ASSERT_EQUAL_STRING("best", clChromaUpsamplingToString(C, CL_CHROMAUPSAMPLING_BEST));
+    TEST_ASSERT_EQUAL_STRING("nearest", clChromaUpsamplingToString(C, CL_CHROMAUPSAMPLING_NEAREST));
+    TEST_ASSERT_EQUAL_STRING("bilinear", clChromaUpsamplingToString(C, CL_CHROMAUPSAMPLING_BILINEAR));
+    TEST_ASSERT_EQUAL_STRING("invalid", clChromaUpsamplingToString(C, (clChromaUpsampling)555));
+
+    clContextDestroy(C);
+}
+
 static void test_stockPrimaries(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -429,6 +475,101 @@ static void test_clContextParseArgs(void)
     clContextDestroy(C);
 }
 
+static void test_avifArgs(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    clWriteParams * writeParams = &C->params.writeParams;
+
+    {
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--tiling", "auto" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(-1, writeParams->tileRowsLog2);
+        TEST_ASSERT_EQUAL_INT(-1, writeParams->tileColsLog2);
+    }
+
+    {
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--tiling", "2,9" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(2, writeParams->tileRowsLog2);
+        TEST_ASSERT_EQUAL_INT(6, writeParams->tileColsLog2);
+    }
+
+    {
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--quantizer-alpha", "10,20" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(10, writeParams->quantizerMinAlpha);
+        TEST_ASSERT_EQUAL_INT(20, writeParams->quantizerMaxAlpha);
+    }
+
+    {
+        // one value sets both, clamped to 0-63
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--quantizer-alpha", "70" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(63, writeParams->quantizerMinAlpha);
+        TEST_ASSERT_EQUAL_INT(63, writeParams->quantizerMaxAlpha);
+    }
+
+    {
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--keyframe", "30" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(30, writeParams->keyframeInterval);
+        TEST_ASSERT_EQUAL_INT(-1, writeParams->quantizerMinAlpha); // back to defaults
+    }
+
+    {
+        // 0 leaves keyframes to the codec
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", "--keyframe", "0" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(0, writeParams->keyframeInterval);
+    }
+
+    {
+        const char * needsArgs[] = { "--tiling", "--quantizer-alpha", "--keyframe" };
+        const char * argv[] = { "colorist", "convert", "input.png", "output.avif", NULL };
+        for (int i = 0; i < 3; ++i) {
+            argv[4] = needsArgs[i];
+            TEST_ASSERT_FALSE(clContextParseArgs(C, ARGS(argv)));
+        }
+    }
+
+    // Auto tiling: AV1's tile limits first, then the larger tile dimension is split until every job
+    // has a tile, as long as tiles stay at least 512 pixels
+    {
+        int rowsLog2, colsLog2;
+        C->jobs = 1;
+        clAVIFAutoTiling(C, 1920, 1080, &rowsLog2, &colsLog2);
+        TEST_ASSERT_EQUAL_INT(0, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(0, colsLog2);
+        clAVIFAutoTiling(C, 8192, 4096, &rowsLog2, &colsLog2); // 4096 wide, 4096*2304 area at most
+        TEST_ASSERT_EQUAL_INT(1, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(1, colsLog2);
+
+        C->jobs = 2;
+        clAVIFAutoTiling(C, 1920, 1080, &rowsLog2, &colsLog2);
+        TEST_ASSERT_EQUAL_INT(0, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(1, colsLog2);
+        clAVIFAutoTiling(C, 1080, 1920, &rowsLog2, &colsLog2);
+        TEST_ASSERT_EQUAL_INT(1, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(0, colsLog2);
+
+        C->jobs = 4;
+        clAVIFAutoTiling(C, 1920, 1080, &rowsLog2, &colsLog2);
+        TEST_ASSERT_EQUAL_INT(1, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(1, colsLog2);
+
+        C->jobs = 64;
+        clAVIFAutoTiling(C, 1920, 1080, &rowsLog2, &colsLog2); // 960x540 tiles can't split further
+        TEST_ASSERT_EQUAL_INT(1, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(1, colsLog2);
+        clAVIFAutoTiling(C, 600, 400, &rowsLog2, &colsLog2);
+        TEST_ASSERT_EQUAL_INT(0, rowsLog2);
+        TEST_ASSERT_EQUAL_INT(0, colsLog2);
+    }
+
+    clContextDestroy(C);
+}
+
 static void test_debugDump(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -505,6 +646,85 @@ static void test_resize(void)
     clContextDestroy(C);
 }
 
+static void test_signals(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->params.ssim = clTrue;
+
+    clImage * red = clImageParseString(C, "300x200,#ff0000", 8, NULL);
+    clImage * darkRed = clImageParseString(C, "300x200,#f00000", 8, NULL);
+    clImage * tiny = clImageParseString(C, "3x3,#ff0000", 8, NULL);
+    clImageSignals signals;
+
+    C->jobs = 4;
+    TEST_ASSERT_TRUE(clImageCalcSignals(C, red, red, &signals));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, signals.mseG22);
+    TEST_ASSERT_TRUE(isinf(signals.psnrG22));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 1.0f, signals.ssimG22);
+
+    TEST_ASSERT_TRUE(clImageCalcSignals(C, red, darkRed, &signals));
+    float threadedMSE = signals.mseG22;
+    TEST_ASSERT_TRUE(signals.mseLinear > 0.0f);
+    TEST_ASSERT_TRUE(signals.mseG22 > 0.0f);
+    TEST_ASSERT_TRUE(signals.ssimG22 < 1.0f);
+
+    C->jobs = 1;
+    TEST_ASSERT_TRUE(clImageCalcSignals(C, red, darkRed, &signals));
+    TEST_ASSERT_FLOAT_WITHIN(threadedMSE * 0.0001f, threadedMSE, signals.mseG22);
+
+    TEST_ASSERT_FALSE(clImageCalcSignals(C, red, tiny, &signals));
+    TEST_ASSERT_TRUE(clImageCalcSignals(C, tiny, tiny, &signals));
+
+    clImageDestroy(C, red);
+    clImageDestroy(C, darkRed);
+    clImageDestroy(C, tiny);
+    clContextDestroy(C);
+}
+
+static void test_imageDiff(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 3;
+
+    // Top half matches, bottom half is off by 16 in red
+    clImage * image1 = clImageParseString(C, "64x64,#808080", 8, NULL);
+    clImage * image2 = clImageParseString(C, "64x64,#808080", 8, NULL);
+    clImagePrepareWritePixels(C, image2, CL_PIXELFORMAT_U16);
+    for (int i = 32 * 64; i < (64 * 64); ++i) {
+        image2->pixelsU16[i * CL_CHANNELS_PER_PIXEL] += 16;
+    }
+
+    clImageDiff * diff = clImageDiffCreate(C, image1, image2, 0.1f, 0);
+    TEST_ASSERT_NOT_NULL(diff);
+    TEST_ASSERT_EQUAL_INT(16, diff->largestChannelDiff);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->matchCount);
+    TEST_ASSERT_EQUAL_INT(0, diff->underThresholdCount);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->overThresholdCount);
+
+    clImageDiffUpdateCounts(C, diff, 15);
+    TEST_ASSERT_EQUAL_INT(0, diff->underThresholdCount);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->overThresholdCount);
+    clImageDiffUpdateCounts(C, diff, 16);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->underThresholdCount);
+    TEST_ASSERT_EQUAL_INT(0, diff->overThresholdCount);
+    clImageDiffUpdateCounts(C, diff, 100000);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->underThresholdCount);
+
+    clImageDiffUpdate(C, diff, 16);
+    TEST_ASSERT_EQUAL_INT(32 * 64, diff->underThresholdCount);
+    uint16_t * matchPixel = &diff->image->pixelsU16[0];
+    uint16_t * underPixel = &diff->image->pixelsU16[(64 * 64 - 1) * CL_CHANNELS_PER_PIXEL];
+    TEST_ASSERT_EQUAL_INT(matchPixel[0], matchPixel[2]);
+    TEST_ASSERT_TRUE(underPixel[0] < underPixel[2]);
+    clImageDiffDestroy(C, diff);
+
+    clImageDestroy(C, image1);
+    clImageDestroy(C, image2);
+    clContextDestroy(C);
+}
+
 static void test_clTask(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -538,6 +758,554 @@ static void test_clTask(void)
     clContextDestroy(C);
 }
 
+static void test_profileClone(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfile * profile = clProfileCreateStock(C, CL_PS_SRGB);
+    TEST_ASSERT_NOT_NULL(profile);
+
+    // Clones share everything until one of them is modified
+    clProfile * clone1 = clProfileClone(C, profile);
+    clProfile * clone2 = clProfileClone(C, clone1);
+    TEST_ASSERT_TRUE(clone1 != profile);
+    TEST_ASSERT_TRUE(clone1->handle == profile->handle);
+    TEST_ASSERT_EQUAL_INT(4, *profile->refCount); // The context's profile records hold one too
+    TEST_ASSERT_TRUE(clProfileMatches(C, profile, clone2));
+
+    // Modifying a clone leaves the others alone
+    TEST_ASSERT_TRUE(clProfileSetLuminance(C, clone1, 300));
+    TEST_ASSERT_TRUE(clone1->handle != profile->handle);
+    TEST_ASSERT_EQUAL_INT(1, *clone1->refCount);
+    TEST_ASSERT_EQUAL_INT(3, *profile->refCount);
+    TEST_ASSERT_FALSE(clProfileMatches(C, profile, clone1));
+    TEST_ASSERT_TRUE(clProfileMatches(C, profile, clone2));
+    int luminance = -1;
+    TEST_ASSERT_TRUE(clProfileQuery(C, profile, NULL, NULL, &luminance));
+    TEST_ASSERT_EQUAL_INT(CL_LUMINANCE_UNSPECIFIED, luminance);
+    TEST_ASSERT_TRUE(clProfileQuery(C, clone1, NULL, NULL, &luminance));
+    TEST_ASSERT_EQUAL_INT(300, luminance);
+    TEST_ASSERT_TRUE(clProfileComponentsMatch(C, profile, clone2));
+    TEST_ASSERT_FALSE(clProfileComponentsMatch(C, profile, clone1));
+
+    // The shared contents outlive the profile they were cloned from
+    clProfileDestroy(C, profile);
+    TEST_ASSERT_EQUAL_INT(2, *clone2->refCount);
+    TEST_ASSERT_TRUE(clProfileSetGamma(C, clone2, 2.2f));
+    clProfileCurve curve;
+    TEST_ASSERT_TRUE(clProfileQuery(C, clone2, NULL, &curve, NULL));
+    TEST_ASSERT_EQUAL_INT(CL_PCT_GAMMA, curve.type);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.2f, curve.gamma);
+    clProfileDestroy(C, clone2);
+    clProfileDestroy(C, clone1);
+
+    clContextDestroy(C);
+}
+
+static void test_profileRecords(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clProfilePrimaries primaries;
+    clProfileCurve curve;
+    clContextGetStockPrimaries(C, "bt2020", &primaries);
+    curve.type = CL_PCT_PQ;
+    curve.implicitScale = 1.0f;
+    curve.gamma = 1.0f;
+
+    // Asking for the same profile twice hands back the interned one
+    clProfile * pq1 = clProfileCreate(C, &primaries, &curve, 10000, NULL);
+    clProfile * pq2 = clProfileCreate(C, &primaries, &curve, 10000, NULL);
+    TEST_ASSERT_NOT_NULL(pq1);
+    TEST_ASSERT_NOT_NULL(pq2);
+    TEST_ASSERT_TRUE(pq1 != pq2);
+    TEST_ASSERT_TRUE(pq1->handle == pq2->handle);
+
+    // Any differing argument makes a new profile
+    clProfile * dim = clProfileCreate(C, &primaries, &curve, 1000, NULL);
+    clProfile * named = clProfileCreate(C, &primaries, &curve, 10000, "named");
+    TEST_ASSERT_TRUE(dim->handle != pq1->handle);
+    TEST_ASSERT_TRUE(named->handle != pq1->handle);
+    TEST_ASSERT_EQUAL_STRING("named", named->description);
+
+    // Stock profiles are interned separately from clProfileCreate() ones with the same components
+    clProfile * srgb1 = clProfileCreateStock(C, CL_PS_SRGB);
+    clProfile * srgb2 = clProfileCreateStock(C, CL_PS_SRGB);
+    TEST_ASSERT_TRUE(srgb1->handle == srgb2->handle);
+    TEST_ASSERT_TRUE(clProfileQuery(C, srgb1, &primaries, NULL, NULL));
+    curve.type = CL_PCT_SRGB;
+    clProfile * srgb3 = clProfileCreate(C, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
+    TEST_ASSERT_TRUE(srgb3->handle != srgb1->handle);
+    TEST_ASSERT_TRUE(clProfileComponentsMatch(C, srgb1, srgb3));
+
+    // Modifying an interned profile doesn't affect the next one handed out
+    TEST_ASSERT_TRUE(clProfileSetLuminance(C, srgb2, 100));
+    clProfile * srgb4 = clProfileCreateStock(C, CL_PS_SRGB);
+    TEST_ASSERT_TRUE(clProfileMatches(C, srgb1, srgb4));
+    TEST_ASSERT_FALSE(clProfileMatches(C, srgb2, srgb4));
+
+    // The registry keeps only the most recently used profiles
+    curve.type = CL_PCT_GAMMA;
+    for (int i = 0; i < CL_PROFILE_RECORDS_MAX * 2; ++i) {
+        clProfile * stock = clProfileCreateStock(C, CL_PS_SRGB); // keep sRGB recently used
+        clProfileDestroy(C, stock);
+        curve.gamma = 1.0f + ((float)i / 16.0f);
+        clProfile * gamma = clProfileCreate(C, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
+        TEST_ASSERT_NOT_NULL(gamma);
+        clProfileDestroy(C, gamma);
+    }
+    int recordCount = 0;
+    for (clProfileRecord * record = C->profiles; record != NULL; record = record->next) {
+        ++recordCount;
+    }
+    TEST_ASSERT_EQUAL_INT(CL_PROFILE_RECORDS_MAX, recordCount);
+    clProfile * srgb5 = clProfileCreateStock(C, CL_PS_SRGB);
+    TEST_ASSERT_TRUE(srgb5->handle == srgb1->handle);
+    clContextGetStockPrimaries(C, "bt2020", &primaries);
+    curve.type = CL_PCT_PQ;
+    curve.gamma = 1.0f;
+    clProfile * pq3 = clProfileCreate(C, &primaries, &curve, 10000, NULL);
+    TEST_ASSERT_TRUE(pq3->handle != pq1->handle); // evicted, so built again
+    TEST_ASSERT_TRUE(clProfileComponentsMatch(C, pq1, pq3));
+    clProfileDestroy(C, srgb5);
+    clProfileDestroy(C, pq3);
+
+    clProfileDestroy(C, pq1);
+    clProfileDestroy(C, pq2);
+    clProfileDestroy(C, dim);
+    clProfileDestroy(C, named);
+    clProfileDestroy(C, srgb1);
+    clProfileDestroy(C, srgb2);
+    clProfileDestroy(C, srgb3);
+    clProfileDestroy(C, srgb4);
+    clContextDestroy(C);
+}
+
+static void test_profileCache(void)
+{
+    const char * cacheFilename = "test_profile_cache.bin";
+    remove(cacheFilename);
+
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->profileCacheFilename = cacheFilename;
+
+    // First run derives everything and writes it out
+    clProfile * profile = clProfileRead(C, "../docs/profiles/HDR_P3_D65_ST2084.icc");
+    TEST_ASSERT_NOT_NULL(profile);
+    clProfile fresh;
+    memcpy(&fresh, profile, sizeof(clProfile));
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+    TEST_ASSERT_TRUE(clFileSize(cacheFilename) > 0);
+
+    // Second run gets the same answers from the file
+    C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->profileCacheFilename = cacheFilename;
+    profile = clProfileRead(C, "../docs/profiles/HDR_P3_D65_ST2084.icc");
+    TEST_ASSERT_NOT_NULL(profile);
+    TEST_ASSERT_TRUE(clProfileCacheLookup(C, profile));
+    TEST_ASSERT_TRUE(profile->ccmm == fresh.ccmm);
+    TEST_ASSERT_EQUAL_INT(CL_PCT_PQ, profile->queryCurve.type);
+    TEST_ASSERT_EQUAL_MEMORY(&fresh.queryPrimaries, &profile->queryPrimaries, sizeof(clProfilePrimaries));
+    TEST_ASSERT_EQUAL_MEMORY(&fresh.queryCurve, &profile->queryCurve, sizeof(clProfileCurve));
+    TEST_ASSERT_EQUAL_INT(fresh.queryLuminance, profile->queryLuminance);
+    TEST_ASSERT_EQUAL_MEMORY(fresh.queryFromXYZ, profile->queryFromXYZ, sizeof(fresh.queryFromXYZ));
+
+    // A different payload that happens to share the hash and size isn't mistaken for a cached one
+    clProfile forged;
+    memcpy(&forged, profile, sizeof(clProfile));
+    forged.raw.ptr = NULL;
+    forged.raw.size = 0;
+    clRawClone(C, &forged.raw, &profile->raw);
+    forged.raw.ptr[forged.raw.size - 1] ^= 0xff;
+    TEST_ASSERT_FALSE(clProfileCacheLookup(C, &forged));
+    clRawFree(C, &forged.raw);
+
+    // Profiles it hasn't seen yet are added alongside
+    clProfile * srgb = clProfileCreateStock(C, CL_PS_SRGB);
+    TEST_ASSERT_TRUE(clProfileCacheFlush(C));
+    TEST_ASSERT_TRUE(clProfileCacheLookup(C, srgb));
+    TEST_ASSERT_TRUE(clProfileCacheLookup(C, profile));
+    clProfileDestroy(C, srgb);
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+
+    // Garbage is ignored and replaced
+    FILE * f = fopen(cacheFilename, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs("not a cache", f);
+    fclose(f);
+    C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->profileCacheFilename = cacheFilename;
+    profile = clProfileRead(C, "../docs/profiles/HDR_P3_D65_ST2084.icc");
+    TEST_ASSERT_NOT_NULL(profile);
+    TEST_ASSERT_TRUE(profile->ccmm);
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+    TEST_ASSERT_TRUE(clFileSize(cacheFilename) > 16);
+
+    // Two contexts sharing a cache file both keep what they added, whichever flushes last
+    remove(cacheFilename);
+    C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->profileCacheFilename = cacheFilename;
+    clContext * other = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(other);
+    other->profileCacheFilename = cacheFilename;
+    profile = clProfileRead(C, "../docs/profiles/HDR_P3_D65_ST2084.icc");
+    TEST_ASSERT_NOT_NULL(profile);
+    srgb = clProfileCreateStock(other, CL_PS_SRGB);
+    TEST_ASSERT_NOT_NULL(srgb);
+    TEST_ASSERT_TRUE(clProfileCacheFlush(other));
+    TEST_ASSERT_TRUE(clProfileCacheFlush(C));
+    TEST_ASSERT_TRUE(clProfileCacheLookup(C, srgb));
+    TEST_ASSERT_TRUE(clProfileCacheLookup(C, profile));
+    clProfileDestroy(other, srgb);
+    clProfileDestroy(C, profile);
+    clContextDestroy(other);
+    clContextDestroy(C);
+}
+
+static void test_batch(void)
+{
+    const char * manifestFilename = "test_batch.txt";
+    const char * jsonManifestFilename = "test_batch.json";
+    remove("test_batch_red.png");
+    remove("test_batch_blue.png");
+    remove("test_batch.icc");
+
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    FILE * f = fopen(manifestFilename, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs("# comment\n", f);
+    fputs("generate \"4x4,#ff0000\" test_batch_red.png\n", f);
+    fputs("\n", f);
+    fputs("colorist generate test_batch.icc -p bt709 -l 100\n", f);
+    fclose(f);
+    {
+        const char * argv[] = { "colorist", "batch", manifestFilename, "-j", "2" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(CL_ACTION_BATCH, C->action);
+        TEST_ASSERT_EQUAL_STRING(manifestFilename, C->inputFilename);
+        TEST_ASSERT_EQUAL_INT(0, clContextBatch(C));
+        TEST_ASSERT_EQUAL_STRING(manifestFilename, C->inputFilename);
+    }
+    TEST_ASSERT_TRUE(clFileSize("test_batch_red.png") > 0);
+    TEST_ASSERT_TRUE(clFileSize("test_batch.icc") > 0);
+
+    // Failures are counted, but don't stop the rest of the batch
+    f = fopen(jsonManifestFilename, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs("[ [\"generate\", \"4x4,#0000ff\", \"test_batch_blue.png\"], \"convert does_not_exist.png out.png\", \"convert --derp\" ]", f);
+    fclose(f);
+    {
+        const char * argv[] = { "colorist", "batch", jsonManifestFilename };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(1, clContextBatch(C));
+    }
+    TEST_ASSERT_TRUE(clFileSize("test_batch_blue.png") > 0);
+
+    {
+        const char * argv[] = { "colorist", "batch", "-" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_NULL(C->inputFilename);
+    }
+    {
+        const char * argv[] = { "colorist", "batch", manifestFilename, "extra" };
+        TEST_ASSERT_FALSE(clContextParseArgs(C, ARGS(argv)));
+    }
+
+    clContextDestroy(C);
+}
+
+static const char * pipelineOutputs[] = { "test_pipeline_0.png", "test_pipeline_1.jpg", "test_pipeline.derp", "test_pipeline_3.icc" };
+
+typedef struct PipelineResults
+{
+    int finished;
+    int order[4];
+    clBool succeeded[4];
+} PipelineResults;
+
+static clBool pipelineSetup(clContext * C, int index, void * userData)
+{
+    COLORIST_UNUSED(userData);
+    const char * argv[] = { "colorist", "convert", "test_pipeline_src.png", pipelineOutputs[index], "--resize", "2" };
+    return clContextParseArgs(C, ARGS(argv));
+}
+
+static void pipelineDone(clContext * C, int index, clBool succeeded, double seconds, void * userData)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(seconds);
+    PipelineResults * results = (PipelineResults *)userData;
+    results->order[results->finished++] = index;
+    results->succeeded[index] = succeeded;
+}
+
+static void test_convertPipeline(void)
+{
+    for (int i = 0; i < 4; ++i) {
+        remove(pipelineOutputs[i]);
+    }
+
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    {
+        const char * argv[] = { "colorist", "generate", "4x4,#ff0000", "test_pipeline_src.png" };
+        TEST_ASSERT_TRUE(clContextParseArgs(C, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(0, clContextGenerate(C, NULL));
+    }
+
+    // Every conversion finishes, in order, and a failure doesn't hold up the ones behind it. With
+    // fewer than three jobs the conversions run one after another instead, with the same results.
+    const int jobCounts[] = { 4, 1 };
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 4; ++i) {
+            remove(pipelineOutputs[i]);
+        }
+        C->jobs = jobCounts[j];
+        PipelineResults results;
+        memset(&results, 0, sizeof(results));
+        TEST_ASSERT_EQUAL_INT(1, clContextConvertPipeline(C, 4, pipelineSetup, pipelineDone, &results));
+        TEST_ASSERT_EQUAL_INT(4, results.finished);
+        for (int i = 0; i < 4; ++i) {
+            TEST_ASSERT_EQUAL_INT(i, results.order[i]);
+        }
+        TEST_ASSERT_TRUE(results.succeeded[0]);
+        TEST_ASSERT_TRUE(results.succeeded[1]);
+        TEST_ASSERT_FALSE(results.succeeded[2]);
+        TEST_ASSERT_TRUE(results.succeeded[3]);
+        TEST_ASSERT_NULL(C->logMutex);
+        TEST_ASSERT_EQUAL_INT(jobCounts[j], C->jobs);
+
+        clImage * image = clContextRead(C, "test_pipeline_0.png", NULL, NULL);
+        TEST_ASSERT_NOT_NULL(image);
+        TEST_ASSERT_EQUAL_INT(2, image->width);
+        clImageDestroy(C, image);
+        TEST_ASSERT_TRUE(clFileSize("test_pipeline_1.jpg") > 0);
+        TEST_ASSERT_TRUE(clFileSize("test_pipeline_3.icc") > 0);
+    }
+
+    clContextDestroy(C);
+}
+
+#if !defined(_WIN32)
+static void serveThread(void * userData)
+{
+    clContext * server = (clContext *)userData;
+    clContextServe(server);
+}
+
+static clBool serveLogContains(cJSON * response, const char * text)
+{
+    cJSON * log = cJSON_GetObjectItem(response, "log");
+    for (cJSON * line = log ? log->child : NULL; line != NULL; line = line->next) {
+        cJSON * lineText = cJSON_GetArrayItem(line, 2);
+        if (cJSON_IsString(lineText) && strstr(lineText->valuestring, text)) {
+            return clTrue;
+        }
+    }
+    return clFalse;
+}
+
+// Sends headerLine as-is and returns the response header, for requests clContextServeRequest() won't make.
+// Afterwards, *outClosed says whether the server hung up.
+static cJSON * sendRawServeHeader(const char * socketFilename, const char * headerLine, clBool * outClosed)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketFilename);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(0, connect(fd, (struct sockaddr *)&address, sizeof(address)));
+    TEST_ASSERT_EQUAL_INT((int)strlen(headerLine), (int)send(fd, headerLine, strlen(headerLine), 0));
+
+    char reply[4096];
+    size_t size = 0;
+    ssize_t bytesRead;
+    while ((size < (sizeof(reply) - 1)) && ((bytesRead = recv(fd, reply + size, 1, 0)) == 1) && (reply[size] != '\n')) {
+        ++size;
+    }
+    reply[size] = 0;
+    *outClosed = (recv(fd, reply + size + 1, 1, 0) == 0) ? clTrue : clFalse;
+    close(fd);
+    return cJSON_Parse(reply);
+}
+
+static void test_serve(void)
+{
+    const char * socketFilename = "test_serve.sock";
+
+    clContext * server = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(server);
+    {
+        const char * argv[] = { "colorist", "serve", socketFilename };
+        TEST_ASSERT_TRUE(clContextParseArgs(server, ARGS(argv)));
+        TEST_ASSERT_EQUAL_INT(CL_ACTION_SERVE, server->action);
+    }
+    clTask * task = clTaskCreate(server, serveThread, server);
+
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // Output comes back in memory, retrying until the server is listening
+    clRaw png = CL_RAW_EMPTY;
+    {
+        const char * args[] = { "generate", "4x4,#ff0000", "red.png" };
+        int ret = 1;
+        for (int attempt = 0; (attempt < 100000) && (ret != 0); ++attempt) {
+            ret = clContextServeRequest(C, socketFilename, 3, args, NULL, &png, NULL);
+        }
+        TEST_ASSERT_EQUAL_INT(0, ret);
+    }
+    TEST_ASSERT_TRUE(png.size > 8);
+    TEST_ASSERT_EQUAL_MEMORY("\x89PNG", png.ptr, 4);
+
+    // Input goes up in memory too, the filenames only choose formats
+    clRaw jpg = CL_RAW_EMPTY;
+    {
+        const char * args[] = { "convert", "upload", "out.jpg", "-q", "80" };
+        cJSON * response = cJSON_CreateObject();
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 5, args, &png, &jpg, response));
+        TEST_ASSERT_TRUE(cJSON_IsTrue(cJSON_GetObjectItem(response, "ok")));
+        TEST_ASSERT_NOT_NULL(cJSON_GetObjectItem(cJSON_GetObjectItem(response, "stats"), "seconds"));
+        TEST_ASSERT_TRUE(cJSON_GetArraySize(cJSON_GetObjectItem(response, "log")) > 0);
+        cJSON_Delete(response);
+    }
+    TEST_ASSERT_TRUE(jpg.size > 2);
+    TEST_ASSERT_EQUAL_MEMORY("\xff\xd8", jpg.ptr, 2);
+
+    {
+        const char * args[] = { "identify", "upload.jpg", "--json" };
+        cJSON * response = cJSON_CreateObject();
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 3, args, &jpg, NULL, response));
+        TEST_ASSERT_NOT_NULL(cJSON_GetObjectItem(cJSON_GetObjectItem(response, "output"), "width"));
+        cJSON_Delete(response);
+    }
+
+    // Every action that reads or writes ICC profiles, and the stats reload, stay in memory too
+    remove("out.icc");
+    remove("out.png");
+    remove("modified.icc");
+    remove("generated.icc");
+    clRaw icc = CL_RAW_EMPTY;
+    {
+        const char * args[] = { "convert", "upload.png", "out.icc" };
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 3, args, &png, &icc, NULL));
+    }
+    clProfile * profile = clProfileParse(C, icc.ptr, icc.size, NULL);
+    TEST_ASSERT_NOT_NULL(profile);
+    clProfileDestroy(C, profile);
+    {
+        const char * args[] = { "convert", "upload.png", "out.png", "--stats" };
+        clRaw statsPNG = CL_RAW_EMPTY;
+        cJSON * response = cJSON_CreateObject();
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 4, args, &png, &statsPNG, response));
+        TEST_ASSERT_TRUE(serveLogContains(response, "PSNR"));
+        TEST_ASSERT_EQUAL_INT(0, cJSON_GetArraySize(cJSON_GetObjectItem(response, "errors")));
+        cJSON_Delete(response);
+        clRawFree(C, &statsPNG);
+    }
+    {
+        const char * args[] = { "modify", "upload.icc", "modified.icc", "--description", "served" };
+        clRaw modified = CL_RAW_EMPTY;
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 5, args, &icc, &modified, NULL));
+        profile = clProfileParse(C, modified.ptr, modified.size, NULL);
+        TEST_ASSERT_NOT_NULL(profile);
+        char * description = clProfileGetMLU(C, profile, "desc", "en", "US");
+        TEST_ASSERT_EQUAL_STRING("served", description);
+        clFree(description);
+        clProfileDestroy(C, profile);
+        clRawFree(C, &modified);
+    }
+    {
+        const char * args[] = { "generate", "generated.icc", "-p", "bt709", "-l", "100" };
+        clRaw generated = CL_RAW_EMPTY;
+        TEST_ASSERT_EQUAL_INT(0, clContextServeRequest(C, socketFilename, 6, args, NULL, &generated, NULL));
+        profile = clProfileParse(C, generated.ptr, generated.size, NULL);
+        TEST_ASSERT_NOT_NULL(profile);
+        int luminance = 0;
+        TEST_ASSERT_TRUE(clProfileQuery(C, profile, NULL, NULL, &luminance));
+        TEST_ASSERT_EQUAL_INT(100, luminance);
+        clProfileDestroy(C, profile);
+        clRawFree(C, &generated);
+    }
+    TEST_ASSERT_TRUE(clFileSize("out.icc") < 0);
+    TEST_ASSERT_TRUE(clFileSize("out.png") < 0);
+    TEST_ASSERT_TRUE(clFileSize("modified.icc") < 0);
+    TEST_ASSERT_TRUE(clFileSize("generated.icc") < 0);
+    clRawFree(C, &icc);
+
+    // Failures are reported back, and the server keeps going
+    {
+        clRaw garbage = CL_RAW_EMPTY;
+        clRawSet(C, &garbage, (const uint8_t *)"not an image", 12);
+        const char * args[] = { "convert", "upload.png", "out.png" };
+        cJSON * response = cJSON_CreateObject();
+        TEST_ASSERT_EQUAL_INT(1, clContextServeRequest(C, socketFilename, 3, args, &garbage, NULL, response));
+        TEST_ASSERT_TRUE(cJSON_GetArraySize(cJSON_GetObjectItem(response, "errors")) > 0);
+        cJSON_Delete(response);
+        clRawFree(C, &garbage);
+    }
+    {
+        const char * args[] = { "batch", "manifest.txt" };
+        TEST_ASSERT_EQUAL_INT(1, clContextServeRequest(C, socketFilename, 2, args, NULL, NULL, NULL));
+    }
+
+    // Payload sizes that aren't a sane number of bytes are refused before anything is allocated
+    {
+        const char * badHeaders[] = { "{\"args\":[\"identify\",\"upload.png\"],\"inputSize\":-4}\n",
+                                      "{\"args\":[\"identify\",\"upload.png\"],\"inputSize\":1.5}\n",
+                                      "{\"args\":[\"identify\",\"upload.png\"],\"inputSize\":\"12\"}\n",
+                                      "{\"args\":[\"identify\",\"upload.png\"],\"inputSize\":1e300}\n" };
+        for (int i = 0; i < 4; ++i) {
+            clBool closed = clFalse;
+            cJSON * reply = sendRawServeHeader(socketFilename, badHeaders[i], &closed);
+            TEST_ASSERT_NOT_NULL(reply);
+            TEST_ASSERT_FALSE(cJSON_IsTrue(cJSON_GetObjectItem(reply, "ok")));
+            TEST_ASSERT_TRUE(cJSON_GetArraySize(cJSON_GetObjectItem(reply, "errors")) > 0);
+            TEST_ASSERT_TRUE(closed);
+            cJSON_Delete(reply);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, clContextServeShutdown(C, socketFilename));
+    clTaskDestroy(server, task);
+    TEST_ASSERT_TRUE(clFileSize(socketFilename) < 0);
+
+    clRawFree(C, &jpg);
+    clRawFree(C, &png);
+    clContextDestroy(C);
+    clContextDestroy(server);
+
+    // Whatever isn't a socket is left alone, even if nothing is listening there
+    const char * notSocketFilename = "test_serve_file.sock";
+    FILE * f = fopen(notSocketFilename, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs("keep me", f);
+    fclose(f);
+    server = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(server);
+    {
+        const char * argv[] = { "colorist", "serve", notSocketFilename };
+        TEST_ASSERT_TRUE(clContextParseArgs(server, ARGS(argv)));
+    }
+    TEST_ASSERT_EQUAL_INT(1, clContextServe(server));
+    TEST_ASSERT_EQUAL_INT(7, clFileSize(notSocketFilename));
+    clContextDestroy(server);
+    remove(notSocketFilename);
+}
+#endif
+
 static void test_types(void)
 {
     clContext * C = clContextCreate(&silentSystem);
@@ -597,6 +1365,13 @@ static void test_raw(void)
 
     clRawFree(C, &raw);
 
+    // Reference XXH64 values
+    const char * spam = "Nobody inspects the spammish repetition";
+    TEST_ASSERT_TRUE(clHash64((const uint8_t *)"", 0) == 0xef46db3751d8e999ULL);
+    TEST_ASSERT_TRUE(clHash64((const uint8_t *)"a", 1) == 0xd24ec4f1a98c6e5bULL);
+    TEST_ASSERT_TRUE(clHash64((const uint8_t *)"abc", 3) == 0x44bc2cf5ad770999ULL);
+    TEST_ASSERT_TRUE(clHash64((const uint8_t *)spam, strlen(spam)) == 0xfbcea83c8a378bf1ULL);
+
     clContextDestroy(C);
 }
 
@@ -609,11 +1384,23 @@ int test_coverage(void)
     RUN_TEST(test_clAction);
     RUN_TEST(test_clFormat);
     RUN_TEST(test_clFilter);
+    RUN_TEST(test_clChromaUpsampling);
     RUN_TEST(test_stockPrimaries);
     RUN_TEST(test_clContextParseArgs);
+    RUN_TEST(test_avifArgs);
     RUN_TEST(test_debugDump);
     RUN_TEST(test_resize);
+    RUN_TEST(test_signals);
+    RUN_TEST(test_imageDiff);
     RUN_TEST(test_clTask);
+    RUN_TEST(test_profileClone);
+    RUN_TEST(test_profileRecords);
+    RUN_TEST(test_profileCache);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_convertPipeline);
+#if !defined(_WIN32)
+    RUN_TEST(test_serve);
+#endif
     RUN_TEST(test_types);
     RUN_TEST(test_floorRound);
     RUN_TEST(test_raw);
@@ -7,6 +7,11 @@
 
 #include "main.h"
 
+#include <stdio.h>
+
+#include "jpeglib.h"
+#include "tiffio.h"
+
 // #define DEBUG_TEST_IMAGES 1
 
 #define TEST_IMAGE_STRING "256x256,#ff0000.128.#00ff00,#00ff00.128.#0000ff"
@@ -250,6 +255,787 @@ static void test_webp(void)
     test_ext(&extInfo);
 }
 
+static void test_jpg_options(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+
+    const clYUVFormat subsamplings[] = { CL_YUVFORMAT_INVALID, CL_YUVFORMAT_444, CL_YUVFORMAT_422, CL_YUVFORMAT_420 };
+    for (int i = 0; i < 4; ++i) {
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        writeParams.quality = 95;
+        writeParams.jpegSubsampling = subsamplings[i];
+        writeParams.jpegProgressive = (i & 1) ? clTrue : clFalse;
+        writeParams.jpegOptimize = (i & 2) ? clTrue : clFalse;
+        writeParams.jpegTrellis = clTrue;
+        TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_options.jpg", NULL, &writeParams), "failed to write image");
+
+        clImage * dstImage = clContextRead(C, "tmp_options.jpg", NULL, NULL);
+        TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+        clImageDiff * diff = clImageDiffCreate(C, srcImage, dstImage, 0.1f, 8);
+        TEST_ASSERT_NOT_NULL(diff);
+        TEST_ASSERT_EQUAL_INT(0, diff->overThresholdCount);
+        clImageDiffDestroy(C, diff);
+        clImageDestroy(C, dstImage);
+    }
+
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+}
+
+// The JPEG writer never emits restart markers, so write this one with libjpeg directly
+static void writeRestartJPG(clImage * image, const char * filename)
+{
+    FILE * f = fopen(filename, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    cinfo.image_width = image->width;
+    cinfo.image_height = image->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo); // 4:2:0, so intervals are 16 pixel rows
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    uint8_t * row = malloc(image->width * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint8_t * src = &image->pixelsU8[cinfo.next_scanline * image->width * CL_CHANNELS_PER_PIXEL];
+        for (int i = 0; i < image->width; ++i) {
+            memcpy(&row[i * 3], &src[i * CL_CHANNELS_PER_PIXEL], 3);
+        }
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    free(row);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
+}
+
+static void test_jpg_restart(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    // A partial last interval, and more tasks than intervals at the end
+    const int sizes[2][2] = { { 256, 250 }, { 96, 40 } };
+    for (int s = 0; s < 2; ++s) {
+        // Every row differs, so a band landing on the wrong rows can't go unnoticed
+        clImage * srcImage = clImageCreate(C, sizes[s][0], sizes[s][1], 8, NULL);
+        TEST_ASSERT_NOT_NULL(srcImage);
+        clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U8);
+        for (int y = 0; y < srcImage->height; ++y) {
+            for (int x = 0; x < srcImage->width; ++x) {
+                uint8_t * pixel = &srcImage->pixelsU8[((y * srcImage->width) + x) * CL_CHANNELS_PER_PIXEL];
+                pixel[0] = (uint8_t)(x + y);
+                pixel[1] = (uint8_t)(y * 3);
+                pixel[2] = (uint8_t)(255 - x);
+                pixel[3] = 255;
+            }
+        }
+        writeRestartJPG(srcImage, "tmp_restart.jpg");
+
+        C->jobs = 1;
+        clImage * serialImage = clContextRead(C, "tmp_restart.jpg", NULL, NULL);
+        TEST_ASSERT_NOT_NULL_MESSAGE(serialImage, "failed to read back image");
+        clImagePrepareReadPixels(C, serialImage, CL_PIXELFORMAT_U8);
+        uint32_t pixelsSize = serialImage->width * serialImage->height * CL_CHANNELS_PER_PIXEL;
+
+        // Decoding bands of restart intervals on tasks is bit exact with a serial decode
+        for (int jobs = 2; jobs <= 5; jobs += 3) {
+            C->jobs = jobs;
+            clImage * dstImage = clContextRead(C, "tmp_restart.jpg", NULL, NULL);
+            TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+            clImagePrepareReadPixels(C, dstImage, CL_PIXELFORMAT_U8);
+            TEST_ASSERT_EQUAL_INT(serialImage->width, dstImage->width);
+            TEST_ASSERT_EQUAL_INT(serialImage->height, dstImage->height);
+            TEST_ASSERT_EQUAL_MEMORY(serialImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+            clImageDestroy(C, dstImage);
+        }
+
+        clImageDestroy(C, serialImage);
+        clImageDestroy(C, srcImage);
+    }
+    clContextDestroy(C);
+}
+
+static void test_png_options(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    const int depths[2] = { 8, 16 };
+    const char * presets[3] = { "fast", "default", "small" };
+    for (int d = 0; d < 2; ++d) {
+        clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, depths[d], NULL);
+        TEST_ASSERT_NOT_NULL(srcImage);
+        clPixelFormat pixelFormat = (depths[d] == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+        clImagePrepareReadPixels(C, srcImage, pixelFormat);
+        uint32_t pixelsSize = srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL * CL_BYTES_PER_CHANNEL[pixelFormat];
+
+        for (int i = 0; i < 6; ++i) {
+            clWriteParams writeParams;
+            clWriteParamsSetDefaults(C, &writeParams);
+            TEST_ASSERT_TRUE(clPNGPresetApply(C, presets[i % 3], &writeParams));
+            writeParams.pngParallel = (i >= 3) ? clTrue : clFalse;
+            TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_options.png", NULL, &writeParams), "failed to write image");
+
+            clImage * dstImage = clContextRead(C, "tmp_options.png", NULL, NULL);
+            TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+            TEST_ASSERT_EQUAL_INT(depths[d], dstImage->depth);
+            clImagePrepareReadPixels(C, dstImage, pixelFormat);
+            if (depths[d] == 16) {
+                TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU16, dstImage->pixelsU16, pixelsSize);
+            } else {
+                TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+            }
+            clImageDestroy(C, dstImage);
+        }
+        clImageDestroy(C, srcImage);
+    }
+
+    TEST_ASSERT_EQUAL_INT(CL_PNGFILTER_PAETH, clPNGFilterFromString(C, "paeth"));
+    TEST_ASSERT_EQUAL_INT(CL_PNGFILTER_INVALID, clPNGFilterFromString(C, "bogus"));
+    clContextDestroy(C);
+}
+
+static void test_png_parallel(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 2;
+
+    // Wide rows, so the second stripe's deflate window is primed starting partway into its oldest
+    // dictionary row. Noise everywhere, except that the start of the second stripe (UP filtered) repeats
+    // the end of that oldest row as it would look filtered with no row above. If the dictionary were
+    // filtered that way, deflate would match it there and the decoded stripe would be corrupt.
+    const int width = 1000;
+    const int height = 300;
+    const int rowBytes = width * CL_CHANNELS_PER_PIXEL;
+    const int splitRow = height / 2;
+    const int dictRows = (32768 + rowBytes) / (rowBytes + 1); // rows needed to fill a 32k window
+    const int dictRow = splitRow - dictRows;
+    const int repeatBytes = 256;
+
+    clImage * srcImage = clImageCreate(C, width, height, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    clImagePrepareWritePixels(C, srcImage, CL_PIXELFORMAT_U8);
+    uint32_t seed = 1;
+    for (int i = 0; i < (rowBytes * height); ++i) {
+        seed = (seed * 1103515245) + 12345;
+        srcImage->pixelsU8[i] = (uint8_t)(seed >> 16);
+    }
+    uint8_t * splitPixels = &srcImage->pixelsU8[splitRow * rowBytes];
+    const uint8_t * abovePixels = &srcImage->pixelsU8[(splitRow - 1) * rowBytes];
+    const uint8_t * dictPixels = &srcImage->pixelsU8[(dictRow * rowBytes) + rowBytes - repeatBytes];
+    for (int i = 0; i < repeatBytes; ++i) {
+        splitPixels[i] = (uint8_t)(abovePixels[i] + dictPixels[i]);
+    }
+    uint32_t pixelsSize = rowBytes * height;
+
+    const clPNGFilter filters[4] = { CL_PNGFILTER_UP, CL_PNGFILTER_AVG, CL_PNGFILTER_PAETH, CL_PNGFILTER_AUTO };
+    for (int f = 0; f < 4; ++f) {
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        writeParams.pngCompressionLevel = 9;
+        writeParams.pngFilter = filters[f];
+        writeParams.pngParallel = clTrue;
+        TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_parallel.png", NULL, &writeParams), "failed to write image");
+
+        clImage * dstImage = clContextRead(C, "tmp_parallel.png", NULL, NULL);
+        TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+        clImagePrepareReadPixels(C, dstImage, CL_PIXELFORMAT_U8);
+        TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+        clImageDestroy(C, dstImage);
+    }
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+}
+
+static void test_tif_options(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    const int depths[2] = { 8, 16 };
+    const clTIFFCompression compressions[2] = { CL_TIFFCOMPRESSION_NONE, CL_TIFFCOMPRESSION_LZW };
+    const int rowsPerStrip[2] = { 0, 3 };
+    for (int d = 0; d < 2; ++d) {
+        clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, depths[d], NULL);
+        TEST_ASSERT_NOT_NULL(srcImage);
+        clPixelFormat pixelFormat = (depths[d] == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+        clImagePrepareReadPixels(C, srcImage, pixelFormat);
+        uint32_t pixelsSize = srcImage->width * srcImage->height * CL_CHANNELS_PER_PIXEL * CL_BYTES_PER_CHANNEL[pixelFormat];
+
+        for (int i = 0; i < 8; ++i) {
+            clWriteParams writeParams;
+            clWriteParamsSetDefaults(C, &writeParams);
+            writeParams.tiffCompression = compressions[i % 2];
+            writeParams.tiffPredictor = ((i / 2) % 2) ? clTrue : clFalse;
+            writeParams.tiffRowsPerStrip = rowsPerStrip[i / 4];
+            TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_options.tif", NULL, &writeParams), "failed to write image");
+
+            clImage * dstImage = clContextRead(C, "tmp_options.tif", NULL, NULL);
+            TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+            TEST_ASSERT_EQUAL_INT(depths[d], dstImage->depth);
+            clImagePrepareReadPixels(C, dstImage, pixelFormat);
+            if (depths[d] == 16) {
+                TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU16, dstImage->pixelsU16, pixelsSize);
+            } else {
+                TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+            }
+            clImageDestroy(C, dstImage);
+        }
+        clImageDestroy(C, srcImage);
+    }
+
+    TEST_ASSERT_EQUAL_INT(CL_TIFFCOMPRESSION_LZW, clTIFFCompressionFromString(C, "lzw"));
+    TEST_ASSERT_EQUAL_INT(CL_TIFFCOMPRESSION_INVALID, clTIFFCompressionFromString(C, "bogus"));
+    clContextDestroy(C);
+}
+
+typedef struct tiffTestLayout
+{
+    int channelCount; // 3 or 4 (alpha)
+    clBool tiled;     // 16x16 tiles, or strips of 5 rows
+    clBool separate;  // PLANARCONFIG_SEPARATE
+    int orientation;
+} tiffTestLayout;
+
+// Writes image's pixels, as stored, with libtiff directly: colorist's writer only makes TOPLEFT,
+// contiguous, stripped TIFFs
+static void writeTestTIFF(clImage * image, const char * filename, const tiffTestLayout * layout)
+{
+    TIFF * tiff = TIFFOpen(filename, "w");
+    TEST_ASSERT_NOT_NULL(tiff);
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, image->width);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, image->height);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, image->depth);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, layout->channelCount);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, layout->separate ? PLANARCONFIG_SEPARATE : PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_ORIENTATION, layout->orientation);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+    if (layout->channelCount == 4) {
+        uint16_t extraSample = EXTRASAMPLE_UNASSALPHA;
+        TIFFSetField(tiff, TIFFTAG_EXTRASAMPLES, 1, &extraSample);
+    }
+
+    const int blockWidth = layout->tiled ? 16 : image->width;
+    const int blockHeight = layout->tiled ? 16 : 5;
+    if (layout->tiled) {
+        TIFFSetField(tiff, TIFFTAG_TILEWIDTH, blockWidth);
+        TIFFSetField(tiff, TIFFTAG_TILELENGTH, blockHeight);
+    } else {
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, blockHeight);
+    }
+
+    const int planeCount = layout->separate ? layout->channelCount : 1;
+    const int samplesPerPixel = layout->separate ? 1 : layout->channelCount;
+    const int bytesPerSample = image->depth / 8;
+    uint8_t * block = calloc(1, blockWidth * blockHeight * samplesPerPixel * bytesPerSample);
+    int stripIndex = 0;
+    for (int plane = 0; plane < planeCount; ++plane) {
+        for (int by = 0; by < image->height; by += blockHeight) {
+            for (int bx = 0; bx < image->width; bx += blockWidth) {
+                int rows = layout->tiled ? blockHeight : CL_MIN(blockHeight, image->height - by);
+                for (int j = 0; j < rows; ++j) {
+                    for (int i = 0; i < blockWidth; ++i) {
+                        for (int s = 0; s < samplesPerPixel; ++s) {
+                            int x = bx + i;
+                            int y = by + j;
+                            int channel = layout->separate ? plane : s;
+                            int sampleIndex = (((j * blockWidth) + i) * samplesPerPixel) + s;
+                            uint16_t value = 0; // padding past the right/bottom edges of tiles
+                            if ((x < image->width) && (y < image->height)) {
+                                int pixelIndex = (((y * image->width) + x) * CL_CHANNELS_PER_PIXEL) + channel;
+                                value = (image->depth == 16) ? image->pixelsU16[pixelIndex] : image->pixelsU8[pixelIndex];
+                            }
+                            if (image->depth == 16) {
+                                ((uint16_t *)block)[sampleIndex] = value;
+                            } else {
+                                block[sampleIndex] = (uint8_t)value;
+                            }
+                        }
+                    }
+                }
+                tmsize_t blockBytes = (tmsize_t)blockWidth * rows * samplesPerPixel * bytesPerSample;
+                if (layout->tiled) {
+                    TEST_ASSERT_TRUE(TIFFWriteTile(tiff, block, bx, by, 0, (uint16_t)plane) > 0);
+                } else {
+                    TEST_ASSERT_TRUE(TIFFWriteEncodedStrip(tiff, stripIndex++, block, blockBytes) > 0);
+                }
+            }
+        }
+    }
+    free(block);
+    TIFFClose(tiff);
+}
+
+// Where the pixel displayed at (x, y) is stored, for a stored image of width x height
+static void tiffStoredPosition(int orientation, int width, int height, int x, int y, int * outX, int * outY)
+{
+    switch (orientation) {
+        case ORIENTATION_TOPRIGHT: // mirrored
+            *outX = width - 1 - x;
+            *outY = y;
+            break;
+        case ORIENTATION_BOTRIGHT: // rotated 180
+            *outX = width - 1 - x;
+            *outY = height - 1 - y;
+            break;
+        case ORIENTATION_BOTLEFT: // flipped
+            *outX = x;
+            *outY = height - 1 - y;
+            break;
+        case ORIENTATION_LEFTTOP: // transposed
+            *outX = y;
+            *outY = x;
+            break;
+        case ORIENTATION_RIGHTTOP: // rotated 90 clockwise
+            *outX = y;
+            *outY = height - 1 - x;
+            break;
+        case ORIENTATION_RIGHTBOT: // transversed
+            *outX = width - 1 - y;
+            *outY = height - 1 - x;
+            break;
+        case ORIENTATION_LEFTBOT: // rotated 90 counterclockwise
+            *outX = width - 1 - y;
+            *outY = x;
+            break;
+        case ORIENTATION_TOPLEFT:
+        default:
+            *outX = x;
+            *outY = y;
+            break;
+    }
+}
+
+static void checkTestTIFF(clContext * C, clImage * srcImage, const tiffTestLayout * layout)
+{
+    writeTestTIFF(srcImage, "tmp_layout.tif", layout);
+    clImage * dstImage = clContextRead(C, "tmp_layout.tif", NULL, NULL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_EQUAL_INT(srcImage->depth, dstImage->depth);
+
+    clBool transposed = (layout->orientation >= ORIENTATION_LEFTTOP) ? clTrue : clFalse;
+    TEST_ASSERT_EQUAL_INT(transposed ? srcImage->height : srcImage->width, dstImage->width);
+    TEST_ASSERT_EQUAL_INT(transposed ? srcImage->width : srcImage->height, dstImage->height);
+
+    clPixelFormat pixelFormat = (srcImage->depth == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+    clImagePrepareReadPixels(C, dstImage, pixelFormat);
+    int maxChannel = (1 << srcImage->depth) - 1;
+    for (int y = 0; y < dstImage->height; ++y) {
+        for (int x = 0; x < dstImage->width; ++x) {
+            int srcX, srcY;
+            tiffStoredPosition(layout->orientation, srcImage->width, srcImage->height, x, y, &srcX, &srcY);
+            int srcIndex = ((srcY * srcImage->width) + srcX) * CL_CHANNELS_PER_PIXEL;
+            int dstIndex = ((y * dstImage->width) + x) * CL_CHANNELS_PER_PIXEL;
+            for (int c = 0; c < CL_CHANNELS_PER_PIXEL; ++c) {
+                int expected, actual;
+                if (srcImage->depth == 16) {
+                    expected = srcImage->pixelsU16[srcIndex + c];
+                    actual = dstImage->pixelsU16[dstIndex + c];
+                } else {
+                    expected = srcImage->pixelsU8[srcIndex + c];
+                    actual = dstImage->pixelsU8[dstIndex + c];
+                }
+                if ((c == 3) && (layout->channelCount == 3)) {
+                    expected = maxChannel;
+                }
+                if (expected != actual) {
+                    char message[128];
+                    sprintf(message, "pixel (%d, %d) channel %d, orientation %d", x, y, c, layout->orientation);
+                    TEST_ASSERT_EQUAL_INT_MESSAGE(expected, actual, message);
+                }
+            }
+        }
+    }
+    clImageDestroy(C, dstImage);
+}
+
+static void test_tif_layouts(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 3;
+
+    // Sizes that leave partial tiles and strips on the right and bottom edges
+    const int depths[2] = { 8, 16 };
+    for (int d = 0; d < 2; ++d) {
+        clImage * srcImage = clImageCreate(C, 37, 23, depths[d], NULL);
+        TEST_ASSERT_NOT_NULL(srcImage);
+        clPixelFormat pixelFormat = (depths[d] == 16) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8;
+        clImagePrepareWritePixels(C, srcImage, pixelFormat);
+        int maxChannel = (1 << depths[d]) - 1;
+        for (int y = 0; y < srcImage->height; ++y) {
+            for (int x = 0; x < srcImage->width; ++x) {
+                int index = ((y * srcImage->width) + x) * CL_CHANNELS_PER_PIXEL;
+                int values[4] = { x * 97, y * 211, (x * y * 13) + 5, (x + y) * 31 };
+                for (int c = 0; c < CL_CHANNELS_PER_PIXEL; ++c) {
+                    if (depths[d] == 16) {
+                        srcImage->pixelsU16[index + c] = (uint16_t)(values[c] % (maxChannel + 1));
+                    } else {
+                        srcImage->pixelsU8[index + c] = (uint8_t)(values[c] % (maxChannel + 1));
+                    }
+                }
+            }
+        }
+
+        // Tiles and strips, interleaved and one plane per channel
+        for (int i = 0; i < 8; ++i) {
+            tiffTestLayout layout;
+            layout.channelCount = (i & 4) ? 4 : 3;
+            layout.tiled = (i & 1) ? clTrue : clFalse;
+            layout.separate = (i & 2) ? clTrue : clFalse;
+            layout.orientation = ORIENTATION_TOPLEFT;
+            checkTestTIFF(C, srcImage, &layout);
+        }
+
+        // Every orientation, from tiles and strips
+        for (int orientation = ORIENTATION_TOPLEFT; orientation <= ORIENTATION_LEFTBOT; ++orientation) {
+            for (int tiled = 0; tiled < 2; ++tiled) {
+                tiffTestLayout layout;
+                layout.channelCount = 4;
+                layout.tiled = tiled ? clTrue : clFalse;
+                layout.separate = clFalse;
+                layout.orientation = orientation;
+                checkTestTIFF(C, srcImage, &layout);
+            }
+        }
+        clImageDestroy(C, srcImage);
+    }
+    clContextDestroy(C);
+}
+
+static void test_webp_options(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_U8);
+    uint32_t pixelsSize = srcImage->width * srcImage->height * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
+
+    // Lossless round trips at either end of the speed range, with and without the ICC chunk
+    const int methods[2] = { 0, 6 };
+    for (int i = 0; i < 4; ++i) {
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        writeParams.quality = 100;
+        writeParams.webpMethod = methods[i % 2];
+        writeParams.writeProfile = (i / 2) ? clFalse : clTrue;
+        TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_options.webp", NULL, &writeParams), "failed to write image");
+
+        clImage * dstImage = clContextRead(C, "tmp_options.webp", NULL, NULL);
+        TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+        clImagePrepareReadPixels(C, dstImage, CL_PIXELFORMAT_U8);
+        TEST_ASSERT_EQUAL_MEMORY(srcImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+        clImageDestroy(C, dstImage);
+    }
+
+    // Near-lossless and tuned lossy encodes still produce readable images
+    for (int i = 0; i < 2; ++i) {
+        clWriteParams writeParams;
+        clWriteParamsSetDefaults(C, &writeParams);
+        if (i == 0) {
+            writeParams.webpNearLossless = 60;
+        } else {
+            writeParams.quality = 75;
+            writeParams.webpMethod = 0;
+            writeParams.webpSegments = 1;
+            writeParams.webpPartitions = 3;
+            writeParams.webpAlphaQuality = 50;
+        }
+        TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_options.webp", NULL, &writeParams), "failed to write image");
+
+        clImage * dstImage = clContextRead(C, "tmp_options.webp", NULL, NULL);
+        TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+        TEST_ASSERT_EQUAL_INT(srcImage->width, dstImage->width);
+        TEST_ASSERT_EQUAL_INT(srcImage->height, dstImage->height);
+        clImageDestroy(C, dstImage);
+    }
+
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+}
+
+// A hinted read of filename must match cropping an unhinted read of it
+static void checkHintCrop(clContext * C, const char * filename, clPixelFormat pixelFormat)
+{
+    clImage * fullImage = clContextRead(C, filename, NULL, NULL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(fullImage, "failed to read back image");
+    TEST_ASSERT_FALSE(C->readExtraInfo.hintApplied);
+
+    clReadHint hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.rect[0] = 37;
+    hint.rect[1] = 101;
+    hint.rect[2] = 64;
+    hint.rect[3] = 300; // past the bottom edge, gets clamped
+    clImage * dstImage = clContextReadWithHint(C, filename, NULL, NULL, &hint);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_TRUE(C->readExtraInfo.hintApplied);
+    TEST_ASSERT_EQUAL_INT(0, C->readExtraInfo.hintReduction);
+    clImage * cropImage = clImageCrop(C, fullImage, 37, 101, 64, 300, clTrue);
+    TEST_ASSERT_EQUAL_INT(cropImage->width, dstImage->width);
+    TEST_ASSERT_EQUAL_INT(cropImage->height, dstImage->height);
+    clImagePrepareReadPixels(C, cropImage, pixelFormat);
+    clImagePrepareReadPixels(C, dstImage, pixelFormat);
+    uint32_t pixelsSize = CL_BYTES_PER_PIXEL(pixelFormat) * cropImage->width * cropImage->height;
+    if (pixelFormat == CL_PIXELFORMAT_U8) {
+        TEST_ASSERT_EQUAL_MEMORY(cropImage->pixelsU8, dstImage->pixelsU8, pixelsSize);
+    } else {
+        TEST_ASSERT_EQUAL_MEMORY(cropImage->pixelsU16, dstImage->pixelsU16, pixelsSize);
+    }
+    clImageDestroy(C, cropImage);
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, fullImage);
+}
+
+static void test_read_hint(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+
+    // JPEG, cropped and then scaled down by the IDCT
+    clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_hint.jpg", NULL, &writeParams), "failed to write image");
+    checkHintCrop(C, "tmp_hint.jpg", CL_PIXELFORMAT_U8);
+
+    clReadHint hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.minWidth = 60;
+    hint.minHeight = 60;
+    clImage * dstImage = clContextReadWithHint(C, "tmp_hint.jpg", NULL, NULL, &hint);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_EQUAL_INT(2, C->readExtraInfo.hintReduction);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->width);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->height);
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, srcImage);
+
+    // WebP, cropped and rescaled by the decoder
+    srcImage = clImageParseString(C, TEST_IMAGE_STRING, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    writeParams.quality = 100; // lossless
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_hint.webp", NULL, &writeParams), "failed to write image");
+    checkHintCrop(C, "tmp_hint.webp", CL_PIXELFORMAT_U8);
+    dstImage = clContextReadWithHint(C, "tmp_hint.webp", NULL, NULL, &hint);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_EQUAL_INT(2, C->readExtraInfo.hintReduction);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->width);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->height);
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, srcImage);
+
+    // TIFF, with strips that straddle the region
+    srcImage = clImageParseString(C, TEST_IMAGE_STRING, 16, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    writeParams.tiffRowsPerStrip = 7;
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_hint.tif", NULL, &writeParams), "failed to write image");
+    checkHintCrop(C, "tmp_hint.tif", CL_PIXELFORMAT_U16);
+    clImageDestroy(C, srcImage);
+
+    // JPEG 2000, with the decode area and resolution level set on the codestream
+    srcImage = clImageParseString(C, TEST_IMAGE_STRING, 16, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    clWriteParamsSetDefaults(C, &writeParams);
+    writeParams.quality = 100; // lossless
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_hint.jp2", NULL, &writeParams), "failed to write image");
+    checkHintCrop(C, "tmp_hint.jp2", CL_PIXELFORMAT_U16);
+    dstImage = clContextReadWithHint(C, "tmp_hint.jp2", NULL, NULL, &hint);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_EQUAL_INT(2, C->readExtraInfo.hintReduction);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->width);
+    TEST_ASSERT_EQUAL_INT(64, dstImage->height);
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, srcImage);
+
+    // A region's reduced size depends on where it starts: at half scale, 3 pixels from x=1 cover a single
+    // reduced pixel (ceil(4/2) - ceil(1/2)), while the same 3 pixels from x=0 cover two
+    memset(&hint, 0, sizeof(hint));
+    hint.minWidth = 2;
+    hint.minHeight = 2;
+    TEST_ASSERT_EQUAL_INT(0, clReadHintReduction(C, &hint, 1, 0, 3, 4, 3));
+    TEST_ASSERT_EQUAL_INT(1, clReadHintReduction(C, &hint, 0, 0, 3, 4, 3));
+    TEST_ASSERT_EQUAL_INT(1, clReadHintReduction(C, &hint, 1, 1, 4, 4, 3));
+
+    clContextDestroy(C);
+}
+
+typedef struct pngRowsInfo
+{
+    int nextRow;
+    int bandCount;
+    clBool outOfOrder;
+} pngRowsInfo;
+
+static void pngRowsCallback(struct clContext * C, struct clImage * image, int firstRow, int rowCount, void * userData)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(image);
+
+    pngRowsInfo * info = (pngRowsInfo *)userData;
+    if ((firstRow != info->nextRow) || (rowCount <= 0)) {
+        info->outOfOrder = clTrue;
+    }
+    info->nextRow = firstRow + rowCount;
+    ++info->bandCount;
+}
+
+static void test_png_rows(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, 16, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_rows.png", NULL, &writeParams), "failed to write image");
+
+    pngRowsInfo info;
+    memset(&info, 0, sizeof(info));
+    C->readRowsFunc = pngRowsCallback;
+    C->readRowsUserData = &info;
+    clImage * dstImage = clContextRead(C, "tmp_rows.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_FALSE(info.outOfOrder);
+    TEST_ASSERT_EQUAL_INT(dstImage->height, info.nextRow);
+    TEST_ASSERT_TRUE(info.bandCount > 1);
+    TEST_ASSERT_TRUE(C->readExtraInfo.decodeFillSeconds > 0.0);
+
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+}
+
+static void test_webp_rows(void)
+{
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+
+    clImage * srcImage = clImageParseString(C, TEST_IMAGE_STRING, 8, NULL);
+    TEST_ASSERT_NOT_NULL(srcImage);
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    TEST_ASSERT_TRUE_MESSAGE(clContextWrite(C, srcImage, "tmp_rows.webp", NULL, &writeParams), "failed to write image");
+
+    // Same band reporting as PNG (pngRowsInfo), from the incremental decoder
+    pngRowsInfo info;
+    memset(&info, 0, sizeof(info));
+    C->readRowsFunc = pngRowsCallback;
+    C->readRowsUserData = &info;
+    clImage * dstImage = clContextRead(C, "tmp_rows.webp", NULL, NULL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dstImage, "failed to read back image");
+    TEST_ASSERT_FALSE(info.outOfOrder);
+    TEST_ASSERT_EQUAL_INT(dstImage->height, info.nextRow);
+
+    clImageDestroy(C, dstImage);
+    clImageDestroy(C, srcImage);
+    clContextDestroy(C);
+}
+
+static void test_sequence(void)
+{
+    static const char * frameStrings[3] = { "64x64,#ff0000", "64x64,#00ff00", "64x64,#0000ff" };
+    const double durations[3] = { 0.1, 0.25, 0.05 };
+
+    clContext * C = clContextCreate(&silentSystem);
+    TEST_ASSERT_NOT_NULL(C);
+    C->jobs = 4;
+
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    writeParams.quality = 100;
+
+    clImage * frames[3];
+    for (int i = 0; i < 3; ++i) {
+        frames[i] = clImageParseString(C, frameStrings[i], 8, NULL);
+        TEST_ASSERT_NOT_NULL(frames[i]);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(clContextWriteSequence(C, frames, durations, 3, "tmp_sequence.webp", NULL, &writeParams), "failed to write sequence");
+    TEST_ASSERT_TRUE_MESSAGE(clContextWriteSequence(C, frames, NULL, 1, "tmp_sequence.png", NULL, &writeParams), "failed to write single frame");
+    TEST_ASSERT_FALSE(clContextWriteSequence(C, frames, NULL, 3, "tmp_sequence.png", NULL, &writeParams));
+
+    // Plain decode, in order
+    clImageSequence * sequence = clImageSequenceCreate(C, "tmp_sequence.webp", NULL, NULL);
+    TEST_ASSERT_NOT_NULL_MESSAGE(sequence, "failed to open sequence");
+    TEST_ASSERT_EQUAL_INT(3, sequence->frameCount);
+    for (int i = 0; i < 3; ++i) {
+        clImage * image = clImageSequenceNext(C, sequence);
+        TEST_ASSERT_NOT_NULL(image);
+        TEST_ASSERT_EQUAL_INT(i, sequence->frameIndex);
+        TEST_ASSERT_EQUAL_INT(64, image->width);
+        TEST_ASSERT_TRUE(sequence->frameDuration > (durations[i] - 0.001));
+        TEST_ASSERT_TRUE(sequence->frameDuration < (durations[i] + 0.001));
+
+        clImageDiff * diff = clImageDiffCreate(C, frames[i], image, 0.1f, 0);
+        TEST_ASSERT_EQUAL_INT(0, diff->overThresholdCount);
+        clImageDiffDestroy(C, diff);
+        clImageDestroy(C, image);
+    }
+    TEST_ASSERT_NULL(clImageSequenceNext(C, sequence));
+    TEST_ASSERT_FALSE(sequence->failed);
+    clImageSequenceDestroy(C, sequence);
+
+    // Pipelined conversion, both on tasks and inline
+    for (int jobs = 1; jobs <= 4; jobs += 3) {
+        C->jobs = jobs;
+        sequence = clImageSequenceCreate(C, "tmp_sequence.webp", NULL, NULL);
+        TEST_ASSERT_NOT_NULL(sequence);
+        clImageSequenceSetConversion(C, sequence, 16, frames[0]->profile, CL_TONEMAP_OFF, NULL);
+        int frameCount = 0;
+        clImage * image;
+        while ((image = clImageSequenceNext(C, sequence)) != NULL) {
+            TEST_ASSERT_EQUAL_INT(16, image->depth);
+            clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
+            TEST_ASSERT_EQUAL_INT((frameCount == 0) ? 65535 : 0, image->pixelsU16[0]);
+            TEST_ASSERT_EQUAL_INT((frameCount == 2) ? 65535 : 0, image->pixelsU16[2]);
+            clImageDestroy(C, image);
+            ++frameCount;
+        }
+        TEST_ASSERT_EQUAL_INT(3, frameCount);
+        TEST_ASSERT_NULL(C->logMutex); // only held while a frame converts
+        clImageSequenceDestroy(C, sequence);
+    }
+
+    // Formats without native sequences are a single frame
+    sequence = clImageSequenceCreate(C, "tmp_sequence.png", NULL, NULL);
+    TEST_ASSERT_NOT_NULL(sequence);
+    TEST_ASSERT_EQUAL_INT(1, sequence->frameCount);
+    clImage * image = clImageSequenceNext(C, sequence);
+    TEST_ASSERT_NOT_NULL(image);
+    clImageDestroy(C, image);
+    TEST_ASSERT_NULL(clImageSequenceNext(C, sequence));
+    clImageSequenceDestroy(C, sequence);
+
+    for (int i = 0; i < 3; ++i) {
+        clImageDestroy(C, frames[i]);
+    }
+    clContextDestroy(C);
+}
 
 int test_io(void)
 {
@@ -258,10 +1044,21 @@ int test_io(void)
     RUN_TEST(test_avif);
     RUN_TEST(test_bmp);
     RUN_TEST(test_jpg);
+    RUN_TEST(test_jpg_options);
+    RUN_TEST(test_jpg_restart);
     RUN_TEST(test_jp2);
     RUN_TEST(test_png);
+    RUN_TEST(test_png_options);
+    RUN_TEST(test_png_parallel);
+    RUN_TEST(test_png_rows);
     RUN_TEST(test_tif);
+    RUN_TEST(test_tif_options);
+    RUN_TEST(test_tif_layouts);
+    RUN_TEST(test_read_hint);
     RUN_TEST(test_webp);
+    RUN_TEST(test_webp_options);
+    RUN_TEST(test_webp_rows);
+    RUN_TEST(test_sequence);
 
     return UNITY_END();
 }
@@ -17,17 +17,8 @@
 #include <stdlib.h>
 #include <string.h>
 
-static void clContextSilentLog(clContext * C, const char * section, int indent, const char * format, va_list args)
-{
-    COLORIST_UNUSED(C);
-    COLORIST_UNUSED(section);
-    COLORIST_UNUSED(indent);
-    COLORIST_UNUSED(format);
-    COLORIST_UNUSED(args);
-}
-
 static cJSON * errorJSON = NULL;
-static void clContextSilentLogError(clContext * C, const char * format, va_list args)
+static void clContextJSONLogError(clContext * C, const char * format, va_list args)
 {
     int needed;
     char * buffer;
@@ -48,6 +39,32 @@ static void clContextSilentLogError(clContext * C, const char * format, va_list
     clFree(buffer);
 }
 
+// Forwards this command line (minus --server) to a running "colorist serve"
+static int runOnServer(clContext * C, int argc, char * argv[], cJSON * jsonOutput)
+{
+    const char ** args = clAllocate(sizeof(const char *) * argc);
+    int argCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--server")) {
+            ++i; // skip the socket too
+            continue;
+        }
+        args[argCount++] = argv[i];
+    }
+
+    cJSON * response = jsonOutput ? cJSON_CreateObject() : NULL;
+    int ret = clContextServeRequest(C, C->serverFilename, argCount, args, NULL, NULL, response);
+    if (response) {
+        cJSON * output = cJSON_GetObjectItem(response, "output");
+        for (cJSON * item = output ? output->child : NULL; item != NULL; item = item->next) {
+            cJSON_AddItemToObject(jsonOutput, item->string, cJSON_Duplicate(item, 1));
+        }
+        cJSON_Delete(response);
+    }
+    clFree((void *)args);
+    return ret;
+}
+
 int main(int argc, char * argv[])
 {
     int ret = 1;
@@ -65,7 +82,7 @@ int main(int argc, char * argv[])
         if (!strcmp(argv[i], "--json")) {
             // JSON output enabled, avoid any other text output
             system.log = clContextSilentLog;
-            system.error = clContextSilentLogError;
+            system.error = clContextJSONLogError;
             jsonOutput = cJSON_CreateObject();
             break;
         }
@@ -85,30 +102,10 @@ int main(int argc, char * argv[])
         goto cleanup;
     }
 
-    switch (C->action) {
-        case CL_ACTION_CALC:
-            ret = clContextGenerate(C, jsonOutput);
-            break;
-        case CL_ACTION_CONVERT:
-            ret = clContextConvert(C);
-            break;
-        case CL_ACTION_GENERATE:
-            ret = clContextGenerate(C, NULL);
-            break;
-        case CL_ACTION_IDENTIFY:
-            ret = clContextIdentify(C, jsonOutput);
-            break;
-        case CL_ACTION_HIGHLIGHT:
-            ret = clContextHighlight(C);
-            break;
-        case CL_ACTION_MODIFY:
-            ret = clContextModify(C);
-            break;
-        case CL_ACTION_ERROR:
-        case CL_ACTION_NONE:
-        default:
-            clContextLogError(C, "Unimplemented action: %s", clActionToString(C, C->action));
-            break;
+    if (C->serverFilename && (C->action != CL_ACTION_SERVE)) {
+        ret = runOnServer(C, argc, argv, jsonOutput);
+    } else {
+        ret = clContextRunAction(C, jsonOutput);
     }
 
 cleanup:
@@ -18,6 +18,7 @@ struct _cmsContext_struct;
 
 struct clContext;
 struct clImage;
+struct clMutex;
 struct clProfile;
 struct clProfilePrimaries;
 struct clRaw;
@@ -26,12 +27,14 @@ struct cJSON;
 typedef enum clAction
 {
     CL_ACTION_NONE = 0,
+    CL_ACTION_BATCH,
     CL_ACTION_CALC,
     CL_ACTION_CONVERT,
     CL_ACTION_GENERATE,
     CL_ACTION_HIGHLIGHT,
     CL_ACTION_IDENTIFY,
     CL_ACTION_MODIFY,
+    CL_ACTION_SERVE,
 
     CL_ACTION_ERROR
 } clAction;
@@ -41,17 +44,63 @@ const char * clActionToString(struct clContext * C, clAction action);
 
 struct clFormat;
 struct clWriteParams;
+
+// Optional hint handed to format readers: the caller only needs part of the image, and/or is going to
+// scale it down afterwards. Readers are free to ignore it. A reader that honors it returns exactly the
+// hinted rect (clamped to the image), optionally decoded at 1/2^n scale as long as the result stays at
+// least minWidth x minHeight, and reports what it did in clReadExtraInfo (hintApplied, etc).
+typedef struct clReadHint
+{
+    int rect[4];   // x, y, width, height in full resolution pixels. A width or height <= 0 means "the whole image"
+    int minWidth;  // Smallest size the caller can use. 0,0 means full resolution is required
+    int minHeight;
+} clReadHint;
+
+// Clamps hint->rect to an image of the given size. Returns clFalse if the hint doesn't ask for a crop,
+// in which case outRect covers the whole image.
+clBool clReadHintRect(struct clContext * C, const clReadHint * hint, int width, int height, int outRect[4]);
+// Largest reduction n (<= maxReduction) for which a rectW x rectH region at rectX,rectY, decoded at
+// 1/2^n scale, still covers the hint's minWidth x minHeight. Edges are rounded up to the reduced grid
+// as JPEG 2000 does, so the reduced width is ceil((rectX + rectW) / 2^n) - ceil(rectX / 2^n); pass an
+// origin of 0,0 for decoders that scale the region after cropping it.
+int clReadHintReduction(struct clContext * C,
+                        const clReadHint * hint,
+                        int rectX,
+                        int rectY,
+                        int rectW,
+                        int rectH,
+                        int maxReduction);
+
 typedef clBool (*clFormatDetectFunc)(struct clContext * C, struct clFormat * format, struct clRaw * input);
 typedef struct clImage * (*clFormatReadFunc)(struct clContext * C,
                                              const char * formatName,
                                              struct clProfile * overrideProfile,
-                                             struct clRaw * input);
+                                             struct clRaw * input,
+                                             const clReadHint * hint); // hint may be NULL
 typedef clBool (*clFormatWriteFunc)(struct clContext * C,
                                     struct clImage * image,
                                     const char * formatName,
                                     struct clRaw * output,
                                     struct clWriteParams * writeParams);
 
+// Optional multi-frame (animation) support. The begin func parses the container and returns an opaque
+// state (NULL on failure), which is handed to the frame func once per frame, in order, and then freed by
+// the end func. The raw input outlives the state. Durations are in seconds.
+typedef void * (*clFormatReadSequenceBeginFunc)(struct clContext * C,
+                                                 const char * formatName,
+                                                 struct clProfile * overrideProfile,
+                                                 struct clRaw * input,
+                                                 int * outFrameCount);
+typedef struct clImage * (*clFormatReadSequenceFrameFunc)(struct clContext * C, void * sequenceState, double * outDuration);
+typedef void (*clFormatReadSequenceEndFunc)(struct clContext * C, void * sequenceState);
+typedef clBool (*clFormatWriteSequenceFunc)(struct clContext * C,
+                                            struct clImage ** frames,
+                                            const double * durations,
+                                            int frameCount,
+                                            const char * formatName,
+                                            struct clRaw * output,
+                                            struct clWriteParams * writeParams);
+
 typedef enum clFormatDepth
 {
     CL_FORMAT_DEPTH_8 = 0,
@@ -79,12 +128,19 @@ typedef struct clFormat
     clFormatDetectFunc detectFunc;
     clFormatReadFunc readFunc;
     clFormatWriteFunc writeFunc;
+    clFormatReadSequenceBeginFunc readSequenceBeginFunc; // optional
+    clFormatReadSequenceFrameFunc readSequenceFrameFunc; // optional
+    clFormatReadSequenceEndFunc readSequenceEndFunc;     // optional
+    clFormatWriteSequenceFunc writeSequenceFunc;         // optional
 } clFormat;
 
 clBool clFormatExists(struct clContext * C, const char * formatName);
 int clFormatMaxDepth(struct clContext * C, const char * formatName);
 int clFormatBestDepth(struct clContext * C, const char * formatName, int reqDepth);
 const char * clFormatDetect(struct clContext * C, const char * filename);
+// Same as clFormatDetect(), but sniffs input (the file's contents, already in memory) instead of
+// reopening the file when the extension doesn't settle it. filename may be NULL.
+const char * clFormatDetectRaw(struct clContext * C, const char * filename, const struct clRaw * input);
 
 // TODO: consider merging with clTonemapParams (requires API refactor)
 typedef enum clTonemap
@@ -153,6 +209,59 @@ typedef enum clYUVFormat
 clYUVFormat clYUVFormatFromString(struct clContext * C, const char * str);
 const char * clYUVFormatToString(struct clContext * C, clYUVFormat format);
 
+typedef enum clChromaUpsampling
+{
+    CL_CHROMAUPSAMPLING_AUTO = 0, // Let the decoder choose
+    CL_CHROMAUPSAMPLING_FASTEST,  // Fastest available path (libyuv when built in)
+    CL_CHROMAUPSAMPLING_BEST,     // Best quality, avoiding libyuv's shortcuts
+    CL_CHROMAUPSAMPLING_NEAREST,
+    CL_CHROMAUPSAMPLING_BILINEAR,
+
+    CL_CHROMAUPSAMPLING_INVALID = -1
+} clChromaUpsampling;
+
+clChromaUpsampling clChromaUpsamplingFromString(struct clContext * C, const char * str);
+const char * clChromaUpsamplingToString(struct clContext * C, clChromaUpsampling upsampling);
+
+typedef enum clPNGFilter
+{
+    CL_PNGFILTER_AUTO = 0, // libpng's default (adaptive, all filters)
+    CL_PNGFILTER_NONE,
+    CL_PNGFILTER_SUB,
+    CL_PNGFILTER_UP,
+    CL_PNGFILTER_AVG,
+    CL_PNGFILTER_PAETH,
+    CL_PNGFILTER_ALL,
+
+    CL_PNGFILTER_INVALID = -1
+} clPNGFilter;
+
+clPNGFilter clPNGFilterFromString(struct clContext * C, const char * str);
+const char * clPNGFilterToString(struct clContext * C, clPNGFilter filter);
+
+typedef enum clPNGStrategy
+{
+    CL_PNGSTRATEGY_DEFAULT = 0, // libpng's choice (Z_FILTERED when filtering)
+    CL_PNGSTRATEGY_RLE,
+    CL_PNGSTRATEGY_HUFFMAN
+} clPNGStrategy;
+
+// Sets pngCompressionLevel, pngFilter and pngStrategy in one go: "fast", "default", or "small"
+clBool clPNGPresetApply(struct clContext * C, const char * presetName, struct clWriteParams * writeParams);
+
+typedef enum clTIFFCompression
+{
+    CL_TIFFCOMPRESSION_NONE = 0,
+    CL_TIFFCOMPRESSION_LZW,
+    CL_TIFFCOMPRESSION_DEFLATE,
+    CL_TIFFCOMPRESSION_ZSTD, // Only when libtiff was built with it
+
+    CL_TIFFCOMPRESSION_INVALID = -1
+} clTIFFCompression;
+
+clTIFFCompression clTIFFCompressionFromString(struct clContext * C, const char * str);
+const char * clTIFFCompressionToString(struct clContext * C, clTIFFCompression compression);
+
 typedef struct clWriteParams
 {
     int quality;
@@ -161,15 +270,39 @@ typedef struct clWriteParams
     clBool writeProfile;   // Write ICC or nclx profile to output file?
     int quantizerMin;      // AVIF only. 0-63 range. 0 is lossless. -1 is "ignore and use quality"
     int quantizerMax;      // AVIF only. 0-63 range. 0 is lossless. -1 is "ignore and use quality"
-    int tileRowsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile rows during encoding.
-    int tileColsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile cols during encoding.
+    int tileRowsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile rows during encoding. -1 is auto (see below)
+    int tileColsLog2;      // AVIF only. 0-6 range. 0 is disabled. Requests 2^n tile cols during encoding. -1 is auto: picked
+                           //            from the image size and C->jobs
     int speed;             // AVIF only. [-1,10] range. -1 is "let the codec choose a default".
                            //            0 is best quality, 10 is fastest encoding speed
     const char * codec;    // AVIF only. Specify a codec to write with (NULL == auto)
     int nclx[3];           // AVIF only. Force NCLX output profile, using these values. (0/0/0 == ignore)
+    int quantizerMinAlpha; // AVIF only. 0-63 range. -1 is "let libavif choose" (lossless alpha)
+    int quantizerMaxAlpha; // AVIF only. 0-63 range. -1 is "let libavif choose" (lossless alpha)
+    int keyframeInterval;  // AVIF sequences only. Force a keyframe every N frames. 0 lets the codec decide.
+    clYUVFormat jpegSubsampling; // JPEG only. Chroma subsampling, CL_YUVFORMAT_INVALID keeps libjpeg's default (420)
+    clBool jpegProgressive;      // JPEG only. Write a progressive JPEG
+    clBool jpegOptimize;         // JPEG only. Compute optimal Huffman tables (smaller output, slower encode)
+    clBool jpegTrellis;          // JPEG only. Trellis quantization, when the JPEG library supports it (mozjpeg)
+    int pngCompressionLevel;     // PNG only. zlib level, 0-9 range. -1 is "let libpng choose" (6)
+    clPNGFilter pngFilter;       // PNG only. Row filter(s) to try on each row
+    clPNGStrategy pngStrategy;   // PNG only. zlib strategy
+    clBool pngParallel;          // PNG only. Deflate row stripes across C->jobs threads (pigz-style)
+    clTIFFCompression tiffCompression; // TIFF only. Strip compression
+    clBool tiffPredictor;              // TIFF only. Horizontal (floating point for 32-bit) predictor, when compressing
+    int tiffRowsPerStrip;              // TIFF only. Rows in each strip. 0 is auto (~64k of pixels per strip)
+    int webpMethod;                    // WebP only. 0-6 range. 0 is fastest, 6 is smallest output
+    int webpNearLossless;              // WebP only. 0-100 range. Below 100 switches to near-lossless encoding (0 is lossiest)
+    int webpAlphaQuality;              // WebP only. 0-100 range. 100 is lossless alpha
+    int webpSegments;                  // WebP only. 1-4 range. Number of segments (quantizer sets) for lossy encoding
+    int webpPartitions;                // WebP only. 0-3 range. log2 of the number of token partitions for lossy encoding
 } clWriteParams;
 void clWriteParamsSetDefaults(struct clContext * C, clWriteParams * writeParams);
 
+// The tile layout AVIF encodes with when tileRowsLog2/tileColsLog2 are -1 (auto): whatever the AV1
+// tile size limits require, then enough tiles for C->jobs, never splitting tiles below 512 pixels
+void clAVIFAutoTiling(struct clContext * C, int width, int height, int * outRowsLog2, int * outColsLog2);
+
 typedef void * (*clContextAllocFunc)(struct clContext * C, size_t bytes); // C will be NULL when allocating the clContext itself
 typedef void (*clContextFreeFunc)(struct clContext * C, void * ptr);
 typedef void (*clContextLogFunc)(struct clContext * C, const char * section, int indent, const char * format, va_list args);
@@ -181,6 +314,10 @@ void clContextDefaultFree(struct clContext * C, void * ptr);
 void clContextDefaultLog(struct clContext * C, const char * section, int indent, const char * format, va_list args);
 void clContextDefaultLogError(struct clContext * C, const char * format, va_list args);
 
+// Drop everything, for callers that want a quiet context or to mute one for a while (swap C->system.log)
+void clContextSilentLog(struct clContext * C, const char * section, int indent, const char * format, va_list args);
+void clContextSilentLogError(struct clContext * C, const char * format, va_list args);
+
 typedef struct clContextSystem
 {
     clContextAllocFunc alloc;
@@ -213,12 +350,26 @@ typedef struct clReadExtraInfo
     int mirrorNeeded; // 0 == none, 1 == mirror on vertical axis (horizontal flip), 2 == mirror on horizontal axis (vertical flip)
     int crop[4];      // x, y, width, height
 
+    // read hint results (see clReadHint), only set by readers which honored the hint
+    clBool hintApplied; // The image is exactly hintRect, so the caller must not crop it again
+    int hintRect[4];    // x, y, width, height of the decoded region, in full resolution pixels
+    int hintReduction;  // The region was decoded at 1/2^hintReduction scale
+
     // perf stats
     double decodeCodecSeconds;    // Time spent actually in the decoder
     double decodeYUVtoRGBSeconds; // Time spent converting from YUV (0 if the format isn't YUV or the codec automatically does)
     double decodeFillSeconds;     // Time spent filling final clImage RGBA16 buffers
 } clReadExtraInfo;
 
+typedef struct clWriteExtraInfo
+{
+    // perf stats
+    double encodeCodecSeconds;      // Wall time spent actually in the encoder
+    double encodeProcessCPUSeconds; // Process CPU time (clock()) while in the encoder: counts the encoder's own threads,
+                                    // but also anything else the process ran meanwhile (other jobs, pipeline stages)
+    double encodeRGBtoYUVSeconds;   // Time spent converting to YUV (0 if the format isn't YUV or the codec automatically does)
+} clWriteExtraInfo;
+
 typedef struct clConversionParams
 {
     clBool autoGrade;               // -a
@@ -239,10 +390,13 @@ typedef struct clConversionParams
     int rotate;                     // --rotate
     const char * stripTags;         // -s
     clBool stats;                   // --stats
+    clBool ssim;                    // --ssim
     clTonemap tonemap;              // -t
     clTonemapParams tonemapParams;  // -t
     clWriteParams writeParams;      // -n, -q, -r, --yuv
     const char * readCodec;         // AVIF only. Specify a codec to read with (NULL == auto)
+    clChromaUpsampling upsampling;  // AVIF and WebP. --upsampling
+    clBool webpBypassFiltering;     // WebP only. --webp-bypass-filtering
     int rect[4];                    // -z
     const char * compositeFilename; // --composite
     clBlendParams compositeParams;  // --composite-gamma, --composite-premultiplied
@@ -258,6 +412,10 @@ typedef struct clFormatRecord
 struct clFormat * clContextFindFormat(struct clContext * C, const char * formatName);
 void clContextRegisterBuiltinFormats(struct clContext * C);
 
+// Optional read hook: readers that decode top-down (currently PNG) call this as each band of rows in
+// image becomes final, so work such as a colour transform can start before the decode finishes.
+typedef void (*clReadRowsFunc)(struct clContext * C, struct clImage * image, int firstRow, int rowCount, void * userData);
+
 typedef struct clContext
 {
     clContextSystem system;
@@ -265,12 +423,22 @@ typedef struct clContext
     struct _cmsContext_struct * lcms; // cmsContext
 
     clFormatRecord * formats;
+    struct clProfileRecord * profiles; // see clProfileRecord
+    struct clProfileCache * profileCache; // see clProfileCacheLookup(), NULL until first used
 
     clAction action;
     clConversionParams params;     // see above
     clReadExtraInfo readExtraInfo; // populated by some formats' readers
+    clWriteExtraInfo writeExtraInfo; // populated by some formats' writers
+    clReadRowsFunc readRowsFunc;   // see clReadRowsFunc, NULL by default
+    void * readRowsUserData;
+    struct clMutex * logMutex;     // If set, held around each log line (batch workers share one, see clContextBatch)
+    struct clRaw * inputRaw;       // If set, actions read their input from here; inputFilename only guesses the format
+    struct clRaw * outputRaw;      // If set, clContextWrite() encodes into here instead of writing the file
     clBool help;                   // -h
     const char * iccOverrideIn;    // -i
+    const char * profileCacheFilename; // --profile-cache
+    const char * serverFilename;   // --server
     int jobs;                      // -j
     clBool verbose;                // -v
     clBool ccmmAllowed;            // --ccmm
@@ -300,7 +468,44 @@ void clContextPrintVersions(clContext * C);
 clBool clContextParseArgs(clContext * C, int argc, const char * argv[]);
 
 struct clImage * clContextRead(clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName);
+// Same as clContextRead(), but passes hint (see clReadHint) along to the format's reader. Check
+// C->readExtraInfo.hintApplied afterwards to see whether it was used.
+struct clImage * clContextReadWithHint(clContext * C,
+                                       const char * filename,
+                                       const char * iccOverride,
+                                       const char ** outFormatName,
+                                       const clReadHint * hint);
+// Same as clContextReadWithHint(), for a file that is already in memory (the caller still owns input).
+// filename is only used to guess the format and may be NULL.
+struct clImage * clContextReadRaw(clContext * C,
+                                  struct clRaw * input,
+                                  const char * filename,
+                                  const char * iccOverride,
+                                  const char ** outFormatName,
+                                  const clReadHint * hint);
+// Fetches the bytes of C->inputFilename, or borrows C->inputRaw if it is set. Release with clContextFreeInput().
+clBool clContextReadInput(clContext * C, struct clRaw * input);
+void clContextFreeInput(clContext * C, struct clRaw * input);
+// Size of what the action just wrote to C->outputFilename (or C->outputRaw), for logging
+int clContextOutputSize(clContext * C);
+// Hands the encoded bytes to C->outputRaw (taking them from output) when it is set, otherwise writes filename
+clBool clContextWriteOutput(clContext * C, struct clRaw * output, const char * filename);
+// Writes profile like clContextWriteOutput(), so ICC output honors C->outputRaw too
+clBool clContextWriteProfile(clContext * C, struct clProfile * profile, const char * filename);
+// Decodes whatever the action just wrote, from C->outputRaw or C->outputFilename
+struct clImage * clContextReadOutput(clContext * C);
 clBool clContextWrite(clContext * C, struct clImage * image, const char * filename, const char * formatName, clWriteParams * writeParams);
+
+// durations (in seconds) may be NULL, and any duration <= 0 becomes CL_SEQUENCE_DEFAULT_FRAME_DURATION.
+// All frames must share the same dimensions; the first frame's profile is written.
+#define CL_SEQUENCE_DEFAULT_FRAME_DURATION (1.0 / 30.0)
+clBool clContextWriteSequence(clContext * C,
+                              struct clImage ** frames,
+                              const double * durations,
+                              int frameCount,
+                              const char * filename,
+                              const char * formatName,
+                              clWriteParams * writeParams);
 char * clContextWriteURI(struct clContext * C, struct clImage * image, const char * formatName, clWriteParams * writeParams);
 void clContextLogWrite(clContext * C, const char * filename, const char * formatName, clWriteParams * writeParams);
 
@@ -308,12 +513,52 @@ clBool clContextGetStockPrimaries(struct clContext * C, const char * name, struc
 clBool clContextGetRawStockPrimaries(struct clContext * C, const char * name, float outPrimaries[8]);
 const char * clContextFindStockPrimariesPrettyName(struct clContext * C, struct clProfilePrimaries * primaries); // returns NULL if not found
 
+// Runs C->action, as parsed by clContextParseArgs(). output is only used by calc and identify.
+int clContextRunAction(clContext * C, struct cJSON * output);
+
+// Runs every entry of a manifest (C->inputFilename, or stdin if NULL) as its own command line. Manifest
+// files are read up front and run across C->jobs; entries streamed over stdin run as they arrive.
+int clContextBatch(clContext * C);
 int clContextConvert(clContext * C);
+
+// Prepares C for the index'th conversion of a pipeline, typically with clContextParseArgs() (the
+// action must be convert). It is called on each stage's own context in turn, so every stage sees the
+// same options.
+typedef clBool (*clConvertPipelineSetupFunc)(clContext * C, int index, void * userData);
+// Called on the last stage's context as each conversion finishes, in order
+typedef void (*clConvertPipelineDoneFunc)(clContext * C, int index, clBool succeeded, double seconds, void * userData);
+// Runs count conversions as a decode -> transform -> encode pipeline, one thread per stage with
+// bounded queues in between, so one image decodes while the one before it transforms and the one
+// before that encodes. Each conversion's -j is split between the stages. C runs the decode stage;
+// the other stages get contexts of their own. If C->jobs is below 3 there aren't enough to give each
+// stage one, so the conversions run one after another on C instead. Returns 1 if any conversion failed.
+int clContextConvertPipeline(clContext * C,
+                             int count,
+                             clConvertPipelineSetupFunc setup,
+                             clConvertPipelineDoneFunc done,
+                             void * userData);
 int clContextGenerate(clContext * C, struct cJSON * output); // output here only used in ACTION_CALC
 int clContextHighlight(clContext * C);
 int clContextIdentify(clContext * C, struct cJSON * output);
 int clContextModify(clContext * C);
 
+// Listens on the Unix domain socket C->inputFilename and runs each request's command line on C, so
+// formats, profiles and caches stay warm between requests. See context_serve.c for the protocol.
+int clContextServe(clContext * C);
+// Runs a command line (argv, without the program name) on the server listening on socketFilename.
+// If input is set, its bytes are sent in place of reading the input file. If output is set, it
+// receives the encoded image instead of the server writing the output file. The server's log and
+// errors are replayed on C, and response (if set) receives the whole response header.
+int clContextServeRequest(clContext * C,
+                          const char * socketFilename,
+                          int argc,
+                          const char ** argv,
+                          struct clRaw * input,
+                          struct clRaw * output,
+                          struct cJSON * response);
+// Asks the server listening on socketFilename to stop once it has replied
+int clContextServeShutdown(clContext * C, const char * socketFilename);
+
 #define TIMING_FORMAT "--> %.3f sec"
 #define OVERALL_TIMING_FORMAT "==> %.3f sec"
 
@@ -42,6 +42,7 @@ typedef struct clImageSignals
     float psnrLinear;
     float mseG22;
     float psnrG22;
+    float ssimG22; // windowed SSIM on 2.2g luma, only calculated when C->params.ssim is set
 } clImageSignals;
 
 typedef struct clImagePixelInfo
@@ -82,8 +83,28 @@ typedef struct clImageDiff
     int underThresholdCount;
     int overThresholdCount;
     int largestChannelDiff;
+    int * diffCounts; // diffCounts[i] is the number of pixels with a largest channel diff <= i
+    int diffCountsSize;
 } clImageDiff;
 
+// Reads the frames of a (possibly animated) file once, in order. Formats without native sequence
+// support are presented as a single frame. When a conversion is set, each frame is converted on a
+// task while the next one is being decoded.
+struct clSequenceConvertInfo;
+typedef struct clImageSequence
+{
+    struct clFormat * format;
+    struct clRaw * input;
+    struct clProfile * overrideProfile;
+    void * decoderState; // owned by the format's sequence funcs, or the whole image for single frame formats
+    int frameCount;
+    int frameIndex;       // index of the frame most recently returned by clImageSequenceNext(), -1 before the first call
+    double frameDuration; // duration in seconds of the frame most recently returned by clImageSequenceNext()
+    int decodedCount;
+    clBool failed;
+    struct clSequenceConvertInfo * convertInfo; // set by clImageSequenceSetConversion()
+} clImageSequence;
+
 typedef struct clImageHDRPixel
 {
     float x;
@@ -175,6 +196,17 @@ void clImageDrawLine(struct clContext * C, clImage * image, int x0, int y0, int
 
 clImageDiff * clImageDiffCreate(struct clContext * C, clImage * image1, clImage * image2, float minIntensity, int threshold);
 void clImageDiffUpdate(struct clContext * C, clImageDiff * diff, int threshold);
+void clImageDiffUpdateCounts(struct clContext * C, clImageDiff * diff, int threshold); // O(1), leaves diff->image alone
 void clImageDiffDestroy(struct clContext * C, clImageDiff * diff);
 
+clImageSequence * clImageSequenceCreate(struct clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName);
+void clImageSequenceSetConversion(struct clContext * C,
+                                  clImageSequence * sequence,
+                                  int depth,
+                                  struct clProfile * dstProfile,
+                                  clTonemap tonemap,
+                                  clTonemapParams * tonemapParams); // call before the first clImageSequenceNext()
+clImage * clImageSequenceNext(struct clContext * C, clImageSequence * sequence); // caller owns the frame, NULL when done (or sequence->failed)
+void clImageSequenceDestroy(struct clContext * C, clImageSequence * sequence);
+
 #endif // ifndef COLORIST_IMAGE_H
@@ -49,13 +49,28 @@ typedef struct clProfileCurve
     float gamma;
 } clProfileCurve;
 
+// clProfileClone() is cheap: a clone shares description, handle and raw with the profile it was
+// cloned from, and refCount counts the clProfiles sharing them. Anything that modifies a profile
+// (clProfileSet*(), clProfileRemoveTag(), clProfileReload()) first gives it a private copy, so
+// clones never see each other's changes. Treat these fields as read-only.
+//
+// clProfileQuery() answers come from the query* fields, which clProfileParse() fills in whenever the
+// handle is (re)parsed, so they are always in sync with the profile's current tags.
 typedef struct clProfile
 {
     char * description;
     void * handle; // cmsHPROFILE
     clRaw raw;     // Populated during clProfileParse(), preferred during clProfilePack(), cleared on any clProfileSet*() call
-    uint8_t signature[16]; // Populated during clProfileParse()
+    uint64_t hash; // clHash64() of raw, populated during clProfileParse()
     clBool ccmm; // Can this profile be used by colorist's built-in CMM? (if false for either src or dst, LittleCMS is used)
+    int * refCount; // Shared by all clones
+    clProfilePrimaries queryPrimaries;
+    clProfileCurve queryCurve;
+    int queryLuminance;
+    clBool queryPrimariesValid; // clFalse if primaries can't be derived from this profile's tags
+    clBool queryCurveValid;     // clFalse if the curve can't be derived from this profile's tags
+    float queryToXYZ[9];        // gbMat3 from clTransformDeriveXYZMatrix(queryPrimaries)
+    float queryFromXYZ[9];      // gbMat3 inverse of queryToXYZ, transposed for CCMM's XYZ -> RGB
 } clProfile;
 
 typedef enum clProfileStock
@@ -71,8 +86,30 @@ typedef struct clProfileYUVCoefficients
 } clProfileYUVCoefficients;
 void clProfileYUVCoefficientsSetDefaults(struct clContext * C, clProfileYUVCoefficients * yuv);
 
+// clProfileCreateStock() and clProfileCreate() intern what they build in C->profiles, keyed by the
+// arguments they were given, so asking for the same profile again just returns a clone of it. The
+// registry isn't locked; create profiles from the thread that owns the context. It keeps the
+// CL_PROFILE_RECORDS_MAX most recently used profiles, so long-lived contexts (serve, batch) don't grow it
+// without bound.
+#define CL_PROFILE_RECORDS_MAX 32
+typedef struct clProfileRecord
+{
+    clBool stock;
+    clProfilePrimaries primaries;
+    clProfileCurveType curveType;
+    float gamma;
+    int maxLuminance;
+    char * description; // NULL if generated
+    clProfile * profile;
+    struct clProfileRecord * next;
+} clProfileRecord;
+void clProfileRecordsDestroy(struct clContext * C);
+
 clProfile * clProfileCreateStock(struct clContext * C, clProfileStock stock);
 clProfile * clProfileClone(struct clContext * C, clProfile * profile);
+// Copy-on-write: gives profile its own copy of anything it shares with its clones, so it can be
+// modified, or handed to another thread while its clones stay in use on this one
+clBool clProfileDetach(struct clContext * C, clProfile * profile);
 clProfile * clProfileCreate(struct clContext * C, clProfilePrimaries * primaries, clProfileCurve * curve, int maxLuminance, const char * description);
 clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t iccLen, const char * description);
 clProfile * clProfileRead(struct clContext * C, const char * filename);
@@ -105,6 +142,16 @@ void clProfileDestroy(struct clContext * C, clProfile * profile);
 
 clBool clProfilePrimariesMatch(struct clContext * C, clProfilePrimaries * p1, clProfilePrimaries * p2);
 
+// Optional on-disk cache of everything clProfileParse() derives from a profile's bytes (the query*
+// fields and ccmm), keyed by clHash64() and size, so short-lived processes don't redo it for the
+// same profiles every run. Set C->profileCacheFilename (--profile-cache) to enable it. The file is
+// memory-mapped on first use and anything new is written back by clProfileCacheFlush(), which
+// clContextDestroy() calls.
+clBool clProfileCacheLookup(struct clContext * C, clProfile * profile); // Fills in profile's query* fields and ccmm on a hit
+void clProfileCacheStore(struct clContext * C, clProfile * profile);
+clBool clProfileCacheFlush(struct clContext * C);
+void clProfileCacheDestroy(struct clContext * C); // Flushes, then unmaps
+
 // TODO: this needs a better name
 char * clGenerateDescription(struct clContext * C, clProfilePrimaries * primaries, clProfileCurve * curve, int maxLuminance);
 
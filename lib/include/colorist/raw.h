@@ -33,4 +33,7 @@ clBool clRawReadFile(struct clContext * C, clRaw * raw, const char * filename);
 clBool clRawReadFileHeader(struct clContext * C, clRaw * raw, const char * filename, size_t bytes);
 clBool clRawWriteFile(struct clContext * C, clRaw * raw, const char * filename);
 
+// Fast 64-bit non-cryptographic hash (XXH64) for in-process lookups and equality checks
+uint64_t clHash64(const uint8_t * data, size_t len);
+
 #endif
@@ -27,4 +27,34 @@ void clTaskJoin(struct clContext * C, clTask * task);
 void clTaskDestroy(struct clContext * C, clTask * task);
 int clTaskLimit(void);
 
+// Runs func once per entry of the infos array (taskCount entries, infoSize bytes apart) on its own
+// thread, and waits for them all. A single task runs on the calling thread.
+void clTaskRunAll(struct clContext * C, clTaskFunc func, void * infos, size_t infoSize, int taskCount);
+
+// Atomically adds 1 to / subtracts 1 from *value, returning the new value
+int clAtomicIncrement(int * value);
+int clAtomicDecrement(int * value);
+
+typedef struct clMutex
+{
+    void * nativeData;
+} clMutex;
+
+clMutex * clMutexCreate(struct clContext * C);
+void clMutexLock(clMutex * mutex);
+void clMutexUnlock(clMutex * mutex);
+void clMutexDestroy(struct clContext * C, clMutex * mutex);
+
+typedef struct clCondition
+{
+    void * nativeData;
+} clCondition;
+
+clCondition * clConditionCreate(struct clContext * C);
+// Atomically unlocks mutex and sleeps until woken, then relocks it. Wakeups can be spurious, so
+// always wait in a loop that rechecks what was waited on.
+void clConditionWait(clCondition * condition, clMutex * mutex);
+void clConditionBroadcast(clCondition * condition);
+void clConditionDestroy(struct clContext * C, clCondition * condition);
+
 #endif // ifndef COLORIST_TASK_H
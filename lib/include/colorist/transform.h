@@ -89,6 +89,10 @@ const char * clTransformCMMName(struct clContext * C, clTransform * transform);
 float clTransformGetLuminanceScale(struct clContext * C, clTransform * transform); // Convenience function
 void clTransformRun(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount);
 
+// Same as clTransformRun(), but never spawns tasks. Safe to call from inside your own tasks as long as
+// clTransformPrepare() was called on the transform beforehand.
+void clTransformRunSerial(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount);
+
 // if X+Y+Z is 0, clTransformXYZToXYY() returns (whitePointX, whitePointY, 0)
 void clTransformXYZToXYY(struct clContext * C, float * dstXYY, const float * srcXYZ, float whitePointX, float whitePointY);
 void clTransformXYYToXYZ(struct clContext * C, float * dstXYZ, const float * srcXYY);
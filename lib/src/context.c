@@ -51,6 +51,8 @@ clAction clActionFromString(struct clContext * C, const char * str)
 {
     COLORIST_UNUSED(C);
 
+    if (!strcmp(str, "batch"))
+        return CL_ACTION_BATCH;
     if (!strcmp(str, "identify"))
         return CL_ACTION_IDENTIFY;
     if (!strcmp(str, "highlight"))
@@ -67,6 +69,8 @@ clAction clActionFromString(struct clContext * C, const char * str)
         return CL_ACTION_CONVERT;
     if (!strcmp(str, "modify"))
         return CL_ACTION_MODIFY;
+    if (!strcmp(str, "serve"))
+        return CL_ACTION_SERVE;
     return CL_ACTION_ERROR;
 }
 
@@ -77,6 +81,8 @@ const char * clActionToString(struct clContext * C, clAction action)
     switch (action) {
         case CL_ACTION_NONE:
             return "--";
+        case CL_ACTION_BATCH:
+            return "batch";
         case CL_ACTION_IDENTIFY:
             return "identify";
         case CL_ACTION_GENERATE:
@@ -89,6 +95,8 @@ const char * clActionToString(struct clContext * C, clAction action)
             return "convert";
         case CL_ACTION_MODIFY:
             return "modify";
+        case CL_ACTION_SERVE:
+            return "serve";
         case CL_ACTION_ERROR:
         default:
             break;
@@ -96,59 +104,104 @@ const char * clActionToString(struct clContext * C, clAction action)
     return "unknown";
 }
 
+int clContextRunAction(struct clContext * C, struct cJSON * output)
+{
+    switch (C->action) {
+        case CL_ACTION_BATCH:
+            return clContextBatch(C);
+        case CL_ACTION_CALC:
+            return clContextGenerate(C, output);
+        case CL_ACTION_CONVERT:
+            return clContextConvert(C);
+        case CL_ACTION_GENERATE:
+            return clContextGenerate(C, NULL);
+        case CL_ACTION_HIGHLIGHT:
+            return clContextHighlight(C);
+        case CL_ACTION_IDENTIFY:
+            return clContextIdentify(C, output);
+        case CL_ACTION_MODIFY:
+            return clContextModify(C);
+        case CL_ACTION_SERVE:
+            return clContextServe(C);
+        case CL_ACTION_ERROR:
+        case CL_ACTION_NONE:
+        default:
+            break;
+    }
+    clContextLogError(C, "Unimplemented action: %s", clActionToString(C, C->action));
+    return 1;
+}
+
 // ------------------------------------------------------------------------------------------------
 // clFormat
 
-static char const * clFormatDetectHeader(struct clContext * C, const char * filename)
+static char const * detectFormatSignature(struct clContext * C, const clRaw * input)
 {
-    clRaw raw = CL_RAW_EMPTY;
-    if (clRawReadFileHeader(C, &raw, filename, 1024)) {
-        for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
-            if (record->format.detectFunc(C, &record->format, &raw)) {
-                clRawFree(C, &raw);
-                return record->format.name;
-            }
+    for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
+        if (record->format.detectFunc(C, &record->format, (clRaw *)input)) {
+            return record->format.name;
         }
     }
-    clRawFree(C, &raw);
     return NULL;
 }
 
-const char * clFormatDetect(struct clContext * C, const char * filename)
+// Guesses from filename's extension first, then from the first bytes of the file. If the caller
+// already has the file in memory (input), those bytes are used instead of opening it again.
+static const char * detectFormat(struct clContext * C, const char * filename, const clRaw * input)
 {
-    // If either slash is AFTER the last period in the filename, there is no extension
-    const char * lastBackSlash = strrchr(filename, '\\');
-    const char * lastSlash = strrchr(filename, '/');
-    const char * ext = strrchr(filename, '.');
-    if ((ext == NULL) || (lastBackSlash && (lastBackSlash > ext)) || (lastSlash && (lastSlash > ext))) {
-        ext = clFormatDetectHeader(C, filename);
-        if (ext)
-            return ext;
-
-        clContextLogError(C, "Unable to guess format");
-        return NULL;
+    const char * ext = NULL;
+    if (filename) {
+        // If either slash is AFTER the last period in the filename, there is no extension
+        const char * lastBackSlash = strrchr(filename, '\\');
+        const char * lastSlash = strrchr(filename, '/');
+        ext = strrchr(filename, '.');
+        if (ext && ((lastBackSlash && (lastBackSlash > ext)) || (lastSlash && (lastSlash > ext)))) {
+            ext = NULL;
+        }
     }
-    ++ext; // skip past the period
 
-    // Special case: icc profile (this might be bad)
-    if (!strcmp(ext, "icc")) {
-        return "icc";
-    }
+    if (ext) {
+        ++ext; // skip past the period
 
-    for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
-        int extensionIndex;
-        for (extensionIndex = 0; extensionIndex < CL_FORMAT_MAX_EXTENSIONS; ++extensionIndex) {
-            if (record->format.extensions[extensionIndex] && !strcmp(record->format.extensions[extensionIndex], ext)) {
-                return record->format.name;
+        // Special case: icc profile (this might be bad)
+        if (!strcmp(ext, "icc")) {
+            return "icc";
+        }
+
+        for (clFormatRecord * record = C->formats; record != NULL; record = record->next) {
+            int extensionIndex;
+            for (extensionIndex = 0; extensionIndex < CL_FORMAT_MAX_EXTENSIONS; ++extensionIndex) {
+                if (record->format.extensions[extensionIndex] && !strcmp(record->format.extensions[extensionIndex], ext)) {
+                    return record->format.name;
+                }
             }
         }
     }
 
-    ext = clFormatDetectHeader(C, filename);
-    if (ext)
-        return ext;
+    const char * formatName = NULL;
+    if (input) {
+        formatName = detectFormatSignature(C, input);
+    } else if (filename) {
+        clRaw header = CL_RAW_EMPTY;
+        if (clRawReadFileHeader(C, &header, filename, 1024)) {
+            formatName = detectFormatSignature(C, &header);
+        }
+        clRawFree(C, &header);
+    }
+    if (!formatName && !ext) {
+        clContextLogError(C, "Unable to guess format");
+    }
+    return formatName;
+}
+
+const char * clFormatDetect(struct clContext * C, const char * filename)
+{
+    return detectFormat(C, filename, NULL);
+}
 
-    return NULL;
+const char * clFormatDetectRaw(struct clContext * C, const char * filename, const struct clRaw * input)
+{
+    return detectFormat(C, filename, input);
 }
 
 int clFormatMaxDepth(struct clContext * C, const char * formatName)
@@ -388,6 +441,159 @@ const char * clYUVFormatToString(struct clContext * C, clYUVFormat format)
     return "invalid";
 }
 
+// ------------------------------------------------------------------------------------------------
+// clChromaUpsampling
+
+clChromaUpsampling clChromaUpsamplingFromString(struct clContext * C, const char * str)
+{
+    COLORIST_UNUSED(C);
+
+    if (!strcmp(str, "auto"))
+        return CL_CHROMAUPSAMPLING_AUTO;
+    if (!strcmp(str, "fastest"))
+        return CL_CHROMAUPSAMPLING_FASTEST;
+    if (!strcmp(str, "best"))
+        return CL_CHROMAUPSAMPLING_BEST;
+    if (!strcmp(str, "nearest"))
+        return CL_CHROMAUPSAMPLING_NEAREST;
+    if (!strcmp(str, "bilinear"))
+        return CL_CHROMAUPSAMPLING_BILINEAR;
+    return CL_CHROMAUPSAMPLING_INVALID;
+}
+
+const char * clChromaUpsamplingToString(struct clContext * C, clChromaUpsampling upsampling)
+{
+    COLORIST_UNUSED(C);
+
+    switch (upsampling) {
+        case CL_CHROMAUPSAMPLING_AUTO:
+            return "auto";
+        case CL_CHROMAUPSAMPLING_FASTEST:
+            return "fastest";
+        case CL_CHROMAUPSAMPLING_BEST:
+            return "best";
+        case CL_CHROMAUPSAMPLING_NEAREST:
+            return "nearest";
+        case CL_CHROMAUPSAMPLING_BILINEAR:
+            return "bilinear";
+        case CL_CHROMAUPSAMPLING_INVALID:
+        default:
+            break;
+    }
+    return "invalid";
+}
+
+// ------------------------------------------------------------------------------------------------
+// clPNGFilter
+
+clPNGFilter clPNGFilterFromString(struct clContext * C, const char * str)
+{
+    COLORIST_UNUSED(C);
+
+    if (!strcmp(str, "auto"))
+        return CL_PNGFILTER_AUTO;
+    if (!strcmp(str, "none"))
+        return CL_PNGFILTER_NONE;
+    if (!strcmp(str, "sub"))
+        return CL_PNGFILTER_SUB;
+    if (!strcmp(str, "up"))
+        return CL_PNGFILTER_UP;
+    if (!strcmp(str, "avg"))
+        return CL_PNGFILTER_AVG;
+    if (!strcmp(str, "paeth"))
+        return CL_PNGFILTER_PAETH;
+    if (!strcmp(str, "all"))
+        return CL_PNGFILTER_ALL;
+    return CL_PNGFILTER_INVALID;
+}
+
+const char * clPNGFilterToString(struct clContext * C, clPNGFilter filter)
+{
+    COLORIST_UNUSED(C);
+
+    switch (filter) {
+        case CL_PNGFILTER_AUTO:
+            return "auto";
+        case CL_PNGFILTER_NONE:
+            return "none";
+        case CL_PNGFILTER_SUB:
+            return "sub";
+        case CL_PNGFILTER_UP:
+            return "up";
+        case CL_PNGFILTER_AVG:
+            return "avg";
+        case CL_PNGFILTER_PAETH:
+            return "paeth";
+        case CL_PNGFILTER_ALL:
+            return "all";
+        case CL_PNGFILTER_INVALID:
+        default:
+            break;
+    }
+    return "invalid";
+}
+
+clBool clPNGPresetApply(struct clContext * C, const char * presetName, struct clWriteParams * writeParams)
+{
+    COLORIST_UNUSED(C);
+
+    if (!strcmp(presetName, "fast")) {
+        // A single cheap filter and run-length matching; several times faster than the default
+        writeParams->pngCompressionLevel = 1;
+        writeParams->pngFilter = CL_PNGFILTER_SUB;
+        writeParams->pngStrategy = CL_PNGSTRATEGY_RLE;
+    } else if (!strcmp(presetName, "default")) {
+        writeParams->pngCompressionLevel = -1;
+        writeParams->pngFilter = CL_PNGFILTER_AUTO;
+        writeParams->pngStrategy = CL_PNGSTRATEGY_DEFAULT;
+    } else if (!strcmp(presetName, "small")) {
+        writeParams->pngCompressionLevel = 9;
+        writeParams->pngFilter = CL_PNGFILTER_ALL;
+        writeParams->pngStrategy = CL_PNGSTRATEGY_DEFAULT;
+    } else {
+        return clFalse;
+    }
+    return clTrue;
+}
+
+// ------------------------------------------------------------------------------------------------
+// clTIFFCompression
+
+clTIFFCompression clTIFFCompressionFromString(struct clContext * C, const char * str)
+{
+    COLORIST_UNUSED(C);
+
+    if (!strcmp(str, "none"))
+        return CL_TIFFCOMPRESSION_NONE;
+    if (!strcmp(str, "lzw"))
+        return CL_TIFFCOMPRESSION_LZW;
+    if (!strcmp(str, "deflate") || !strcmp(str, "zip"))
+        return CL_TIFFCOMPRESSION_DEFLATE;
+    if (!strcmp(str, "zstd"))
+        return CL_TIFFCOMPRESSION_ZSTD;
+    return CL_TIFFCOMPRESSION_INVALID;
+}
+
+const char * clTIFFCompressionToString(struct clContext * C, clTIFFCompression compression)
+{
+    COLORIST_UNUSED(C);
+
+    switch (compression) {
+        case CL_TIFFCOMPRESSION_NONE:
+            return "none";
+        case CL_TIFFCOMPRESSION_LZW:
+            return "lzw";
+        case CL_TIFFCOMPRESSION_DEFLATE:
+            return "deflate";
+        case CL_TIFFCOMPRESSION_ZSTD:
+            return "zstd";
+        case CL_TIFFCOMPRESSION_INVALID:
+        default:
+            break;
+    }
+    return "invalid";
+}
+
 // ------------------------------------------------------------------------------------------------
 // clContext
 
@@ -422,8 +628,11 @@ void clConversionParamsSetDefaults(clContext * C, clConversionParams * params)
     params->rotate = 0;
     params->stripTags = NULL;
     params->stats = clFalse;
+    params->ssim = clFalse;
     params->tonemap = CL_TONEMAP_AUTO;
     params->readCodec = NULL;
+    params->upsampling = CL_CHROMAUPSAMPLING_AUTO;
+    params->webpBypassFiltering = clFalse;
     clTonemapParamsSetDefaults(C, &params->tonemapParams);
     params->compositeFilename = NULL;
     clWriteParamsSetDefaults(C, &params->writeParams);
@@ -447,6 +656,25 @@ void clWriteParamsSetDefaults(struct clContext * C, clWriteParams * writeParams)
     writeParams->nclx[0] = 0;
     writeParams->nclx[1] = 0;
     writeParams->nclx[2] = 0;
+    writeParams->quantizerMinAlpha = -1;
+    writeParams->quantizerMaxAlpha = -1;
+    writeParams->keyframeInterval = 0;
+    writeParams->jpegSubsampling = CL_YUVFORMAT_INVALID;
+    writeParams->jpegProgressive = clFalse;
+    writeParams->jpegOptimize = clFalse;
+    writeParams->jpegTrellis = clFalse;
+    writeParams->pngCompressionLevel = -1;
+    writeParams->pngFilter = CL_PNGFILTER_AUTO;
+    writeParams->pngStrategy = CL_PNGSTRATEGY_DEFAULT;
+    writeParams->pngParallel = clFalse;
+    writeParams->tiffCompression = CL_TIFFCOMPRESSION_NONE;
+    writeParams->tiffPredictor = clFalse;
+    writeParams->tiffRowsPerStrip = 0;
+    writeParams->webpMethod = 4;
+    writeParams->webpNearLossless = 100;
+    writeParams->webpAlphaQuality = 100;
+    writeParams->webpSegments = 4;
+    writeParams->webpPartitions = 0;
 }
 
 static void clContextSetDefaultArgs(clContext * C)
@@ -455,6 +683,8 @@ static void clContextSetDefaultArgs(clContext * C)
     clConversionParamsSetDefaults(C, &C->params);
     C->help = clFalse;
     C->iccOverrideIn = NULL;
+    C->profileCacheFilename = NULL;
+    C->serverFilename = NULL;
     C->jobs = clTaskLimit();
     C->verbose = clFalse;
     C->ccmmAllowed = clTrue;
@@ -494,6 +724,9 @@ clContext * clContextCreate(clContextSystem * system)
     // to fully honor the chad tags in the profiles (if any).
     cmsSetAdaptationStateTHR(C->lcms, 0);
 
+    C->readRowsFunc = NULL;
+    C->readRowsUserData = NULL;
+
     clContextSetDefaultArgs(C);
     clContextRegisterBuiltinFormats(C);
     return C;
@@ -508,6 +741,8 @@ void clContextDestroy(clContext * C)
         clFree(freeme);
     }
     C->formats = NULL;
+    clProfileRecordsDestroy(C);
+    clProfileCacheDestroy(C);
     cmsDeleteContext(C->lcms);
     clFree(C);
 }
@@ -756,7 +991,7 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
     const char * filenames[2] = { NULL, NULL };
     while (argIndex < argc) {
         const char * arg = argv[argIndex];
-        if ((arg[0] == '-')) {
+        if ((arg[0] == '-') && (arg[1] != 0)) { // a lone "-" is a positional (stdin)
             if (!strcmp(arg, "-a") || !strcmp(arg, "--auto") || !strcmp(arg, "--autograde")) {
                 C->params.autoGrade = clTrue;
             } else if (!strcmp(arg, "-b") || !strcmp(arg, "--bpc")) {
@@ -842,6 +1077,9 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 C->params.stripTags = arg;
             } else if (!strcmp(arg, "--stats")) {
                 C->params.stats = clTrue;
+            } else if (!strcmp(arg, "--ssim")) {
+                C->params.stats = clTrue;
+                C->params.ssim = clTrue;
             } else if (!strcmp(arg, "-t") || !strcmp(arg, "--tonemap")) {
                 NEXTARG();
                 if (!clTonemapFromString(C, arg, &C->params.tonemap, &C->params.tonemapParams)) {
@@ -887,6 +1125,86 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                     clContextLogError(C, "Unknown YUV Format: %s", arg);
                     return clFalse;
                 }
+                C->params.writeParams.jpegSubsampling = C->params.writeParams.yuvFormat;
+            } else if (!strcmp(arg, "--progressive")) {
+                C->params.writeParams.jpegProgressive = clTrue;
+            } else if (!strcmp(arg, "--optimize")) {
+                C->params.writeParams.jpegOptimize = clTrue;
+            } else if (!strcmp(arg, "--trellis")) {
+                C->params.writeParams.jpegTrellis = clTrue;
+            } else if (!strcmp(arg, "--png-level")) {
+                NEXTARG();
+                C->params.writeParams.pngCompressionLevel = atoi(arg);
+                if ((C->params.writeParams.pngCompressionLevel < 0) || (C->params.writeParams.pngCompressionLevel > 9)) {
+                    clContextLogError(C, "PNG compression level must be in the range [0-9]: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--png-filter")) {
+                NEXTARG();
+                C->params.writeParams.pngFilter = clPNGFilterFromString(C, arg);
+                if (C->params.writeParams.pngFilter == CL_PNGFILTER_INVALID) {
+                    clContextLogError(C, "Unknown PNG filter: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--png-preset")) {
+                NEXTARG();
+                if (!clPNGPresetApply(C, arg, &C->params.writeParams)) {
+                    clContextLogError(C, "Unknown PNG preset: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--png-parallel")) {
+                C->params.writeParams.pngParallel = clTrue;
+            } else if (!strcmp(arg, "--tiff-compression")) {
+                NEXTARG();
+                C->params.writeParams.tiffCompression = clTIFFCompressionFromString(C, arg);
+                if (C->params.writeParams.tiffCompression == CL_TIFFCOMPRESSION_INVALID) {
+                    clContextLogError(C, "Unknown TIFF compression: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--tiff-predictor")) {
+                C->params.writeParams.tiffPredictor = clTrue;
+            } else if (!strcmp(arg, "--tiff-rows")) {
+                NEXTARG();
+                C->params.writeParams.tiffRowsPerStrip = atoi(arg);
+                if (C->params.writeParams.tiffRowsPerStrip < 0) {
+                    clContextLogError(C, "TIFF rows per strip must be positive (or 0 for auto): %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-method")) {
+                NEXTARG();
+                C->params.writeParams.webpMethod = atoi(arg);
+                if ((C->params.writeParams.webpMethod < 0) || (C->params.writeParams.webpMethod > 6)) {
+                    clContextLogError(C, "WebP method must be in the range [0-6]: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-near-lossless")) {
+                NEXTARG();
+                C->params.writeParams.webpNearLossless = atoi(arg);
+                if ((C->params.writeParams.webpNearLossless < 0) || (C->params.writeParams.webpNearLossless > 100)) {
+                    clContextLogError(C, "WebP near-lossless level must be in the range [0-100]: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-alpha-quality")) {
+                NEXTARG();
+                C->params.writeParams.webpAlphaQuality = atoi(arg);
+                if ((C->params.writeParams.webpAlphaQuality < 0) || (C->params.writeParams.webpAlphaQuality > 100)) {
+                    clContextLogError(C, "WebP alpha quality must be in the range [0-100]: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-segments")) {
+                NEXTARG();
+                C->params.writeParams.webpSegments = atoi(arg);
+                if ((C->params.writeParams.webpSegments < 1) || (C->params.writeParams.webpSegments > 4)) {
+                    clContextLogError(C, "WebP segments must be in the range [1-4]: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-partitions")) {
+                NEXTARG();
+                C->params.writeParams.webpPartitions = atoi(arg);
+                if ((C->params.writeParams.webpPartitions < 0) || (C->params.writeParams.webpPartitions > 3)) {
+                    clContextLogError(C, "WebP partitions must be in the range [0-3]: %s", arg);
+                    return clFalse;
+                }
             } else if (!strcmp(arg, "--cmm") || !strcmp(arg, "--cms")) {
                 NEXTARG();
                 if (!strcmp(arg, "auto") || !strcmp(arg, "colorist") || !strcmp(arg, "ccmm")) {
@@ -897,6 +1215,12 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                     clContextLogError(C, "Unknown CMM: %s", arg);
                     return clFalse;
                 }
+            } else if (!strcmp(arg, "--profile-cache")) {
+                NEXTARG();
+                C->profileCacheFilename = arg;
+            } else if (!strcmp(arg, "--server")) {
+                NEXTARG();
+                C->serverFilename = arg;
             } else if (!strcmp(arg, "--deflum")) {
                 NEXTARG();
                 C->defaultLuminance = atoi(arg);
@@ -907,6 +1231,15 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
             } else if (!strcmp(arg, "--frameindex")) {
                 NEXTARG();
                 C->params.frameIndex = (uint32_t)atoi(arg);
+            } else if (!strcmp(arg, "--upsampling")) {
+                NEXTARG();
+                C->params.upsampling = clChromaUpsamplingFromString(C, arg);
+                if (C->params.upsampling == CL_CHROMAUPSAMPLING_INVALID) {
+                    clContextLogError(C, "Unknown chroma upsampling: %s", arg);
+                    return clFalse;
+                }
+            } else if (!strcmp(arg, "--webp-bypass-filtering")) {
+                C->params.webpBypassFiltering = clTrue;
             } else if (!strcmp(arg, "--hlglum")) {
                 NEXTARG();
                 int hlgLum = atoi(arg);
@@ -942,6 +1275,27 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 }
                 C->params.writeParams.quantizerMin = CL_CLAMP(C->params.writeParams.quantizerMin, 0, 63);
                 C->params.writeParams.quantizerMax = CL_CLAMP(C->params.writeParams.quantizerMax, 0, 63);
+            } else if (!strcmp(arg, "--quantizer-alpha")) {
+                NEXTARG();
+                char tmpBuffer[16]; // the biggest legal string is "63,63", so I don't mind truncation here
+                strncpy(tmpBuffer, arg, 15);
+                tmpBuffer[15] = 0;
+                char * comma = strchr(tmpBuffer, ',');
+                if (comma) {
+                    *comma = 0;
+                    ++comma;
+                    C->params.writeParams.quantizerMinAlpha = atoi(tmpBuffer);
+                    C->params.writeParams.quantizerMaxAlpha = atoi(comma);
+                } else {
+                    int quantizerBoth = atoi(tmpBuffer);
+                    C->params.writeParams.quantizerMinAlpha = quantizerBoth;
+                    C->params.writeParams.quantizerMaxAlpha = quantizerBoth;
+                }
+                C->params.writeParams.quantizerMinAlpha = CL_CLAMP(C->params.writeParams.quantizerMinAlpha, 0, 63);
+                C->params.writeParams.quantizerMaxAlpha = CL_CLAMP(C->params.writeParams.quantizerMaxAlpha, 0, 63);
+            } else if (!strcmp(arg, "--keyframe")) {
+                NEXTARG();
+                C->params.writeParams.keyframeInterval = CL_MAX(atoi(arg), 0);
             } else if (!strcmp(arg, "--rotate")) {
                 NEXTARG();
                 C->params.rotate = atoi(arg);
@@ -956,22 +1310,27 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
                 }
             } else if (!strcmp(arg, "--tiling")) {
                 NEXTARG();
-                char tmpBuffer[16]; // the biggest legal string is "6,6", so I don't mind truncation here
-                strncpy(tmpBuffer, arg, 15);
-                tmpBuffer[15] = 0;
-                char * comma = strchr(tmpBuffer, ',');
-                if (comma) {
-                    *comma = 0;
-                    ++comma;
-                    C->params.writeParams.tileRowsLog2 = atoi(tmpBuffer);
-                    C->params.writeParams.tileColsLog2 = atoi(comma);
+                if (!strcmp(arg, "auto")) {
+                    C->params.writeParams.tileRowsLog2 = -1;
+                    C->params.writeParams.tileColsLog2 = -1;
                 } else {
-                    int tileBoth = atoi(tmpBuffer);
-                    C->params.writeParams.tileRowsLog2 = tileBoth;
-                    C->params.writeParams.tileColsLog2 = tileBoth;
+                    char tmpBuffer[16]; // the biggest legal string is "6,6", so I don't mind truncation here
+                    strncpy(tmpBuffer, arg, 15);
+                    tmpBuffer[15] = 0;
+                    char * comma = strchr(tmpBuffer, ',');
+                    if (comma) {
+                        *comma = 0;
+                        ++comma;
+                        C->params.writeParams.tileRowsLog2 = atoi(tmpBuffer);
+                        C->params.writeParams.tileColsLog2 = atoi(comma);
+                    } else {
+                        int tileBoth = atoi(tmpBuffer);
+                        C->params.writeParams.tileRowsLog2 = tileBoth;
+                        C->params.writeParams.tileColsLog2 = tileBoth;
+                    }
+                    C->params.writeParams.tileRowsLog2 = CL_CLAMP(C->params.writeParams.tileRowsLog2, 0, 6);
+                    C->params.writeParams.tileColsLog2 = CL_CLAMP(C->params.writeParams.tileColsLog2, 0, 6);
                 }
-                C->params.writeParams.tileRowsLog2 = CL_CLAMP(C->params.writeParams.tileRowsLog2, 0, 6);
-                C->params.writeParams.tileColsLog2 = CL_CLAMP(C->params.writeParams.tileColsLog2, 0, 6);
             } else if (!strcmp(arg, "--nclx")) {
                 NEXTARG();
                 if (!parseNCLX(C, C->params.writeParams.nclx, arg))
@@ -1017,6 +1376,28 @@ clBool clContextParseArgs(clContext * C, int argc, const char * argv[])
     }
 
     switch (C->action) {
+        case CL_ACTION_BATCH:
+            if (filenames[0] && strcmp(filenames[0], "-")) {
+                C->inputFilename = filenames[0];
+            }
+            if (filenames[1]) {
+                clContextLogError(C, "batch does not accept an output filename.");
+                return clFalse;
+            }
+            break;
+
+        case CL_ACTION_SERVE:
+            C->inputFilename = filenames[0];
+            if (!C->inputFilename) {
+                clContextLogError(C, "serve requires a socket filename.");
+                return clFalse;
+            }
+            if (filenames[1]) {
+                clContextLogError(C, "serve does not accept an output filename.");
+                return clFalse;
+            }
+            break;
+
         case CL_ACTION_IDENTIFY:
             C->inputFilename = filenames[0];
             if (!C->inputFilename) {
@@ -1129,6 +1510,8 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "        colorist generate  [image string] [output image] [OPTIONS]");
     clContextLog(C, NULL, 0, "        colorist modify    [input.icc]    [output.icc]   [OPTIONS]");
     clContextLog(C, NULL, 0, "        colorist calc      [image string]                [OPTIONS]");
+    clContextLog(C, NULL, 0, "        colorist batch     [manifest]                    [OPTIONS]");
+    clContextLog(C, NULL, 0, "        colorist serve     [socket]                      [OPTIONS]");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Basic Options:");
     clContextLog(C, NULL, 0, "    -h,--help                : Display this help");
@@ -1142,10 +1525,14 @@ void clContextPrintSyntax(clContext * C)
                  COLORIST_DEFAULT_LUMINANCE);
     clContextLog(C, NULL, 0, "    --hlglum LUMINANCE       : Alternative to --deflum, hlglum chooses an appropriate diffuse white for --deflum based on peak HLG lum.");
     clContextLog(C, NULL, 0, "                               (--hlglum and --deflum are mutually exclusive as they are two ways to set the same value.)");
+    clContextLog(C, NULL, 0, "    --profile-cache FILE     : Cache parsed ICC profile details in FILE, reused by later runs (default: off)");
+    clContextLog(C, NULL, 0, "    --server SOCKET          : Run this command on a \"colorist serve\" listening on SOCKET instead of in this process");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Input Options:");
     clContextLog(C, NULL, 0, "    -i,--iccin file.icc      : Override source ICC profile. default is to use embedded profile (if any), or sRGB@deflum");
     clContextLog(C, NULL, 0, "    --frameindex INDEX       : Choose the source frame from an image sequence (AVIF only, defaults to frame 0)");
+    clContextLog(C, NULL, 0, "    --upsampling MODE        : Chroma upsampling when decoding (AVIF and WebP). auto (default), fastest, best, nearest, bilinear");
+    clContextLog(C, NULL, 0, "    --webp-bypass-filtering  : Skip the in-loop deblocking filter when decoding (WebP only, faster but blockier, for previews)");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Output Profile Options:");
     clContextLog(C, NULL, 0, "    -o,--iccout file.icc     : Override destination ICC profile. Disables all other output profile options");
@@ -1163,12 +1550,30 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "    -q,--quality QUALITY     : Output quality for supported output formats. (default: 90)");
     clContextLog(C, NULL, 0, "    -r,--rate RATE           : Output rate for for supported output formats. If 0, codec uses -q value above instead. (default: 0)");
     clContextLog(C, NULL, 0, "    -t,--tonemap TM          : Set tonemapping. auto (default), on, or off. Tune with optional comma separated vals: contrast=1.0,clip=1.0,speed=1.0,power=1.0");
-    clContextLog(C, NULL, 0, "    --yuv YUVFORMAT          : Choose yuv output format for supported formats. 444 (default), 422, 420, 400");
+    clContextLog(C, NULL, 0, "    --yuv YUVFORMAT          : Choose yuv output format for supported formats. 444 (default), 422, 420, 400 (JPEG defaults to 420)");
     clContextLog(C, NULL, 0, "    --quantizer MIN,MAX      : Choose min and max quantizer values directly instead of using -q (AVIF only, 0-63 range, 0,0 is lossless)");
+    clContextLog(C, NULL, 0, "    --quantizer-alpha MIN,MAX: Choose min and max quantizer values for the alpha plane (AVIF only, 0-63 range, default: lossless)");
     clContextLog(C, NULL, 0, "    --tiling ROWS,COLS       : Enable tiling when encoding (AVIF only, 0-6 range, log2 based. Enables 2^ROWS rows and/or 2^COLS cols)");
+    clContextLog(C, NULL, 0, "                               \"auto\" picks rows and cols from the image size and the number of jobs (-j)");
+    clContextLog(C, NULL, 0, "    --keyframe INTERVAL      : Force a keyframe every INTERVAL frames when writing a sequence (AVIF only, 0 = codec decides (default))");
     clContextLog(C, NULL, 0, "    --codec READ,WRITE       : Specify which internal codec to be used when decoding (AVIF only, auto,auto is default, see libavif version below for choices)");
     clContextLog(C, NULL, 0, "    --speed SPEED            : Specify the quality/speed tradeoff when encoding (AVIF only, [0-10] range. auto = default (let the codec decide), 0=best quality, 10=fastest)");
     clContextLog(C, NULL, 0, "    --nclx PRI,TF,MTX        : Force the output NCLX color profile to specific values (AVIF only, does not affect conversion, only the color profile signaling)");
+    clContextLog(C, NULL, 0, "    --progressive            : Write progressive output (JPEG only)");
+    clContextLog(C, NULL, 0, "    --optimize               : Optimize entropy coding for smaller output, at the cost of encoding speed (JPEG only)");
+    clContextLog(C, NULL, 0, "    --trellis                : Use trellis quantization if the JPEG library supports it (JPEG only, mozjpeg)");
+    clContextLog(C, NULL, 0, "    --png-level LEVEL        : zlib compression level (PNG only, [0-9] range, default: 6)");
+    clContextLog(C, NULL, 0, "    --png-filter FILTER      : Row filter (PNG only). auto (default), none, sub, up, avg, paeth, all");
+    clContextLog(C, NULL, 0, "    --png-preset PRESET      : Set level, filter and zlib strategy together (PNG only). fast, default, small");
+    clContextLog(C, NULL, 0, "    --png-parallel           : Deflate row stripes on all jobs (PNG only, slightly larger output)");
+    clContextLog(C, NULL, 0, "    --tiff-compression COMP  : Strip compression (TIFF only). none (default), lzw, deflate, zstd (if libtiff supports it)");
+    clContextLog(C, NULL, 0, "    --tiff-predictor         : Apply the horizontal predictor before compressing (TIFF only, usually much smaller output)");
+    clContextLog(C, NULL, 0, "    --tiff-rows ROWS         : Rows per strip (TIFF only, 0 = auto (default)). Strips are compressed in parallel across jobs");
+    clContextLog(C, NULL, 0, "    --webp-method METHOD     : Speed/size tradeoff (WebP only, [0-6] range, 0=fastest, 6=smallest, default: 4)");
+    clContextLog(C, NULL, 0, "    --webp-near-lossless N   : Near-lossless preprocessing level (WebP only, [0-100] range, 100=off (default), 0=lossiest)");
+    clContextLog(C, NULL, 0, "    --webp-alpha-quality Q   : Alpha plane quality (WebP only, [0-100] range, default: 100 (lossless))");
+    clContextLog(C, NULL, 0, "    --webp-segments N        : Number of segments for lossy encoding (WebP only, [1-4] range, default: 4)");
+    clContextLog(C, NULL, 0, "    --webp-partitions N      : log2 of the token partition count for lossy encoding (WebP only, [0-3] range, default: 0)");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Convert Options:");
     clContextLog(C, NULL, 0, "    --resize w,h,filter      : Resize dst image to WxH. Use optional filter (auto (default), box, triangle, cubic, catmullrom, mitchell, nearest)");
@@ -1181,6 +1586,7 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "    --composite-offset x,y   : When compositing, offsets source image onto destination image");
     clContextLog(C, NULL, 0, "    --hald FILENAME          : Image containing valid Hald CLUT to be used after color conversion");
     clContextLog(C, NULL, 0, "    --stats                  : Enable post-conversion stats (MSE, PSNR, etc)");
+    clContextLog(C, NULL, 0, "    --ssim                   : Enable post-conversion stats, including windowed SSIM (slower)");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "Identify / Calc Options:");
     clContextLog(C, NULL, 0, "    -z,--rect x,y,w,h        : Pixels to dump. x,y,w,h");
@@ -1189,6 +1595,10 @@ void clContextPrintSyntax(clContext * C)
     clContextLog(C, NULL, 0, "Modify Options:");
     clContextLog(C, NULL, 0, "    -s,--striptags TAG,...   : Strips ICC tags from profile");
     clContextLog(C, NULL, 0, "");
+    clContextLog(C, NULL, 0, "Batch Options:");
+    clContextLog(C, NULL, 0, "    [manifest]               : One command line per line (\"convert in.png out.jpg -q 80\"), or a JSON array of argument arrays.");
+    clContextLog(C, NULL, 0, "                               Omit it (or use -) to run lines from stdin as they arrive. -j and --profile-cache apply to the whole batch");
+    clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "See image string examples here: https://joedrago.github.io/colorist/docs/Usage.html");
     clContextLog(C, NULL, 0, "");
     clContextLog(C, NULL, 0, "CPUs Available: %d", clTaskLimit());
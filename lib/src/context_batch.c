@@ -0,0 +1,566 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/context.h"
+
+#include "colorist/raw.h"
+#include "colorist/task.h"
+
+#include "cJSON.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+// Inputs at least this big on disk are converted one at a time with every job working on their
+// pixels; smaller ones are spread across the jobs, one file per job. Compressed size is only a rough
+// stand-in for pixel count, but it costs a stat() instead of a decode.
+#define BATCH_LARGE_INPUT_BYTES (2 * 1024 * 1024)
+
+#define BATCH_MAX_ARGS 256
+
+typedef enum clBatchEntryState
+{
+    BATCH_ENTRY_PENDING = 0,
+    BATCH_ENTRY_INVALID // Failed to parse, never runs
+} clBatchEntryState;
+
+typedef struct clBatchEntry
+{
+    int index;            // Line (text manifest) or position (JSON manifest), for messages
+    int argc;
+    char ** argv;         // argv[0] is a stand-in program name, as clContextParseArgs() expects
+    char * storage;       // Owns the argument strings
+    clBatchEntryState state;
+    clAction action;      // As parsed up front
+    clBool large;         // See BATCH_LARGE_INPUT_BYTES
+    clBool explicitJobs;  // The entry chose its own -j
+} clBatchEntry;
+
+typedef struct clBatch
+{
+    clContext * C;
+    clBatchEntry * entries;
+    int count;
+    int capacity;
+
+    const char * manifestFilename;      // NULL when reading stdin
+    int jobs;                           // from the batch command line
+    const char * profileCacheFilename;  // from the batch command line, shared by every entry
+    int jobsPerEntry;                   // while running small entries side by side
+    int nextEntry;                      // claimed with clAtomicIncrement() by the workers
+    int succeeded;
+    int failed;
+} clBatch;
+
+typedef struct clBatchWorker
+{
+    clBatch * batch;
+    clContext * C;
+    clTask * task;
+} clBatchWorker;
+
+// Large conversions, run through clContextConvertPipeline()
+typedef struct clBatchPipeline
+{
+    clBatch * batch;
+    clBatchEntry ** entries;
+    int count;
+} clBatchPipeline;
+
+// Splits line into arguments in place, honoring double quotes. Returns the number of arguments,
+// or -1 if there are more than maxArgs.
+static int splitLine(char * line, char ** args, int maxArgs)
+{
+    int count = 0;
+    char * src = line;
+    while (*src) {
+        while (*src && isspace((unsigned char)*src)) {
+            ++src;
+        }
+        if (!*src) {
+            break;
+        }
+        if (count == maxArgs) {
+            return -1;
+        }
+
+        char * dst = src;
+        args[count++] = dst;
+        clBool quoted = clFalse;
+        while (*src && (quoted || !isspace((unsigned char)*src))) {
+            if (*src == '"') {
+                quoted = !quoted;
+            } else {
+                *dst++ = *src;
+            }
+            ++src;
+        }
+        if (*src) {
+            ++src;
+        }
+        *dst = 0;
+    }
+    return count;
+}
+
+static void addEntry(clBatch * batch, int index, const char ** args, int argCount)
+{
+    clContext * C = batch->C;
+
+    // Allow entries to be pasted straight from a shell, program name and all
+    if ((argCount > 0) && !strcmp(args[0], "colorist")) {
+        ++args;
+        --argCount;
+    }
+    if (argCount == 0) {
+        return;
+    }
+
+    if (batch->count == batch->capacity) {
+        int newCapacity = batch->capacity ? (batch->capacity * 2) : 16;
+        clBatchEntry * newEntries = clAllocate(sizeof(clBatchEntry) * newCapacity);
+        if (batch->entries) {
+            memcpy(newEntries, batch->entries, sizeof(clBatchEntry) * batch->count);
+            clFree(batch->entries);
+        }
+        batch->entries = newEntries;
+        batch->capacity = newCapacity;
+    }
+
+    size_t storageSize = sizeof("colorist");
+    for (int i = 0; i < argCount; ++i) {
+        storageSize += strlen(args[i]) + 1;
+    }
+
+    clBatchEntry * entry = &batch->entries[batch->count++];
+    memset(entry, 0, sizeof(clBatchEntry));
+    entry->index = index;
+    entry->argc = argCount + 1;
+    entry->argv = clAllocate(sizeof(char *) * entry->argc);
+    entry->storage = clAllocate(storageSize);
+
+    char * p = entry->storage;
+    strcpy(p, "colorist");
+    entry->argv[0] = p;
+    p += sizeof("colorist");
+    for (int i = 0; i < argCount; ++i) {
+        size_t len = strlen(args[i]);
+        memcpy(p, args[i], len + 1);
+        entry->argv[i + 1] = p;
+        p += len + 1;
+
+        if (!strcmp(args[i], "-j") || !strcmp(args[i], "--jobs")) {
+            entry->explicitJobs = clTrue;
+        }
+    }
+}
+
+static void freeEntry(clContext * C, clBatchEntry * entry)
+{
+    clFree(entry->argv);
+    clFree(entry->storage);
+}
+
+static clBool addLine(clBatch * batch, int index, char * line)
+{
+    char * args[BATCH_MAX_ARGS];
+    char * firstChar = line;
+    while (*firstChar && isspace((unsigned char)*firstChar)) {
+        ++firstChar;
+    }
+    if (*firstChar == '#') {
+        return clTrue; // comment
+    }
+
+    int argCount = splitLine(line, args, BATCH_MAX_ARGS);
+    if (argCount < 0) {
+        clContextLogError(batch->C, "Batch entry %d has too many arguments (max %d)", index, BATCH_MAX_ARGS);
+        return clFalse;
+    }
+    addEntry(batch, index, (const char **)args, argCount);
+    return clTrue;
+}
+
+// A JSON manifest is an array whose elements are either an array of argument strings, or a single
+// string which is split like a line of a text manifest.
+static clBool parseJSONManifest(clBatch * batch, const char * text)
+{
+    clContext * C = batch->C;
+    clBool ret = clTrue;
+    cJSON * json = cJSON_Parse(text);
+    if (!json || !cJSON_IsArray(json)) {
+        clContextLogError(C, "Batch manifest is not a JSON array: %s", batch->manifestFilename);
+        cJSON_Delete(json);
+        return clFalse;
+    }
+
+    int index = 0;
+    for (cJSON * element = json->child; element != NULL; element = element->next) {
+        ++index;
+        if (cJSON_IsString(element)) {
+            char * line = clContextStrdup(C, element->valuestring);
+            ret = addLine(batch, index, line);
+            clFree(line);
+        } else if (cJSON_IsArray(element)) {
+            const char * args[BATCH_MAX_ARGS];
+            int argCount = 0;
+            for (cJSON * arg = element->child; arg != NULL; arg = arg->next) {
+                if (!cJSON_IsString(arg)) {
+                    clContextLogError(C, "Batch entry %d contains a non-string argument", index);
+                    ret = clFalse;
+                    break;
+                }
+                if (argCount == BATCH_MAX_ARGS) {
+                    clContextLogError(C, "Batch entry %d has too many arguments (max %d)", index, BATCH_MAX_ARGS);
+                    ret = clFalse;
+                    break;
+                }
+                args[argCount++] = arg->valuestring;
+            }
+            if (ret) {
+                addEntry(batch, index, args, argCount);
+            }
+        } else {
+            clContextLogError(C, "Batch entry %d must be a string or an array of strings", index);
+            ret = clFalse;
+        }
+        if (!ret) {
+            break;
+        }
+    }
+    cJSON_Delete(json);
+    return ret;
+}
+
+static clBool parseTextManifest(clBatch * batch, char * text)
+{
+    int index = 0;
+    char * line = text;
+    while (line) {
+        ++index;
+        char * next = strchr(line, '\n');
+        if (next) {
+            *next++ = 0;
+        }
+        if (!addLine(batch, index, line)) {
+            return clFalse;
+        }
+        line = next;
+    }
+    return clTrue;
+}
+
+static clBool loadManifest(clBatch * batch)
+{
+    clContext * C = batch->C;
+    clRaw raw = CL_RAW_EMPTY;
+    if (!clRawReadFile(C, &raw, batch->manifestFilename)) {
+        return clFalse;
+    }
+
+    // NUL terminate a copy so both parsers can treat it as a string
+    char * text = clAllocate(raw.size + 1);
+    if (raw.size > 0) {
+        memcpy(text, raw.ptr, raw.size);
+    }
+    text[raw.size] = 0;
+    clRawFree(C, &raw);
+
+    const char * firstChar = text;
+    while (*firstChar && isspace((unsigned char)*firstChar)) {
+        ++firstChar;
+    }
+    clBool ret = (*firstChar == '[') ? parseJSONManifest(batch, text) : parseTextManifest(batch, text);
+    clFree(text);
+    return ret;
+}
+
+static clBool parseEntry(clContext * W, clBatch * batch, clBatchEntry * entry, int jobs)
+{
+    if (!clContextParseArgs(W, entry->argc, (const char **)entry->argv)) {
+        return clFalse;
+    }
+    if (!entry->explicitJobs) {
+        W->jobs = jobs;
+    }
+    W->profileCacheFilename = batch->profileCacheFilename;
+    return clTrue;
+}
+
+// Parses and runs one entry on W. Everything the entry sets is reset by the next entry's
+// clContextParseArgs(), but W's formats, profile registry, profile cache and LittleCMS context all
+// carry over from entry to entry.
+static clBool runEntry(clContext * W, clBatch * batch, clBatchEntry * entry, int jobs)
+{
+    if (!parseEntry(W, batch, entry, jobs)) {
+        return clFalse;
+    }
+
+    int ret = 1;
+    switch (W->action) {
+        case CL_ACTION_BATCH:
+        case CL_ACTION_SERVE:
+            clContextLogError(W, "Batch entry %d: %s can't run inside a batch", entry->index, clActionToString(W, W->action));
+            break;
+        case CL_ACTION_NONE:
+            clContextLogError(W, "Batch entry %d has no action", entry->index);
+            break;
+        default:
+            ret = clContextRunAction(W, NULL);
+            break;
+    }
+    return (ret == 0) ? clTrue : clFalse;
+}
+
+static void finishEntry(clContext * W, clBatch * batch, clBatchEntry * entry, clBool succeeded, double seconds)
+{
+    if (succeeded) {
+        clAtomicIncrement(&batch->succeeded);
+        clContextLog(W, "batch", 0, "Finished entry %d " TIMING_FORMAT, entry->index, seconds);
+    } else {
+        clAtomicIncrement(&batch->failed);
+        clContextLogError(W, "Batch entry %d failed", entry->index);
+    }
+}
+
+static clBool setupPipelineEntry(clContext * W, int index, void * userData)
+{
+    clBatchPipeline * pipeline = (clBatchPipeline *)userData;
+    return parseEntry(W, pipeline->batch, pipeline->entries[index], pipeline->batch->jobs);
+}
+
+static void finishPipelineEntry(clContext * W, int index, clBool succeeded, double seconds, void * userData)
+{
+    clBatchPipeline * pipeline = (clBatchPipeline *)userData;
+    finishEntry(W, pipeline->batch, pipeline->entries[index], succeeded, seconds);
+}
+
+static void runSmallEntries(void * userData)
+{
+    clBatchWorker * worker = (clBatchWorker *)userData;
+    clBatch * batch = worker->batch;
+    for (;;) {
+        int entryIndex = clAtomicIncrement(&batch->nextEntry) - 1;
+        if (entryIndex >= batch->count) {
+            break;
+        }
+        clBatchEntry * entry = &batch->entries[entryIndex];
+        if (entry->large || (entry->state != BATCH_ENTRY_PENDING)) {
+            continue;
+        }
+
+        Timer t;
+        timerStart(&t);
+        clBool succeeded = runEntry(worker->C, batch, entry, batch->jobsPerEntry);
+        finishEntry(worker->C, batch, entry, succeeded, timerElapsedSeconds(&t));
+    }
+}
+
+// Checks every entry's arguments before anything runs, and sorts out which inputs are large.
+static void classifyEntries(clBatch * batch)
+{
+    clContext * C = batch->C;
+
+    // Warnings are printed again when the entry really runs, only errors are interesting here
+    clContextLogFunc log = C->system.log;
+    C->system.log = clContextSilentLog;
+    for (int i = 0; i < batch->count; ++i) {
+        clBatchEntry * entry = &batch->entries[i];
+        if (!clContextParseArgs(C, entry->argc, (const char **)entry->argv)) {
+            entry->state = BATCH_ENTRY_INVALID;
+            continue;
+        }
+        entry->action = C->action;
+        if (C->inputFilename && (C->action != CL_ACTION_CALC) && (C->action != CL_ACTION_GENERATE)) {
+            entry->large = (clFileSize(C->inputFilename) >= BATCH_LARGE_INPUT_BYTES) ? clTrue : clFalse;
+        }
+    }
+    C->system.log = log;
+
+    for (int i = 0; i < batch->count; ++i) {
+        clBatchEntry * entry = &batch->entries[i];
+        if (entry->state == BATCH_ENTRY_INVALID) {
+            clContextLogError(C, "Batch entry %d has invalid arguments, skipping", entry->index);
+            ++batch->failed;
+        }
+    }
+}
+
+static void runManifest(clBatch * batch)
+{
+    clContext * C = batch->C;
+
+    classifyEntries(batch);
+
+    int smallCount = 0;
+    int largeCount = 0;
+    for (int i = 0; i < batch->count; ++i) {
+        if (batch->entries[i].state == BATCH_ENTRY_PENDING) {
+            if (batch->entries[i].large) {
+                ++largeCount;
+            } else {
+                ++smallCount;
+            }
+        }
+    }
+    clContextLog(C,
+                 "batch",
+                 0,
+                 "%d entries: %d small (side by side), %d large (one at a time)",
+                 batch->count,
+                 smallCount,
+                 largeCount);
+
+    // Small entries: one file per worker, every worker pulling the next entry as it finishes one. The
+    // calling thread is a worker too, reusing C; the rest get contexts of their own, since a context's
+    // profile registry and per-read state aren't shareable across threads.
+    if (smallCount > 0) {
+        int workerCount = CL_MIN(batch->jobs, smallCount);
+        batch->jobsPerEntry = CL_MAX(batch->jobs / workerCount, 1);
+        batch->nextEntry = 0;
+
+        clBatchWorker * workers = clAllocate(sizeof(clBatchWorker) * workerCount);
+        clMutex * logMutex = NULL;
+        if (workerCount > 1) {
+            logMutex = clMutexCreate(C);
+            C->logMutex = logMutex;
+        }
+        workers[0].batch = batch;
+        workers[0].C = C;
+        for (int i = 1; i < workerCount; ++i) {
+            workers[i].batch = batch;
+            workers[i].C = clContextCreate(&C->system);
+            workers[i].C->logMutex = logMutex;
+            workers[i].task = clTaskCreate(C, runSmallEntries, &workers[i]);
+        }
+        runSmallEntries(&workers[0]);
+        for (int i = 1; i < workerCount; ++i) {
+            clTaskDestroy(C, workers[i].task);
+            clContextDestroy(workers[i].C);
+        }
+        if (logMutex) {
+            C->logMutex = NULL;
+            clMutexDestroy(C, logMutex);
+        }
+        clFree(workers);
+    }
+
+    // Large entries: one at a time, with every job on the pixels. Conversions still overlap each
+    // other's stages: one decodes while the one before it transforms and the one before that encodes.
+    clBatchPipeline pipeline;
+    pipeline.batch = batch;
+    pipeline.entries = clAllocate(sizeof(clBatchEntry *) * CL_MAX(largeCount, 1));
+    pipeline.count = 0;
+    for (int i = 0; i < batch->count; ++i) {
+        clBatchEntry * entry = &batch->entries[i];
+        if (entry->large && (entry->state == BATCH_ENTRY_PENDING)) {
+            if (entry->action == CL_ACTION_CONVERT) {
+                pipeline.entries[pipeline.count++] = entry;
+                continue;
+            }
+            Timer t;
+            timerStart(&t);
+            clBool succeeded = runEntry(C, batch, entry, batch->jobs);
+            finishEntry(C, batch, entry, succeeded, timerElapsedSeconds(&t));
+        }
+    }
+    if (pipeline.count > 1) {
+        clContextLog(C, "batch", 0, "Pipelining %d large conversions", pipeline.count);
+        clContextConvertPipeline(C, pipeline.count, setupPipelineEntry, finishPipelineEntry, &pipeline);
+    } else if (pipeline.count == 1) {
+        Timer t;
+        timerStart(&t);
+        clBool succeeded = runEntry(C, batch, pipeline.entries[0], batch->jobs);
+        finishEntry(C, batch, pipeline.entries[0], succeeded, timerElapsedSeconds(&t));
+    }
+    clFree(pipeline.entries);
+}
+
+// Entries streamed over stdin run one at a time as each line arrives, with every job on the pixels.
+static void runStdin(clBatch * batch)
+{
+    clContext * C = batch->C;
+    int lineSize = 1024;
+    char * line = clAllocate(lineSize);
+    int index = 0;
+
+    clContextLog(C, "batch", 0, "Reading entries from stdin");
+    while (fgets(line, lineSize, stdin)) {
+        int len = (int)strlen(line);
+        while ((len == (lineSize - 1)) && (line[len - 1] != '\n')) {
+            // Line didn't fit, grow and keep reading
+            char * bigger = clAllocate(lineSize * 2);
+            memcpy(bigger, line, len + 1);
+            clFree(line);
+            line = bigger;
+            lineSize *= 2;
+            if (!fgets(line + len, lineSize - len, stdin)) {
+                break;
+            }
+            len += (int)strlen(line + len);
+        }
+        ++index;
+
+        int firstEntry = batch->count;
+        if (!addLine(batch, index, line)) {
+            ++batch->failed;
+            continue;
+        }
+        for (int i = firstEntry; i < batch->count; ++i) {
+            clBatchEntry * entry = &batch->entries[i];
+            Timer t;
+            timerStart(&t);
+            clBool succeeded = runEntry(C, batch, entry, batch->jobs);
+            finishEntry(C, batch, entry, succeeded, timerElapsedSeconds(&t));
+            freeEntry(C, entry);
+        }
+        batch->count = firstEntry; // Nothing to keep around once it has run
+        fflush(stdout);
+    }
+    clFree(line);
+}
+
+int clContextBatch(clContext * C)
+{
+    Timer overall;
+    timerStart(&overall);
+
+    clBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.C = C;
+    batch.manifestFilename = C->inputFilename;
+    batch.jobs = C->jobs;
+    batch.profileCacheFilename = C->profileCacheFilename;
+
+    if (batch.manifestFilename) {
+        clContextLog(C, "batch", 0, "Reading manifest: %s", batch.manifestFilename);
+        if (loadManifest(&batch)) {
+            runManifest(&batch);
+        } else {
+            ++batch.failed;
+        }
+    } else {
+        runStdin(&batch);
+    }
+
+    for (int i = 0; i < batch.count; ++i) {
+        freeEntry(C, &batch.entries[i]);
+    }
+    clFree(batch.entries);
+
+    // Entries reset these as they parse; put the batch's own back for whoever looks next
+    C->inputFilename = batch.manifestFilename;
+    C->outputFilename = NULL;
+    C->jobs = batch.jobs;
+    C->profileCacheFilename = batch.profileCacheFilename;
+    C->action = CL_ACTION_BATCH;
+
+    clContextLog(C, "batch", 0, "%d succeeded, %d failed", batch.succeeded, batch.failed);
+    clContextLog(C, "timing", -1, OVERALL_TIMING_FORMAT, timerElapsedSeconds(&overall));
+    return (batch.failed > 0) ? 1 : 0;
+}
@@ -10,16 +10,24 @@
 #include "colorist/image.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/raw.h"
 #include "colorist/task.h"
 
 #include <string.h>
 
-#define FAIL()               \
-    {                        \
-        returnCode = 1;      \
-        goto convertCleanup; \
+#define FAIL()                \
+    {                         \
+        job->failed = clTrue; \
+        goto cleanup;         \
     }
 
+// Pipeline stages hand jobs to each other through queues this deep, which bounds how many decoded
+// images can be waiting on a slower stage
+#define CONVERT_QUEUE_CAPACITY 2
+
+// One job per pipeline stage. With fewer, the stage threads would just fight over the cores.
+#define CONVERT_PIPELINE_MIN_JOBS 3
+
 struct ImageInfo
 {
     int width;
@@ -31,23 +39,27 @@ struct ImageInfo
     int luminance;
 };
 
-int clContextConvert(clContext * C)
+// One image's trip through the conversion. clContextConvert() runs each stage right after the other on
+// one context, clContextConvertPipeline() runs each on its own thread and context.
+typedef struct clConvertJob
 {
-    Timer overall, t;
-    int returnCode = 0;
-
-    // Goals
+    int index;
+    int jobs;                  // The conversion's -j, before the pipeline splits it between stages
+    clBool failed;             // Later stages skip it
+    Timer overall;
+    clConversionParams params; // Copied from the decode stage's context, with formatName resolved
+    clImage * srcImage;        // Only kept past the transform stage when stats need it
+    clImage * dstImage;
+
+    // Copied from the decode stage's C->readExtraInfo, see clReadHint
+    clBool hintApplied;
+    int hintRect[4];
+} clConvertJob;
+
+static void convertDecode(clContext * C, clConvertJob * job)
+{
+    Timer t;
     clImage * srcImage = NULL;
-    clImage * dstImage = NULL;
-    clProfile * dstProfile = NULL;
-
-    // Information about the src&dst images, used to make all decisions
-    struct ImageInfo srcInfo;
-    struct ImageInfo dstInfo;
-
-    // Hald CLUT
-    clImage * haldImage = NULL;
-    int haldDims = 0;
 
     clConversionParams params;
     memcpy(&params, &C->params, sizeof(params));
@@ -56,31 +68,69 @@ int clContextConvert(clContext * C)
         params.formatName = clFormatDetect(C, C->outputFilename);
     if (!params.formatName) {
         clContextLogError(C, "Unknown output file format: %s", C->outputFilename);
-        FAIL();
+        job->failed = clTrue;
+        return;
     }
+    memcpy(&job->params, &params, sizeof(params));
 
-    clContextLog(C, "action", 0, "Convert [%d max threads]: %s -> %s", C->jobs, C->inputFilename, C->outputFilename);
-    timerStart(&overall);
+    clContextLog(C, "action", 0, "Convert [%d max threads]: %s -> %s", job->jobs, C->inputFilename, C->outputFilename);
+    timerStart(&job->overall);
 
-    clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, clFileSize(C->inputFilename));
+    // Read the input once; detection and decoding both work from this copy
+    clRaw input = CL_RAW_EMPTY;
     timerStart(&t);
-    srcImage = clContextRead(C, C->inputFilename, C->iccOverrideIn, NULL);
+    if (!clContextReadInput(C, &input)) {
+        job->failed = clTrue;
+        return;
+    }
+    clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, (int)input.size);
+    // Let the reader skip what the crop (-z) throws away, and decode at a lower resolution when the
+    // resize (--resize) is going to shrink it anyway
+    clReadHint readHint;
+    memcpy(readHint.rect, params.rect, sizeof(readHint.rect));
+    readHint.minWidth = (params.resizeW > 0) ? params.resizeW : 0;
+    readHint.minHeight = (params.resizeH > 0) ? params.resizeH : 0;
+    if ((readHint.minWidth > 0) != (readHint.minHeight > 0)) {
+        // One side is derived from the other and the aspect ratio; keep a pixel of slack for its rounding
+        if (readHint.minWidth > 0) {
+            readHint.minWidth += 1;
+        } else {
+            readHint.minHeight += 1;
+        }
+    }
+    srcImage = clContextReadRaw(C, &input, C->inputFilename, C->iccOverrideIn, NULL, &readHint);
+    clContextFreeInput(C, &input);
     if (srcImage == NULL) {
-        return 1;
+        job->failed = clTrue;
+        return;
     }
     clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
 
-    if (!strcmp(params.formatName, "icc")) {
-        // Just dump out the profile to disk and bail out
+    job->srcImage = srcImage;
+    job->hintApplied = C->readExtraInfo.hintApplied;
+    memcpy(job->hintRect, C->readExtraInfo.hintRect, sizeof(job->hintRect));
+}
 
-        clContextLog(C, "encode", 0, "Writing ICC: %s", C->outputFilename);
-        clProfileDebugDump(C, srcImage->profile, C->verbose, 0);
+// Crop, resize, grade, convert, composite, Hald CLUT and rotate
+static void convertTransform(clContext * C, clConvertJob * job)
+{
+    Timer t;
 
-        if (!clProfileWrite(C, srcImage->profile, C->outputFilename)) {
-            FAIL();
-        }
-        goto convertCleanup;
-    }
+    // Goals
+    clImage * srcImage = job->srcImage;
+    clImage * dstImage = NULL;
+    clProfile * dstProfile = NULL;
+
+    // Information about the src&dst images, used to make all decisions
+    struct ImageInfo srcInfo;
+    struct ImageInfo dstInfo;
+
+    // Hald CLUT
+    clImage * haldImage = NULL;
+    int haldDims = 0;
+
+    clConversionParams params;
+    memcpy(&params, &job->params, sizeof(params));
 
     // Load HALD, if any
     if (params.hald) {
@@ -113,9 +163,28 @@ int clContextConvert(clContext * C)
         }
     }
 
+    // Size of the (cropped) source at full resolution, which the resize below is relative to
+    int regionW = srcImage->width;
+    int regionH = srcImage->height;
+
     int crop[4];
-    memcpy(crop, C->params.rect, 4 * sizeof(int));
-    if (clImageAdjustRect(C, srcImage, &crop[0], &crop[1], &crop[2], &crop[3])) {
+    memcpy(crop, params.rect, 4 * sizeof(int));
+    if (job->hintApplied) {
+        regionW = job->hintRect[2];
+        regionH = job->hintRect[3];
+        if ((regionW != srcImage->width) || (regionH != srcImage->height) || (job->hintRect[0] != 0) || (job->hintRect[1] != 0)) {
+            clContextLog(C,
+                         "crop",
+                         0,
+                         "Decoded +%d+%d %dx%d of the source as %dx%d",
+                         job->hintRect[0],
+                         job->hintRect[1],
+                         regionW,
+                         regionH,
+                         srcImage->width,
+                         srcImage->height);
+        }
+    } else if (clImageAdjustRect(C, srcImage, &crop[0], &crop[1], &crop[2], &crop[3])) {
         timerStart(&t);
         clContextLog(C,
                      "crop",
@@ -129,6 +198,8 @@ int clContextConvert(clContext * C)
                      crop[3]);
         srcImage = clImageCrop(C, srcImage, crop[0], crop[1], crop[2], crop[3], clFalse);
         clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
+        regionW = srcImage->width;
+        regionH = srcImage->height;
     }
 
     // -----------------------------------------------------------------------
@@ -202,11 +273,11 @@ int clContextConvert(clContext * C)
     // Override width and height
     if ((params.resizeW > 0) || (params.resizeH > 0)) {
         if (params.resizeW <= 0) {
-            dstInfo.width = (int)(((float)srcInfo.width / (float)srcInfo.height) * params.resizeH);
+            dstInfo.width = (int)(((float)regionW / (float)regionH) * params.resizeH);
             dstInfo.height = params.resizeH;
         } else if (params.resizeH <= 0) {
             dstInfo.width = params.resizeW;
-            dstInfo.height = (int)(((float)srcInfo.height / (float)srcInfo.width) * params.resizeW);
+            dstInfo.height = (int)(((float)regionH / (float)regionW) * params.resizeW);
         } else {
             dstInfo.width = params.resizeW;
             dstInfo.height = params.resizeH;
@@ -336,13 +407,13 @@ int clContextConvert(clContext * C)
         FAIL();
     }
 
-    if (C->params.compositeFilename) {
+    if (params.compositeFilename) {
         clContextLog(C,
                      "composite",
                      0,
                      "Composition enabled. Reading: %s (%d bytes)",
-                     C->params.compositeFilename,
-                     clFileSize(C->params.compositeFilename));
+                     params.compositeFilename,
+                     clFileSize(params.compositeFilename));
         timerStart(&t);
         clImage * compositeImage = clContextRead(C, params.compositeFilename, NULL, NULL);
         if (compositeImage == NULL) {
@@ -403,19 +474,53 @@ int clContextConvert(clContext * C)
         clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
     }
 
+cleanup:
+    if (dstProfile)
+        clProfileDestroy(C, dstProfile);
+    if (haldImage)
+        clImageDestroy(C, haldImage);
+    if (srcImage && !params.stats && !job->failed) {
+        clImageDestroy(C, srcImage);
+        srcImage = NULL;
+    }
+    job->srcImage = srcImage;
+    job->dstImage = dstImage;
+}
+
+static void convertEncode(clContext * C, clConvertJob * job)
+{
+    Timer t;
+    clImage * srcImage = job->srcImage;
+    clImage * dstImage = job->dstImage;
+
+    clConversionParams params;
+    memcpy(&params, &job->params, sizeof(params));
+
+    if (!strcmp(params.formatName, "icc")) {
+        // Just dump out the profile and bail out
+
+        clContextLog(C, "encode", 0, "Writing ICC: %s", C->outputFilename);
+        clProfileDebugDump(C, srcImage->profile, C->verbose, 0);
+
+        if (!clContextWriteProfile(C, srcImage->profile, C->outputFilename)) {
+            FAIL();
+        }
+        goto cleanup;
+    }
+
     timerStart(&t);
     clContextLogWrite(C, C->outputFilename, params.formatName, &params.writeParams);
     if (!clContextWrite(C, dstImage, C->outputFilename, params.formatName, &params.writeParams)) {
         FAIL();
     }
-    clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(C->outputFilename));
+    clContextLog(C, "encode", 1, "Wrote %d bytes.", clContextOutputSize(C));
     clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
 
     if (params.stats) {
         clContextLog(C, "stats", 0, "Calculating conversion stats...");
         timerStart(&t);
 
-        clImage * convertedImage = clContextRead(C, C->outputFilename, NULL, NULL);
+        clImage * convertedImage = clContextReadOutput(C);
         if (convertedImage) {
             clImageSignals signals;
             if (clImageCalcSignals(C, srcImage, convertedImage, &signals)) {
@@ -423,6 +528,9 @@ int clContextConvert(clContext * C)
                 clContextLog(C, "stats", 1, "PSNR (Lin) : %g", signals.psnrLinear);
                 clContextLog(C, "stats", 1, "MSE  (2.2g): %g", signals.mseG22);
                 clContextLog(C, "stats", 1, "PSNR (2.2g): %g", signals.psnrG22);
+                if (params.ssim) {
+                    clContextLog(C, "stats", 1, "SSIM (2.2g): %g", signals.ssimG22);
+                }
             }
             clImageDestroy(C, convertedImage);
         } else {
@@ -432,19 +540,341 @@ int clContextConvert(clContext * C)
         clContextLog(C, "timing", -1, TIMING_FORMAT, timerElapsedSeconds(&t));
     }
 
-convertCleanup:
-    if (dstProfile)
-        clProfileDestroy(C, dstProfile);
-    if (srcImage)
-        clImageDestroy(C, srcImage);
-    if (dstImage)
-        clImageDestroy(C, dstImage);
-    if (haldImage)
-        clImageDestroy(C, haldImage);
+cleanup:
+    return;
+}
 
-    if (returnCode == 0) {
+// Frees whatever the job still holds. Returns clContextConvert()'s return code.
+static int convertFinish(clContext * C, clConvertJob * job)
+{
+    if (job->srcImage)
+        clImageDestroy(C, job->srcImage);
+    if (job->dstImage)
+        clImageDestroy(C, job->dstImage);
+    job->srcImage = NULL;
+    job->dstImage = NULL;
+
+    if (!job->failed) {
         clContextLog(C, "action", 0, "Conversion complete.");
-        clContextLog(C, "timing", -1, OVERALL_TIMING_FORMAT, timerElapsedSeconds(&overall));
+        clContextLog(C, "timing", -1, OVERALL_TIMING_FORMAT, timerElapsedSeconds(&job->overall));
+        return 0;
+    }
+    return 1;
+}
+
+static clBool convertIsIcc(clConvertJob * job)
+{
+    return (job->params.formatName && !strcmp(job->params.formatName, "icc")) ? clTrue : clFalse;
+}
+
+// Runs every stage of job on C, one after the other
+static void convertRun(clContext * C, clConvertJob * job)
+{
+    job->jobs = C->jobs;
+    convertDecode(C, job);
+    if (!job->failed && !convertIsIcc(job)) {
+        convertTransform(C, job);
+    }
+    if (!job->failed) {
+        convertEncode(C, job);
+    }
+}
+
+int clContextConvert(clContext * C)
+{
+    clConvertJob job;
+    memset(&job, 0, sizeof(job));
+    convertRun(C, &job);
+    return convertFinish(C, &job);
+}
+
+// ---------------------------------------------------------------------------
+// Pipeline
+
+typedef struct clConvertQueue
+{
+    clConvertJob * jobs[CONVERT_QUEUE_CAPACITY];
+    int first;
+    int count;
+    clBool closed; // Nothing more will be pushed
+    clMutex * mutex;
+    clCondition * changed;
+} clConvertQueue;
+
+typedef struct clConvertPipeline
+{
+    clConvertPipelineSetupFunc setup;
+    clConvertPipelineDoneFunc done;
+    void * userData;
+    clConvertQueue decoded;
+    clConvertQueue transformed;
+    int failed; // Only touched by the encode stage
+} clConvertPipeline;
+
+typedef struct clConvertStage
+{
+    clConvertPipeline * pipeline;
+    clContext * C;
+    clTask * task;
+} clConvertStage;
+
+static void queueCreate(clContext * C, clConvertQueue * queue)
+{
+    memset(queue, 0, sizeof(clConvertQueue));
+    queue->mutex = clMutexCreate(C);
+    queue->changed = clConditionCreate(C);
+}
+
+static void queueDestroy(clContext * C, clConvertQueue * queue)
+{
+    COLORIST_ASSERT(queue->count == 0);
+    clConditionDestroy(C, queue->changed);
+    clMutexDestroy(C, queue->mutex);
+}
+
+// Blocks while the queue is full
+static void queuePush(clConvertQueue * queue, clConvertJob * job)
+{
+    clMutexLock(queue->mutex);
+    while (queue->count == CONVERT_QUEUE_CAPACITY) {
+        clConditionWait(queue->changed, queue->mutex);
+    }
+    queue->jobs[(queue->first + queue->count) % CONVERT_QUEUE_CAPACITY] = job;
+    ++queue->count;
+    clConditionBroadcast(queue->changed);
+    clMutexUnlock(queue->mutex);
+}
+
+// Blocks while the queue is empty. Returns NULL once it is empty and closed.
+static clConvertJob * queuePop(clConvertQueue * queue)
+{
+    clConvertJob * job = NULL;
+    clMutexLock(queue->mutex);
+    while ((queue->count == 0) && !queue->closed) {
+        clConditionWait(queue->changed, queue->mutex);
+    }
+    if (queue->count > 0) {
+        job = queue->jobs[queue->first];
+        queue->first = (queue->first + 1) % CONVERT_QUEUE_CAPACITY;
+        --queue->count;
+        clConditionBroadcast(queue->changed);
+    }
+    clMutexUnlock(queue->mutex);
+    return job;
+}
+
+static void queueClose(clConvertQueue * queue)
+{
+    clMutexLock(queue->mutex);
+    queue->closed = clTrue;
+    clConditionBroadcast(queue->changed);
+    clMutexUnlock(queue->mutex);
+}
+
+typedef enum clConvertStageType
+{
+    CONVERT_STAGE_DECODE = 0,
+    CONVERT_STAGE_TRANSFORM,
+    CONVERT_STAGE_ENCODE
+} clConvertStageType;
+
+// Splits a conversion's jobs between the stages. Decoding and encoding are mostly single threaded
+// (or close to it) in every format, while resizing and color conversion scale with jobs.
+static int stageJobs(int jobs, clConvertStageType stage)
+{
+    int edgeJobs = CL_MAX(jobs / 4, 1);
+    if (stage == CONVERT_STAGE_TRANSFORM) {
+        return CL_MAX(jobs - (2 * edgeJobs), 1);
+    }
+    return edgeJobs;
+}
+
+// Runs the pipeline's setup for job on this stage's context. Only the decode stage logs what the setup
+// says (warnings from clContextParseArgs(), etc), the later stages would just repeat it.
+static clBool stageSetup(clConvertStage * stage, clConvertJob * job, clConvertStageType stageType)
+{
+    clContext * C = stage->C;
+    clConvertPipeline * pipeline = stage->pipeline;
+
+    clContextLogFunc log = C->system.log;
+    if (stageType != CONVERT_STAGE_DECODE) {
+        C->system.log = clContextSilentLog;
+    }
+    clBool ret = pipeline->setup(C, job->index, pipeline->userData);
+    C->system.log = log;
+    if (!ret) {
+        return clFalse;
+    }
+    if (C->action != CL_ACTION_CONVERT) {
+        clContextLogError(C, "Pipeline entry %d isn't a conversion", job->index);
+        return clFalse;
+    }
+    if (stageType == CONVERT_STAGE_DECODE) {
+        job->jobs = C->jobs;
+    }
+    C->jobs = stageJobs(job->jobs, stageType);
+    return clTrue;
+}
+
+// A profile can share its LittleCMS handle with clones elsewhere, such as the ones the stage's context
+// interns, which that stage keeps using on the next image. Give the job's images private copies before
+// another stage's thread gets them.
+static void stageHandOff(clContext * C, clConvertJob * job)
+{
+    if (job->srcImage && !clProfileDetach(C, job->srcImage->profile)) {
+        job->failed = clTrue;
+    }
+    if (job->dstImage && !clProfileDetach(C, job->dstImage->profile)) {
+        job->failed = clTrue;
+    }
+}
+
+static void transformStage(void * userData)
+{
+    clConvertStage * stage = (clConvertStage *)userData;
+    clConvertPipeline * pipeline = stage->pipeline;
+    clConvertJob * job;
+    while ((job = queuePop(&pipeline->decoded)) != NULL) {
+        if (!job->failed && !convertIsIcc(job)) {
+            if (stageSetup(stage, job, CONVERT_STAGE_TRANSFORM)) {
+                convertTransform(stage->C, job);
+                stageHandOff(stage->C, job);
+            } else {
+                job->failed = clTrue;
+            }
+        }
+        queuePush(&pipeline->transformed, job);
+    }
+    queueClose(&pipeline->transformed);
+}
+
+static void encodeStage(void * userData)
+{
+    clConvertStage * stage = (clConvertStage *)userData;
+    clConvertPipeline * pipeline = stage->pipeline;
+    clContext * C = stage->C;
+    clConvertJob * job;
+    while ((job = queuePop(&pipeline->transformed)) != NULL) {
+        if (!job->failed) {
+            if (stageSetup(stage, job, CONVERT_STAGE_ENCODE)) {
+                convertEncode(C, job);
+            } else {
+                job->failed = clTrue;
+            }
+        }
+        clBool succeeded = (convertFinish(C, job) == 0) ? clTrue : clFalse;
+        if (!succeeded) {
+            ++pipeline->failed;
+        }
+        if (pipeline->done) {
+            double seconds = (job->overall.start != 0) ? timerElapsedSeconds(&job->overall) : 0.0;
+            pipeline->done(C, job->index, succeeded, seconds, pipeline->userData);
+        }
+        clFree(job);
+    }
+}
+
+// What clContextConvertPipeline() does when there aren't enough jobs to go around: every conversion
+// runs start to finish on C before the next one begins
+static int convertSerially(clContext * C,
+                           int count,
+                           clConvertPipelineSetupFunc setup,
+                           clConvertPipelineDoneFunc done,
+                           void * userData)
+{
+    int failed = 0;
+    int jobs = C->jobs;
+    for (int i = 0; i < count; ++i) {
+        clConvertJob job;
+        memset(&job, 0, sizeof(job));
+        job.index = i;
+        if (!setup(C, i, userData)) {
+            job.failed = clTrue;
+        } else if (C->action != CL_ACTION_CONVERT) {
+            clContextLogError(C, "Pipeline entry %d isn't a conversion", i);
+            job.failed = clTrue;
+        } else {
+            convertRun(C, &job);
+        }
+        clBool succeeded = (convertFinish(C, &job) == 0) ? clTrue : clFalse;
+        if (!succeeded) {
+            ++failed;
+        }
+        if (done) {
+            double seconds = (job.overall.start != 0) ? timerElapsedSeconds(&job.overall) : 0.0;
+            done(C, i, succeeded, seconds, userData);
+        }
+    }
+    C->jobs = jobs;
+    return (failed > 0) ? 1 : 0;
+}
+
+int clContextConvertPipeline(clContext * C,
+                             int count,
+                             clConvertPipelineSetupFunc setup,
+                             clConvertPipelineDoneFunc done,
+                             void * userData)
+{
+    if (C->jobs < CONVERT_PIPELINE_MIN_JOBS) {
+        return convertSerially(C, count, setup, done, userData);
+    }
+
+    clConvertPipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.setup = setup;
+    pipeline.done = done;
+    pipeline.userData = userData;
+    queueCreate(C, &pipeline.decoded);
+    queueCreate(C, &pipeline.transformed);
+
+    // Stages log from their own threads, so they need to take turns
+    clMutex * ownLogMutex = NULL;
+    if (!C->logMutex) {
+        ownLogMutex = clMutexCreate(C);
+        C->logMutex = ownLogMutex;
+    }
+
+    // C decodes on this thread. The other stages get contexts of their own, since a context's profile
+    // registry and per-read state aren't shareable across threads.
+    clConvertStage decoder;
+    clConvertStage transformer;
+    clConvertStage encoder;
+    decoder.pipeline = &pipeline;
+    decoder.C = C;
+    decoder.task = NULL;
+    transformer.pipeline = &pipeline;
+    transformer.C = clContextCreate(&C->system);
+    transformer.C->logMutex = C->logMutex;
+    transformer.task = clTaskCreate(C, transformStage, &transformer);
+    encoder.pipeline = &pipeline;
+    encoder.C = clContextCreate(&C->system);
+    encoder.C->logMutex = C->logMutex;
+    encoder.task = clTaskCreate(C, encodeStage, &encoder);
+
+    int jobs = C->jobs;
+    for (int i = 0; i < count; ++i) {
+        clConvertJob * job = clAllocateStruct(clConvertJob);
+        job->index = i;
+        if (stageSetup(&decoder, job, CONVERT_STAGE_DECODE)) {
+            convertDecode(C, job);
+            stageHandOff(C, job);
+        } else {
+            job->failed = clTrue;
+        }
+        queuePush(&pipeline.decoded, job);
+    }
+    queueClose(&pipeline.decoded);
+
+    clTaskDestroy(C, transformer.task);
+    clTaskDestroy(C, encoder.task);
+    clContextDestroy(transformer.C);
+    clContextDestroy(encoder.C);
+    C->jobs = jobs;
+    if (ownLogMutex) {
+        C->logMutex = NULL;
+        clMutexDestroy(C, ownLogMutex);
     }
-    return returnCode;
+    queueDestroy(C, &pipeline.decoded);
+    queueDestroy(C, &pipeline.transformed);
+    return (pipeline.failed > 0) ? 1 : 0;
 }
@@ -12,41 +12,101 @@
 #include <string.h>
 
 clBool clFormatDetectAVIF(struct clContext * C, struct clFormat * format, struct clRaw * input);
-struct clImage * clFormatReadAVIF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadAVIF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteAVIF(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
                          struct clRaw * output,
                          struct clWriteParams * writeParams);
+void * clFormatReadSequenceBeginAVIF(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount);
+struct clImage * clFormatReadSequenceFrameAVIF(struct clContext * C, void * sequenceState, double * outDuration);
+void clFormatReadSequenceEndAVIF(struct clContext * C, void * sequenceState);
+clBool clFormatWriteSequenceAVIF(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadBMP(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadBMP(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteBMP(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJPG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJP2(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadJXR(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJXR(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJXR(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadPNG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadTIFF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteTIFF(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
                          struct clRaw * output,
                          struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadWebP(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadWebP(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteWebP(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
                          struct clRaw * output,
                          struct clWriteParams * writeParams);
+void * clFormatReadSequenceBeginWebP(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount);
+struct clImage * clFormatReadSequenceFrameWebP(struct clContext * C, void * sequenceState, double * outDuration);
+void clFormatReadSequenceEndWebP(struct clContext * C, void * sequenceState);
+clBool clFormatWriteSequenceWebP(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams);
 
 static clBool detectFormatSignature(struct clContext * C, struct clFormat * format, struct clRaw * input)
 {
@@ -87,6 +147,10 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.detectFunc = clFormatDetectAVIF;
         format.readFunc = clFormatReadAVIF;
         format.writeFunc = clFormatWriteAVIF;
+        format.readSequenceBeginFunc = clFormatReadSequenceBeginAVIF;
+        format.readSequenceFrameFunc = clFormatReadSequenceFrameAVIF;
+        format.readSequenceEndFunc = clFormatReadSequenceEndAVIF;
+        format.writeSequenceFunc = clFormatWriteSequenceAVIF;
         clContextRegisterFormat(C, &format);
     }
 
@@ -268,6 +332,10 @@ void clContextRegisterBuiltinFormats(struct clContext * C)
         format.detectFunc = detectFormatSignature;
         format.readFunc = clFormatReadWebP;
         format.writeFunc = clFormatWriteWebP;
+        format.readSequenceBeginFunc = clFormatReadSequenceBeginWebP;
+        format.readSequenceFrameFunc = clFormatReadSequenceFrameWebP;
+        format.readSequenceEndFunc = clFormatReadSequenceEndWebP;
+        format.writeSequenceFunc = clFormatWriteSequenceWebP;
         clContextRegisterFormat(C, &format);
     }
 }
@@ -166,7 +166,7 @@ int clContextGenerate(clContext * C, struct cJSON * output)
     } else {
         clContextLog(C, action, 0, "Writing ICC: %s", C->outputFilename);
         clProfileDebugDump(C, dstProfile, C->verbose, 0);
-        if (!clProfileWrite(C, dstProfile, C->outputFilename)) {
+        if (!clContextWriteProfile(C, dstProfile, C->outputFilename)) {
             clProfileDestroy(C, dstProfile);
             return 1;
         }
@@ -174,7 +174,7 @@ int clContextGenerate(clContext * C, struct cJSON * output)
 
     clProfileDestroy(C, dstProfile);
     if (C->outputFilename) {
-        clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(C->outputFilename));
+        clContextLog(C, "encode", 1, "Wrote %d bytes.", clContextOutputSize(C));
         clContextLog(C, "action", 0, "Generation complete (%g sec).", timerElapsedSeconds(&overall));
     } else {
         clContextLog(C, "action", 0, "Calc complete (%g sec).", timerElapsedSeconds(&overall));
@@ -9,6 +9,7 @@
 
 #include "colorist/image.h"
 #include "colorist/profile.h"
+#include "colorist/raw.h"
 
 #include "cJSON.h"
 
@@ -18,21 +19,30 @@ int clContextHighlight(clContext * C)
 {
     COLORIST_UNUSED(C);
 
+    // Read the input once; detection and decoding both work from this copy
+    clRaw input = CL_RAW_EMPTY;
+    if (!clContextReadInput(C, &input)) {
+        return 1;
+    }
+
     const char * formatName = C->params.formatName;
     if (!formatName)
-        formatName = clFormatDetect(C, C->inputFilename);
+        formatName = clFormatDetectRaw(C, C->inputFilename, &input);
     if (!formatName) {
         clContextLogError(C, "Unknown file format: %s", C->inputFilename);
+        clContextFreeInput(C, &input);
         return 1;
     }
     if (!strcmp(formatName, "icc")) {
         clContextLogError(C, "Highlights cannot output to ICC.");
+        clContextFreeInput(C, &input);
         return 1;
     }
 
     clContextLog(C, "action", 0, "Highlight: %s", C->inputFilename);
-    clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, clFileSize(C->inputFilename));
-    clImage * image = clContextRead(C, C->inputFilename, C->iccOverrideIn, &formatName);
+    clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, (int)input.size);
+    clImage * image = clContextReadRaw(C, &input, C->inputFilename, C->iccOverrideIn, &formatName, NULL);
+    clContextFreeInput(C, &input);
     int ret = 1;
     if (image) {
         clImageDebugDump(C, image, 0, 0, 0, 0, 1);
@@ -76,7 +86,7 @@ int clContextHighlight(clContext * C)
             clContextLogWrite(C, C->outputFilename, params.formatName, &params.writeParams);
             if (clContextWrite(C, highlight, C->outputFilename, params.formatName, &params.writeParams)) {
                 ret = 0;
-                clContextLog(C, "encode", 1, "Wrote %d bytes.", clFileSize(C->outputFilename));
+                clContextLog(C, "encode", 1, "Wrote %d bytes.", clContextOutputSize(C));
             }
 
             clImageDestroy(C, highlight);
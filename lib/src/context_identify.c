@@ -9,6 +9,7 @@
 
 #include "colorist/image.h"
 #include "colorist/profile.h"
+#include "colorist/raw.h"
 
 #include "cJSON.h"
 
@@ -16,17 +17,24 @@
 
 int clContextIdentify(clContext * C, struct cJSON * output)
 {
+    // Read the input once; detection and decoding both work from this copy
+    clRaw input = CL_RAW_EMPTY;
+    if (!clContextReadInput(C, &input)) {
+        return 1;
+    }
+
     const char * formatName = C->params.formatName;
     if (!formatName)
-        formatName = clFormatDetect(C, C->inputFilename);
+        formatName = clFormatDetectRaw(C, C->inputFilename, &input);
     if (!formatName) {
         clContextLogError(C, "Unknown file format: %s", C->inputFilename);
+        clContextFreeInput(C, &input);
         return 1;
     }
 
     clContextLog(C, "action", 0, "Identify: %s", C->inputFilename);
     if (!strcmp(formatName, "icc")) {
-        clProfile * profile = clProfileRead(C, C->inputFilename);
+        clProfile * profile = clProfileParse(C, input.ptr, input.size, NULL);
         if (profile) {
             clContextLog(C, "identify", 1, "Format: %s", formatName);
             if (output) {
@@ -37,8 +45,8 @@ int clContextIdentify(clContext * C, struct cJSON * output)
             clProfileDestroy(C, profile);
         }
     } else {
-        clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, clFileSize(C->inputFilename));
-        clImage * image = clContextRead(C, C->inputFilename, C->iccOverrideIn, &formatName);
+        clContextLog(C, "decode", 0, "Reading: %s (%d bytes)", C->inputFilename, (int)input.size);
+        clImage * image = clContextReadRaw(C, &input, C->inputFilename, C->iccOverrideIn, &formatName, NULL);
         if (image) {
             int rect[4];
             memcpy(rect, C->params.rect, sizeof(rect));
@@ -56,5 +64,6 @@ int clContextIdentify(clContext * C, struct cJSON * output)
             clImageDestroy(C, image);
         }
     }
+    clContextFreeInput(C, &input);
     return 0;
 }
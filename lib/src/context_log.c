@@ -7,6 +7,8 @@
 
 #include "colorist/context.h"
 
+#include "colorist/task.h"
+
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -100,11 +102,33 @@ void clContextDefaultLogError(clContext * C, const char * format, va_list args)
 
 #endif /* ifdef COLORIST_EMSCRIPTEN */
 
+void clContextSilentLog(clContext * C, const char * section, int indent, const char * format, va_list args)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(section);
+    COLORIST_UNUSED(indent);
+    COLORIST_UNUSED(format);
+    COLORIST_UNUSED(args);
+}
+
+void clContextSilentLogError(clContext * C, const char * format, va_list args)
+{
+    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(format);
+    COLORIST_UNUSED(args);
+}
+
 void clContextLog(clContext * C, const char * section, int indent, const char * format, ...)
 {
     va_list args;
     va_start(args, format);
+    if (C->logMutex) {
+        clMutexLock(C->logMutex);
+    }
     C->system.log(C, section, indent, format, args);
+    if (C->logMutex) {
+        clMutexUnlock(C->logMutex);
+    }
     va_end(args);
 }
 
@@ -112,7 +136,13 @@ void clContextLogError(clContext * C, const char * format, ...)
 {
     va_list args;
     va_start(args, format);
+    if (C->logMutex) {
+        clMutexLock(C->logMutex);
+    }
     C->system.error(C, format, args);
+    if (C->logMutex) {
+        clMutexUnlock(C->logMutex);
+    }
     va_end(args);
 }
 
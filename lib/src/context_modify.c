@@ -8,6 +8,7 @@
 #include "colorist/context.h"
 
 #include "colorist/profile.h"
+#include "colorist/raw.h"
 
 #include <string.h>
 
@@ -15,7 +16,12 @@ int clContextModify(clContext * C)
 {
     clContextLog(C, "action", 0, "Modify: %s -> %s", C->inputFilename, C->outputFilename);
 
-    clProfile * profile = clProfileRead(C, C->inputFilename);
+    clProfile * profile = NULL;
+    clRaw input = CL_RAW_EMPTY;
+    if (clContextReadInput(C, &input)) {
+        profile = clProfileParse(C, input.ptr, input.size, NULL);
+        clContextFreeInput(C, &input);
+    }
     if (!profile) {
         clContextLogError(C, "Cannot parse ICC profile: %s", C->inputFilename);
         goto cleanup;
@@ -80,7 +86,7 @@ int clContextModify(clContext * C)
     clContextLog(C, "modify", 0, "Writing profile: %s", C->outputFilename);
     clProfileDebugDump(C, profile, clTrue, 0);
 
-    if (!clProfileWrite(C, profile, C->outputFilename)) {
+    if (!clContextWriteProfile(C, profile, C->outputFilename)) {
         clContextLogError(C, "Cannot write ICC profile: %s", C->outputFilename);
         goto cleanup;
     }
@@ -13,11 +13,95 @@
 #include <stdio.h>
 #include <string.h>
 
+clBool clReadHintRect(struct clContext * C, const clReadHint * hint, int width, int height, int outRect[4])
+{
+    COLORIST_UNUSED(C);
+
+    outRect[0] = 0;
+    outRect[1] = 0;
+    outRect[2] = width;
+    outRect[3] = height;
+    if (!hint || (hint->rect[0] < 0) || (hint->rect[1] < 0) || (hint->rect[2] <= 0) || (hint->rect[3] <= 0)) {
+        return clFalse;
+    }
+
+    // Same clamping as clImageAdjustRect()
+    int x = CL_MIN(hint->rect[0], width - 1);
+    int y = CL_MIN(hint->rect[1], height - 1);
+    outRect[0] = x;
+    outRect[1] = y;
+    outRect[2] = CL_MIN(x + hint->rect[2], width) - x;
+    outRect[3] = CL_MIN(y + hint->rect[3], height) - y;
+    return clTrue;
+}
+
+static int reducedExtent(int origin, int size, int reduction)
+{
+    int scale = 1 << reduction;
+    return ((origin + size + scale - 1) >> reduction) - ((origin + scale - 1) >> reduction);
+}
+
+int clReadHintReduction(struct clContext * C,
+                        const clReadHint * hint,
+                        int rectX,
+                        int rectY,
+                        int rectW,
+                        int rectH,
+                        int maxReduction)
+{
+    COLORIST_UNUSED(C);
+
+    if (!hint || ((hint->minWidth <= 0) && (hint->minHeight <= 0))) {
+        return 0;
+    }
+
+    int reduction = 0;
+    while (reduction < maxReduction) {
+        int next = reduction + 1;
+        int reducedW = reducedExtent(rectX, rectW, next);
+        int reducedH = reducedExtent(rectY, rectH, next);
+        if ((reducedW < hint->minWidth) || (reducedH < hint->minHeight)) {
+            break;
+        }
+        reduction = next;
+    }
+    return reduction;
+}
+
 struct clImage * clContextRead(clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName)
+{
+    return clContextReadWithHint(C, filename, iccOverride, outFormatName, NULL);
+}
+
+struct clImage * clContextReadWithHint(clContext * C,
+                                       const char * filename,
+                                       const char * iccOverride,
+                                       const char ** outFormatName,
+                                       const clReadHint * hint)
+{
+    if (outFormatName)
+        *outFormatName = NULL;
+
+    // One read of the file serves both format detection and decoding
+    clRaw input = CL_RAW_EMPTY;
+    if (!clRawReadFile(C, &input, filename)) {
+        return NULL;
+    }
+    clImage * image = clContextReadRaw(C, &input, filename, iccOverride, outFormatName, hint);
+    clRawFree(C, &input);
+    return image;
+}
+
+struct clImage * clContextReadRaw(clContext * C,
+                                  struct clRaw * input,
+                                  const char * filename,
+                                  const char * iccOverride,
+                                  const char ** outFormatName,
+                                  const clReadHint * hint)
 {
     clImage * image = NULL;
     clFormat * format;
-    const char * formatName = clFormatDetect(C, filename);
+    const char * formatName = clFormatDetectRaw(C, filename, input);
     if (outFormatName)
         *outFormatName = formatName;
     if (!formatName) {
@@ -39,18 +123,13 @@ struct clImage * clContextRead(clContext * C, const char * filename, const char
         }
     }
 
-    clRaw input = CL_RAW_EMPTY;
-    if (!clRawReadFile(C, &input, filename)) {
-        return clFalse;
-    }
-
     // Clear this out, only some of the format readers actually populate anything in here
     memset(&C->readExtraInfo, 0, sizeof(C->readExtraInfo));
 
     format = clContextFindFormat(C, formatName);
     COLORIST_ASSERT(format);
     if (format->readFunc) {
-        image = format->readFunc(C, formatName, overrideProfile, &input);
+        image = format->readFunc(C, formatName, overrideProfile, input, hint);
     } else {
         clContextLogError(C, "Unimplemented file reader '%s'", formatName);
     }
@@ -74,10 +153,50 @@ struct clImage * clContextRead(clContext * C, const char * filename, const char
             overrideProfile = NULL;
         }
     }
-    clRawFree(C, &input);
     return image;
 }
 
+clBool clContextReadInput(clContext * C, struct clRaw * input)
+{
+    if (C->inputRaw) {
+        // Borrowed, clContextFreeInput() leaves it alone
+        input->ptr = C->inputRaw->ptr;
+        input->size = C->inputRaw->size;
+        return clTrue;
+    }
+    return clRawReadFile(C, input, C->inputFilename);
+}
+
+void clContextFreeInput(clContext * C, struct clRaw * input)
+{
+    if (C->inputRaw && (input->ptr == C->inputRaw->ptr)) {
+        input->ptr = NULL;
+        input->size = 0;
+        return;
+    }
+    clRawFree(C, input);
+}
+
+int clContextOutputSize(clContext * C)
+{
+    if (C->outputRaw) {
+        return (int)C->outputRaw->size;
+    }
+    return clFileSize(C->outputFilename);
+}
+
+clBool clContextWriteOutput(clContext * C, struct clRaw * output, const char * filename)
+{
+    if (C->outputRaw) {
+        clRawFree(C, C->outputRaw);
+        *C->outputRaw = *output;
+        output->ptr = NULL;
+        output->size = 0;
+        return clTrue;
+    }
+    return clRawWriteFile(C, output, filename);
+}
+
 clBool clContextWrite(clContext * C, struct clImage * image, const char * filename, const char * formatName, clWriteParams * writeParams)
 {
     clBool result = clFalse;
@@ -93,10 +212,13 @@ clBool clContextWrite(clContext * C, struct clImage * image, const char * filena
     clFormat * format = clContextFindFormat(C, formatName);
     COLORIST_ASSERT(format);
 
+    // Clear this out, only some of the format writers actually populate anything in here
+    memset(&C->writeExtraInfo, 0, sizeof(C->writeExtraInfo));
+
     if (format->writeFunc) {
         clRaw output = CL_RAW_EMPTY;
         if (format->writeFunc(C, image, formatName, &output, writeParams)) {
-            if (clRawWriteFile(C, &output, filename)) {
+            if (clContextWriteOutput(C, &output, filename)) {
                 result = clTrue;
             }
         }
@@ -107,6 +229,84 @@ clBool clContextWrite(clContext * C, struct clImage * image, const char * filena
     return result;
 }
 
+clBool clContextWriteSequence(clContext * C,
+                              struct clImage ** frames,
+                              const double * durations,
+                              int frameCount,
+                              const char * filename,
+                              const char * formatName,
+                              clWriteParams * writeParams)
+{
+    if (frameCount < 1) {
+        clContextLogError(C, "No frames to write: %s", filename);
+        return clFalse;
+    }
+
+    if (formatName == NULL) {
+        formatName = clFormatDetect(C, filename);
+        if (formatName == NULL) {
+            clContextLogError(C, "Unknown output file format '%s', please specify with -f", filename);
+            return clFalse;
+        }
+    }
+
+    clFormat * format = clContextFindFormat(C, formatName);
+    COLORIST_ASSERT(format);
+
+    if (!format->writeSequenceFunc) {
+        if (frameCount == 1) {
+            return clContextWrite(C, frames[0], filename, formatName, writeParams);
+        }
+        clContextLogError(C, "File writer '%s' can't write multiple frames", formatName);
+        return clFalse;
+    }
+
+    memset(&C->writeExtraInfo, 0, sizeof(C->writeExtraInfo));
+
+    for (int frameIndex = 1; frameIndex < frameCount; ++frameIndex) {
+        if ((frames[frameIndex]->width != frames[0]->width) || (frames[frameIndex]->height != frames[0]->height)) {
+            clContextLogError(C,
+                              "Frame %d is %dx%d, expected %dx%d",
+                              frameIndex,
+                              frames[frameIndex]->width,
+                              frames[frameIndex]->height,
+                              frames[0]->width,
+                              frames[0]->height);
+            return clFalse;
+        }
+    }
+
+    clBool result = clFalse;
+    clRaw output = CL_RAW_EMPTY;
+    if (format->writeSequenceFunc(C, frames, durations, frameCount, formatName, &output, writeParams)) {
+        if (clContextWriteOutput(C, &output, filename)) {
+            result = clTrue;
+        }
+    }
+    clRawFree(C, &output);
+    return result;
+}
+
+clBool clContextWriteProfile(clContext * C, struct clProfile * profile, const char * filename)
+{
+    clRaw output = CL_RAW_EMPTY;
+    if (!clProfilePack(C, profile, &output)) {
+        clContextLogError(C, "Can't pack ICC profile");
+        return clFalse;
+    }
+    clBool result = clContextWriteOutput(C, &output, filename);
+    clRawFree(C, &output);
+    return result;
+}
+
+clImage * clContextReadOutput(clContext * C)
+{
+    if (C->outputRaw) {
+        return clContextReadRaw(C, C->outputRaw, C->outputFilename, NULL, NULL, NULL);
+    }
+    return clContextRead(C, C->outputFilename, NULL, NULL);
+}
+
 char * clContextWriteURI(struct clContext * C, clImage * image, const char * formatName, clWriteParams * writeParams)
 {
     char * output = NULL;
@@ -0,0 +1,653 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+// lstat() and S_ISSOCK() are hidden by -std=c99 otherwise
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "colorist/context.h"
+
+#include "colorist/profile.h"
+#include "colorist/raw.h"
+
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Protocol: every message, in either direction, is one line of JSON (a header) followed by however
+// many raw bytes the header announces.
+//
+// Request header:
+//     "args"         : colorist command line without the program name, e.g. ["convert", "a.png", "b.jpg", "-q", "80"]
+//     "cwd"          : (optional) directory relative paths in args are opened from
+//     "inputSize"    : (optional) this many bytes of input follow, read instead of the input filename
+//     "returnOutput" : (optional) send the encoded image back instead of writing the output filename
+//     "shutdown"     : (optional) stop the server after replying
+// Input and output filenames are still needed with inputSize / returnOutput, as they pick the formats.
+//
+// Response header:
+//     "ok"           : whether the action succeeded
+//     "log"          : every log line, as [section, indent, text]
+//     "errors"       : every error message
+//     "output"       : JSON result, for identify/calc requests with --json
+//     "stats"        : {"seconds", "decodeSeconds", "encodeSeconds"}
+//     "outputSize"   : this many bytes of output follow
+
+#define SERVE_MAX_HEADER_SIZE (1024 * 1024)
+#define SERVE_MAX_PAYLOAD_SIZE (1024.0 * 1024.0 * 1024.0) // inputSize / outputSize
+
+#if defined(_WIN32) || defined(COLORIST_EMSCRIPTEN)
+
+int clContextServe(clContext * C)
+{
+    clContextLogError(C, "serve is not supported on this platform");
+    return 1;
+}
+
+int clContextServeRequest(clContext * C,
+                          const char * socketFilename,
+                          int argc,
+                          const char ** argv,
+                          struct clRaw * input,
+                          struct clRaw * output,
+                          struct cJSON * response)
+{
+    COLORIST_UNUSED(socketFilename);
+    COLORIST_UNUSED(argc);
+    COLORIST_UNUSED(argv);
+    COLORIST_UNUSED(input);
+    COLORIST_UNUSED(output);
+    COLORIST_UNUSED(response);
+    clContextLogError(C, "--server is not supported on this platform");
+    return 1;
+}
+
+int clContextServeShutdown(clContext * C, const char * socketFilename)
+{
+    COLORIST_UNUSED(socketFilename);
+    clContextLogError(C, "--server is not supported on this platform");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SERVE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SERVE_SEND_FLAGS 0
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Socket I/O
+
+typedef struct clServeStream
+{
+    int fd;
+    uint8_t buffer[4096]; // Bytes read past the end of a header belong to the payload
+    size_t pos;
+    size_t end;
+} clServeStream;
+
+static clBool streamFill(clServeStream * stream)
+{
+    for (;;) {
+        ssize_t bytesRead = recv(stream->fd, stream->buffer, sizeof(stream->buffer), 0);
+        if (bytesRead > 0) {
+            stream->pos = 0;
+            stream->end = (size_t)bytesRead;
+            return clTrue;
+        }
+        if ((bytesRead < 0) && (errno == EINTR)) {
+            continue;
+        }
+        return clFalse;
+    }
+}
+
+// Reads a newline terminated header into a NUL terminated string. Returns NULL at the end of the
+// stream, or if the header is unreasonably large.
+static char * streamReadHeader(clContext * C, clServeStream * stream)
+{
+    size_t capacity = 1024;
+    size_t size = 0;
+    char * header = clAllocate(capacity);
+    for (;;) {
+        if ((stream->pos == stream->end) && !streamFill(stream)) {
+            clFree(header);
+            return NULL;
+        }
+        char c = (char)stream->buffer[stream->pos++];
+        if (c == '\n') {
+            header[size] = 0;
+            return header;
+        }
+        if ((size + 1) == capacity) {
+            if (capacity >= SERVE_MAX_HEADER_SIZE) {
+                clFree(header);
+                return NULL;
+            }
+            char * bigger = clAllocate(capacity * 2);
+            memcpy(bigger, header, size);
+            clFree(header);
+            header = bigger;
+            capacity *= 2;
+        }
+        header[size++] = c;
+    }
+}
+
+static clBool streamRead(clServeStream * stream, uint8_t * dst, size_t size)
+{
+    while (size > 0) {
+        if ((stream->pos == stream->end) && !streamFill(stream)) {
+            return clFalse;
+        }
+        size_t available = stream->end - stream->pos;
+        size_t bytesToCopy = (available < size) ? available : size;
+        memcpy(dst, stream->buffer + stream->pos, bytesToCopy);
+        stream->pos += bytesToCopy;
+        dst += bytesToCopy;
+        size -= bytesToCopy;
+    }
+    return clTrue;
+}
+
+// Reads a header's announced payload into payload, if item is a sensible size. A bad size or a failed
+// allocation leaves the stream out of step with the messages, so the connection has to close after.
+static clBool streamReadPayload(clContext * C, clServeStream * stream, cJSON * item, const char * name, clRaw * payload)
+{
+    if (!item) {
+        return clTrue;
+    }
+    double size = cJSON_IsNumber(item) ? item->valuedouble : -1.0;
+    if ((size < 0.0) || (size > SERVE_MAX_PAYLOAD_SIZE) || (size != floor(size))) {
+        clContextLogError(C, "Invalid %s (must be a whole number of bytes, at most %.0f)", name, SERVE_MAX_PAYLOAD_SIZE);
+        return clFalse;
+    }
+    if (size == 0.0) {
+        return clTrue;
+    }
+    clRawRealloc(C, payload, (size_t)size);
+    if (!payload->ptr) {
+        clContextLogError(C, "Can't allocate %.0f bytes for %s", size, name);
+        payload->size = 0;
+        return clFalse;
+    }
+    if (!streamRead(stream, payload->ptr, payload->size)) {
+        clContextLogError(C, "Truncated payload, expected %.0f bytes", size);
+        clRawFree(C, payload);
+        return clFalse;
+    }
+    return clTrue;
+}
+
+static clBool sendAll(int fd, const uint8_t * src, size_t size)
+{
+    while (size > 0) {
+        ssize_t bytesSent = send(fd, src, size, SERVE_SEND_FLAGS);
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return clFalse;
+        }
+        src += bytesSent;
+        size -= (size_t)bytesSent;
+    }
+    return clTrue;
+}
+
+static clBool sendMessage(int fd, cJSON * header, const clRaw * payload)
+{
+    char * text = cJSON_PrintUnformatted(header);
+    if (!text) {
+        return clFalse;
+    }
+    clBool ret = sendAll(fd, (const uint8_t *)text, strlen(text)) && sendAll(fd, (const uint8_t *)"\n", 1);
+    free(text);
+    if (ret && payload && (payload->size > 0)) {
+        ret = sendAll(fd, payload->ptr, payload->size);
+    }
+    return ret;
+}
+
+static clBool fillAddress(clContext * C, struct sockaddr_un * address, const char * socketFilename)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socketFilename) >= sizeof(address->sun_path)) {
+        clContextLogError(C, "Socket path is too long (max %d bytes): %s", (int)sizeof(address->sun_path) - 1, socketFilename);
+        return clFalse;
+    }
+    strcpy(address->sun_path, socketFilename);
+    return clTrue;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Server
+
+// While a request runs, the server context's log and errors are collected here to send back with the
+// response. Only one clContextServe() can run per process.
+static cJSON * capturedLog = NULL;
+static cJSON * capturedErrors = NULL;
+
+static char * formatMessage(clContext * C, const char * format, va_list args)
+{
+    va_list sizeArgs;
+    va_copy(sizeArgs, args);
+    int needed = vsnprintf(NULL, 0, format, sizeArgs);
+    va_end(sizeArgs);
+    if (needed < 0) {
+        needed = 0;
+    }
+    char * text = clAllocate(needed + 1);
+    vsnprintf(text, needed + 1, format, args);
+    return text;
+}
+
+static void serveCaptureLog(clContext * C, const char * section, int indent, const char * format, va_list args)
+{
+    char * text = formatMessage(C, format, args);
+    cJSON * line = cJSON_CreateArray();
+    cJSON_AddItemToArray(line, section ? cJSON_CreateString(section) : cJSON_CreateNull());
+    cJSON_AddItemToArray(line, cJSON_CreateNumber(indent));
+    cJSON_AddItemToArray(line, cJSON_CreateString(text));
+    cJSON_AddItemToArray(capturedLog, line);
+    clFree(text);
+}
+
+static void serveCaptureError(clContext * C, const char * format, va_list args)
+{
+    char * text = formatMessage(C, format, args);
+    cJSON_AddItemToArray(capturedErrors, cJSON_CreateString(text));
+    clFree(text);
+}
+
+typedef struct clServeSettings
+{
+    int jobs;
+    const char * profileCacheFilename;
+    char cwd[PATH_MAX];
+} clServeSettings;
+
+static int runRequest(clContext * C, clServeSettings * settings, cJSON * request, cJSON * output)
+{
+    cJSON * args = cJSON_GetObjectItem(request, "args");
+    if (!cJSON_IsArray(args) || (cJSON_GetArraySize(args) < 1)) {
+        clContextLogError(C, "Request has no args");
+        return 1;
+    }
+
+    int argc = cJSON_GetArraySize(args) + 1;
+    const char ** argv = clAllocate(sizeof(const char *) * argc);
+    argv[0] = "colorist";
+    clBool explicitJobs = clFalse;
+    clBool wantsJSON = clFalse;
+    int argIndex = 1;
+    for (cJSON * arg = args->child; arg != NULL; arg = arg->next) {
+        if (!cJSON_IsString(arg)) {
+            clContextLogError(C, "Request args must all be strings");
+            clFree((void *)argv);
+            return 1;
+        }
+        argv[argIndex++] = arg->valuestring;
+        if (!strcmp(arg->valuestring, "-j") || !strcmp(arg->valuestring, "--jobs")) {
+            explicitJobs = clTrue;
+        } else if (!strcmp(arg->valuestring, "--json")) {
+            wantsJSON = clTrue;
+        }
+    }
+
+    int ret = 1;
+    if (clContextParseArgs(C, argc, argv)) {
+        if (!explicitJobs) {
+            C->jobs = settings->jobs;
+        }
+        C->profileCacheFilename = settings->profileCacheFilename;
+        switch (C->action) {
+            case CL_ACTION_BATCH:
+            case CL_ACTION_SERVE:
+                clContextLogError(C, "%s can't be requested from a server", clActionToString(C, C->action));
+                break;
+            default:
+                ret = clContextRunAction(C, wantsJSON ? output : NULL);
+                break;
+        }
+    }
+    clFree((void *)argv);
+    return ret;
+}
+
+// Handles one request from stream. Returns clFalse once the connection should close.
+static clBool serveRequest(clContext * C, clServeSettings * settings, clServeStream * stream, clBool * outShutdown)
+{
+    char * headerText = streamReadHeader(C, stream);
+    if (!headerText) {
+        return clFalse;
+    }
+    cJSON * request = cJSON_Parse(headerText);
+    clFree(headerText);
+    if (!request) {
+        clContextLogError(C, "Malformed request header, closing connection");
+        return clFalse;
+    }
+
+    Timer t;
+    timerStart(&t);
+
+    clBool keepGoing = clTrue;
+    clRaw input = CL_RAW_EMPTY;
+    if (!streamReadPayload(C, stream, cJSON_GetObjectItem(request, "inputSize"), "inputSize", &input)) {
+        // Tell the client why before hanging up on it
+        cJSON * response = cJSON_CreateObject();
+        cJSON_AddBoolToObject(response, "ok", 0);
+        cJSON * errors = cJSON_AddArrayToObject(response, "errors");
+        cJSON_AddItemToArray(errors, cJSON_CreateString("Invalid or unreadable input payload"));
+        sendMessage(stream->fd, response, NULL);
+        cJSON_Delete(response);
+        cJSON_Delete(request);
+        return clFalse;
+    }
+    clRaw output = CL_RAW_EMPTY;
+    cJSON * returnOutput = cJSON_GetObjectItem(request, "returnOutput");
+    cJSON * cwd = cJSON_GetObjectItem(request, "cwd");
+    cJSON * shutdown = cJSON_GetObjectItem(request, "shutdown");
+    cJSON * response = cJSON_CreateObject();
+    cJSON * jsonOutput = cJSON_CreateObject();
+
+    // Everything the action logs goes back to the client
+    capturedLog = cJSON_CreateArray();
+    capturedErrors = cJSON_CreateArray();
+    clContextSystem system = C->system;
+    C->system.log = serveCaptureLog;
+    C->system.error = serveCaptureError;
+    C->inputRaw = (input.size > 0) ? &input : NULL;
+    C->outputRaw = cJSON_IsTrue(returnOutput) ? &output : NULL;
+
+    int ret = 0;
+    if (cJSON_IsString(cwd) && (chdir(cwd->valuestring) != 0)) {
+        clContextLogError(C, "Can't change to directory: %s", cwd->valuestring);
+        ret = 1;
+    }
+    if ((ret == 0) && cJSON_GetObjectItem(request, "args")) {
+        ret = runRequest(C, settings, request, jsonOutput);
+    }
+    if (chdir(settings->cwd) != 0) {
+        clContextLogError(C, "Can't change back to directory: %s", settings->cwd);
+    }
+    // Keep the cache file current, a server is usually stopped by a signal rather than cleanly
+    clProfileCacheFlush(C);
+
+    C->inputRaw = NULL;
+    C->outputRaw = NULL;
+    C->system = system;
+
+    cJSON_AddBoolToObject(response, "ok", (ret == 0) ? 1 : 0);
+    cJSON_AddItemToObject(response, "log", capturedLog);
+    cJSON_AddItemToObject(response, "errors", capturedErrors);
+    capturedLog = NULL;
+    capturedErrors = NULL;
+    cJSON_AddItemToObject(response, "output", jsonOutput);
+    cJSON * stats = cJSON_CreateObject();
+    cJSON_AddNumberToObject(stats, "seconds", timerElapsedSeconds(&t));
+    cJSON_AddNumberToObject(stats, "decodeSeconds", C->readExtraInfo.decodeCodecSeconds);
+    cJSON_AddNumberToObject(stats, "encodeSeconds", C->writeExtraInfo.encodeCodecSeconds);
+    cJSON_AddItemToObject(response, "stats", stats);
+    cJSON_AddNumberToObject(response, "outputSize", (double)output.size);
+
+    if (!sendMessage(stream->fd, response, &output)) {
+        keepGoing = clFalse;
+    }
+
+    cJSON * firstArg = cJSON_GetArrayItem(cJSON_GetObjectItem(request, "args"), 0);
+    clContextLog(C,
+                 "serve",
+                 0,
+                 "%s: %s " TIMING_FORMAT,
+                 cJSON_IsString(firstArg) ? firstArg->valuestring : "--",
+                 (ret == 0) ? "OK" : "FAILED",
+                 timerElapsedSeconds(&t));
+    fflush(stdout); // Servers tend to log to a file, keep it current
+
+    if (cJSON_IsTrue(shutdown)) {
+        *outShutdown = clTrue;
+        keepGoing = clFalse;
+    }
+
+    cJSON_Delete(response);
+    cJSON_Delete(request);
+    clRawFree(C, &input);
+    clRawFree(C, &output);
+    return keepGoing;
+}
+
+int clContextServe(clContext * C)
+{
+    const char * socketFilename = C->inputFilename;
+    clServeSettings settings;
+    settings.jobs = C->jobs;
+    settings.profileCacheFilename = C->profileCacheFilename;
+    if (!getcwd(settings.cwd, sizeof(settings.cwd))) {
+        clContextLogError(C, "Can't determine the current directory");
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    if (!fillAddress(C, &address, socketFilename)) {
+        return 1;
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        clContextLogError(C, "Can't create socket: %s", strerror(errno));
+        return 1;
+    }
+    int bindResult = bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+    if ((bindResult != 0) && (errno == EADDRINUSE)) {
+        // Either another server is using it, or one was killed and left its socket behind
+        int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        clBool live = (probeFd >= 0) && (connect(probeFd, (struct sockaddr *)&address, sizeof(address)) == 0);
+        if (probeFd >= 0) {
+            close(probeFd);
+        }
+        if (!live) {
+            // Only ever clear away a socket; anything else at that path isn't the server's to delete
+            struct stat st;
+            if ((lstat(socketFilename, &st) != 0) || !S_ISSOCK(st.st_mode)) {
+                clContextLogError(C, "Can't listen on %s: something other than a socket is already there", socketFilename);
+                close(listenFd);
+                return 1;
+            }
+            unlink(socketFilename);
+            bindResult = bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+        }
+    }
+    if ((bindResult != 0) || (listen(listenFd, 16) != 0)) {
+        clContextLogError(C, "Can't listen on %s: %s", socketFilename, strerror(errno));
+        close(listenFd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // A client hanging up early shouldn't take the server down
+
+    // Everything on C (formats, interned profiles, the profile cache, the LittleCMS context) stays
+    // warm from one request to the next. Connections are served one at a time; each may send any
+    // number of requests.
+    clContextLog(C, "serve", 0, "Listening on %s", socketFilename);
+    fflush(stdout);
+    clBool shutdown = clFalse;
+    while (!shutdown) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            clContextLogError(C, "accept() failed: %s", strerror(errno));
+            break;
+        }
+        clServeStream * stream = clAllocateStruct(clServeStream);
+        stream->fd = fd;
+        while (serveRequest(C, &settings, stream, &shutdown)) {
+        }
+        clFree(stream);
+        close(fd);
+    }
+
+    close(listenFd);
+    unlink(socketFilename);
+    C->inputFilename = socketFilename;
+    C->jobs = settings.jobs;
+    C->profileCacheFilename = settings.profileCacheFilename;
+    C->action = CL_ACTION_SERVE;
+    clContextLog(C, "serve", 0, "Stopped");
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Client
+
+// Sends request (and input, if any) and replays the response on C. Returns 0 if the server reports success.
+static int sendRequest(clContext * C,
+                       const char * socketFilename,
+                       cJSON * request,
+                       struct clRaw * input,
+                       struct clRaw * output,
+                       struct cJSON * response)
+{
+    struct sockaddr_un address;
+    if (!fillAddress(C, &address, socketFilename)) {
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        clContextLogError(C, "Can't create socket: %s", strerror(errno));
+        return 1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        clContextLogError(C, "Can't connect to %s: %s", socketFilename, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    int ret = 1;
+    char * headerText = NULL;
+    cJSON * reply = NULL;
+    clServeStream * stream = clAllocateStruct(clServeStream);
+    stream->fd = fd;
+    if (!sendMessage(fd, request, input)) {
+        clContextLogError(C, "Failed to send request to %s", socketFilename);
+        goto cleanup;
+    }
+    headerText = streamReadHeader(C, stream);
+    reply = headerText ? cJSON_Parse(headerText) : NULL;
+    if (!reply) {
+        clContextLogError(C, "No response from %s", socketFilename);
+        goto cleanup;
+    }
+
+    // Replay the server's output as if the action had run here
+    cJSON * log = cJSON_GetObjectItem(reply, "log");
+    for (cJSON * line = log ? log->child : NULL; line != NULL; line = line->next) {
+        cJSON * section = cJSON_GetArrayItem(line, 0);
+        cJSON * indent = cJSON_GetArrayItem(line, 1);
+        cJSON * text = cJSON_GetArrayItem(line, 2);
+        if (cJSON_IsNumber(indent) && cJSON_IsString(text)) {
+            clContextLog(C, cJSON_IsString(section) ? section->valuestring : NULL, indent->valueint, "%s", text->valuestring);
+        }
+    }
+    cJSON * errors = cJSON_GetObjectItem(reply, "errors");
+    for (cJSON * error = errors ? errors->child : NULL; error != NULL; error = error->next) {
+        if (cJSON_IsString(error)) {
+            clContextLogError(C, "%s", error->valuestring);
+        }
+    }
+
+    clRaw received = CL_RAW_EMPTY;
+    if (!streamReadPayload(C, stream, cJSON_GetObjectItem(reply, "outputSize"), "outputSize", &received)) {
+        clContextLogError(C, "Bad response from %s", socketFilename);
+        goto cleanup;
+    }
+    if (received.size > 0) {
+        if (output) {
+            clRawFree(C, output);
+            *output = received;
+        } else {
+            clRawFree(C, &received);
+        }
+    }
+
+    ret = cJSON_IsTrue(cJSON_GetObjectItem(reply, "ok")) ? 0 : 1;
+    if (response) {
+        for (cJSON * item = reply->child; item != NULL; item = item->next) {
+            cJSON_AddItemToObject(response, item->string, cJSON_Duplicate(item, 1));
+        }
+    }
+
+cleanup:
+    if (headerText) {
+        clFree(headerText);
+    }
+    cJSON_Delete(reply);
+    clFree(stream);
+    close(fd);
+    return ret;
+}
+
+int clContextServeRequest(clContext * C,
+                          const char * socketFilename,
+                          int argc,
+                          const char ** argv,
+                          struct clRaw * input,
+                          struct clRaw * output,
+                          struct cJSON * response)
+{
+    cJSON * request = cJSON_CreateObject();
+    cJSON * args = cJSON_CreateArray();
+    for (int i = 0; i < argc; ++i) {
+        cJSON_AddItemToArray(args, cJSON_CreateString(argv[i]));
+    }
+    cJSON_AddItemToObject(request, "args", args);
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) {
+        cJSON_AddStringToObject(request, "cwd", cwd);
+    }
+    if (input) {
+        cJSON_AddNumberToObject(request, "inputSize", (double)input->size);
+    }
+    if (output) {
+        cJSON_AddBoolToObject(request, "returnOutput", 1);
+    }
+    int ret = sendRequest(C, socketFilename, request, input, output, response);
+    cJSON_Delete(request);
+    return ret;
+}
+
+int clContextServeShutdown(clContext * C, const char * socketFilename)
+{
+    cJSON * request = cJSON_CreateObject();
+    cJSON_AddBoolToObject(request, "shutdown", 1);
+    int ret = sendRequest(C, socketFilename, request, NULL, NULL, NULL);
+    cJSON_Delete(request);
+    return ret;
+}
+
+#endif /* if defined(_WIN32) || defined(COLORIST_EMSCRIPTEN) */
@@ -14,18 +14,45 @@
 #include "avif/avif.h"
 
 #include <string.h>
+#include <time.h>
 
 static clProfile * nclxToclProfile(struct clContext * C, avifImage * avif);
 static clBool clProfileToNclx(struct clContext * C, struct clProfile * profile, avifImage * avif);
 static void logAvifImage(struct clContext * C, avifImage * avif, avifIOStats * ioStats);
+static avifDecoder * createAvifDecoder(struct clContext * C, struct clRaw * input);
+static clProfile * avifToProfile(struct clContext * C, avifImage * avif, struct clProfile * overrideProfile);
+static clImage * avifToImage(struct clContext * C, avifImage * avif, struct clProfile * profile);
+static avifImage * imageToAvif(struct clContext * C, struct clImage * image, struct clWriteParams * writeParams);
+static avifEncoder * createAvifEncoder(struct clContext * C, struct clWriteParams * writeParams, int width, int height);
 
 clBool clFormatDetectAVIF(struct clContext * C, struct clFormat * format, struct clRaw * input);
-struct clImage * clFormatReadAVIF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadAVIF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteAVIF(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
                          struct clRaw * output,
                          struct clWriteParams * writeParams);
+void * clFormatReadSequenceBeginAVIF(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount);
+struct clImage * clFormatReadSequenceFrameAVIF(struct clContext * C, void * sequenceState, double * outDuration);
+void clFormatReadSequenceEndAVIF(struct clContext * C, void * sequenceState);
+clBool clFormatWriteSequenceAVIF(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams);
+
+// Timescale used when writing image sequences (a common video timescale, exact for the usual frame rates)
+#define AVIF_SEQUENCE_TIMESCALE 90000
 
 clBool clFormatDetectAVIF(struct clContext * C, struct clFormat * format, struct clRaw * input)
 {
@@ -41,38 +68,24 @@ clBool clFormatDetectAVIF(struct clContext * C, struct clFormat * format, struct
     return clFalse;
 }
 
-struct clImage * clFormatReadAVIF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+struct clImage * clFormatReadAVIF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint)
 {
     COLORIST_UNUSED(formatName);
-    COLORIST_UNUSED(input);
-    COLORIST_UNUSED(C);
+    COLORIST_UNUSED(hint);
 
     clImage * image = NULL;
     clProfile * profile = NULL;
 
-    avifROData raw;
-    raw.data = input->ptr;
-    raw.size = input->size;
-
     Timer t;
     timerStart(&t);
 
-    avifDecoder * decoder = avifDecoderCreate();
-    if (C->params.readCodec) {
-        decoder->codecChoice = avifCodecChoiceFromName(C->params.readCodec);
-    }
-    const char * codecName = avifCodecName(decoder->codecChoice, AVIF_CODEC_FLAG_CAN_DECODE);
-    if (codecName == NULL) {
-        clContextLogError(C, "No AV1 codec available for decoding");
-        goto readCleanup;
-    }
-    clContextLog(C, "avif", 1, "AV1 codec (decode): %s", codecName);
-
-    avifDecoderSetIOMemory(decoder, raw.data, raw.size);
-    avifResult decodeResult = avifDecoderParse(decoder);
-    if (decodeResult != AVIF_RESULT_OK) {
-        clContextLogError(C, "Failed to parse AVIF (%s)", avifResultToString(decodeResult));
-        goto readCleanup;
+    avifDecoder * decoder = createAvifDecoder(C, input);
+    if (!decoder) {
+        return NULL;
     }
 
     uint32_t frameIndex = 0;
@@ -94,40 +107,14 @@ struct clImage * clFormatReadAVIF(struct clContext * C, const char * formatName,
 
     C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
 
-    if (overrideProfile) {
-        profile = clProfileClone(C, overrideProfile);
-    } else if (avif->icc.data && avif->icc.size) {
-        profile = clProfileParse(C, avif->icc.data, avif->icc.size, NULL);
-        if (!profile) {
-            clContextLogError(C, "Failed parse ICC profile chunk");
-            goto readCleanup;
-        }
-    } else {
-        profile = nclxToclProfile(C, avif);
+    profile = avifToProfile(C, avif, overrideProfile);
+    if (!profile) {
+        goto readCleanup;
     }
 
     logAvifImage(C, avif, &decoder->ioStats);
 
-    clImageLogCreate(C, avif->width, avif->height, avif->depth, profile);
-    image = clImageCreate(C, avif->width, avif->height, avif->depth, profile);
-
-    timerStart(&t);
-    avifRGBImage rgb;
-    avifRGBImageSetDefaults(&rgb, avif);
-    if (avifImageUsesU16(avif)) {
-        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
-
-        rgb.pixels = (uint8_t *)image->pixelsU16;
-        rgb.rowBytes = image->width * sizeof(uint16_t) * CL_CHANNELS_PER_PIXEL;
-        avifImageYUVToRGB(avif, &rgb);
-    } else {
-        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
-
-        rgb.pixels = image->pixelsU8;
-        rgb.rowBytes = image->width * sizeof(uint8_t) * CL_CHANNELS_PER_PIXEL;
-        avifImageYUVToRGB(avif, &rgb);
-    }
-    C->readExtraInfo.decodeYUVtoRGBSeconds = timerElapsedSeconds(&t);
+    image = avifToImage(C, avif, profile);
 
     if (decoder->imageCount > 1) {
         C->readExtraInfo.frameIndex = (int)frameIndex;
@@ -181,21 +168,327 @@ readCleanup:
     return image;
 }
 
+typedef struct clSequenceAVIF
+{
+    avifDecoder * decoder;
+    clProfile * overrideProfile;
+    clProfile * profile; // derived from the first decoded frame
+} clSequenceAVIF;
+
+void * clFormatReadSequenceBeginAVIF(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount)
+{
+    COLORIST_UNUSED(formatName);
+
+    avifDecoder * decoder = createAvifDecoder(C, input);
+    if (!decoder) {
+        return NULL;
+    }
+    clContextLog(C, "avif", 1, "AVIF contains %d frame%s, decoding in order.", decoder->imageCount, (decoder->imageCount == 1) ? "" : "s");
+
+    clSequenceAVIF * sequence = clAllocateStruct(clSequenceAVIF);
+    sequence->decoder = decoder;
+    sequence->overrideProfile = overrideProfile;
+    sequence->profile = NULL;
+    *outFrameCount = decoder->imageCount;
+    return sequence;
+}
+
+struct clImage * clFormatReadSequenceFrameAVIF(struct clContext * C, void * sequenceState, double * outDuration)
+{
+    clSequenceAVIF * sequence = (clSequenceAVIF *)sequenceState;
+    avifDecoder * decoder = sequence->decoder;
+
+    Timer t;
+    timerStart(&t);
+
+    avifResult frameResult = avifDecoderNextImage(decoder);
+    if (frameResult != AVIF_RESULT_OK) {
+        clContextLogError(C, "Failed to get AVIF frame %d (%s)", decoder->imageIndex, avifResultToString(frameResult));
+        return NULL;
+    }
+    C->readExtraInfo.decodeCodecSeconds += timerElapsedSeconds(&t);
+
+    if (!sequence->profile) {
+        sequence->profile = avifToProfile(C, decoder->image, sequence->overrideProfile);
+        if (!sequence->profile) {
+            return NULL;
+        }
+        logAvifImage(C, decoder->image, &decoder->ioStats);
+    }
+
+    *outDuration = decoder->imageTiming.duration;
+    return avifToImage(C, decoder->image, sequence->profile);
+}
+
+void clFormatReadSequenceEndAVIF(struct clContext * C, void * sequenceState)
+{
+    clSequenceAVIF * sequence = (clSequenceAVIF *)sequenceState;
+    avifDecoderDestroy(sequence->decoder);
+    if (sequence->profile) {
+        clProfileDestroy(C, sequence->profile);
+    }
+    clFree(sequence);
+}
+
 clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams)
 {
     COLORIST_UNUSED(formatName);
 
-    clBool writeResult = clTrue;
-    avifImage * avif = NULL;
+    clBool writeResult = clFalse;
     avifEncoder * encoder = NULL;
+    avifRWData avifOutput = AVIF_DATA_EMPTY;
+
+    avifImage * avif = imageToAvif(C, image, writeParams);
+    if (!avif) {
+        goto writeCleanup;
+    }
+
+    encoder = createAvifEncoder(C, writeParams, image->width, image->height);
+    if (!encoder) {
+        goto writeCleanup;
+    }
+
+    Timer t;
+    timerStart(&t);
+    clock_t cpuStart = clock();
+    avifResult encodeResult = avifEncoderWrite(encoder, avif, &avifOutput);
+    C->writeExtraInfo.encodeCodecSeconds += timerElapsedSeconds(&t);
+    C->writeExtraInfo.encodeProcessCPUSeconds += (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+    if (encodeResult != AVIF_RESULT_OK) {
+        clContextLogError(C, "AVIF encoder failed (%s)", avifResultToString(encodeResult));
+        goto writeCleanup;
+    }
+
+    if (!avifOutput.data || !avifOutput.size) {
+        clContextLogError(C, "AVIF encoder returned empty data");
+        goto writeCleanup;
+    }
+
+    clRawSet(C, output, avifOutput.data, avifOutput.size);
+
+    logAvifImage(C, avif, &encoder->ioStats);
+    clContextLog(C,
+                 "avif",
+                 1,
+                 "Encoder time: %.3f sec wall, %.3f sec process CPU",
+                 C->writeExtraInfo.encodeCodecSeconds,
+                 C->writeExtraInfo.encodeProcessCPUSeconds);
+    writeResult = clTrue;
+
+writeCleanup:
+    if (encoder) {
+        avifEncoderDestroy(encoder);
+    }
+    if (avif) {
+        avifImageDestroy(avif);
+    }
+    avifRWDataFree(&avifOutput);
+    return writeResult;
+}
+
+clBool clFormatWriteSequenceAVIF(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams)
+{
+    COLORIST_UNUSED(formatName);
+
+    clBool writeResult = clFalse;
+    avifImage * avif = NULL;
+    avifRWData avifOutput = AVIF_DATA_EMPTY;
+
+    avifEncoder * encoder = createAvifEncoder(C, writeParams, frames[0]->width, frames[0]->height);
+    if (!encoder) {
+        goto writeCleanup;
+    }
+    encoder->timescale = AVIF_SEQUENCE_TIMESCALE;
+    clContextLog(C, "avif", 1, "Encoding %d frame%s", frameCount, (frameCount == 1) ? "" : "s");
+    if (writeParams->keyframeInterval > 0) {
+        clContextLog(C, "avif", 1, "Keyframe interval: %d", writeParams->keyframeInterval);
+    }
+
+    Timer t;
+    clock_t cpuStart;
 
-    clRaw rawProfile = CL_RAW_EMPTY;
-    if (!clProfilePack(C, image->profile, &rawProfile)) {
-        clContextLogError(C, "Failed to create ICC profile");
-        writeResult = clFalse;
+    for (int frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        avif = imageToAvif(C, frames[frameIndex], writeParams);
+        if (!avif) {
+            goto writeCleanup;
+        }
+
+        double duration = (durations && (durations[frameIndex] > 0.0)) ? durations[frameIndex] : CL_SEQUENCE_DEFAULT_FRAME_DURATION;
+        uint64_t durationInTimescales = (uint64_t)(duration * AVIF_SEQUENCE_TIMESCALE + 0.5);
+        if (durationInTimescales < 1) {
+            durationInTimescales = 1;
+        }
+        uint32_t addImageFlags = (frameCount == 1) ? AVIF_ADD_IMAGE_FLAG_SINGLE : AVIF_ADD_IMAGE_FLAG_NONE;
+        if ((writeParams->keyframeInterval > 0) && ((frameIndex % writeParams->keyframeInterval) == 0)) {
+            addImageFlags |= AVIF_ADD_IMAGE_FLAG_FORCE_KEYFRAME;
+        }
+        timerStart(&t);
+        cpuStart = clock();
+        avifResult addResult = avifEncoderAddImage(encoder, avif, durationInTimescales, addImageFlags);
+        C->writeExtraInfo.encodeCodecSeconds += timerElapsedSeconds(&t);
+        C->writeExtraInfo.encodeProcessCPUSeconds += (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+        if (addResult != AVIF_RESULT_OK) {
+            clContextLogError(C, "AVIF encoder failed on frame %d (%s)", frameIndex, avifResultToString(addResult));
+            goto writeCleanup;
+        }
+
+        if (frameIndex < (frameCount - 1)) {
+            avifImageDestroy(avif);
+            avif = NULL;
+        }
+    }
+
+    timerStart(&t);
+    cpuStart = clock();
+    avifResult finishResult = avifEncoderFinish(encoder, &avifOutput);
+    C->writeExtraInfo.encodeCodecSeconds += timerElapsedSeconds(&t);
+    C->writeExtraInfo.encodeProcessCPUSeconds += (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+    if (finishResult != AVIF_RESULT_OK) {
+        clContextLogError(C, "AVIF encoder failed (%s)", avifResultToString(finishResult));
+        goto writeCleanup;
+    }
+
+    if (!avifOutput.data || !avifOutput.size) {
+        clContextLogError(C, "AVIF encoder returned empty data");
         goto writeCleanup;
     }
 
+    clRawSet(C, output, avifOutput.data, avifOutput.size);
+
+    logAvifImage(C, avif, &encoder->ioStats);
+    clContextLog(C,
+                 "avif",
+                 1,
+                 "Encoder time: %.3f sec wall, %.3f sec process CPU",
+                 C->writeExtraInfo.encodeCodecSeconds,
+                 C->writeExtraInfo.encodeProcessCPUSeconds);
+    writeResult = clTrue;
+
+writeCleanup:
+    if (encoder) {
+        avifEncoderDestroy(encoder);
+    }
+    if (avif) {
+        avifImageDestroy(avif);
+    }
+    avifRWDataFree(&avifOutput);
+    return writeResult;
+}
+
+static avifDecoder * createAvifDecoder(struct clContext * C, struct clRaw * input)
+{
+    avifDecoder * decoder = avifDecoderCreate();
+    decoder->maxThreads = C->jobs;
+    if (C->params.readCodec) {
+        decoder->codecChoice = avifCodecChoiceFromName(C->params.readCodec);
+    }
+    const char * codecName = avifCodecName(decoder->codecChoice, AVIF_CODEC_FLAG_CAN_DECODE);
+    if (codecName == NULL) {
+        clContextLogError(C, "No AV1 codec available for decoding");
+        avifDecoderDestroy(decoder);
+        return NULL;
+    }
+    clContextLog(C, "avif", 1, "AV1 codec (decode): %s", codecName);
+
+    avifDecoderSetIOMemory(decoder, input->ptr, input->size);
+    avifResult decodeResult = avifDecoderParse(decoder);
+    if (decodeResult != AVIF_RESULT_OK) {
+        clContextLogError(C, "Failed to parse AVIF (%s)", avifResultToString(decodeResult));
+        avifDecoderDestroy(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+static clProfile * avifToProfile(struct clContext * C, avifImage * avif, struct clProfile * overrideProfile)
+{
+    if (overrideProfile) {
+        return clProfileClone(C, overrideProfile);
+    }
+    if (avif->icc.data && avif->icc.size) {
+        clProfile * profile = clProfileParse(C, avif->icc.data, avif->icc.size, NULL);
+        if (!profile) {
+            clContextLogError(C, "Failed parse ICC profile chunk");
+        }
+        return profile;
+    }
+    return nclxToclProfile(C, avif);
+}
+
+// libavif 0.9.1 added explicit speed/quality choices and a way to opt out of libyuv. Older
+// versions only know nearest/bilinear, and use libyuv (when built in) wherever it applies.
+static void avifSetUpsampling(struct clContext * C, avifRGBImage * rgb)
+{
+    switch (C->params.upsampling) {
+#if defined(AVIF_VERSION) && (AVIF_VERSION >= 90100)
+        case CL_CHROMAUPSAMPLING_FASTEST:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_FASTEST;
+            break;
+        case CL_CHROMAUPSAMPLING_BEST:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_BEST_QUALITY;
+            rgb->avoidLibYUV = AVIF_TRUE;
+            break;
+#else
+        case CL_CHROMAUPSAMPLING_FASTEST:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_NEAREST;
+            break;
+        case CL_CHROMAUPSAMPLING_BEST:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_BILINEAR;
+            break;
+#endif
+        case CL_CHROMAUPSAMPLING_NEAREST:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_NEAREST;
+            break;
+        case CL_CHROMAUPSAMPLING_BILINEAR:
+            rgb->chromaUpsampling = AVIF_CHROMA_UPSAMPLING_BILINEAR;
+            break;
+        case CL_CHROMAUPSAMPLING_AUTO:
+        case CL_CHROMAUPSAMPLING_INVALID:
+        default:
+            return;
+    }
+    clContextLog(C, "avif", 1, "Chroma upsampling: %s", clChromaUpsamplingToString(C, C->params.upsampling));
+}
+
+static clImage * avifToImage(struct clContext * C, avifImage * avif, struct clProfile * profile)
+{
+    clImageLogCreate(C, avif->width, avif->height, avif->depth, profile);
+    clImage * image = clImageCreate(C, avif->width, avif->height, avif->depth, profile);
+
+    Timer t;
+    timerStart(&t);
+    avifRGBImage rgb;
+    avifRGBImageSetDefaults(&rgb, avif);
+    avifSetUpsampling(C, &rgb);
+    if (avifImageUsesU16(avif)) {
+        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
+
+        rgb.pixels = (uint8_t *)image->pixelsU16;
+        rgb.rowBytes = image->width * sizeof(uint16_t) * CL_CHANNELS_PER_PIXEL;
+        avifImageYUVToRGB(avif, &rgb);
+    } else {
+        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
+
+        rgb.pixels = image->pixelsU8;
+        rgb.rowBytes = image->width * sizeof(uint8_t) * CL_CHANNELS_PER_PIXEL;
+        avifImageYUVToRGB(avif, &rgb);
+    }
+    C->readExtraInfo.decodeYUVtoRGBSeconds += timerElapsedSeconds(&t);
+    return image;
+}
+
+static avifImage * imageToAvif(struct clContext * C, struct clImage * image, struct clWriteParams * writeParams)
+{
     avifPixelFormat avifYUVFormat;
     switch (writeParams->yuvFormat) {
         case CL_YUVFORMAT_444:
@@ -213,11 +506,10 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
         case CL_YUVFORMAT_INVALID:
         default:
             clContextLogError(C, "Unable to choose AVIF YUV format");
-            writeResult = clFalse;
-            goto writeCleanup;
+            return NULL;
     }
 
-    avif = avifImageCreate(image->width, image->height, image->depth, avifYUVFormat);
+    avifImage * avif = avifImageCreate(image->width, image->height, image->depth, avifYUVFormat);
 
     if (writeParams->writeProfile) {
         if (writeParams->nclx[0] && writeParams->nclx[1] && writeParams->nclx[2]) {
@@ -243,11 +535,20 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
                          avif->matrixCoefficients,
                          avif->yuvRange);
         } else {
+            clRaw rawProfile = CL_RAW_EMPTY;
+            if (!clProfilePack(C, image->profile, &rawProfile)) {
+                clContextLogError(C, "Failed to create ICC profile");
+                avifImageDestroy(avif);
+                return NULL;
+            }
             clContextLog(C, "avif", 1, "Writing colr box (icc): %u bytes", (uint32_t)rawProfile.size);
             avifImageSetProfileICC(avif, rawProfile.ptr, rawProfile.size);
+            clRawFree(C, &rawProfile);
         }
     }
 
+    Timer t;
+    timerStart(&t);
     avifRGBImage rgb;
     avifRGBImageSetDefaults(&rgb, avif);
     if (avifImageUsesU16(avif)) {
@@ -263,17 +564,64 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
         rgb.rowBytes = image->width * sizeof(uint8_t) * CL_CHANNELS_PER_PIXEL;
         avifImageRGBToYUV(avif, &rgb);
     }
+    C->writeExtraInfo.encodeRGBtoYUVSeconds += timerElapsedSeconds(&t);
+    return avif;
+}
 
-    avifRWData avifOutput = AVIF_DATA_EMPTY;
+// AV1 tiles may be at most 4096 wide and 4096*2304 in area
+#define AVIF_MAX_TILE_WIDTH 4096
+#define AVIF_MAX_TILE_AREA (4096 * 2304)
+// Auto tiling won't split tiles below this; tiny tiles cost more quality than the extra threads win back
+#define AVIF_AUTO_TILE_MIN_SIZE 512
+
+static int avifTileSize(int size, int log2)
+{
+    return (size + (1 << log2) - 1) >> log2;
+}
+
+// Picks just enough tiles to give every job one, splitting whichever tile dimension is larger
+void clAVIFAutoTiling(struct clContext * C, int width, int height, int * outRowsLog2, int * outColsLog2)
+{
+    int rowsLog2 = 0;
+    int colsLog2 = 0;
+
+    // Required by the spec, regardless of job count
+    while ((colsLog2 < 6) && (avifTileSize(width, colsLog2) > AVIF_MAX_TILE_WIDTH)) {
+        ++colsLog2;
+    }
+    while ((rowsLog2 < 6) && (((int64_t)avifTileSize(width, colsLog2) * avifTileSize(height, rowsLog2)) > AVIF_MAX_TILE_AREA)) {
+        ++rowsLog2;
+    }
+
+    while ((1 << (rowsLog2 + colsLog2)) < C->jobs) {
+        int tileWidth = avifTileSize(width, colsLog2);
+        int tileHeight = avifTileSize(height, rowsLog2);
+        clBool canSplitCols = (colsLog2 < 6) && ((tileWidth / 2) >= AVIF_AUTO_TILE_MIN_SIZE);
+        clBool canSplitRows = (rowsLog2 < 6) && ((tileHeight / 2) >= AVIF_AUTO_TILE_MIN_SIZE);
+        if (canSplitCols && (!canSplitRows || (tileWidth >= tileHeight))) {
+            ++colsLog2;
+        } else if (canSplitRows) {
+            ++rowsLog2;
+        } else {
+            break;
+        }
+    }
+
+    *outRowsLog2 = rowsLog2;
+    *outColsLog2 = colsLog2;
+}
 
-    encoder = avifEncoderCreate();
+static avifEncoder * createAvifEncoder(struct clContext * C, struct clWriteParams * writeParams, int width, int height)
+{
+    avifEncoder * encoder = avifEncoderCreate();
     if (writeParams->codec) {
         encoder->codecChoice = avifCodecChoiceFromName(writeParams->codec);
     }
     const char * codecName = avifCodecName(encoder->codecChoice, AVIF_CODEC_FLAG_CAN_ENCODE);
     if (codecName == NULL) {
         clContextLogError(C, "No AV1 codec available for encoding");
-        goto writeCleanup;
+        avifEncoderDestroy(encoder);
+        return NULL;
     }
     clContextLog(C, "avif", 1, "AV1 codec (encode): %s", codecName);
 
@@ -308,10 +656,31 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
                      encoder->minQuantizer,
                      encoder->maxQuantizer);
     }
-    encoder->tileRowsLog2 = writeParams->tileRowsLog2;
-    encoder->tileColsLog2 = writeParams->tileColsLog2;
+    if ((writeParams->quantizerMinAlpha != -1) || (writeParams->quantizerMaxAlpha != -1)) {
+        encoder->minQuantizerAlpha = (writeParams->quantizerMinAlpha != -1) ? writeParams->quantizerMinAlpha : 0;
+        encoder->maxQuantizerAlpha = (writeParams->quantizerMaxAlpha != -1) ? writeParams->quantizerMaxAlpha : 0;
+        clContextLog(C,
+                     "avif",
+                     1,
+                     "Encoding alpha quantizer (0=lossless, 63=worst) min/max: %d/%d",
+                     encoder->minQuantizerAlpha,
+                     encoder->maxQuantizerAlpha);
+    }
+    clBool autoTiling = (writeParams->tileRowsLog2 == -1) || (writeParams->tileColsLog2 == -1);
+    if (autoTiling) {
+        clAVIFAutoTiling(C, width, height, &encoder->tileRowsLog2, &encoder->tileColsLog2);
+    } else {
+        encoder->tileRowsLog2 = writeParams->tileRowsLog2;
+        encoder->tileColsLog2 = writeParams->tileColsLog2;
+    }
     if (encoder->tileRowsLog2 || encoder->tileColsLog2) {
-        clContextLog(C, "avif", 1, "Encoding tiling (log2): 2^%d rows / 2^%d cols", encoder->tileRowsLog2, encoder->tileColsLog2);
+        clContextLog(C,
+                     "avif",
+                     1,
+                     "Encoding tiling (log2): 2^%d rows / 2^%d cols%s",
+                     encoder->tileRowsLog2,
+                     encoder->tileColsLog2,
+                     autoTiling ? " (auto)" : "");
     } else {
         clContextLog(C, "avif", 1, "Encoding tiling (log2): disabled");
     }
@@ -321,33 +690,7 @@ clBool clFormatWriteAVIF(struct clContext * C, struct clImage * image, const cha
     } else {
         clContextLog(C, "avif", 1, "Encoding speed (0=BestQuality, 10=Fastest): %d", encoder->speed);
     }
-    avifResult encodeResult = avifEncoderWrite(encoder, avif, &avifOutput);
-    if (encodeResult != AVIF_RESULT_OK) {
-        clContextLogError(C, "AVIF encoder failed (%s)", avifResultToString(encodeResult));
-        writeResult = clFalse;
-        goto writeCleanup;
-    }
-
-    if (!avifOutput.data || !avifOutput.size) {
-        clContextLogError(C, "AVIF encoder returned empty data");
-        writeResult = clFalse;
-        goto writeCleanup;
-    }
-
-    clRawSet(C, output, avifOutput.data, avifOutput.size);
-
-    logAvifImage(C, avif, &encoder->ioStats);
-
-writeCleanup:
-    if (encoder) {
-        avifEncoderDestroy(encoder);
-    }
-    if (avif) {
-        avifImageDestroy(avif);
-    }
-    avifRWDataFree(&avifOutput);
-    clRawFree(C, &rawProfile);
-    return writeResult;
+    return encoder;
 }
 
 static clProfile * nclxToclProfile(struct clContext * C, avifImage * avif)
@@ -20,7 +20,11 @@ extern void color_sycc_to_rgb(opj_image_t * img);
 extern void color_cmyk_to_rgb(opj_image_t * image);
 extern void color_esycc_to_rgb(opj_image_t * image);
 
-struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJP2(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
 static void error_callback(const char * msg, void * client_data)
@@ -85,19 +89,72 @@ static OPJ_BOOL seekCallback(OPJ_OFF_T p_nb_bytes, void * p_user_data)
     return OPJ_TRUE;
 }
 
-struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+// Interleaves one row of decoded components into RGBA16, scaling each sample to the destination
+// depth with a shift. Kept as a flat loop over independent pixels so the compiler can vectorize it.
+static void jp2InterleaveRow(uint16_t * dst,
+                             const OPJ_INT32 * r,
+                             const OPJ_INT32 * g,
+                             const OPJ_INT32 * b,
+                             const OPJ_INT32 * a, // NULL fills alpha with opaqueAlpha
+                             int count,
+                             const int shiftUp[4],
+                             const int shiftDown[4],
+                             uint16_t opaqueAlpha)
+{
+    if (a) {
+        for (int i = 0; i < count; ++i) {
+            dst[(i * 4) + 0] = (uint16_t)((r[i] << shiftUp[0]) >> shiftDown[0]);
+            dst[(i * 4) + 1] = (uint16_t)((g[i] << shiftUp[1]) >> shiftDown[1]);
+            dst[(i * 4) + 2] = (uint16_t)((b[i] << shiftUp[2]) >> shiftDown[2]);
+            dst[(i * 4) + 3] = (uint16_t)((a[i] << shiftUp[3]) >> shiftDown[3]);
+        }
+    } else {
+        for (int i = 0; i < count; ++i) {
+            dst[(i * 4) + 0] = (uint16_t)((r[i] << shiftUp[0]) >> shiftDown[0]);
+            dst[(i * 4) + 1] = (uint16_t)((g[i] << shiftUp[1]) >> shiftDown[1]);
+            dst[(i * 4) + 2] = (uint16_t)((b[i] << shiftUp[2]) >> shiftDown[2]);
+            dst[(i * 4) + 3] = opaqueAlpha;
+        }
+    }
+}
+
+// Lowest resolution count across the components' default coding style, minus one: the largest
+// reduction opj_set_decoded_resolution_factor() accepts
+static int jp2MaxReduction(opj_codec_t * opjCodec, int numcomps)
+{
+    int maxReduction = 0;
+    opj_codestream_info_v2_t * info = opj_get_cstr_info(opjCodec);
+    if (info) {
+        if (info->m_default_tile_info.tccp_info) {
+            maxReduction = 32;
+            for (int i = 0; i < numcomps; ++i) {
+                maxReduction = CL_MIN(maxReduction, (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1);
+            }
+            maxReduction = CL_MAX(maxReduction, 0);
+        }
+        opj_destroy_cstr_info(&info);
+    }
+    return maxReduction;
+}
+
+struct clImage * clFormatReadJP2(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint)
 {
     COLORIST_UNUSED(formatName);
 
     clImage * image = NULL;
     clProfile * profile = NULL;
-    int i, pixelCount, dstDepth;
+    int i, width, height, dstDepth;
 
     opj_dparameters_t parameters;
     opj_codec_t * opjCodec = NULL;
     opj_image_t * opjImage = NULL;
     opj_stream_t * opjStream = NULL;
-    int channelFactor[4] = { 1, 1, 1, 1 };
+    int shiftUp[4] = { 0, 0, 0, 0 };
+    int shiftDown[4] = { 0, 0, 0, 0 };
     int maxChannel;
     struct opjCallbackInfo ci;
 
@@ -141,6 +198,11 @@ struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName,
         return NULL;
     }
 
+    if (C->jobs > 1) {
+        // Must happen between opj_setup_decoder() and opj_read_header()
+        opj_codec_set_threads(opjCodec, C->jobs);
+    }
+
     if (!opj_read_header(opjStream, opjCodec, &opjImage)) {
         clContextLogError(C, "Failed to read %s header", errorExtName);
         opj_stream_destroy(opjStream);
@@ -149,6 +211,42 @@ struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName,
         return NULL;
     }
 
+    if (hint) {
+        // Only decode the part of the codestream the caller wants, at the lowest resolution level that's
+        // still big enough
+        int rect[4];
+        clBool cropping = clReadHintRect(C, hint, (int)(opjImage->x1 - opjImage->x0), (int)(opjImage->y1 - opjImage->y0), rect);
+        // The reduced area's edges snap to the reduced grid of the image's reference grid, not the region's
+        int reduction = clReadHintReduction(C,
+                                            hint,
+                                            (int)opjImage->x0 + rect[0],
+                                            (int)opjImage->y0 + rect[1],
+                                            rect[2],
+                                            rect[3],
+                                            jp2MaxReduction(opjCodec, (int)opjImage->numcomps));
+        if ((reduction > 0) && !opj_set_decoded_resolution_factor(opjCodec, (OPJ_UINT32)reduction)) {
+            reduction = 0;
+        }
+        if (cropping) {
+            OPJ_INT32 x0 = (OPJ_INT32)opjImage->x0 + rect[0];
+            OPJ_INT32 y0 = (OPJ_INT32)opjImage->y0 + rect[1];
+            if (!opj_set_decode_area(opjCodec, opjImage, x0, y0, x0 + rect[2], y0 + rect[3])) {
+                clContextLogError(C, "Failed to set %s decode area", errorExtName);
+                opj_stream_destroy(opjStream);
+                opj_destroy_codec(opjCodec);
+                opj_image_destroy(opjImage);
+                return NULL;
+            }
+        }
+        if (cropping || (reduction > 0)) {
+            clContextLog(C, "JP2", 1, "Decoding +%d+%d %dx%d at 1/%d scale", rect[0], rect[1], rect[2], rect[3], 1 << reduction);
+        }
+
+        C->readExtraInfo.hintApplied = clTrue;
+        memcpy(C->readExtraInfo.hintRect, rect, sizeof(rect));
+        C->readExtraInfo.hintReduction = reduction;
+    }
+
     if (!opj_decode(opjCodec, opjStream, opjImage)) {
         clContextLogError(C, "Failed to decode %s!", errorExtName);
         opj_destroy_codec(opjCodec);
@@ -200,41 +298,37 @@ struct clImage * clFormatReadJP2(struct clContext * C, const char * formatName,
     }
     for (i = 0; i < (int)opjImage->numcomps; ++i) {
         // Calculate scales for incoming components
-        channelFactor[i] = 1 << (dstDepth - opjImage->comps[i].prec);
+        int shift = dstDepth - (int)opjImage->comps[i].prec;
+        shiftUp[i] = CL_MAX(shift, 0);
+        shiftDown[i] = CL_MAX(-shift, 0);
     }
     maxChannel = (1 << dstDepth) - 1;
 
-    clImageLogCreate(C, opjImage->x1, opjImage->y1, dstDepth, profile);
-    image = clImageCreate(C, opjImage->x1, opjImage->y1, dstDepth, profile);
+    // comps[0] is the decoded size, which is smaller than x1,y1 when a hint reduced or cropped the decode
+    width = (int)opjImage->comps[0].w;
+    height = (int)opjImage->comps[0].h;
+    clImageLogCreate(C, width, height, dstDepth, profile);
+    image = clImageCreate(C, width, height, dstDepth, profile);
     if (profile) {
         clProfileDestroy(C, profile);
     }
     clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
 
-    pixelCount = image->width * image->height;
-
     timerStart(&t);
 
-    uint16_t * pixel = image->pixelsU16;
-    if (opjImage->numcomps == 3) {
-        // RGB, fill A
-        for (i = 0; i < pixelCount; ++i) {
-            pixel[0] = (uint16_t)(opjImage->comps[0].data[i] * channelFactor[0]);
-            pixel[1] = (uint16_t)(opjImage->comps[1].data[i] * channelFactor[1]);
-            pixel[2] = (uint16_t)(opjImage->comps[2].data[i] * channelFactor[2]);
-            pixel[3] = (uint16_t)(maxChannel);
-            pixel += 4;
-        }
-    } else {
-        // RGBA
-        COLORIST_ASSERT(opjImage->numcomps == 4);
-        for (i = 0; i < pixelCount; ++i) {
-            pixel[0] = (uint16_t)(opjImage->comps[0].data[i] * channelFactor[0]);
-            pixel[1] = (uint16_t)(opjImage->comps[1].data[i] * channelFactor[1]);
-            pixel[2] = (uint16_t)(opjImage->comps[2].data[i] * channelFactor[2]);
-            pixel[3] = (uint16_t)(opjImage->comps[3].data[i] * channelFactor[3]);
-            pixel += 4;
-        }
+    COLORIST_ASSERT((opjImage->numcomps == 3) || (opjImage->numcomps == 4));
+    const OPJ_INT32 * alpha = (opjImage->numcomps == 4) ? opjImage->comps[3].data : NULL;
+    for (int j = 0; j < height; ++j) {
+        size_t offset = (size_t)j * width;
+        jp2InterleaveRow(&image->pixelsU16[offset * CL_CHANNELS_PER_PIXEL],
+                         opjImage->comps[0].data + offset,
+                         opjImage->comps[1].data + offset,
+                         opjImage->comps[2].data + offset,
+                         alpha ? (alpha + offset) : NULL,
+                         width,
+                         shiftUp,
+                         shiftDown,
+                         (uint16_t)maxChannel);
     }
     C->readExtraInfo.decodeFillSeconds = timerElapsedSeconds(&t);
 
@@ -309,14 +403,19 @@ clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char
     }
 
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
-    for (int j = 0; j < image->height; ++j) {
-        for (int i = 0; i < image->width; ++i) {
-            int dstOffset = i + (j * image->width);
-            int srcOffset = 4 * dstOffset;
-            opjImage->comps[0].data[dstOffset] = image->pixelsU16[srcOffset + 0];
-            opjImage->comps[1].data[dstOffset] = image->pixelsU16[srcOffset + 1];
-            opjImage->comps[2].data[dstOffset] = image->pixelsU16[srcOffset + 2];
-            opjImage->comps[3].data[dstOffset] = image->pixelsU16[srcOffset + 3];
+    {
+        // Flat loop over independent pixels with separate outputs, so the compiler can vectorize it
+        const uint16_t * src = image->pixelsU16;
+        OPJ_INT32 * r = opjImage->comps[0].data;
+        OPJ_INT32 * g = opjImage->comps[1].data;
+        OPJ_INT32 * b = opjImage->comps[2].data;
+        OPJ_INT32 * a = opjImage->comps[3].data;
+        int pixelCount = image->width * image->height;
+        for (int i = 0; i < pixelCount; ++i) {
+            r[i] = src[(i * 4) + 0];
+            g[i] = src[(i * 4) + 1];
+            b[i] = src[(i * 4) + 2];
+            a[i] = src[(i * 4) + 3];
         }
     }
 
@@ -350,6 +449,12 @@ clBool clFormatWriteJP2(struct clContext * C, struct clImage * image, const char
     opj_set_error_handler(opjCodec, error_callback, C);
 
     opj_setup_encoder(opjCodec, &parameters, opjImage);
+#if (OPJ_VERSION_MAJOR > 2) || ((OPJ_VERSION_MAJOR == 2) && (OPJ_VERSION_MINOR >= 4))
+    // OpenJPEG only threads (and only accepts threads for) the encoder as of 2.4
+    if (C->jobs > 1) {
+        opj_codec_set_threads(opjCodec, C->jobs);
+    }
+#endif
 
     OPJ_BOOL bSuccess;
 
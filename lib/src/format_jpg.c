@@ -10,6 +10,7 @@
 #include "colorist/context.h"
 #include "colorist/profile.h"
 #include "colorist/raw.h"
+#include "colorist/task.h"
 
 #include "lcms2.h"
 
@@ -36,14 +37,363 @@ static void setup_read_icc_profile(j_decompress_ptr cinfo);
 static boolean read_icc_profile(struct clContext * C, j_decompress_ptr cinfo, JOCTET ** icc_data_ptr, unsigned int * icc_data_len);
 static void write_icc_profile(j_compress_ptr cinfo, const JOCTET * icc_data_ptr, unsigned int icc_data_len);
 
-struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJPG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+// libjpeg-turbo can fill in the alpha channel itself, letting scanlines land directly in the RGBA image
+#ifdef JCS_EXTENSIONS
+#define JPG_READ_COLOR_SPACE JCS_EXT_RGBA
+#else
+#define JPG_READ_COLOR_SPACE JCS_RGB
+#endif
+#define JPG_MAX_BATCH_ROWS 16
+
+// Decodes skipRows scanlines into scratch (discarding them), then rowCount scanlines into image rows
+// starting at dstRow. Scanlines are read in rec_outbuf_height batches. Returns the number of rows written.
+static int readJPGRows(struct jpeg_decompress_struct * cinfo, clImage * image, int skipRows, int dstRow, int rowCount, JSAMPARRAY scratch)
+{
+    int batchRows = CL_CLAMP(cinfo->rec_outbuf_height, 1, JPG_MAX_BATCH_ROWS);
+    while (skipRows > 0) {
+        int readRows = (int)jpeg_read_scanlines(cinfo, scratch, (JDIMENSION)CL_MIN(batchRows, skipRows));
+        if (readRows == 0) {
+            return 0;
+        }
+        skipRows -= readRows;
+    }
+
+    int rowBytes = image->width * CL_CHANNELS_PER_PIXEL;
+    int rowsWritten = 0;
+    while (rowsWritten < rowCount) {
+        int wantedRows = CL_MIN(batchRows, rowCount - rowsWritten);
+        uint8_t * firstRow = &image->pixelsU8[(size_t)(dstRow + rowsWritten) * rowBytes];
+#ifdef JCS_EXTENSIONS
+        JSAMPROW rows[JPG_MAX_BATCH_ROWS];
+        for (int i = 0; i < wantedRows; ++i) {
+            rows[i] = firstRow + ((size_t)i * rowBytes);
+        }
+        int readRows = (int)jpeg_read_scanlines(cinfo, rows, (JDIMENSION)wantedRows);
+#else
+        int readRows = (int)jpeg_read_scanlines(cinfo, scratch, (JDIMENSION)wantedRows);
+        for (int j = 0; j < readRows; ++j) {
+            uint8_t * dst = firstRow + ((size_t)j * rowBytes);
+            const uint8_t * src = scratch[j];
+            for (int i = 0; i < image->width; ++i) {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst[3] = 255;
+                dst += CL_CHANNELS_PER_PIXEL;
+                src += 3;
+            }
+        }
+#endif
+        if (readRows == 0) {
+            break;
+        }
+        rowsWritten += readRows;
+    }
+    return rowsWritten;
+}
+
+// Decodes the image->width x image->height region at srcX,skipRows of the (possibly scaled) output.
+// libjpeg-turbo can skip rows without decoding them and, after jpeg_crop_scanline(), decodes little
+// more than the columns that are needed; plain libjpeg has to decode and discard everything above and
+// to the left of the region. Returns the number of rows written.
+static int readJPGRegion(struct jpeg_decompress_struct * cinfo, clImage * image, int srcX, int skipRows, JSAMPARRAY scratch)
+{
+    int batchRows = CL_CLAMP(cinfo->rec_outbuf_height, 1, JPG_MAX_BATCH_ROWS);
+#ifdef LIBJPEG_TURBO_VERSION
+    if ((skipRows > 0) && ((int)jpeg_skip_scanlines(cinfo, (JDIMENSION)skipRows) != skipRows)) {
+        return 0;
+    }
+#else
+    while (skipRows > 0) {
+        int readRows = (int)jpeg_read_scanlines(cinfo, scratch, (JDIMENSION)CL_MIN(batchRows, skipRows));
+        if (readRows == 0) {
+            return 0;
+        }
+        skipRows -= readRows;
+    }
+#endif
+
+    int components = cinfo->output_components;
+    int rowBytes = image->width * CL_CHANNELS_PER_PIXEL;
+    int rowsWritten = 0;
+    while (rowsWritten < image->height) {
+        int readRows = (int)jpeg_read_scanlines(cinfo, scratch, (JDIMENSION)CL_MIN(batchRows, image->height - rowsWritten));
+        if (readRows == 0) {
+            break;
+        }
+        for (int j = 0; j < readRows; ++j) {
+            uint8_t * dst = &image->pixelsU8[(size_t)(rowsWritten + j) * rowBytes];
+            const uint8_t * src = scratch[j] + ((size_t)srcX * components);
+            if (components == CL_CHANNELS_PER_PIXEL) {
+                memcpy(dst, src, rowBytes);
+            } else {
+                for (int i = 0; i < image->width; ++i) {
+                    dst[(i * 4) + 0] = src[(i * 3) + 0];
+                    dst[(i * 4) + 1] = src[(i * 3) + 1];
+                    dst[(i * 4) + 2] = src[(i * 3) + 2];
+                    dst[(i * 4) + 3] = 255;
+                }
+            }
+        }
+        rowsWritten += readRows;
+    }
+    return rowsWritten;
+}
+
+// Byte offsets of the restart intervals of a single scan baseline JPEG, used to decode horizontal bands
+// of MCU rows independently. Restart markers reset the DC predictors, so every interval can be handed
+// to a fresh decoder as long as its markers are renumbered to start at RST0.
+typedef struct clJPGSegments
+{
+    size_t headerSize;      // SOI up to and including the SOS segment
+    size_t sofHeightOffset; // offset of the (big endian) image height in the SOF segment
+    int intervalCount;
+    size_t * intervalStarts;
+    size_t * intervalEnds;
+    int intervalRows; // pixel rows per restart interval
+} clJPGSegments;
+
+static clBool findJPGSegments(struct clContext * C, clRaw * input, clJPGSegments * segments)
+{
+    const uint8_t * p = input->ptr;
+    size_t size = input->size;
+    size_t sofHeightOffset = 0;
+    size_t pos = 2; // skip SOI
+    for (;;) {
+        if ((pos + 4) > size) {
+            return clFalse;
+        }
+        if (p[pos] != 0xFF) {
+            return clFalse;
+        }
+        uint8_t marker = p[pos + 1];
+        if (marker == 0xFF) {
+            ++pos; // fill byte
+            continue;
+        }
+        size_t segmentLength = ((size_t)p[pos + 2] << 8) | p[pos + 3];
+        if ((pos + 2 + segmentLength) > size) {
+            return clFalse;
+        }
+        if ((marker == 0xC0) || (marker == 0xC1)) { // baseline / extended sequential Huffman
+            sofHeightOffset = pos + 5;
+        } else if ((marker >= 0xC2) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC)) {
+            return clFalse; // progressive, lossless, arithmetic, ...
+        }
+        pos += 2 + segmentLength;
+        if (marker == 0xDA) {
+            break;
+        }
+    }
+    if (sofHeightOffset == 0) {
+        return clFalse;
+    }
+
+    // Count the restart markers in the entropy coded data
+    int intervalCount = 1;
+    for (size_t i = pos; (i + 1) < size; ++i) {
+        if ((p[i] == 0xFF) && (p[i + 1] >= 0xD0) && (p[i + 1] <= 0xD7)) {
+            ++intervalCount;
+        }
+    }
+
+    segments->headerSize = pos;
+    segments->sofHeightOffset = sofHeightOffset;
+    segments->intervalStarts = clAllocate(sizeof(size_t) * intervalCount);
+    segments->intervalEnds = clAllocate(sizeof(size_t) * intervalCount);
+
+    int intervalIndex = 0;
+    segments->intervalStarts[0] = pos;
+    for (size_t i = pos; (i + 1) < size; ++i) {
+        if (p[i] != 0xFF) {
+            continue;
+        }
+        uint8_t marker = p[i + 1];
+        if ((marker == 0x00) || (marker == 0xFF)) {
+            continue; // stuffed zero or fill byte
+        }
+        if ((marker >= 0xD0) && (marker <= 0xD7)) {
+            if ((marker != (0xD0 + (intervalIndex & 7))) || ((intervalIndex + 1) >= intervalCount)) {
+                break; // out of sequence, let the regular decoder cope
+            }
+            segments->intervalEnds[intervalIndex] = i;
+            ++intervalIndex;
+            segments->intervalStarts[intervalIndex] = i + 2;
+            ++i;
+            continue;
+        }
+        if (marker == 0xD9) {
+            segments->intervalEnds[intervalIndex] = i;
+            segments->intervalCount = intervalIndex + 1;
+            return clTrue;
+        }
+        break; // DNL, a second scan or garbage
+    }
+
+    clFree(segments->intervalStarts);
+    clFree(segments->intervalEnds);
+    segments->intervalStarts = NULL;
+    segments->intervalEnds = NULL;
+    return clFalse;
+}
+
+typedef struct clJPGSegmentTask
+{
+    clContext * C;
+    clRaw * input;
+    clJPGSegments * segments;
+    clImage * image;
+    int firstInterval; // decoded intervals, including one interval of overlap on each side
+    int lastInterval;  // (exclusive)
+    int skipRows;
+    int dstRow;
+    int rowCount;
+    clBool failed;
+} clJPGSegmentTask;
+
+static void decodeJPGSegmentTask(clJPGSegmentTask * info)
+{
+    clContext * C = info->C;
+    clJPGSegments * segments = info->segments;
+    const uint8_t * p = info->input->ptr;
+
+    // Build a standalone JPEG: the original headers (with a shorter height), the chosen intervals with their
+    // restart markers renumbered, and an EOI.
+    size_t streamSize = segments->headerSize + 2;
+    for (int i = info->firstInterval; i < info->lastInterval; ++i) {
+        streamSize += segments->intervalEnds[i] - segments->intervalStarts[i] + 2;
+    }
+    uint8_t * stream = clAllocate(streamSize);
+    memcpy(stream, p, segments->headerSize);
+    int streamHeight = CL_MIN(info->lastInterval * segments->intervalRows, info->image->height) - (info->firstInterval * segments->intervalRows);
+    stream[segments->sofHeightOffset] = (uint8_t)(streamHeight >> 8);
+    stream[segments->sofHeightOffset + 1] = (uint8_t)(streamHeight & 0xff);
+    size_t streamPos = segments->headerSize;
+    for (int i = info->firstInterval; i < info->lastInterval; ++i) {
+        size_t intervalSize = segments->intervalEnds[i] - segments->intervalStarts[i];
+        memcpy(&stream[streamPos], &p[segments->intervalStarts[i]], intervalSize);
+        streamPos += intervalSize;
+        stream[streamPos++] = 0xFF;
+        stream[streamPos++] = (i == (info->lastInterval - 1)) ? 0xD9 : (uint8_t)(0xD0 + ((i - info->firstInterval) & 7));
+    }
+
+    struct my_error_mgr jerr;
+    struct jpeg_decompress_struct cinfo;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        clFree(stream);
+        info->failed = clTrue;
+        return;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, stream, (unsigned long)streamSize);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JPG_READ_COLOR_SPACE;
+    jpeg_start_decompress(&cinfo);
+    int batchRows = CL_CLAMP(cinfo.rec_outbuf_height, 1, JPG_MAX_BATCH_ROWS);
+    JSAMPARRAY scratch = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * cinfo.output_components, batchRows);
+    if (readJPGRows(&cinfo, info->image, info->skipRows, info->dstRow, info->rowCount, scratch) != info->rowCount) {
+        info->failed = clTrue;
+    }
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    clFree(stream);
+}
+
+// Returns clTrue if the image was decoded across tasks. Expects cinfo to have just started decompressing.
+static clBool readJPGSegments(struct clContext * C, struct jpeg_decompress_struct * cinfo, clRaw * input, clImage * image)
+{
+    if ((C->jobs < 2) || (cinfo->restart_interval == 0) || cinfo->progressive_mode || cinfo->arith_code ||
+        (cinfo->comps_in_scan != cinfo->num_components) || (cinfo->output_width != cinfo->image_width) ||
+        (cinfo->output_height != cinfo->image_height)) {
+        return clFalse;
+    }
+
+    // Only split on whole MCU rows
+    int mcuWidth = cinfo->max_h_samp_factor * DCTSIZE;
+    int mcuHeight = cinfo->max_v_samp_factor * DCTSIZE;
+    if ((((int)cinfo->image_width + mcuWidth - 1) / mcuWidth != (int)cinfo->MCUs_per_row) ||
+        (((int)cinfo->image_height + mcuHeight - 1) / mcuHeight != (int)cinfo->MCU_rows_in_scan) ||
+        ((cinfo->restart_interval % cinfo->MCUs_per_row) != 0)) {
+        return clFalse;
+    }
+
+    clJPGSegments segments;
+    memset(&segments, 0, sizeof(segments));
+    if (!findJPGSegments(C, input, &segments)) {
+        return clFalse;
+    }
+    segments.intervalRows = (int)(cinfo->restart_interval / cinfo->MCUs_per_row) * mcuHeight;
+    int expectedIntervals = (image->height + segments.intervalRows - 1) / segments.intervalRows;
+    int taskCount = CL_MIN(C->jobs, segments.intervalCount);
+    if ((segments.intervalCount != expectedIntervals) || (taskCount < 2)) {
+        clFree(segments.intervalStarts);
+        clFree(segments.intervalEnds);
+        return clFalse;
+    }
+    clContextLog(C, "jpg", 1, "Decoding %d restart intervals across %d tasks", segments.intervalCount, taskCount);
+
+    clJPGSegmentTask * infos = clAllocate(taskCount * sizeof(clJPGSegmentTask));
+    clTask ** tasks = clAllocate(taskCount * sizeof(clTask *));
+    for (int i = 0; i < taskCount; ++i) {
+        // One interval of overlap on either side keeps chroma upsampling identical to a serial decode
+        int first = (segments.intervalCount * i) / taskCount;
+        int last = (segments.intervalCount * (i + 1)) / taskCount;
+        clJPGSegmentTask * info = &infos[i];
+        info->C = C;
+        info->input = input;
+        info->segments = &segments;
+        info->image = image;
+        info->firstInterval = CL_MAX(first - 1, 0);
+        info->lastInterval = CL_MIN(last + 1, segments.intervalCount);
+        info->skipRows = (first - info->firstInterval) * segments.intervalRows;
+        info->dstRow = first * segments.intervalRows;
+        info->rowCount = CL_MIN(last * segments.intervalRows, image->height) - info->dstRow;
+        info->failed = clFalse;
+    }
+    for (int i = 1; i < taskCount; ++i) {
+        tasks[i] = clTaskCreate(C, (clTaskFunc)decodeJPGSegmentTask, &infos[i]);
+    }
+    decodeJPGSegmentTask(&infos[0]);
+    clBool failed = infos[0].failed;
+    for (int i = 1; i < taskCount; ++i) {
+        clTaskDestroy(C, tasks[i]);
+        failed = failed || infos[i].failed;
+    }
+    clFree(tasks);
+    clFree(infos);
+    clFree(segments.intervalStarts);
+    clFree(segments.intervalEnds);
+
+    if (failed) {
+        clContextLog(C, "jpg", 1, "Restart interval decode failed, falling back to a serial decode");
+        return clFalse;
+    }
+    return clTrue;
+}
+
+struct clImage * clFormatReadJPG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint)
 {
     COLORIST_UNUSED(formatName);
 
     clImage * image = NULL;
+    int rect[4];
+    clBool cropping = clFalse;
+    int reduction = 0;
 
     struct my_error_mgr jerr;
     struct jpeg_decompress_struct cinfo;
@@ -64,11 +414,48 @@ struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName,
     setup_read_icc_profile(&cinfo);
     jpeg_mem_src(&cinfo, input->ptr, (unsigned long)input->size);
     jpeg_read_header(&cinfo, TRUE);
-    cinfo.out_color_space = JCS_RGB;
+    cinfo.out_color_space = JPG_READ_COLOR_SPACE;
+    if (hint) {
+        // DCT scaling lets the IDCT produce a 1/2, 1/4 or 1/8 scale image directly
+        cropping = clReadHintRect(C, hint, (int)cinfo.image_width, (int)cinfo.image_height, rect);
+        reduction = clReadHintReduction(C, hint, rect[0], rect[1], rect[2], rect[3], 3);
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1U << reduction;
+    }
     jpeg_start_decompress(&cinfo);
 
-    int row_stride = cinfo.output_width * cinfo.output_components;
-    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
+    // The region in output (scaled) pixels, rounded the same way as the output size
+    int regionX = 0;
+    int regionY = 0;
+    int regionW = (int)cinfo.output_width;
+    int regionH = (int)cinfo.output_height;
+    int srcX = 0;
+    if (cropping) {
+        int scale = 1 << reduction;
+        regionX = CL_MIN((rect[0] + scale - 1) >> reduction, (int)cinfo.output_width - 1);
+        regionY = CL_MIN((rect[1] + scale - 1) >> reduction, (int)cinfo.output_height - 1);
+        regionW = CL_MAX(CL_MIN((rect[0] + rect[2] + scale - 1) >> reduction, (int)cinfo.output_width) - regionX, 1);
+        regionH = CL_MAX(CL_MIN((rect[1] + rect[3] + scale - 1) >> reduction, (int)cinfo.output_height) - regionY, 1);
+        srcX = regionX;
+#ifdef LIBJPEG_TURBO_VERSION
+        // The crop is widened to the left to an iMCU boundary, and output_width shrinks to match
+        JDIMENSION cropX = (JDIMENSION)regionX;
+        JDIMENSION cropW = (JDIMENSION)regionW;
+        jpeg_crop_scanline(&cinfo, &cropX, &cropW);
+        srcX = regionX - (int)cropX;
+#endif
+    }
+    if (hint) {
+        if (cropping || (reduction > 0)) {
+            clContextLog(C, "jpg", 1, "Decoding +%d+%d %dx%d at 1/%d scale", rect[0], rect[1], rect[2], rect[3], 1 << reduction);
+        }
+        C->readExtraInfo.hintApplied = clTrue;
+        memcpy(C->readExtraInfo.hintRect, rect, sizeof(rect));
+        C->readExtraInfo.hintReduction = reduction;
+    }
+
+    int batchRows = CL_CLAMP(cinfo.rec_outbuf_height, 1, JPG_MAX_BATCH_ROWS);
+    JSAMPARRAY scratch = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * cinfo.output_components, batchRows);
 
     clProfile * profile = NULL;
     if (overrideProfile) {
@@ -87,36 +474,92 @@ struct clImage * clFormatReadJPG(struct clContext * C, const char * formatName,
         }
     }
 
-    clImageLogCreate(C, cinfo.output_width, cinfo.output_height, 8, profile);
-    image = clImageCreate(C, cinfo.output_width, cinfo.output_height, 8, profile);
+    clImageLogCreate(C, regionW, regionH, 8, profile);
+    image = clImageCreate(C, regionW, regionH, 8, profile);
     clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
 
     if (profile) {
         clProfileDestroy(C, profile);
     }
 
-    int row = 0;
-    while (cinfo.output_scanline < cinfo.output_height) {
-        jpeg_read_scanlines(&cinfo, buffer, 1);
-        uint8_t * pixelRow = &image->pixelsU8[row * image->width * CL_CHANNELS_PER_PIXEL];
-        for (unsigned int i = 0; i < cinfo.output_width; ++i) {
-            uint8_t * dst = &pixelRow[i * CL_CHANNELS_PER_PIXEL];
-            uint8_t * src = &buffer[0][i * 3];
-            dst[0] = src[0];
-            dst[1] = src[1];
-            dst[2] = src[2];
-            dst[3] = 255;
-        }
-        ++row;
+    if (cropping) {
+        // Rows below the region are never decoded
+        readJPGRegion(&cinfo, image, srcX, regionY, scratch);
+        jpeg_abort_decompress(&cinfo);
+    } else if (readJPGSegments(C, &cinfo, input, image)) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        readJPGRows(&cinfo, image, 0, 0, image->height, scratch);
+        jpeg_finish_decompress(&cinfo);
     }
-
-    jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
 
     C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
     return image;
 }
 
+// Compressed output goes straight into the destination clRaw, growing it as needed
+#define JPG_WRITE_INITIAL_SIZE (64 * 1024)
+typedef struct clJPGDestination
+{
+    struct jpeg_destination_mgr pub;
+    struct clContext * C;
+    clRaw * dst;
+    size_t offset; // bytes handed over to dst before the current free_in_buffer window
+} clJPGDestination;
+
+static void jpgDestinationInit(j_compress_ptr cinfo)
+{
+    clJPGDestination * dest = (clJPGDestination *)cinfo->dest;
+    clRawRealloc(dest->C, dest->dst, JPG_WRITE_INITIAL_SIZE);
+    dest->offset = 0;
+    dest->pub.next_output_byte = dest->dst->ptr;
+    dest->pub.free_in_buffer = dest->dst->size;
+}
+
+static boolean jpgDestinationEmpty(j_compress_ptr cinfo)
+{
+    // libjpeg only calls this once the whole buffer is full
+    clJPGDestination * dest = (clJPGDestination *)cinfo->dest;
+    size_t used = dest->dst->size;
+    clRawRealloc(dest->C, dest->dst, used * 2);
+    dest->pub.next_output_byte = dest->dst->ptr + used;
+    dest->pub.free_in_buffer = dest->dst->size - used;
+    return TRUE;
+}
+
+static void jpgDestinationTerm(j_compress_ptr cinfo)
+{
+    clJPGDestination * dest = (clJPGDestination *)cinfo->dest;
+    dest->offset = dest->dst->size - dest->pub.free_in_buffer;
+}
+
+static void jpgSetSubsampling(struct clContext * C, struct jpeg_compress_struct * cinfo, clYUVFormat yuvFormat)
+{
+    int hSamp = 1;
+    int vSamp = 1;
+    switch (yuvFormat) {
+        case CL_YUVFORMAT_420:
+            hSamp = 2;
+            vSamp = 2;
+            break;
+        case CL_YUVFORMAT_422:
+            hSamp = 2;
+            break;
+        case CL_YUVFORMAT_400:
+            jpeg_set_colorspace(cinfo, JCS_GRAYSCALE);
+            break;
+        case CL_YUVFORMAT_444:
+            break;
+        case CL_YUVFORMAT_INVALID:
+        default:
+            return; // keep libjpeg's default
+    }
+    cinfo->comp_info[0].h_samp_factor = hSamp;
+    cinfo->comp_info[0].v_samp_factor = vSamp;
+    clContextLog(C, "jpg", 1, "Chroma subsampling: %s", clYUVFormatToString(C, yuvFormat));
+}
+
 clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams)
 {
     COLORIST_UNUSED(formatName);
@@ -124,11 +567,6 @@ clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
 
-    JSAMPROW row_pointer[1];
-    int row_stride;
-    unsigned char * outbuffer = NULL;
-    unsigned long outsize = 0;
-
     clRaw rawProfile = CL_RAW_EMPTY;
     if (!clProfilePack(C, image->profile, &rawProfile)) {
         return clFalse;
@@ -136,52 +574,98 @@ clBool clFormatWriteJPG(struct clContext * C, struct clImage * image, const char
 
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_compress(&cinfo);
-    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
 
-    clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
+    clJPGDestination dest;
+    dest.pub.init_destination = jpgDestinationInit;
+    dest.pub.empty_output_buffer = jpgDestinationEmpty;
+    dest.pub.term_destination = jpgDestinationTerm;
+    dest.C = C;
+    dest.dst = output;
+    dest.offset = 0;
+    cinfo.dest = &dest.pub;
 
-    int pixelCount = image->width * image->height;
-    uint8_t * jpegPixels = clAllocate(3 * pixelCount);
-    for (int i = 0; i < pixelCount; ++i) {
-        uint8_t * imagePixel = &image->pixelsU8[i * CL_CHANNELS_PER_PIXEL];
-        uint8_t * jpegPixel = &jpegPixels[i * 3];
-        jpegPixel[0] = imagePixel[0];
-        jpegPixel[1] = imagePixel[1];
-        jpegPixel[2] = imagePixel[2];
-    }
+    clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
 
     cinfo.image_width = image->width;
     cinfo.image_height = image->height;
+#ifdef JCS_EXTENSIONS
+    // libjpeg-turbo reads the RGBA rows in place, skipping the alpha byte
+    cinfo.input_components = CL_CHANNELS_PER_PIXEL;
+    cinfo.in_color_space = JCS_EXT_RGBX;
+#else
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_RGB;
+#endif
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, writeParams->quality, TRUE);
+    jpgSetSubsampling(C, &cinfo, writeParams->jpegSubsampling);
+    if (writeParams->jpegOptimize) {
+        cinfo.optimize_coding = TRUE;
+    }
+    if (writeParams->jpegProgressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+    if (writeParams->jpegTrellis) {
+#if defined(JPEG_C_PARAM_SUPPORTED)
+        // mozjpeg extension
+        if (jpeg_c_bool_param_supported(&cinfo, JBOOLEAN_TRELLIS_QUANT)) {
+            jpeg_c_set_bool_param(&cinfo, JBOOLEAN_TRELLIS_QUANT, TRUE);
+            jpeg_c_set_bool_param(&cinfo, JBOOLEAN_TRELLIS_QUANT_DC, TRUE);
+        }
+#else
+        clContextLog(C, "jpg", 1, "Trellis quantization isn't supported by this JPEG library, ignoring");
+#endif
+    }
+    clContextLog(C,
+                 "jpg",
+                 1,
+                 "Encoding: Q=%d%s%s",
+                 writeParams->quality,
+                 writeParams->jpegProgressive ? ", progressive" : "",
+                 writeParams->jpegOptimize ? ", optimized coding" : "");
     jpeg_start_compress(&cinfo, TRUE);
 
     if (writeParams->writeProfile) {
         write_icc_profile(&cinfo, rawProfile.ptr, (unsigned int)rawProfile.size);
     }
 
-    row_stride = image->width * 3;
+    int rowBytes = image->width * CL_CHANNELS_PER_PIXEL;
+#ifdef JCS_EXTENSIONS
+    JSAMPROW rowPointers[JPG_MAX_BATCH_ROWS];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int rowCount = CL_MIN(JPG_MAX_BATCH_ROWS, (int)(cinfo.image_height - cinfo.next_scanline));
+        for (int i = 0; i < rowCount; ++i) {
+            rowPointers[i] = &image->pixelsU8[(size_t)(cinfo.next_scanline + i) * rowBytes];
+        }
+        (void)jpeg_write_scanlines(&cinfo, rowPointers, (JDIMENSION)rowCount);
+    }
+#else
+    JSAMPROW rowPointer = (*cinfo.mem->alloc_small)((j_common_ptr)&cinfo, JPOOL_IMAGE, (size_t)image->width * 3);
     while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &jpegPixels[cinfo.next_scanline * row_stride];
-        (void)jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        const uint8_t * src = &image->pixelsU8[(size_t)cinfo.next_scanline * rowBytes];
+        uint8_t * dst = rowPointer;
+        for (int i = 0; i < image->width; ++i) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst += 3;
+            src += CL_CHANNELS_PER_PIXEL;
+        }
+        (void)jpeg_write_scanlines(&cinfo, &rowPointer, 1);
     }
+#endif
 
     jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    clRawFree(C, &rawProfile);
 
-    if (outbuffer && outsize) {
-        clRawSet(C, output, outbuffer, outsize);
-    } else {
+    if (!dest.offset) {
         clContextLogError(C, "ERROR: JPG compression failed");
         clRawFree(C, output);
+        return clFalse;
     }
-    free(outbuffer);
-
-    jpeg_destroy_compress(&cinfo);
-    clFree(jpegPixels);
-    clRawFree(C, &rawProfile);
-    return (output->size > 0) ? clTrue : clFalse;
+    output->size = dest.offset;
+    return clTrue;
 }
 
 // ----------------------------------------------------------------------------
@@ -42,15 +42,24 @@ static int DPK_QPS_16[11][6] = { { 197, 203, 210, 202, 207, 213 },
                                  { 16, 27, 33, 14, 27, 33 },
                                  { 5, 8, 9, 4, 7, 8 } };
 
-struct clImage * clFormatReadJXR(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadJXR(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWriteJXR(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct clImage * clFormatReadJXR(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+struct clImage * clFormatReadJXR(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint)
 {
     COLORIST_UNUSED(C);
     COLORIST_UNUSED(formatName);
     COLORIST_UNUSED(overrideProfile);
     COLORIST_UNUSED(input);
+    COLORIST_UNUSED(hint);
 
     clRaw rawProfile = CL_RAW_EMPTY;
     clProfile * profile = NULL;
@@ -9,67 +9,55 @@
 
 #include "colorist/context.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
 
 #include "png.h"
+#include "zlib.h"
 
+#include <stdlib.h>
 #include <string.h>
 
-struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadPNG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint);
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams);
 
-struct readInfo
-{
-    struct clContext * C;
-    clRaw * src;
-    png_size_t offset;
-};
+// Rows are reported through C->readRowsFunc in bands of this many rows
+#define PNG_READ_BAND_ROWS 16
 
-static void readCallback(png_structp png, png_bytep data, png_size_t length)
+// libpng's progressive reader is fed the whole input buffer in place; rows are copied straight
+// into the clImage as they are decoded, without a row pointer array.
+typedef struct clPNGReader
+{
+    clContext * C;
+    clProfile * overrideProfile;
+    clImage * image;
+    size_t rowBytes;
+    clBool interlaced;
+    int bandFirstRow; // first row not yet handed to C->readRowsFunc
+    clBool finished;
+    double fillSeconds;
+    double reportSeconds; // spent in C->readRowsFunc, not counted as decode time
+} clPNGReader;
+
+static void pngReportRows(clPNGReader * reader, int endRow)
 {
-    struct readInfo * ri = (struct readInfo *)png_get_io_ptr(png);
-    if ((ri->offset + length) <= ri->src->size) {
-        memcpy(data, ri->src->ptr + ri->offset, length);
+    clContext * C = reader->C;
+    if (C->readRowsFunc && (endRow > reader->bandFirstRow)) {
+        Timer t;
+        timerStart(&t);
+        C->readRowsFunc(C, reader->image, reader->bandFirstRow, endRow - reader->bandFirstRow, C->readRowsUserData);
+        reader->reportSeconds += timerElapsedSeconds(&t);
     }
-    ri->offset += length;
+    reader->bandFirstRow = endRow;
 }
 
-struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+static void pngInfoCallback(png_structp png, png_infop info)
 {
-    COLORIST_UNUSED(formatName);
-
-    clImage * image = NULL;
-    png_bytep * rowPointers = NULL;
-
-    if (png_sig_cmp(input->ptr, 0, 8)) {
-        clContextLogError(C, "not a PNG");
-        return NULL;
-    }
-
-    Timer t;
-    timerStart(&t);
-
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    png_infop info = png_create_info_struct(png);
-    COLORIST_ASSERT(png && info);
-
-    if (setjmp(png_jmpbuf(png))) {
-        if (rowPointers) {
-            clFree(rowPointers);
-        }
-        if (image) {
-            clImageDestroy(C, image);
-        }
-        png_destroy_read_struct(&png, &info, NULL);
-        return NULL;
-    }
-
-    struct readInfo ri;
-    ri.C = C;
-    ri.src = input;
-    ri.offset = 0;
-
-    png_set_read_fn(png, &ri, readCallback);
-    png_read_info(png, info);
+    clPNGReader * reader = (clPNGReader *)png_get_progressive_ptr(png);
+    clContext * C = reader->C;
 
     clProfile * profile = NULL;
 
@@ -78,8 +66,8 @@ struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName,
     unsigned char * iccpData;
     png_uint_32 iccpDataLen;
 
-    if (overrideProfile) {
-        profile = clProfileClone(C, overrideProfile);
+    if (reader->overrideProfile) {
+        profile = clProfileClone(C, reader->overrideProfile);
     } else if (png_get_iCCP(png, info, &iccpProfileName, &iccpCompression, &iccpData, &iccpDataLen) == PNG_INFO_iCCP) {
         profile = clProfileParse(C, iccpData, iccpDataLen, iccpProfileName);
     }
@@ -117,31 +105,104 @@ struct clImage * clFormatReadPNG(struct clContext * C, const char * formatName,
         imgBytesPerChannel = 2;
     }
 
+    reader->interlaced = (png_set_interlace_handling(png) > 1) ? clTrue : clFalse;
     png_read_update_info(png, info);
 
     clImageLogCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
-    image = clImageCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
+    reader->image = clImageCreate(C, rawWidth, rawHeight, imgBitDepth, profile);
     if (profile) {
         clProfileDestroy(C, profile);
     }
-    rowPointers = (png_bytep *)clAllocate(sizeof(png_bytep) * rawHeight);
-    if (imgBytesPerChannel == 1) {
-        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
-        for (int y = 0; y < rawHeight; ++y) {
-            rowPointers[y] = &image->pixelsU8[CL_CHANNELS_PER_PIXEL * y * rawWidth];
-        }
+    clImagePrepareWritePixels(C, reader->image, (imgBytesPerChannel == 1) ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16);
+    reader->rowBytes = (size_t)rawWidth * CL_CHANNELS_PER_PIXEL * imgBytesPerChannel;
+}
+
+static void pngRowCallback(png_structp png, png_bytep newRow, png_uint_32 rowNum, int pass)
+{
+    COLORIST_UNUSED(pass);
+
+    clPNGReader * reader = (clPNGReader *)png_get_progressive_ptr(png);
+    clImage * image = reader->image;
+    if (!newRow || ((int)rowNum >= image->height)) {
+        return;
+    }
+
+    Timer t;
+    timerStart(&t);
+    uint8_t * pixels = (image->depth == 16) ? (uint8_t *)image->pixelsU16 : image->pixelsU8;
+    png_bytep dstRow = pixels + (reader->rowBytes * rowNum);
+    if (reader->interlaced) {
+        png_progressive_combine_row(png, dstRow, newRow);
     } else {
-        clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
-        for (int y = 0; y < rawHeight; ++y) {
-            rowPointers[y] = (png_byte *)&image->pixelsU16[CL_CHANNELS_PER_PIXEL * y * rawWidth];
+        memcpy(dstRow, newRow, reader->rowBytes);
+    }
+    reader->fillSeconds += timerElapsedSeconds(&t);
+
+    // Interlaced rows aren't final until the last pass, those are reported by pngEndCallback
+    if (!reader->interlaced) {
+        int endRow = (int)rowNum + 1;
+        if (((endRow - reader->bandFirstRow) >= PNG_READ_BAND_ROWS) || (endRow == image->height)) {
+            pngReportRows(reader, endRow);
+        }
+    }
+}
+
+static void pngEndCallback(png_structp png, png_infop info)
+{
+    COLORIST_UNUSED(info);
+
+    clPNGReader * reader = (clPNGReader *)png_get_progressive_ptr(png);
+    if (reader->image) {
+        pngReportRows(reader, reader->image->height);
+    }
+    reader->finished = clTrue;
+}
+
+struct clImage * clFormatReadPNG(struct clContext * C,
+                                 const char * formatName,
+                                 struct clProfile * overrideProfile,
+                                 struct clRaw * input,
+                                 const struct clReadHint * hint)
+{
+    COLORIST_UNUSED(formatName);
+    COLORIST_UNUSED(hint);
+
+    if ((input->size < 8) || png_sig_cmp(input->ptr, 0, 8)) {
+        clContextLogError(C, "not a PNG");
+        return NULL;
+    }
+
+    Timer t;
+    timerStart(&t);
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    COLORIST_ASSERT(png && info);
+
+    clPNGReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.C = C;
+    reader.overrideProfile = overrideProfile;
+
+    if (setjmp(png_jmpbuf(png))) {
+        if (reader.image) {
+            clImageDestroy(C, reader.image);
         }
+        png_destroy_read_struct(&png, &info, NULL);
+        return NULL;
+    }
+
+    png_set_progressive_read_fn(png, &reader, pngInfoCallback, pngRowCallback, pngEndCallback);
+    png_process_data(png, info, input->ptr, input->size);
+    if (!reader.finished) {
+        png_error(png, "truncated PNG");
     }
-    png_read_image(png, rowPointers);
-    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
+
+    C->readExtraInfo.decodeFillSeconds = reader.fillSeconds;
+    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t) - reader.fillSeconds - reader.reportSeconds;
 
     png_destroy_read_struct(&png, &info, NULL);
-    clFree(rowPointers);
-    return image;
+    return reader.image;
 }
 
 struct writeInfo
@@ -167,10 +228,362 @@ static void writeCallback(png_structp png, png_bytep data, png_size_t length)
     wi->offset += length;
 }
 
+// Maps to libpng's PNG_FILTER_* flags; -1 means "leave libpng's default alone"
+static int pngFilterFlags(clPNGFilter filter)
+{
+    switch (filter) {
+        case CL_PNGFILTER_NONE:
+            return PNG_FILTER_NONE;
+        case CL_PNGFILTER_SUB:
+            return PNG_FILTER_SUB;
+        case CL_PNGFILTER_UP:
+            return PNG_FILTER_UP;
+        case CL_PNGFILTER_AVG:
+            return PNG_FILTER_AVG;
+        case CL_PNGFILTER_PAETH:
+            return PNG_FILTER_PAETH;
+        case CL_PNGFILTER_ALL:
+            return PNG_ALL_FILTERS;
+        case CL_PNGFILTER_AUTO:
+        case CL_PNGFILTER_INVALID:
+        default:
+            break;
+    }
+    return -1;
+}
+
+static int pngZlibStrategy(clPNGStrategy strategy, int filterFlags)
+{
+    switch (strategy) {
+        case CL_PNGSTRATEGY_RLE:
+            return Z_RLE;
+        case CL_PNGSTRATEGY_HUFFMAN:
+            return Z_HUFFMAN_ONLY;
+        case CL_PNGSTRATEGY_DEFAULT:
+        default:
+            break;
+    }
+    // Matches libpng: filtered rows compress better with Z_FILTERED
+    return (filterFlags == PNG_FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parallel deflate
+//
+// Each stripe of rows is filtered and deflated on its own thread as a raw deflate stream, primed
+// with the (re-filtered) 32k of data preceding it as a dictionary, and ended with a sync flush so
+// the stripes can simply be concatenated. The zlib header and the combined adler32 are added
+// around them, and the result is written out as IDAT chunks.
+
+#define PNG_WINDOW_SIZE (32 * 1024)
+#define PNG_MIN_STRIPE_ROWS 32
+
+typedef struct clPNGStripeTask
+{
+    clContext * C;
+    clImage * image;
+    int firstRow;
+    int rowCount;
+    int level;
+    int strategy;
+    int filterFlags;
+    size_t prefixBytes; // space left at the front of deflated (zlib header)
+    size_t suffixBytes; // space left at the end of deflated (adler32)
+
+    clRaw deflated;
+    size_t deflatedSize;
+    uLong adler;
+    size_t filteredSize;
+    clBool failed;
+} clPNGStripeTask;
+
+static int pngPaeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if ((pa <= pb) && (pa <= pc))
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+// Writes the filter type byte followed by the filtered row into out. prior is NULL on the first row.
+static void pngFilterRow(int filterValue, uint8_t * out, const uint8_t * row, const uint8_t * prior, size_t rowBytes, int bpp)
+{
+    uint8_t * dst = out + 1;
+    out[0] = (uint8_t)filterValue;
+    for (size_t i = 0; i < rowBytes; ++i) {
+        int a = (i >= (size_t)bpp) ? row[i - bpp] : 0;
+        int b = prior ? prior[i] : 0;
+        int c = (prior && (i >= (size_t)bpp)) ? prior[i - bpp] : 0;
+        int predicted;
+        switch (filterValue) {
+            case PNG_FILTER_VALUE_SUB:
+                predicted = a;
+                break;
+            case PNG_FILTER_VALUE_UP:
+                predicted = b;
+                break;
+            case PNG_FILTER_VALUE_AVG:
+                predicted = (a + b) >> 1;
+                break;
+            case PNG_FILTER_VALUE_PAETH:
+                predicted = pngPaeth(a, b, c);
+                break;
+            case PNG_FILTER_VALUE_NONE:
+            default:
+                predicted = 0;
+                break;
+        }
+        dst[i] = (uint8_t)(row[i] - predicted);
+    }
+}
+
+// Filters a row with every filter allowed by filterFlags, and returns the candidate (in scratch)
+// with the smallest sum of absolute signed residuals, the same heuristic libpng uses.
+static const uint8_t * pngFilterRowAdaptive(int filterFlags, uint8_t * scratch, const uint8_t * row, const uint8_t * prior, size_t rowBytes, int bpp)
+{
+    static const int filterBits[5] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+
+    const uint8_t * best = NULL;
+    uint64_t bestSum = 0;
+    for (int filterValue = 0; filterValue < 5; ++filterValue) {
+        if (!(filterFlags & filterBits[filterValue])) {
+            continue;
+        }
+        uint8_t * candidate = scratch + (filterValue * (rowBytes + 1));
+        pngFilterRow(filterValue, candidate, row, prior, rowBytes, bpp);
+        if (filterFlags == filterBits[filterValue]) {
+            return candidate;
+        }
+
+        uint64_t sum = 0;
+        for (size_t i = 1; i <= rowBytes; ++i) {
+            sum += (uint64_t)abs((int8_t)candidate[i]);
+        }
+        if (!best || (sum < bestSum)) {
+            best = candidate;
+            bestSum = sum;
+        }
+    }
+    return best;
+}
+
+// Returns row y as the big-endian bytes PNG expects, using scratch when the layout differs
+static const uint8_t * pngStripeRow(clImage * image, int y, uint8_t * scratch)
+{
+    int channelCount = image->width * CL_CHANNELS_PER_PIXEL;
+    if (image->depth == 8) {
+        return &image->pixelsU8[channelCount * y];
+    }
+    const uint16_t * src = &image->pixelsU16[channelCount * y];
+    for (int i = 0; i < channelCount; ++i) {
+        scratch[(i * 2) + 0] = (uint8_t)(src[i] >> 8);
+        scratch[(i * 2) + 1] = (uint8_t)(src[i] & 0xff);
+    }
+    return scratch;
+}
+
+static clBool pngStripeDeflate(clPNGStripeTask * task, z_stream * z, const uint8_t * data, size_t size, int flush)
+{
+    clContext * C = task->C;
+
+    z->next_in = (Bytef *)data;
+    z->avail_in = (uInt)size;
+    for (;;) {
+        size_t capacity = task->deflated.size - task->suffixBytes;
+        if (task->deflatedSize == capacity) {
+            clRawRealloc(C, &task->deflated, task->deflated.size * 2);
+            capacity = task->deflated.size - task->suffixBytes;
+        }
+        uInt availOut = (uInt)(capacity - task->deflatedSize);
+        z->next_out = task->deflated.ptr + task->deflatedSize;
+        z->avail_out = availOut;
+        int ret = deflate(z, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return clFalse;
+        }
+        task->deflatedSize += availOut - z->avail_out;
+
+        if (flush == Z_FINISH) {
+            if (ret == Z_STREAM_END) {
+                break;
+            }
+        } else if ((z->avail_in == 0) && (z->avail_out != 0)) {
+            break;
+        }
+    }
+    return clTrue;
+}
+
+static void pngStripeTaskFunc(clPNGStripeTask * task)
+{
+    clContext * C = task->C;
+    clImage * image = task->image;
+    int bpp = CL_CHANNELS_PER_PIXEL * ((image->depth == 16) ? 2 : 1);
+    size_t rowBytes = (size_t)image->width * bpp;
+    size_t filteredRowBytes = rowBytes + 1;
+    int lastRow = task->firstRow + task->rowCount - 1;
+
+    // Re-filter just enough of the previous stripe to prime the deflate window with
+    int dictRows = 0;
+    if (task->firstRow > 0) {
+        dictRows = (int)((PNG_WINDOW_SIZE + filteredRowBytes - 1) / filteredRowBytes);
+        dictRows = CL_MIN(dictRows, task->firstRow);
+    }
+
+    uint8_t * rowScratch = clAllocate(rowBytes * 2);
+    uint8_t * filterScratch = clAllocate(filteredRowBytes * 5);
+    uint8_t * dict = dictRows ? clAllocate(filteredRowBytes * dictRows) : NULL;
+    size_t dictSize = 0;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, task->level, Z_DEFLATED, -15, 8, task->strategy) != Z_OK) {
+        task->failed = clTrue;
+        goto stripeCleanup;
+    }
+
+    size_t stripeBytes = filteredRowBytes * task->rowCount;
+    clRawRealloc(C, &task->deflated, task->prefixBytes + deflateBound(&z, (uLong)stripeBytes) + 64 + task->suffixBytes);
+    task->deflatedSize = task->prefixBytes;
+    task->adler = adler32(0, NULL, 0);
+    task->filteredSize = 0;
+
+    // The dictionary has to match the bytes the previous stripe actually deflated, so its first row is
+    // filtered against the real row above it too
+    int firstDictRow = task->firstRow - dictRows;
+    const uint8_t * prior = NULL;
+    if (firstDictRow > 0) {
+        prior = pngStripeRow(image, firstDictRow - 1, rowScratch + (((firstDictRow - 1) & 1) * rowBytes));
+    }
+    for (int y = firstDictRow; y <= lastRow; ++y) {
+        // Alternate scratch rows so the prior row survives 16-bit swapping
+        const uint8_t * row = pngStripeRow(image, y, rowScratch + ((y & 1) * rowBytes));
+        const uint8_t * filtered = pngFilterRowAdaptive(task->filterFlags, filterScratch, row, prior, rowBytes, bpp);
+
+        if (y < task->firstRow) {
+            memcpy(dict + dictSize, filtered, filteredRowBytes);
+            dictSize += filteredRowBytes;
+        } else {
+            if ((y == task->firstRow) && dictSize) {
+                size_t windowBytes = CL_MIN(dictSize, PNG_WINDOW_SIZE);
+                deflateSetDictionary(&z, dict + dictSize - windowBytes, (uInt)windowBytes);
+            }
+            task->adler = adler32(task->adler, filtered, (uInt)filteredRowBytes);
+            task->filteredSize += filteredRowBytes;
+            if (!pngStripeDeflate(task, &z, filtered, filteredRowBytes, Z_NO_FLUSH)) {
+                task->failed = clTrue;
+                break;
+            }
+        }
+
+        prior = row;
+    }
+    if (!task->failed) {
+        // The last stripe finishes the deflate stream, every other one ends on a byte boundary
+        int flush = task->suffixBytes ? Z_FINISH : Z_SYNC_FLUSH;
+        if (!pngStripeDeflate(task, &z, NULL, 0, flush)) {
+            task->failed = clTrue;
+        }
+    }
+    deflateEnd(&z);
+
+stripeCleanup:
+    if (dict) {
+        clFree(dict);
+    }
+    clFree(filterScratch);
+    clFree(rowScratch);
+}
+static void pngZlibHeader(uint8_t * out, int level, int strategy)
+{
+    // Same FLEVEL hint zlib itself would write
+    int levelHint = 3;
+    if (level == Z_DEFAULT_COMPRESSION) {
+        level = 6;
+    }
+    if ((strategy >= Z_HUFFMAN_ONLY) || (level < 2)) {
+        levelHint = 0;
+    } else if (level < 6) {
+        levelHint = 1;
+    } else if (level == 6) {
+        levelHint = 2;
+    }
+    unsigned int header = (0x78 << 8) | (levelHint << 6); // deflate, 32k window
+    header += 31 - (header % 31);
+    out[0] = (uint8_t)(header >> 8);
+    out[1] = (uint8_t)(header & 0xff);
+}
+
+static void pngWriteStripes(clContext * C, png_structp png, clImage * image, int level, int strategy, int filterFlags, int stripeCount)
+{
+    clPNGStripeTask * tasks = clAllocate(stripeCount * sizeof(clPNGStripeTask));
+    memset(tasks, 0, stripeCount * sizeof(clPNGStripeTask));
+    int rowsPerStripe = image->height / stripeCount;
+    for (int i = 0; i < stripeCount; ++i) {
+        clPNGStripeTask * task = &tasks[i];
+        task->C = C;
+        task->image = image;
+        task->firstRow = i * rowsPerStripe;
+        task->rowCount = (i == (stripeCount - 1)) ? (image->height - task->firstRow) : rowsPerStripe;
+        task->level = level;
+        task->strategy = strategy;
+        task->filterFlags = filterFlags;
+        task->prefixBytes = (i == 0) ? 2 : 0;
+        task->suffixBytes = (i == (stripeCount - 1)) ? 4 : 0;
+    }
+
+    clTask ** threads = clAllocate(stripeCount * sizeof(clTask *));
+    for (int i = 0; i < stripeCount; ++i) {
+        threads[i] = clTaskCreate(C, (clTaskFunc)pngStripeTaskFunc, &tasks[i]);
+    }
+    for (int i = 0; i < stripeCount; ++i) {
+        clTaskDestroy(C, threads[i]);
+    }
+    clFree(threads);
+
+    clBool failed = clFalse;
+    uLong adler = adler32(0, NULL, 0);
+    for (int i = 0; i < stripeCount; ++i) {
+        failed = failed || tasks[i].failed;
+        adler = adler32_combine(adler, tasks[i].adler, (z_off_t)tasks[i].filteredSize);
+    }
+
+    if (!failed) {
+        clPNGStripeTask * lastTask = &tasks[stripeCount - 1];
+        pngZlibHeader(tasks[0].deflated.ptr, level, strategy);
+        png_save_uint_32(lastTask->deflated.ptr + lastTask->deflatedSize, (png_uint_32)adler);
+        lastTask->deflatedSize += 4;
+
+        for (int i = 0; i < stripeCount; ++i) {
+            const uint8_t * data = tasks[i].deflated.ptr;
+            size_t remaining = tasks[i].deflatedSize;
+            while (remaining > 0) {
+                size_t chunkSize = CL_MIN(remaining, PNG_UINT_31_MAX);
+                png_write_chunk(png, (png_const_bytep) "IDAT", data, chunkSize);
+                data += chunkSize;
+                remaining -= chunkSize;
+            }
+        }
+    }
+
+    for (int i = 0; i < stripeCount; ++i) {
+        clRawFree(C, &tasks[i].deflated);
+    }
+    clFree(tasks);
+
+    if (failed) {
+        png_error(png, "parallel deflate failed");
+    }
+}
+
 clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams)
 {
     COLORIST_UNUSED(formatName);
-    COLORIST_UNUSED(writeParams);
 
     png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     png_infop info = png_create_info_struct(png);
@@ -198,12 +611,49 @@ clBool clFormatWritePNG(struct clContext * C, struct clImage * image, const char
     wi.dst = output;
     png_set_write_fn(png, &wi, writeCallback, NULL);
 
+    int filterFlags = pngFilterFlags(writeParams->pngFilter);
+    if (filterFlags != -1) {
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, filterFlags);
+    } else {
+        filterFlags = PNG_ALL_FILTERS; // libpng's default for 8/16 bit RGBA
+    }
+    int level = (writeParams->pngCompressionLevel >= 0) ? writeParams->pngCompressionLevel : Z_DEFAULT_COMPRESSION;
+    int strategy = pngZlibStrategy(writeParams->pngStrategy, filterFlags);
+    png_set_compression_level(png, level);
+    png_set_compression_strategy(png, strategy);
+
+    int stripeCount = 1;
+    if (writeParams->pngParallel) {
+        stripeCount = CL_CLAMP(C->jobs, 1, CL_MAX(image->height / PNG_MIN_STRIPE_ROWS, 1));
+    }
+    clContextLog(C,
+                 "png",
+                 1,
+                 "Compression: level %d, filter %s%s",
+                 (level == Z_DEFAULT_COMPRESSION) ? 6 : level,
+                 clPNGFilterToString(C, writeParams->pngFilter),
+                 (stripeCount > 1) ? ", parallel" : "");
     png_set_IHDR(png, info, image->width, image->height, image->depth, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
     if (writeParams->writeProfile) {
         png_set_iCCP(png, info, image->profile->description, 0, rawProfile.ptr, (png_uint_32)rawProfile.size);
     }
     png_write_info(png, info);
 
+    if (stripeCount > 1) {
+        if (image->depth == 16) {
+            clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
+        } else {
+            clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
+        }
+        pngWriteStripes(C, png, image, level, strategy, filterFlags, stripeCount);
+        png_write_chunk(png, (png_const_bytep) "IEND", NULL, 0);
+        png_destroy_write_struct(&png, &info);
+
+        clRawFree(C, &rawProfile);
+        output->size = wi.offset;
+        return clTrue;
+    }
+
     rowPointers = (png_bytep *)clAllocate(sizeof(png_bytep) * image->height);
     int imgBytesPerChannel = (image->depth == 16) ? 2 : 1;
     if (imgBytesPerChannel == 1) {
@@ -9,12 +9,17 @@
 
 #include "colorist/context.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
 
 #include "tiffio.h"
 
 #include <string.h>
 
-struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadTIFF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteTIFF(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
@@ -26,12 +31,21 @@ typedef struct tiffCallbackInfo
     struct clContext * C;
     clRaw * raw;
     toff_t offset;
+    toff_t size; // bytes of raw actually in use; when writing, raw grows ahead of this
 } tiffCallbackInfo;
 
+static void tiffCallbackInfoInit(tiffCallbackInfo * ci, clContext * C, clRaw * raw, toff_t size)
+{
+    ci->C = C;
+    ci->raw = raw;
+    ci->offset = 0;
+    ci->size = size;
+}
+
 static tmsize_t readCallback(tiffCallbackInfo * ci, void * ptr, tmsize_t size)
 {
-    if ((ci->offset + size) > ci->raw->size) {
-        size = (tmsize_t)(ci->raw->size - ci->offset);
+    if ((ci->offset + size) > ci->size) {
+        size = (tmsize_t)(ci->size - ci->offset);
     }
     if (size <= 0) {
         return 0;
@@ -43,15 +57,24 @@ static tmsize_t readCallback(tiffCallbackInfo * ci, void * ptr, tmsize_t size)
 
 static tmsize_t writeCallback(tiffCallbackInfo * ci, void * ptr, tmsize_t size)
 {
-    if ((ci->offset + size) > ci->raw->size) {
-        tmsize_t newSize = (tmsize_t)(ci->offset + size);
-        clRawRealloc(ci->C, ci->raw, newSize);
-    }
     if (size <= 0) {
         return 0;
     }
+    toff_t end = ci->offset + size;
+    if (end > ci->raw->size) {
+        // Grow geometrically; libtiff writes in small pieces and an exact fit here copies the whole
+        // output on every strip
+        size_t capacity = ci->raw->size ? ci->raw->size : (64 * 1024);
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        clRawRealloc(ci->C, ci->raw, capacity);
+    }
     memcpy(ci->raw->ptr + ci->offset, ptr, size);
-    ci->offset += size;
+    ci->offset = end;
+    if (ci->size < end) {
+        ci->size = end;
+    }
     return size;
 }
 
@@ -66,7 +89,7 @@ static toff_t seekCallback(tiffCallbackInfo * ci, toff_t off, int whence)
             ci->offset = off;
             break;
         case SEEK_END:
-            ci->offset = ci->raw->size + off;
+            ci->offset = ci->size + off;
             break;
     }
     return ci->offset;
@@ -81,17 +104,22 @@ static int closeCalllback(tiffCallbackInfo * ci)
 
 static toff_t sizeCallback(tiffCallbackInfo * ci)
 {
-    return ci->offset; // this seems bad
+    return ci->size;
 }
 
+// Reads are served straight out of the input buffer, which lets libtiff skip readCallback's copies
+// and lets several handles share the same input.
 static int mapCallback(tiffCallbackInfo * ci, void ** base, toff_t * size)
 {
-    COLORIST_UNUSED(ci);
-
-    *base = NULL;
-    *size = 0;
+    if (!ci->raw->ptr || !ci->size) {
+        *base = NULL;
+        *size = 0;
+        return 0;
+    }
 
-    return 0;
+    *base = ci->raw->ptr;
+    *size = ci->size;
+    return 1;
 }
 
 static void unmapCallback(tiffCallbackInfo * ci, void * base, toff_t size)
@@ -127,13 +155,418 @@ static void warningHandler(thandle_t handle, const char * module, const char * f
     clContextLogError(ci->C, "TIFF Warning: %s", tmp);
 }
 
-struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+static TIFF * tiffOpen(tiffCallbackInfo * ci, const char * mode)
+{
+    return TIFFClientOpen("tiff",
+                          mode,
+                          (thandle_t)ci,
+                          (TIFFReadWriteProc)readCallback,
+                          (TIFFReadWriteProc)writeCallback,
+                          (TIFFSeekProc)seekCallback,
+                          (TIFFCloseProc)closeCalllback,
+                          (TIFFSizeProc)sizeCallback,
+                          (TIFFMapFileProc)mapCallback,
+                          (TIFFUnmapFileProc)unmapCallback);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Block reading
+//
+// Strips and tiles are both treated as "blocks": rectangles of one plane (or all channels, when
+// contiguous) that libtiff can decode independently. Blocks are split across C->jobs tasks, each
+// with its own TIFF handle over the shared input, and expanded straight into the RGBA image.
+// When only a region is wanted (see clReadHint), just the blocks touching it are decoded and the
+// image is the size of the region.
+
+typedef struct clTIFFLayout
+{
+    clImage * image;
+    uint8_t * pixels;
+    size_t rowBytes;
+    int channelCount;
+    int depth; // bits per sample: 1, 8, 16 or 32 (float)
+    clBool separate;
+    clBool flipY; // ORIENTATION_BOTLEFT
+    uint8_t levels[2];
+
+    int fullWidth; // size of the stored image; image is the region of it starting at regionX,regionY
+    int fullHeight;
+    int regionX; // in stored (not oriented) coordinates
+    int regionY;
+
+    clBool tiled;
+    int blockWidth;
+    int blockHeight;
+    int blocksAcross;
+    int blocksPerPlane;
+    int blockCount;
+    tmsize_t blockSize;
+    tmsize_t blockRowBytes;
+
+    int * blocks; // indices of the blocks overlapping the region
+    int blocksUsed;
+} clTIFFLayout;
+
+typedef struct clTIFFBlockTask
+{
+    clContext * C;
+    clRaw * input;
+    clTIFFLayout * layout;
+    TIFF * tiff; // NULL if the task should open its own handle
+    int firstBlock; // into layout->blocks
+    int blockCount;
+    clBool failed;
+} clTIFFBlockTask;
+
+// The expansion helpers below are kept as flat, forward, per-type loops with no aliasing between
+// src and dst so that the compiler can vectorize them. plane is the channel being written for
+// PLANARCONFIG_SEPARATE images, or -1 when all channelCount channels are interleaved in src.
+
+static void tiffExpandRowU8(uint8_t * dst, const uint8_t * src, int count, int channelCount, int plane)
+{
+    if (plane >= 0) {
+        for (int i = 0; i < count; ++i) {
+            dst[(i * 4) + plane] = src[i];
+        }
+        if ((plane == 0) && (channelCount == 3)) {
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 3] = 255;
+            }
+        }
+        return;
+    }
+
+    switch (channelCount) {
+        case 1:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[i];
+                dst[(i * 4) + 1] = src[i];
+                dst[(i * 4) + 2] = src[i];
+                dst[(i * 4) + 3] = 255;
+            }
+            break;
+        case 3:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[(i * 3) + 0];
+                dst[(i * 4) + 1] = src[(i * 3) + 1];
+                dst[(i * 4) + 2] = src[(i * 3) + 2];
+                dst[(i * 4) + 3] = 255;
+            }
+            break;
+        case 4:
+            memcpy(dst, src, (size_t)count * 4 * sizeof(uint8_t));
+            break;
+    }
+}
+
+static void tiffExpandRowU16(uint16_t * dst, const uint16_t * src, int count, int channelCount, int plane)
+{
+    if (plane >= 0) {
+        for (int i = 0; i < count; ++i) {
+            dst[(i * 4) + plane] = src[i];
+        }
+        if ((plane == 0) && (channelCount == 3)) {
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 3] = 65535;
+            }
+        }
+        return;
+    }
+
+    switch (channelCount) {
+        case 1:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[i];
+                dst[(i * 4) + 1] = src[i];
+                dst[(i * 4) + 2] = src[i];
+                dst[(i * 4) + 3] = 65535;
+            }
+            break;
+        case 3:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[(i * 3) + 0];
+                dst[(i * 4) + 1] = src[(i * 3) + 1];
+                dst[(i * 4) + 2] = src[(i * 3) + 2];
+                dst[(i * 4) + 3] = 65535;
+            }
+            break;
+        case 4:
+            memcpy(dst, src, (size_t)count * 4 * sizeof(uint16_t));
+            break;
+    }
+}
+
+static void tiffExpandRowF32(float * dst, const float * src, int count, int channelCount, int plane)
+{
+    if (plane >= 0) {
+        for (int i = 0; i < count; ++i) {
+            dst[(i * 4) + plane] = src[i];
+        }
+        if ((plane == 0) && (channelCount == 3)) {
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 3] = 1.0f;
+            }
+        }
+        return;
+    }
+
+    switch (channelCount) {
+        case 1:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[i];
+                dst[(i * 4) + 1] = src[i];
+                dst[(i * 4) + 2] = src[i];
+                dst[(i * 4) + 3] = 1.0f;
+            }
+            break;
+        case 3:
+            for (int i = 0; i < count; ++i) {
+                dst[(i * 4) + 0] = src[(i * 3) + 0];
+                dst[(i * 4) + 1] = src[(i * 3) + 1];
+                dst[(i * 4) + 2] = src[(i * 3) + 2];
+                dst[(i * 4) + 3] = 1.0f;
+            }
+            break;
+        case 4:
+            memcpy(dst, src, (size_t)count * 4 * sizeof(float));
+            break;
+    }
+}
+
+// 1-bit samples, mapped through levels (which honors PHOTOMETRIC_MINISWHITE for grey)
+// skip is the number of pixels to skip at the start of src, which may not be byte aligned.
+static void tiffExpandRowBits(uint8_t * dst,
+                              const uint8_t * src,
+                              int skip,
+                              int count,
+                              int channelCount,
+                              int plane,
+                              const uint8_t levels[2])
+{
+    int srcChannels = (plane >= 0) ? 1 : channelCount;
+    for (int i = 0; i < count; ++i) {
+        for (int c = 0; c < srcChannels; ++c) {
+            int sampleIndex = ((skip + i) * srcChannels) + c;
+            uint8_t v = levels[(src[sampleIndex >> 3] >> (7 - (sampleIndex & 7))) & 1];
+            if (plane >= 0) {
+                dst[(i * 4) + plane] = v;
+            } else if (channelCount == 1) {
+                dst[(i * 4) + 0] = v;
+                dst[(i * 4) + 1] = v;
+                dst[(i * 4) + 2] = v;
+            } else {
+                dst[(i * 4) + c] = v;
+            }
+        }
+        if ((channelCount != 4) && (plane <= 0)) {
+            dst[(i * 4) + 3] = 255;
+        }
+    }
+}
+
+static void tiffExpandBlock(clTIFFLayout * layout, int blockIndex, const uint8_t * block)
+{
+    clImage * image = layout->image;
+    int plane = -1;
+    int planeBlockIndex = blockIndex;
+    if (layout->separate) {
+        plane = blockIndex / layout->blocksPerPlane;
+        planeBlockIndex = blockIndex % layout->blocksPerPlane;
+    }
+    int x0 = (planeBlockIndex % layout->blocksAcross) * layout->blockWidth;
+    int y0 = (planeBlockIndex / layout->blocksAcross) * layout->blockHeight;
+
+    // Clip the block to the region
+    int cx0 = CL_MAX(x0, layout->regionX);
+    int cy0 = CL_MAX(y0, layout->regionY);
+    int cx1 = CL_MIN(CL_MIN(x0 + layout->blockWidth, layout->fullWidth), layout->regionX + image->width);
+    int cy1 = CL_MIN(CL_MIN(y0 + layout->blockHeight, layout->fullHeight), layout->regionY + image->height);
+    if ((cx0 >= cx1) || (cy0 >= cy1)) {
+        return;
+    }
+    int w = cx1 - cx0;
+    int skip = cx0 - x0;
+    int srcChannels = (plane >= 0) ? 1 : layout->channelCount;
+
+    size_t pixelBytes = layout->rowBytes / image->width;
+    for (int j = cy0; j < cy1; ++j) {
+        int y = j - layout->regionY;
+        if (layout->flipY) {
+            y = image->height - 1 - y;
+        }
+        const uint8_t * src = block + ((j - y0) * layout->blockRowBytes);
+        uint8_t * dst = layout->pixels + (y * layout->rowBytes) + ((cx0 - layout->regionX) * pixelBytes);
+        switch (layout->depth) {
+            case 1:
+                tiffExpandRowBits(dst, src, skip, w, layout->channelCount, plane, layout->levels);
+                break;
+            case 8:
+                tiffExpandRowU8(dst, src + (skip * srcChannels), w, layout->channelCount, plane);
+                break;
+            case 16:
+                tiffExpandRowU16((uint16_t *)dst, (const uint16_t *)src + (skip * srcChannels), w, layout->channelCount, plane);
+                break;
+            case 32:
+                tiffExpandRowF32((float *)dst, (const float *)src + (skip * srcChannels), w, layout->channelCount, plane);
+                break;
+        }
+    }
+}
+
+static void tiffBlockTaskFunc(clTIFFBlockTask * task)
+{
+    clContext * C = task->C;
+    clTIFFLayout * layout = task->layout;
+
+    tiffCallbackInfo ci;
+    tiffCallbackInfoInit(&ci, C, task->input, task->input->size);
+
+    TIFF * tiff = task->tiff;
+    if (!tiff) {
+        tiff = tiffOpen(&ci, "rb");
+        if (!tiff) {
+            task->failed = clTrue;
+            return;
+        }
+    }
+
+    uint8_t * block = clAllocate(layout->blockSize);
+    for (int i = 0; i < task->blockCount; ++i) {
+        int blockIndex = layout->blocks[task->firstBlock + i];
+        tmsize_t bytesRead;
+        if (layout->tiled) {
+            bytesRead = TIFFReadEncodedTile(tiff, (uint32_t)blockIndex, block, layout->blockSize);
+        } else {
+            bytesRead = TIFFReadEncodedStrip(tiff, (uint32_t)blockIndex, block, layout->blockSize);
+        }
+        if (bytesRead < 0) {
+            clContextLogError(C, "Failed to read TIFF %s %d", layout->tiled ? "tile" : "strip", blockIndex);
+            task->failed = clTrue;
+            break;
+        }
+        tiffExpandBlock(layout, blockIndex, block);
+    }
+    clFree(block);
+
+    if (tiff != task->tiff) {
+        TIFFClose(tiff);
+    }
+}
+
+// Lists the blocks (of every plane) that overlap the region, in file order
+static void tiffFindBlocks(clContext * C, clTIFFLayout * layout)
+{
+    int firstColumn = layout->regionX / layout->blockWidth;
+    int lastColumn = (layout->regionX + layout->image->width - 1) / layout->blockWidth;
+    int firstRow = layout->regionY / layout->blockHeight;
+    int lastRow = (layout->regionY + layout->image->height - 1) / layout->blockHeight;
+    int planeCount = layout->blockCount / layout->blocksPerPlane;
+
+    layout->blocks = clAllocate(layout->blockCount * sizeof(int));
+    layout->blocksUsed = 0;
+    for (int plane = 0; plane < planeCount; ++plane) {
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                layout->blocks[layout->blocksUsed++] = (plane * layout->blocksPerPlane) + (row * layout->blocksAcross) + column;
+            }
+        }
+    }
+}
+
+static clBool tiffReadBlocks(clContext * C, TIFF * tiff, clRaw * input, clTIFFLayout * layout)
+{
+    tiffFindBlocks(C, layout);
+
+    int taskCount = CL_CLAMP(C->jobs, 1, layout->blocksUsed);
+    int blocksPerTask = layout->blocksUsed / taskCount;
+
+    clTIFFBlockTask * tasks = clAllocate(taskCount * sizeof(clTIFFBlockTask));
+    memset(tasks, 0, taskCount * sizeof(clTIFFBlockTask));
+    for (int i = 0; i < taskCount; ++i) {
+        clTIFFBlockTask * task = &tasks[i];
+        task->C = C;
+        task->input = input;
+        task->layout = layout;
+        task->tiff = (i == 0) ? tiff : NULL; // the first task borrows the main handle
+        task->firstBlock = i * blocksPerTask;
+        task->blockCount = (i == (taskCount - 1)) ? (layout->blocksUsed - task->firstBlock) : blocksPerTask;
+    }
+
+    if (taskCount == 1) {
+        tiffBlockTaskFunc(&tasks[0]);
+    } else {
+        clTask ** threads = clAllocate(taskCount * sizeof(clTask *));
+        for (int i = 0; i < taskCount; ++i) {
+            threads[i] = clTaskCreate(C, (clTaskFunc)tiffBlockTaskFunc, &tasks[i]);
+        }
+        for (int i = 0; i < taskCount; ++i) {
+            clTaskDestroy(C, threads[i]);
+        }
+        clFree(threads);
+    }
+
+    clBool success = clTrue;
+    for (int i = 0; i < taskCount; ++i) {
+        if (tasks[i].failed) {
+            success = clFalse;
+        }
+    }
+    clFree(tasks);
+    clFree(layout->blocks);
+    layout->blocks = NULL;
+    return success;
+}
+
+// Applies the orientations that aren't handled while filling (everything but TOPLEFT/BOTLEFT)
+static clImage * tiffApplyOrientation(clContext * C, clImage * image, int orientation)
+{
+    clImage * oriented = NULL;
+    switch (orientation) {
+        case ORIENTATION_TOPRIGHT:
+            oriented = clImageMirror(C, image, 1);
+            break;
+        case ORIENTATION_BOTRIGHT:
+            oriented = clImageRotate(C, image, 2);
+            break;
+        case ORIENTATION_LEFTTOP: {
+            // transpose
+            clImage * rotated = clImageRotate(C, image, 1);
+            oriented = clImageMirror(C, rotated, 1);
+            clImageDestroy(C, rotated);
+            break;
+        }
+        case ORIENTATION_RIGHTTOP:
+            oriented = clImageRotate(C, image, 1);
+            break;
+        case ORIENTATION_RIGHTBOT: {
+            // transverse
+            clImage * rotated = clImageRotate(C, image, 1);
+            oriented = clImageMirror(C, rotated, 0);
+            clImageDestroy(C, rotated);
+            break;
+        }
+        case ORIENTATION_LEFTBOT:
+            oriented = clImageRotate(C, image, 3);
+            break;
+        default:
+            return image;
+    }
+    clImageDestroy(C, image);
+    return oriented;
+}
+
+struct clImage * clFormatReadTIFF(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint)
 {
     COLORIST_UNUSED(formatName);
 
     clProfile * profile = NULL;
     clImage * image = NULL;
     TIFF * tiff;
+    int rect[4];
     int width = 0;
     int height = 0;
     int depth = 0;
@@ -143,14 +576,11 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     int orientation = ORIENTATION_TOPLEFT;
     int sampleFormat = SAMPLEFORMAT_UINT;
     uint8_t * iccBuf = NULL;
-    int rowIndex, rowBytes;
     tiffCallbackInfo ci;
-    uint8_t * pixels = NULL;
     clBool fp32 = clFalse;
+    clTIFFLayout layout;
 
-    ci.C = C;
-    ci.raw = input;
-    ci.offset = 0;
+    tiffCallbackInfoInit(&ci, C, input, input->size);
 
     Timer t;
     timerStart(&t);
@@ -160,16 +590,7 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     TIFFSetWarningHandler(NULL);
     TIFFSetWarningHandlerExt(warningHandler);
 
-    tiff = TIFFClientOpen("tiff",
-                          "rb",
-                          (thandle_t)&ci,
-                          (TIFFReadWriteProc)readCallback,
-                          (TIFFReadWriteProc)writeCallback,
-                          (TIFFSeekProc)seekCallback,
-                          (TIFFCloseProc)closeCalllback,
-                          (TIFFSizeProc)sizeCallback,
-                          (TIFFMapFileProc)mapCallback,
-                          (TIFFUnmapFileProc)unmapCallback);
+    tiff = tiffOpen(&ci, "rb");
     if (!tiff) {
         clContextLogError(C, "cannot open TIFF for read");
         goto readCleanup;
@@ -228,8 +649,7 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
     }
 
     if (TIFFGetField(tiff, TIFFTAG_ORIENTATION, &orientation)) {
-        if ((orientation != ORIENTATION_TOPLEFT) && (orientation != ORIENTATION_BOTLEFT)) {
-            // TODO: Support other orientations
+        if ((orientation < ORIENTATION_TOPLEFT) || (orientation > ORIENTATION_LEFTBOT)) {
             clContextLogError(C, "Unsupported orientation (%d)", orientation);
             goto readCleanup;
         }
@@ -238,336 +658,418 @@ struct clImage * clFormatReadTIFF(struct clContext * C, const char * formatName,
         orientation = ORIENTATION_TOPLEFT;
     }
 
-    uint8_t monochrome[2] = { 255, 0 };
-    if (depth == 1) {
+    memset(&layout, 0, sizeof(layout));
+    layout.channelCount = channelCount;
+    layout.depth = fp32 ? 32 : depth;
+    layout.separate = ((planarConfig == PLANARCONFIG_SEPARATE) && (channelCount > 1)) ? clTrue : clFalse;
+    layout.flipY = (orientation == ORIENTATION_BOTLEFT) ? clTrue : clFalse;
+    layout.levels[0] = 0;
+    layout.levels[1] = 255;
+    if ((depth == 1) && (channelCount == 1)) {
         uint16_t photometric = PHOTOMETRIC_MINISWHITE;
         TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
-        if (photometric == PHOTOMETRIC_MINISBLACK) {
-            monochrome[0] = 0;
-            monochrome[1] = 255;
+        if (photometric != PHOTOMETRIC_MINISBLACK) {
+            layout.levels[0] = 255;
+            layout.levels[1] = 0;
         }
     }
 
-    clImageLogCreate(C, width, height, depth, profile);
-    image = clImageCreate(C, width, height, depth, profile);
+    layout.tiled = TIFFIsTiled(tiff) ? clTrue : clFalse;
+    if (layout.tiled) {
+        uint32_t tileWidth = 0;
+        uint32_t tileHeight = 0;
+        TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tileWidth);
+        TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tileHeight);
+        if ((tileWidth == 0) || (tileHeight == 0)) {
+            clContextLogError(C, "cannot read tile size from TIFF");
+            goto readCleanup;
+        }
+        layout.blockWidth = (int)tileWidth;
+        layout.blockHeight = (int)tileHeight;
+        layout.blockCount = (int)TIFFNumberOfTiles(tiff);
+        layout.blockSize = TIFFTileSize(tiff);
+        layout.blockRowBytes = TIFFTileRowSize(tiff);
+    } else {
+        uint32_t rowsPerStrip = 0;
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+        layout.blockWidth = width;
+        layout.blockHeight = ((rowsPerStrip == 0) || (rowsPerStrip > (uint32_t)height)) ? height : (int)rowsPerStrip;
+        layout.blockCount = (int)TIFFNumberOfStrips(tiff);
+        layout.blockSize = TIFFStripSize(tiff);
+        layout.blockRowBytes = TIFFScanlineSize(tiff);
+    }
+    layout.blocksAcross = (width + layout.blockWidth - 1) / layout.blockWidth;
+    layout.blocksPerPlane = layout.blocksAcross * ((height + layout.blockHeight - 1) / layout.blockHeight);
+    if ((layout.blockSize <= 0) || (layout.blockRowBytes <= 0) ||
+        (layout.blockCount != (layout.blocksPerPlane * (layout.separate ? channelCount : 1)))) {
+        clContextLogError(C, "unsupported %s layout in TIFF", layout.tiled ? "tile" : "strip");
+        goto readCleanup;
+    }
+    if (layout.tiled || (orientation != ORIENTATION_TOPLEFT)) {
+        clContextLog(C,
+                     "tiff",
+                     1,
+                     "%d %s%s, orientation %d",
+                     layout.blockCount,
+                     layout.tiled ? "tile" : "strip",
+                     (layout.blockCount == 1) ? "" : "s",
+                     orientation);
+    }
+
+    // Regions are only mapped onto the stored image for orientations that don't transpose or mirror
+    // it horizontally. Other orientations are decoded whole and left for the caller to crop.
+    layout.fullWidth = width;
+    layout.fullHeight = height;
+    if (((orientation == ORIENTATION_TOPLEFT) || (orientation == ORIENTATION_BOTLEFT)) &&
+        clReadHintRect(C, hint, width, height, rect)) {
+        layout.regionX = rect[0];
+        layout.regionY = layout.flipY ? (height - rect[1] - rect[3]) : rect[1];
+        clContextLog(C, "tiff", 1, "Decoding +%d+%d %dx%d", rect[0], rect[1], rect[2], rect[3]);
+
+        C->readExtraInfo.hintApplied = clTrue;
+        memcpy(C->readExtraInfo.hintRect, rect, sizeof(rect));
+        C->readExtraInfo.hintReduction = 0;
+    } else {
+        rect[2] = width;
+        rect[3] = height;
+    }
+
+    clImageLogCreate(C, rect[2], rect[3], depth, profile);
+    image = clImageCreate(C, rect[2], rect[3], depth, profile);
+    layout.image = image;
 
     if (fp32) {
         clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_F32);
-        pixels = (uint8_t *)image->pixelsF32;
-        rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
+        layout.pixels = (uint8_t *)image->pixelsF32;
+        layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
     } else if ((depth == 1) || (depth == 8)) {
         clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
-        pixels = image->pixelsU8;
-        rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
+        layout.pixels = image->pixelsU8;
+        layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
     } else {
         clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U16);
-        pixels = (uint8_t *)image->pixelsU16;
-        rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
+        layout.pixels = (uint8_t *)image->pixelsU16;
+        layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
     }
 
-    if (planarConfig == PLANARCONFIG_CONTIG) {
-        for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
-            uint8_t * pixelRow;
-            if (orientation == ORIENTATION_TOPLEFT) {
-                pixelRow = &pixels[rowIndex * rowBytes];
-            } else {
-                // ORIENTATION_BOTLEFT
-                pixelRow = &pixels[(image->height - 1 - rowIndex) * rowBytes];
-            }
-            if (TIFFReadScanline(tiff, pixelRow, rowIndex, 0) < 0) {
-                clContextLogError(C, "Failed to read TIFF scanline row %d", rowIndex);
-                clImageDestroy(C, image);
-                image = NULL;
-                goto readCleanup;
-            }
+    if (!tiffReadBlocks(C, tiff, input, &layout)) {
+        clImageDestroy(C, image);
+        image = NULL;
+        goto readCleanup;
+    }
+    image = tiffApplyOrientation(C, image, orientation);
 
-            if (channelCount == 1) {
-                // Expand grey in-place into RGBA, then fill A
-                if (fp32) {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        float * srcPixel = (float *)&pixelRow[x * sizeof(float)];
-                        float * dstPixel = (float *)&pixelRow[x * 4 * sizeof(float)];
-                        dstPixel[3] = 1.0f;
-                        dstPixel[2] = srcPixel[0];
-                        dstPixel[1] = srcPixel[0];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                } else if (depth == 1) {
-                    int shift = 7 - (image->width % 8);
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint8_t mask = (uint8_t)(1 << (7 - shift));
-                        uint8_t * srcPixel = &pixelRow[(x / 8) * sizeof(uint8_t)];
-                        uint8_t * dstPixel = &pixelRow[x * 4 * sizeof(uint8_t)];
-                        dstPixel[3] = 255;
-                        dstPixel[2] = (srcPixel[0] & mask) ? monochrome[1] : monochrome[0];
-                        dstPixel[1] = (srcPixel[0] & mask) ? monochrome[1] : monochrome[0];
-                        dstPixel[0] = (srcPixel[0] & mask) ? monochrome[1] : monochrome[0];
-                        --shift;
-                        if (shift < 0) {
-                            shift = 7;
-                        }
-                    }
-                } else if (depth == 8) {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint8_t * srcPixel = &pixelRow[x * sizeof(uint8_t)];
-                        uint8_t * dstPixel = &pixelRow[x * 4 * sizeof(uint8_t)];
-                        dstPixel[3] = 255;
-                        dstPixel[2] = srcPixel[0];
-                        dstPixel[1] = srcPixel[0];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                } else {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint16_t * srcPixel = (uint16_t *)&pixelRow[x * sizeof(uint16_t)];
-                        uint16_t * dstPixel = (uint16_t *)&pixelRow[x * 4 * sizeof(uint16_t)];
-                        dstPixel[3] = 65535;
-                        dstPixel[2] = srcPixel[0];
-                        dstPixel[1] = srcPixel[0];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                }
-            } else if (channelCount == 3) {
-                // Expand RGB in-place into RGBA, then fill A
-                if (fp32) {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        float * srcPixel = (float *)&pixelRow[x * 3 * sizeof(float)];
-                        float * dstPixel = (float *)&pixelRow[x * 4 * sizeof(float)];
-                        dstPixel[3] = 1.0f;
-                        dstPixel[2] = srcPixel[2];
-                        dstPixel[1] = srcPixel[1];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                } else if (depth == 1) {
-                    int shift = 7 - (image->width % 8);
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint8_t mask = (uint8_t)(1 << (7 - shift));
-                        uint8_t * srcPixel = &pixelRow[((x * 3) / 8) * sizeof(uint8_t)];
-                        uint8_t * dstPixel = &pixelRow[x * 4 * sizeof(uint8_t)];
-                        dstPixel[3] = 255;
-                        dstPixel[2] = (srcPixel[2] & mask) ? monochrome[1] : monochrome[0];
-                        dstPixel[1] = (srcPixel[1] & mask) ? monochrome[1] : monochrome[0];
-                        dstPixel[0] = (srcPixel[0] & mask) ? monochrome[1] : monochrome[0];
-                        --shift;
-                        if (shift < 0) {
-                            shift = 7;
-                        }
-                    }
-                } else if (depth == 8) {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint8_t * srcPixel = &pixelRow[x * 3 * sizeof(uint8_t)];
-                        uint8_t * dstPixel = &pixelRow[x * 4 * sizeof(uint8_t)];
-                        dstPixel[3] = 255;
-                        dstPixel[2] = srcPixel[2];
-                        dstPixel[1] = srcPixel[1];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                } else {
-                    for (int x = image->width - 1; x >= 0; --x) {
-                        uint16_t * srcPixel = (uint16_t *)&pixelRow[x * 3 * sizeof(uint16_t)];
-                        uint16_t * dstPixel = (uint16_t *)&pixelRow[x * 4 * sizeof(uint16_t)];
-                        dstPixel[3] = 65535;
-                        dstPixel[2] = srcPixel[2];
-                        dstPixel[1] = srcPixel[1];
-                        dstPixel[0] = srcPixel[0];
-                    }
-                }
-            }
-        }
-    } else if (planarConfig == PLANARCONFIG_SEPARATE) {
-        if (channelCount <= 1) {
-            clContextLogError(C, "unsupported planarConfig(%u) and channelCount(%d) from TIFF", planarConfig, channelCount);
-            goto readCleanup;
-        }
+    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
 
-        uint8_t * readPixelRow = (uint8_t *)clAllocate(rowBytes);
+readCleanup:
+    if (tiff) {
+        TIFFClose(tiff);
+    }
+    if (profile) {
+        clProfileDestroy(C, profile);
+    }
+    return image;
+}
 
-        for (int channel = 0; channel < channelCount; ++channel) {
-            for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
-                uint8_t * pixelRow;
-                if (orientation == ORIENTATION_TOPLEFT) {
-                    pixelRow = &pixels[rowIndex * rowBytes];
-                } else {
-                    // ORIENTATION_BOTLEFT
-                    pixelRow = &pixels[(image->height - 1 - rowIndex) * rowBytes];
-                }
-                if (TIFFReadScanline(tiff, readPixelRow, rowIndex, (uint16_t)channel) < 0) {
-                    clContextLogError(C, "Failed to read TIFF scanline row %d", rowIndex);
-                    clImageDestroy(C, image);
-                    image = NULL;
-                    clFree(readPixelRow);
-                    goto readCleanup;
-                }
+// ------------------------------------------------------------------------------------------------
+// Strip writing
+//
+// Compressed strips are independent, so they are split across C->jobs tasks. The first task
+// encodes straight into the output handle; the others encode into scratch TIFFs of their own
+// (same tags, so libtiff's codecs and predictors do the work) and their finished strips are copied
+// into the output afterwards with TIFFWriteRawStrip, keeping the strips in order.
 
-                if (fp32) {
-                    float * srcPixel = (float *)readPixelRow;
-                    float * dstPixel = (float *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[channel] = srcPixel[0];
-                        dstPixel += 4;
-                        srcPixel += 1;
-                    }
-                } else if (depth == 1) {
-                    int shift = 7;
-                    uint8_t * srcPixel = (uint8_t *)readPixelRow;
-                    uint8_t * dstPixel = (uint8_t *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        uint8_t mask = (uint8_t)(1 << (7 - shift));
-                        dstPixel[channel] = (uint8_t)((srcPixel[0] & mask) << shift);
-                        dstPixel += 4;
-                        --shift;
-                        if (shift < 0) {
-                            shift = 7;
-                            srcPixel += 1;
-                        }
-                    }
-                } else if (depth == 8) {
-                    uint8_t * srcPixel = (uint8_t *)readPixelRow;
-                    uint8_t * dstPixel = (uint8_t *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[channel] = srcPixel[0];
-                    }
-                } else {
-                    uint16_t * srcPixel = (uint16_t *)readPixelRow;
-                    uint16_t * dstPixel = (uint16_t *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[channel] = srcPixel[0];
-                        dstPixel += 4;
-                        srcPixel += 1;
-                    }
-                }
-            }
+#define TIFF_AUTO_STRIP_BYTES (64 * 1024)
+
+typedef struct clTIFFWriteLayout
+{
+    clImage * image;
+    const uint8_t * pixels;
+    tmsize_t rowBytes;
+    uint16_t bitsPerSample;
+    uint16_t sampleFormat;
+    uint16_t compression;
+    uint16_t predictor; // PREDICTOR_NONE if unused
+    int rowsPerStrip;
+    int stripCount;
+} clTIFFWriteLayout;
+
+typedef struct clTIFFStripTask
+{
+    clContext * C;
+    clTIFFWriteLayout * layout;
+    TIFF * tiff; // NULL if the task should encode into its own scratch TIFF
+    int firstStrip;
+    int stripCount;
+    clRaw scratch;
+    uint64_t * offsets; // where each encoded strip landed in scratch
+    uint64_t * sizes;
+    clBool failed;
+} clTIFFStripTask;
+
+static void tiffSetWriteFields(TIFF * tiff, clTIFFWriteLayout * layout)
+{
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, layout->image->width);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, layout->image->height);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, layout->bitsPerSample);
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, layout->sampleFormat);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 4);
+    TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, layout->rowsPerStrip);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, layout->compression);
+    if (layout->predictor != PREDICTOR_NONE) {
+        TIFFSetField(tiff, TIFFTAG_PREDICTOR, layout->predictor);
+    }
+}
+
+static clBool tiffCompressionTag(clContext * C, clTIFFCompression compression, uint16_t * outTag)
+{
+    switch (compression) {
+        case CL_TIFFCOMPRESSION_NONE:
+            *outTag = COMPRESSION_NONE;
+            break;
+        case CL_TIFFCOMPRESSION_LZW:
+            *outTag = COMPRESSION_LZW;
+            break;
+        case CL_TIFFCOMPRESSION_DEFLATE:
+            *outTag = COMPRESSION_ADOBE_DEFLATE;
+            break;
+        case CL_TIFFCOMPRESSION_ZSTD:
+#ifdef COMPRESSION_ZSTD
+            *outTag = COMPRESSION_ZSTD;
+            break;
+#else
+            clContextLogError(C, "TIFF compression zstd is not supported by this version of libtiff");
+            return clFalse;
+#endif
+        case CL_TIFFCOMPRESSION_INVALID:
+        default:
+            clContextLogError(C, "Unknown TIFF compression: %d", (int)compression);
+            return clFalse;
+    }
+
+    if (!TIFFIsCODECConfigured(*outTag)) {
+        clContextLogError(C, "TIFF compression %s is not available in this build of libtiff", clTIFFCompressionToString(C, compression));
+        return clFalse;
+    }
+    return clTrue;
+}
+
+static void tiffStripTaskFunc(clTIFFStripTask * task)
+{
+    clContext * C = task->C;
+    clTIFFWriteLayout * layout = task->layout;
+    uint8_t * rows = NULL;
+
+    tiffCallbackInfo ci;
+    tiffCallbackInfoInit(&ci, C, &task->scratch, 0);
+
+    TIFF * tiff = task->tiff;
+    if (!tiff) {
+        tiff = tiffOpen(&ci, "w");
+        if (!tiff) {
+            task->failed = clTrue;
+            return;
         }
+        tiffSetWriteFields(tiff, layout);
+    }
 
-        clFree(readPixelRow);
-
-        // Fill A
-        if (channelCount == 3) {
-            for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
-                uint8_t * pixelRow = &pixels[rowIndex * rowBytes];
-
-                if (fp32) {
-                    float * dstPixel = (float *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[3] = 1.0f;
-                        dstPixel += 4;
-                    }
-                } else if ((depth == 1) || (depth == 8)) {
-                    uint8_t * dstPixel = pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[3] = 255;
-                        dstPixel += 4;
-                    }
-                } else {
-                    uint16_t * dstPixel = (uint16_t *)pixelRow;
-                    for (int x = 0; x < image->width; ++x) {
-                        dstPixel[3] = 65535;
-                        dstPixel += 4;
-                    }
-                }
-            }
+    // The predictor works in place, so strips are encoded from a copy rather than the image's rows
+    rows = clAllocate(layout->rowBytes * layout->rowsPerStrip);
+    for (int i = 0; i < task->stripCount; ++i) {
+        int stripIndex = task->firstStrip + i;
+        int firstRow = stripIndex * layout->rowsPerStrip;
+        int rowCount = CL_MIN(layout->rowsPerStrip, layout->image->height - firstRow);
+        tmsize_t stripBytes = layout->rowBytes * rowCount;
+        memcpy(rows, layout->pixels + (firstRow * layout->rowBytes), stripBytes);
+        if (TIFFWriteEncodedStrip(tiff, (uint32_t)stripIndex, rows, stripBytes) < 0) {
+            clContextLogError(C, "Failed to write TIFF strip %d", stripIndex);
+            task->failed = clTrue;
+            goto stripCleanup;
         }
     }
 
-    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
+    if (tiff != task->tiff) {
+        uint64_t * offsets = NULL;
+        uint64_t * sizes = NULL;
+        if (!TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets) || !TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &sizes)) {
+            task->failed = clTrue;
+            goto stripCleanup;
+        }
+        task->offsets = clAllocate(task->stripCount * sizeof(uint64_t));
+        task->sizes = clAllocate(task->stripCount * sizeof(uint64_t));
+        memcpy(task->offsets, &offsets[task->firstStrip], task->stripCount * sizeof(uint64_t));
+        memcpy(task->sizes, &sizes[task->firstStrip], task->stripCount * sizeof(uint64_t));
+    }
 
-readCleanup:
-    if (tiff) {
+stripCleanup:
+    clFree(rows);
+    if (tiff != task->tiff) {
         TIFFClose(tiff);
     }
-    if (profile) {
-        clProfileDestroy(C, profile);
+}
+
+static clBool tiffWriteStrips(clContext * C, TIFF * tiff, clTIFFWriteLayout * layout)
+{
+    if (layout->compression == COMPRESSION_NONE) {
+        // Uncompressed strips are already in their final (native byte order) form
+        for (int stripIndex = 0; stripIndex < layout->stripCount; ++stripIndex) {
+            int firstRow = stripIndex * layout->rowsPerStrip;
+            int rowCount = CL_MIN(layout->rowsPerStrip, layout->image->height - firstRow);
+            void * strip = (void *)(layout->pixels + (firstRow * layout->rowBytes));
+            if (TIFFWriteRawStrip(tiff, (uint32_t)stripIndex, strip, layout->rowBytes * rowCount) < 0) {
+                clContextLogError(C, "Failed to write TIFF strip %d", stripIndex);
+                return clFalse;
+            }
+        }
+        return clTrue;
     }
-    return image;
+
+    int taskCount = CL_CLAMP(C->jobs, 1, layout->stripCount);
+    int stripsPerTask = layout->stripCount / taskCount;
+
+    clTIFFStripTask * tasks = clAllocate(taskCount * sizeof(clTIFFStripTask));
+    memset(tasks, 0, taskCount * sizeof(clTIFFStripTask));
+    for (int i = 0; i < taskCount; ++i) {
+        clTIFFStripTask * task = &tasks[i];
+        task->C = C;
+        task->layout = layout;
+        task->tiff = (i == 0) ? tiff : NULL; // the first task writes straight into the output
+        task->firstStrip = i * stripsPerTask;
+        task->stripCount = (i == (taskCount - 1)) ? (layout->stripCount - task->firstStrip) : stripsPerTask;
+    }
+
+    if (taskCount == 1) {
+        tiffStripTaskFunc(&tasks[0]);
+    } else {
+        clTask ** threads = clAllocate(taskCount * sizeof(clTask *));
+        for (int i = 0; i < taskCount; ++i) {
+            threads[i] = clTaskCreate(C, (clTaskFunc)tiffStripTaskFunc, &tasks[i]);
+        }
+        for (int i = 0; i < taskCount; ++i) {
+            clTaskDestroy(C, threads[i]);
+        }
+        clFree(threads);
+    }
+
+    clBool success = clTrue;
+    for (int i = 0; i < taskCount; ++i) {
+        clTIFFStripTask * task = &tasks[i];
+        if (task->failed) {
+            success = clFalse;
+        }
+        if (success && !task->tiff) {
+            for (int j = 0; j < task->stripCount; ++j) {
+                int stripIndex = task->firstStrip + j;
+                if (TIFFWriteRawStrip(tiff, (uint32_t)stripIndex, task->scratch.ptr + task->offsets[j], (tmsize_t)task->sizes[j]) < 0) {
+                    clContextLogError(C, "Failed to write TIFF strip %d", stripIndex);
+                    success = clFalse;
+                    break;
+                }
+            }
+        }
+        clRawFree(C, &task->scratch);
+        clFree(task->offsets);
+        clFree(task->sizes);
+    }
+    clFree(tasks);
+    return success;
 }
 
 clBool clFormatWriteTIFF(struct clContext * C, struct clImage * image, const char * formatName, struct clRaw * output, struct clWriteParams * writeParams)
 {
     COLORIST_UNUSED(formatName);
-    COLORIST_UNUSED(writeParams);
 
     clBool writeResult = clTrue;
     TIFF * tiff = NULL;
-    int rowIndex, rowBytes;
     tiffCallbackInfo ci;
-    uint8_t * pixels = NULL;
+    clTIFFWriteLayout layout;
 
     clRaw rawProfile = CL_RAW_EMPTY;
     if (!clProfilePack(C, image->profile, &rawProfile)) {
         clContextLogError(C, "Failed to create ICC profile");
+        writeResult = clFalse;
         goto writeCleanup;
     }
 
-    ci.C = C;
-    ci.raw = output;
-    ci.offset = 0;
-
-    TIFFSetErrorHandler(NULL);
-    TIFFSetErrorHandlerExt(errorHandler);
-    TIFFSetWarningHandler(NULL);
-    TIFFSetWarningHandlerExt(warningHandler);
-
-    tiff = TIFFClientOpen("tiff",
-                          "wb",
-                          (thandle_t)&ci,
-                          (TIFFReadWriteProc)readCallback,
-                          (TIFFReadWriteProc)writeCallback,
-                          (TIFFSeekProc)seekCallback,
-                          (TIFFCloseProc)closeCalllback,
-                          (TIFFSizeProc)sizeCallback,
-                          (TIFFMapFileProc)mapCallback,
-                          (TIFFUnmapFileProc)unmapCallback);
-    if (!tiff) {
-        clContextLogError(C, "cannot open TIFF for write");
+    memset(&layout, 0, sizeof(layout));
+    layout.image = image;
+    if (!tiffCompressionTag(C, writeParams->tiffCompression, &layout.compression)) {
         writeResult = clFalse;
         goto writeCleanup;
     }
 
-    clBool fp32 = (image->depth == 32) ? clTrue : clFalse;
-    if (fp32) {
-        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 32);
-        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+    if (image->depth == 32) {
+        layout.bitsPerSample = 32;
+        layout.sampleFormat = SAMPLEFORMAT_IEEEFP;
 
         clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_F32);
-        pixels = (uint8_t *)image->pixelsF32;
-        rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
+        layout.pixels = (const uint8_t *)image->pixelsF32;
+        layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_F32);
     } else {
-        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, image->depth);
-        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+        layout.bitsPerSample = (uint16_t)image->depth;
+        layout.sampleFormat = SAMPLEFORMAT_UINT;
         if (image->depth == 8) {
             clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
-            pixels = image->pixelsU8;
-            rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
+            layout.pixels = image->pixelsU8;
+            layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
         } else {
             clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U16);
-            pixels = (uint8_t *)image->pixelsU16;
-            rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
+            layout.pixels = (const uint8_t *)image->pixelsU16;
+            layout.rowBytes = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U16);
         }
     }
 
-    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, image->width);
-    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, image->height);
-    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 4);
-    TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, rowBytes));
+    layout.predictor = PREDICTOR_NONE;
+    if (writeParams->tiffPredictor && (layout.compression != COMPRESSION_NONE)) {
+        layout.predictor = (layout.sampleFormat == SAMPLEFORMAT_IEEEFP) ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL;
+    }
+
+    layout.rowsPerStrip = writeParams->tiffRowsPerStrip;
+    if (layout.rowsPerStrip <= 0) {
+        layout.rowsPerStrip = (int)CL_MAX(1, TIFF_AUTO_STRIP_BYTES / layout.rowBytes);
+    }
+    layout.rowsPerStrip = CL_MIN(layout.rowsPerStrip, image->height);
+    layout.stripCount = (image->height + layout.rowsPerStrip - 1) / layout.rowsPerStrip;
+
+    tiffCallbackInfoInit(&ci, C, output, 0);
 
+    TIFFSetErrorHandler(NULL);
+    TIFFSetErrorHandlerExt(errorHandler);
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(warningHandler);
+
+    Timer t;
+    timerStart(&t);
+
+    // Native byte order: the samples can then be written as-is, and libtiff never swabs them
+    tiff = tiffOpen(&ci, "w");
+    if (!tiff) {
+        clContextLogError(C, "cannot open TIFF for write");
+        writeResult = clFalse;
+        goto writeCleanup;
+    }
+
+    tiffSetWriteFields(tiff, &layout);
     if (writeParams->writeProfile) {
         TIFFSetField(tiff, TIFFTAG_ICCPROFILE, rawProfile.size, rawProfile.ptr);
     }
 
-    for (rowIndex = 0; rowIndex < image->height; ++rowIndex) {
-        uint8_t * pixelRow = &pixels[rowIndex * rowBytes];
-        if (TIFFWriteScanline(tiff, pixelRow, rowIndex, 0) < 0) {
-            clContextLogError(C, "Failed to write TIFF scanline row %d", rowIndex);
-            writeResult = clFalse;
-            goto writeCleanup;
-        }
+    if (!tiffWriteStrips(C, tiff, &layout)) {
+        writeResult = clFalse;
+        goto writeCleanup;
     }
 
 writeCleanup:
     if (tiff) {
         TIFFClose(tiff);
+        if (writeResult) {
+            // Drop the slack left by writeCallback's geometric growth
+            clRawRealloc(C, output, (size_t)ci.size);
+            C->writeExtraInfo.encodeCodecSeconds = timerElapsedSeconds(&t);
+        }
     }
     clRawFree(C, &rawProfile);
     return writeResult;
@@ -11,24 +11,111 @@
 #include "colorist/profile.h"
 
 #include "decode.h"
+#include "demux.h"
 #include "encode.h"
 #include "mux.h"
 
 #include <string.h>
 
-struct clImage * clFormatReadWebP(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input);
+struct clImage * clFormatReadWebP(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint);
 clBool clFormatWriteWebP(struct clContext * C,
                          struct clImage * image,
                          const char * formatName,
                          struct clRaw * output,
                          struct clWriteParams * writeParams);
+void * clFormatReadSequenceBeginWebP(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount);
+struct clImage * clFormatReadSequenceFrameWebP(struct clContext * C, void * sequenceState, double * outDuration);
+void clFormatReadSequenceEndWebP(struct clContext * C, void * sequenceState);
+clBool clFormatWriteSequenceWebP(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams);
+
+static void setupWebPConfig(struct clContext * C, WebPConfig * config, struct clWriteParams * writeParams)
+{
+    config->lossless = (writeParams->quality >= 100) ? 1 : 0;
+    config->emulate_jpeg_size = 1; // consistency across export quality values
+    config->quality = (float)writeParams->quality;
+    config->method = writeParams->webpMethod;
+    config->thread_level = (C->jobs > 1) ? 1 : 0;
+    config->alpha_quality = writeParams->webpAlphaQuality;
+    config->segments = writeParams->webpSegments;
+    config->partitions = writeParams->webpPartitions;
+    if (writeParams->webpNearLossless < 100) {
+        // near_lossless is a preprocessing step of the lossless encoder
+        config->lossless = 1;
+        config->near_lossless = writeParams->webpNearLossless;
+    }
+    clContextLog(C,
+                 "webp",
+                 1,
+                 "%s, method %d%s",
+                 config->lossless ? ((config->near_lossless < 100) ? "Near-lossless" : "Lossless") : "Lossy",
+                 config->method,
+                 config->thread_level ? ", threaded" : "");
+}
+
+// Compressed output goes straight into the destination clRaw, growing it as needed
+#define WEBP_WRITE_INITIAL_SIZE (64 * 1024)
+typedef struct clWebPWriter
+{
+    struct clContext * C;
+    clRaw * dst;
+    size_t offset; // bytes written so far; dst->size is the capacity
+} clWebPWriter;
+
+static int webpWrite(const uint8_t * data, size_t dataSize, const WebPPicture * picture)
+{
+    clWebPWriter * writer = (clWebPWriter *)picture->custom_ptr;
+    size_t needed = writer->offset + dataSize;
+    if (needed > writer->dst->size) {
+        size_t newSize = CL_MAX(writer->dst->size, WEBP_WRITE_INITIAL_SIZE);
+        while (newSize < needed) {
+            newSize *= 2;
+        }
+        clRawRealloc(writer->C, writer->dst, newSize);
+    }
+    memcpy(writer->dst->ptr + writer->offset, data, dataSize);
+    writer->offset = needed;
+    return 1;
+}
 
-struct clImage * clFormatReadWebP(struct clContext * C, const char * formatName, struct clProfile * overrideProfile, struct clRaw * input)
+// The whole file is already in memory, so the incremental decoder is handed a growing window of
+// the frame's bitstream in place (WebPIUpdate, no copies) and decodes straight into the clImage.
+// When C->readRowsFunc is set, the window grows in chunks of this size and finished rows are
+// reported after each one.
+#define WEBP_READ_CHUNK_SIZE (64 * 1024)
+// Deepest 1/2^n reduction to consider for a hint's minWidth/minHeight (libwebp scales to any size)
+#define WEBP_MAX_REDUCTION 8
+
+struct clImage * clFormatReadWebP(struct clContext * C,
+                                  const char * formatName,
+                                  struct clProfile * overrideProfile,
+                                  struct clRaw * input,
+                                  const struct clReadHint * hint)
 {
     COLORIST_UNUSED(formatName);
 
     clImage * image = NULL;
     clProfile * profile = NULL;
+    WebPDemuxer * demux = NULL;
+    WebPIDecoder * idec = NULL;
+    WebPIterator frameIter;
+    clBool haveFrame = clFalse;
+    clBool decoded = clFalse;
+    WebPDecoderConfig config;
+    double reportSeconds = 0.0; // spent in C->readRowsFunc, not counted as decode time
 
     Timer t;
     timerStart(&t);
@@ -36,61 +123,137 @@ struct clImage * clFormatReadWebP(struct clContext * C, const char * formatName,
     WebPData webpFileContents;
     webpFileContents.bytes = input->ptr;
     webpFileContents.size = input->size;
-    WebPMux * mux = WebPMuxCreate(&webpFileContents, 0);
-
-    uint32_t muxFlags;
-    WebPMuxGetFeatures(mux, &muxFlags);
+    demux = WebPDemux(&webpFileContents);
+    if (!demux) {
+        clContextLogError(C, "Failed to parse WebP");
+        goto readCleanup;
+    }
 
     if (overrideProfile) {
         profile = clProfileClone(C, overrideProfile);
-    } else if (muxFlags & ICCP_FLAG) {
-        WebPData iccChunk;
-        if (WebPMuxGetChunk(mux, "ICCP", &iccChunk) != WEBP_MUX_OK) {
+    } else if (WebPDemuxGetI(demux, WEBP_FF_FORMAT_FLAGS) & ICCP_FLAG) {
+        WebPChunkIterator chunkIter;
+        if (!WebPDemuxGetChunk(demux, "ICCP", 1, &chunkIter)) {
             clContextLogError(C, "Failed get ICC profile chunk");
             goto readCleanup;
         }
-        profile = clProfileParse(C, iccChunk.bytes, iccChunk.size, NULL);
+        profile = clProfileParse(C, chunkIter.chunk.bytes, chunkIter.chunk.size, NULL);
+        WebPDemuxReleaseChunkIterator(&chunkIter);
         if (!profile) {
             clContextLogError(C, "Failed parse ICC profile chunk");
             goto readCleanup;
         }
     }
 
-    WebPMuxFrameInfo frameInfo;
-    memset(&frameInfo, 0, sizeof(frameInfo));
-    if (WebPMuxGetFrame(mux, 1, &frameInfo) != WEBP_MUX_OK) {
+    if (!WebPDemuxGetFrame(demux, 1, &frameIter)) {
         clContextLogError(C, "Failed to get frame chunk in WebP");
         goto readCleanup;
     }
+    haveFrame = clTrue;
+    const uint8_t * bitstream = frameIter.fragment.bytes;
+    size_t bitstreamSize = frameIter.fragment.size;
 
-    int width, height;
-    if (!WebPGetInfo(frameInfo.bitstream.bytes, frameInfo.bitstream.size, &width, &height)) {
+    if (!WebPInitDecoderConfig(&config) || (WebPGetFeatures(bitstream, bitstreamSize, &config.input) != VP8_STATUS_OK)) {
         clContextLogError(C, "Failed to decode WebP");
         goto readCleanup;
     }
+    int width = config.input.width;
+    int height = config.input.height;
+
+    config.options.use_threads = (C->jobs > 1) ? 1 : 0;
+    config.options.bypass_filtering = C->params.webpBypassFiltering ? 1 : 0;
+    if ((C->params.upsampling == CL_CHROMAUPSAMPLING_FASTEST) || (C->params.upsampling == CL_CHROMAUPSAMPLING_NEAREST)) {
+        config.options.no_fancy_upsampling = 1;
+    }
+    if (hint) {
+        // libwebp crops exactly (no even-pixel snapping for RGBA output) and rescales while decoding
+        int rect[4];
+        clBool cropping = clReadHintRect(C, hint, width, height, rect);
+        int reduction = clReadHintReduction(C, hint, 0, 0, rect[2], rect[3], WEBP_MAX_REDUCTION);
+        if (cropping) {
+            config.options.use_cropping = 1;
+            config.options.crop_left = rect[0];
+            config.options.crop_top = rect[1];
+            config.options.crop_width = rect[2];
+            config.options.crop_height = rect[3];
+        }
+        width = rect[2];
+        height = rect[3];
+        if (reduction > 0) {
+            width = (width + (1 << reduction) - 1) >> reduction;
+            height = (height + (1 << reduction) - 1) >> reduction;
+            config.options.use_scaling = 1;
+            config.options.scaled_width = width;
+            config.options.scaled_height = height;
+        }
+        if (cropping || (reduction > 0)) {
+            clContextLog(C, "webp", 1, "Decoding +%d+%d %dx%d at 1/%d scale", rect[0], rect[1], rect[2], rect[3], 1 << reduction);
+        }
+
+        C->readExtraInfo.hintApplied = clTrue;
+        memcpy(C->readExtraInfo.hintRect, rect, sizeof(rect));
+        C->readExtraInfo.hintReduction = reduction;
+    }
 
     clImageLogCreate(C, width, height, 8, profile);
     image = clImageCreate(C, width, height, 8, profile);
     clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
-    if (!WebPDecodeRGBAInto(frameInfo.bitstream.bytes,
-                            frameInfo.bitstream.size,
-                            image->pixelsU8,
-                            image->width * image->height * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8),
-                            image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8))) {
-        clContextLogError(C, "Failed to decode WebP");
+
+    config.output.colorspace = MODE_RGBA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = image->pixelsU8;
+    config.output.u.RGBA.stride = image->width * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8);
+    config.output.u.RGBA.size = (size_t)config.output.u.RGBA.stride * image->height;
+
+    idec = WebPIDecode(NULL, 0, &config);
+    if (!idec) {
+        clContextLogError(C, "Failed to create WebP decoder");
+        goto readCleanup;
+    }
+
+    size_t chunkSize = C->readRowsFunc ? WEBP_READ_CHUNK_SIZE : bitstreamSize;
+    size_t availableSize = 0;
+    int reportedRows = 0;
+    VP8StatusCode status = VP8_STATUS_SUSPENDED;
+    while ((status == VP8_STATUS_SUSPENDED) && (availableSize < bitstreamSize)) {
+        availableSize = CL_MIN(availableSize + chunkSize, bitstreamSize);
+        status = WebPIUpdate(idec, bitstream, availableSize);
+
+        int lastRow = 0;
+        if (C->readRowsFunc && WebPIDecGetRGB(idec, &lastRow, NULL, NULL, NULL) && (lastRow > reportedRows)) {
+            Timer reportTimer;
+            timerStart(&reportTimer);
+            C->readRowsFunc(C, image, reportedRows, lastRow - reportedRows, C->readRowsUserData);
+            reportSeconds += timerElapsedSeconds(&reportTimer);
+            reportedRows = lastRow;
+        }
+    }
+    if (status != VP8_STATUS_OK) {
+        clContextLogError(C, "Failed to decode WebP (status %d)", (int)status);
         goto readCleanup;
     }
+    decoded = clTrue;
 
-    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t);
+    C->readExtraInfo.decodeCodecSeconds = timerElapsedSeconds(&t) - reportSeconds;
 
 readCleanup:
-    WebPDataClear(&frameInfo.bitstream);
-    if (mux) {
-        WebPMuxDelete(mux);
+    if (idec) {
+        WebPIDelete(idec);
+        WebPFreeDecBuffer(&config.output);
+    }
+    if (haveFrame) {
+        WebPDemuxReleaseIterator(&frameIter);
+    }
+    if (demux) {
+        WebPDemuxDelete(demux);
     }
     if (profile) {
         clProfileDestroy(C, profile);
     }
+    if (image && !decoded) {
+        clImageDestroy(C, image);
+        image = NULL;
+    }
     return image;
 }
 
@@ -98,35 +261,33 @@ clBool clFormatWriteWebP(struct clContext * C, struct clImage * image, const cha
 {
     COLORIST_UNUSED(formatName);
 
-    clBool writeResult = clTrue;
+    clBool writeResult = clFalse;
 
     WebPConfig config;
     WebPPicture picture;
-    WebPMemoryWriter memoryWriter;
+    clWebPWriter writer;
 
     WebPData imageChunk, assembledChunk;
     WebPMux * mux = NULL;
+    clRaw rawProfile = CL_RAW_EMPTY;
 
     memset(&imageChunk, 0, sizeof(imageChunk));
     memset(&assembledChunk, 0, sizeof(assembledChunk));
 
-    WebPMemoryWriterInit(&memoryWriter);
     WebPConfigInit(&config);
     WebPPictureInit(&picture);
 
-    clRaw rawProfile = CL_RAW_EMPTY;
-    if (!clProfilePack(C, image->profile, &rawProfile)) {
-        clContextLogError(C, "Failed to create ICC profile");
+    setupWebPConfig(C, &config, writeParams);
+    if (!WebPValidateConfig(&config)) {
+        clContextLogError(C, "Invalid WebP encoder settings");
         goto writeCleanup;
     }
 
-    config.lossless = (writeParams->quality >= 100) ? 1 : 0;
-    config.emulate_jpeg_size = 1; // consistency across export quality values
-    config.quality = (float)writeParams->quality;
-    config.method = 6; // always go for the best output, encoding speed be damned
-
-    picture.writer = WebPMemoryWrite;
-    picture.custom_ptr = (void *)&memoryWriter;
+    writer.C = C;
+    writer.dst = output;
+    writer.offset = 0;
+    picture.writer = webpWrite;
+    picture.custom_ptr = (void *)&writer;
     picture.use_argb = 1;
     picture.width = image->width;
     picture.height = image->height;
@@ -134,27 +295,39 @@ clBool clFormatWriteWebP(struct clContext * C, struct clImage * image, const cha
     clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
     WebPPictureImportRGBA(&picture, image->pixelsU8, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8) * image->width);
 
+    Timer t;
+    timerStart(&t);
     if (!WebPEncode(&config, &picture)) {
         clContextLogError(C, "Failed to encode WebP");
-        writeResult = clFalse;
+        goto writeCleanup;
+    }
+    C->writeExtraInfo.encodeCodecSeconds = timerElapsedSeconds(&t);
+    output->size = writer.offset;
+
+    if (!writeParams->writeProfile) {
+        // The encoder already wrote a complete (simple format) WebP file
+        writeResult = clTrue;
+        goto writeCleanup;
+    }
+
+    if (!clProfilePack(C, image->profile, &rawProfile)) {
+        clContextLogError(C, "Failed to create ICC profile");
         goto writeCleanup;
     }
 
     mux = WebPMuxNew();
 
-    if (writeParams->writeProfile) {
-        WebPData iccChunk;
-        memset(&iccChunk, 0, sizeof(iccChunk));
-        iccChunk.bytes = rawProfile.ptr;
-        iccChunk.size = rawProfile.size;
-        if (!WebPMuxSetChunk(mux, "ICCP", &iccChunk, 0)) {
-            clContextLogError(C, "Failed create ICC profile");
-            goto writeCleanup;
-        }
+    WebPData iccChunk;
+    memset(&iccChunk, 0, sizeof(iccChunk));
+    iccChunk.bytes = rawProfile.ptr;
+    iccChunk.size = rawProfile.size;
+    if (WebPMuxSetChunk(mux, "ICCP", &iccChunk, 0) != WEBP_MUX_OK) {
+        clContextLogError(C, "Failed create ICC profile");
+        goto writeCleanup;
     }
 
-    imageChunk.bytes = memoryWriter.mem;
-    imageChunk.size = memoryWriter.size;
+    imageChunk.bytes = output->ptr;
+    imageChunk.size = output->size;
     WebPMuxSetImage(mux, &imageChunk, 0);
     if (WebPMuxAssemble(mux, &assembledChunk) != WEBP_MUX_OK) {
         clContextLogError(C, "Failed to assemble WebP");
@@ -162,14 +335,241 @@ clBool clFormatWriteWebP(struct clContext * C, struct clImage * image, const cha
     }
 
     clRawSet(C, output, assembledChunk.bytes, assembledChunk.size);
+    writeResult = clTrue;
 
 writeCleanup:
     if (mux) {
         WebPMuxDelete(mux);
     }
     WebPDataClear(&assembledChunk);
-    WebPMemoryWriterClear(&memoryWriter);
     WebPPictureFree(&picture);
     clRawFree(C, &rawProfile);
     return writeResult;
 }
+
+typedef struct clSequenceWebP
+{
+    WebPAnimDecoder * decoder;
+    clProfile * profile;
+    int timestamp; // end of the most recently decoded frame, in ms
+} clSequenceWebP;
+
+void * clFormatReadSequenceBeginWebP(struct clContext * C,
+                                     const char * formatName,
+                                     struct clProfile * overrideProfile,
+                                     struct clRaw * input,
+                                     int * outFrameCount)
+{
+    COLORIST_UNUSED(formatName);
+
+    WebPData webpFileContents;
+    webpFileContents.bytes = input->ptr;
+    webpFileContents.size = input->size;
+
+    WebPAnimDecoderOptions options;
+    if (!WebPAnimDecoderOptionsInit(&options)) {
+        clContextLogError(C, "Failed to init WebP decoder");
+        return NULL;
+    }
+    options.color_mode = MODE_RGBA;
+    options.use_threads = (C->jobs > 1) ? 1 : 0;
+
+    WebPAnimDecoder * decoder = WebPAnimDecoderNew(&webpFileContents, &options);
+    if (!decoder) {
+        clContextLogError(C, "Failed to decode WebP");
+        return NULL;
+    }
+
+    WebPAnimInfo animInfo;
+    if (!WebPAnimDecoderGetInfo(decoder, &animInfo)) {
+        clContextLogError(C, "Failed to decode WebP");
+        WebPAnimDecoderDelete(decoder);
+        return NULL;
+    }
+
+    clProfile * profile = NULL;
+    if (overrideProfile) {
+        profile = clProfileClone(C, overrideProfile);
+    } else {
+        const WebPDemuxer * demux = WebPAnimDecoderGetDemuxer(decoder);
+        if (WebPDemuxGetI(demux, WEBP_FF_FORMAT_FLAGS) & ICCP_FLAG) {
+            WebPChunkIterator chunkIter;
+            if (!WebPDemuxGetChunk(demux, "ICCP", 1, &chunkIter)) {
+                clContextLogError(C, "Failed get ICC profile chunk");
+                WebPAnimDecoderDelete(decoder);
+                return NULL;
+            }
+            profile = clProfileParse(C, chunkIter.chunk.bytes, chunkIter.chunk.size, NULL);
+            WebPDemuxReleaseChunkIterator(&chunkIter);
+            if (!profile) {
+                clContextLogError(C, "Failed parse ICC profile chunk");
+                WebPAnimDecoderDelete(decoder);
+                return NULL;
+            }
+        }
+    }
+
+    clContextLog(C,
+                 "webp",
+                 1,
+                 "WebP contains %u frame%s (%ux%u canvas), decoding in order.",
+                 animInfo.frame_count,
+                 (animInfo.frame_count == 1) ? "" : "s",
+                 animInfo.canvas_width,
+                 animInfo.canvas_height);
+
+    clSequenceWebP * sequence = clAllocateStruct(clSequenceWebP);
+    sequence->decoder = decoder;
+    sequence->profile = profile;
+    sequence->timestamp = 0;
+    *outFrameCount = (int)animInfo.frame_count;
+    return sequence;
+}
+
+struct clImage * clFormatReadSequenceFrameWebP(struct clContext * C, void * sequenceState, double * outDuration)
+{
+    clSequenceWebP * sequence = (clSequenceWebP *)sequenceState;
+
+    Timer t;
+    timerStart(&t);
+
+    uint8_t * canvas = NULL;
+    int timestamp = 0;
+    if (!WebPAnimDecoderGetNext(sequence->decoder, &canvas, &timestamp)) {
+        clContextLogError(C, "Failed to decode WebP frame");
+        return NULL;
+    }
+    *outDuration = (double)(timestamp - sequence->timestamp) / 1000.0;
+    sequence->timestamp = timestamp;
+
+    // The decoder hands back its own fully composited canvas, which is reused for the next frame
+    WebPAnimInfo animInfo;
+    WebPAnimDecoderGetInfo(sequence->decoder, &animInfo);
+    int width = (int)animInfo.canvas_width;
+    int height = (int)animInfo.canvas_height;
+
+    clImageLogCreate(C, width, height, 8, sequence->profile);
+    clImage * image = clImageCreate(C, width, height, 8, sequence->profile);
+    clImagePrepareWritePixels(C, image, CL_PIXELFORMAT_U8);
+    memcpy(image->pixelsU8, canvas, (size_t)width * height * CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8));
+
+    C->readExtraInfo.decodeCodecSeconds += timerElapsedSeconds(&t);
+    return image;
+}
+
+void clFormatReadSequenceEndWebP(struct clContext * C, void * sequenceState)
+{
+    clSequenceWebP * sequence = (clSequenceWebP *)sequenceState;
+    WebPAnimDecoderDelete(sequence->decoder);
+    if (sequence->profile) {
+        clProfileDestroy(C, sequence->profile);
+    }
+    clFree(sequence);
+}
+
+clBool clFormatWriteSequenceWebP(struct clContext * C,
+                                 struct clImage ** frames,
+                                 const double * durations,
+                                 int frameCount,
+                                 const char * formatName,
+                                 struct clRaw * output,
+                                 struct clWriteParams * writeParams)
+{
+    COLORIST_UNUSED(formatName);
+
+    clBool writeResult = clFalse;
+
+    WebPConfig config;
+    WebPAnimEncoderOptions options;
+    WebPAnimEncoder * encoder = NULL;
+    WebPMux * mux = NULL;
+    WebPData animChunk, assembledChunk;
+    clRaw rawProfile = CL_RAW_EMPTY;
+
+    memset(&animChunk, 0, sizeof(animChunk));
+    memset(&assembledChunk, 0, sizeof(assembledChunk));
+
+    if (!WebPConfigInit(&config) || !WebPAnimEncoderOptionsInit(&options)) {
+        clContextLogError(C, "Failed to init WebP encoder");
+        goto writeCleanup;
+    }
+    setupWebPConfig(C, &config, writeParams);
+
+    encoder = WebPAnimEncoderNew(frames[0]->width, frames[0]->height, &options);
+    if (!encoder) {
+        clContextLogError(C, "Failed to create WebP animation encoder");
+        goto writeCleanup;
+    }
+
+    double timestamp = 0.0;
+    for (int frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        clImage * image = frames[frameIndex];
+
+        WebPPicture picture;
+        WebPPictureInit(&picture);
+        picture.use_argb = 1;
+        picture.width = image->width;
+        picture.height = image->height;
+
+        clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
+        WebPPictureImportRGBA(&picture, image->pixelsU8, CL_BYTES_PER_PIXEL(CL_PIXELFORMAT_U8) * image->width);
+        int added = WebPAnimEncoderAdd(encoder, &picture, (int)(timestamp * 1000.0 + 0.5), &config);
+        WebPPictureFree(&picture);
+        if (!added) {
+            clContextLogError(C, "Failed to encode WebP frame %d (%s)", frameIndex, WebPAnimEncoderGetError(encoder));
+            goto writeCleanup;
+        }
+
+        timestamp += (durations && (durations[frameIndex] > 0.0)) ? durations[frameIndex] : CL_SEQUENCE_DEFAULT_FRAME_DURATION;
+    }
+
+    // A NULL frame marks the end time of the last frame
+    if (!WebPAnimEncoderAdd(encoder, NULL, (int)(timestamp * 1000.0 + 0.5), NULL) || !WebPAnimEncoderAssemble(encoder, &animChunk)) {
+        clContextLogError(C, "Failed to assemble WebP (%s)", WebPAnimEncoderGetError(encoder));
+        goto writeCleanup;
+    }
+
+    if (!writeParams->writeProfile) {
+        clRawSet(C, output, animChunk.bytes, animChunk.size);
+        writeResult = clTrue;
+        goto writeCleanup;
+    }
+
+    if (!clProfilePack(C, frames[0]->profile, &rawProfile)) {
+        clContextLogError(C, "Failed to create ICC profile");
+        goto writeCleanup;
+    }
+
+    mux = WebPMuxCreate(&animChunk, 0);
+    if (!mux) {
+        clContextLogError(C, "Failed to assemble WebP");
+        goto writeCleanup;
+    }
+
+    WebPData iccChunk;
+    iccChunk.bytes = rawProfile.ptr;
+    iccChunk.size = rawProfile.size;
+    if (WebPMuxSetChunk(mux, "ICCP", &iccChunk, 0) != WEBP_MUX_OK) {
+        clContextLogError(C, "Failed create ICC profile");
+        goto writeCleanup;
+    }
+    if (WebPMuxAssemble(mux, &assembledChunk) != WEBP_MUX_OK) {
+        clContextLogError(C, "Failed to assemble WebP");
+        goto writeCleanup;
+    }
+
+    clRawSet(C, output, assembledChunk.bytes, assembledChunk.size);
+    writeResult = clTrue;
+
+writeCleanup:
+    if (mux) {
+        WebPMuxDelete(mux);
+    }
+    if (encoder) {
+        WebPAnimEncoderDelete(encoder);
+    }
+    WebPDataClear(&animChunk);
+    WebPDataClear(&assembledChunk);
+    clRawFree(C, &rawProfile);
+    return writeResult;
+}
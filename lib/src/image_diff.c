@@ -10,11 +10,146 @@
 #include "colorist/context.h"
 #include "colorist/pixelmath.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
 #include "colorist/transform.h"
 
-#include <stdlib.h>
 #include <string.h>
 
+// Intensities are 8-bit values of round(255 * intensity^(1/2.2)). Instead of a powf() per pixel,
+// thresholds[k] holds the smallest intensity that rounds to k, and start[] gives the lowest
+// candidate k for each bucket of the [0,1] intensity range so a lookup only walks a step or two.
+#define DIFF_INTENSITY_BUCKETS 1024
+
+typedef struct clDiffIntensityLUT
+{
+    float thresholds[256];
+    uint8_t start[DIFF_INTENSITY_BUCKETS + 1];
+} clDiffIntensityLUT;
+
+static void diffIntensityLUTInit(clDiffIntensityLUT * lut)
+{
+    lut->thresholds[0] = 0.0f;
+    for (int k = 1; k < 256; ++k) {
+        lut->thresholds[k] = powf(((float)k - 0.5f) / 255.0f, 2.2f);
+    }
+
+    int k = 0;
+    for (int bucket = 0; bucket <= DIFF_INTENSITY_BUCKETS; ++bucket) {
+        float bucketStart = (float)bucket / (float)DIFF_INTENSITY_BUCKETS;
+        while ((k < 255) && (lut->thresholds[k + 1] <= bucketStart)) {
+            ++k;
+        }
+        lut->start[bucket] = (uint8_t)k;
+    }
+}
+
+static uint16_t diffIntensityLookup(const clDiffIntensityLUT * lut, float intensity)
+{
+    int k = lut->start[(int)(intensity * (float)DIFF_INTENSITY_BUCKETS)];
+    while ((k < 255) && (intensity >= lut->thresholds[k + 1])) {
+        ++k;
+    }
+    return (uint16_t)k;
+}
+
+typedef struct clDiffCreateTask
+{
+    clImage * image1;
+    clImage * image2;
+    clImageDiff * diff;
+    const clDiffIntensityLUT * lut;
+    float intensityScale[3]; // luma coefficients, pre-divided by image1's max channel value
+    int firstPixel;
+    int pixelCount;
+
+    // output
+    int * histogram; // histogramMax + 1 entries
+    int histogramMax;
+    int largestChannelDiff;
+} clDiffCreateTask;
+
+static void diffCreateTaskFunc(clDiffCreateTask * info)
+{
+    const uint16_t * pixels1 = &info->image1->pixelsU16[info->firstPixel * CL_CHANNELS_PER_PIXEL];
+    const uint16_t * pixels2 = &info->image2->pixelsU16[info->firstPixel * CL_CHANNELS_PER_PIXEL];
+    uint16_t * diffs = &info->diff->diffs[info->firstPixel];
+    uint16_t * intensities = &info->diff->intensities[info->firstPixel];
+    const float minIntensity = info->diff->minIntensity;
+
+    // Largest channel diff; kept branch-free so the compiler is free to vectorize it
+    for (int i = 0; i < info->pixelCount; ++i) {
+        const uint16_t * p1 = &pixels1[i * CL_CHANNELS_PER_PIXEL];
+        const uint16_t * p2 = &pixels2[i * CL_CHANNELS_PER_PIXEL];
+        int d0 = (int)p1[0] - (int)p2[0];
+        int d1 = (int)p1[1] - (int)p2[1];
+        int d2 = (int)p1[2] - (int)p2[2];
+        int d3 = (int)p1[3] - (int)p2[3];
+        d0 = (d0 < 0) ? -d0 : d0;
+        d1 = (d1 < 0) ? -d1 : d1;
+        d2 = (d2 < 0) ? -d2 : d2;
+        d3 = (d3 < 0) ? -d3 : d3;
+        int d01 = (d0 > d1) ? d0 : d1;
+        int d23 = (d2 > d3) ? d2 : d3;
+        diffs[i] = (uint16_t)((d01 > d23) ? d01 : d23);
+    }
+
+    int largestChannelDiff = 0;
+    for (int i = 0; i < info->pixelCount; ++i) {
+        ++info->histogram[CL_MIN(diffs[i], info->histogramMax)];
+        largestChannelDiff = (largestChannelDiff < diffs[i]) ? diffs[i] : largestChannelDiff;
+    }
+    info->largestChannelDiff = largestChannelDiff;
+
+    for (int i = 0; i < info->pixelCount; ++i) {
+        const uint16_t * p1 = &pixels1[i * CL_CHANNELS_PER_PIXEL];
+        float intensity = ((float)p1[0] * info->intensityScale[0]) + ((float)p1[1] * info->intensityScale[1]) +
+                          ((float)p1[2] * info->intensityScale[2]);
+        intensity = CL_CLAMP(intensity + minIntensity, 0.0f, 1.0f);
+        intensities[i] = diffIntensityLookup(info->lut, intensity);
+    }
+}
+
+typedef struct clDiffPaintTask
+{
+    clImageDiff * diff;
+    int threshold;
+    int firstPixel;
+    int pixelCount;
+} clDiffPaintTask;
+
+static void diffPaintTaskFunc(clDiffPaintTask * info)
+{
+    clImageDiff * diff = info->diff;
+    for (int i = info->firstPixel; i < (info->firstPixel + info->pixelCount); ++i) {
+        uint16_t * diffPixel = &diff->image->pixelsU16[i * CL_CHANNELS_PER_PIXEL];
+        uint16_t intensity = diff->intensities[i];
+
+        if (diff->diffs[i] == 0) {
+            diffPixel[0] = intensity;
+            diffPixel[1] = intensity;
+            diffPixel[2] = intensity;
+        } else if (diff->diffs[i] <= info->threshold) {
+            diffPixel[0] = intensity >> 4;
+            diffPixel[1] = intensity >> 4;
+            diffPixel[2] = intensity;
+        } else {
+            diffPixel[0] = intensity;
+            diffPixel[1] = intensity >> 4;
+            diffPixel[2] = intensity >> 4;
+        }
+        diffPixel[3] = 255;
+    }
+}
+
+// Splits the image into whole rows per task
+static int diffTaskCount(clContext * C, clImageDiff * diff, int * rowsPerTask)
+{
+    int height = diff->image->height;
+    int taskCount = CL_CLAMP(C->jobs, 1, CL_MAX(height, 1));
+    *rowsPerTask = height / taskCount;
+    return taskCount;
+}
+
 clImageDiff * clImageDiffCreate(struct clContext * C, clImage * image1, clImage * image2, float minIntensity, int threshold)
 {
     if (!clProfileComponentsMatch(C, image1->profile, image2->profile) || (image1->width != image2->width) ||
@@ -31,101 +166,97 @@ clImageDiff * clImageDiffCreate(struct clContext * C, clImage * image1, clImage
     diff->intensities = clAllocate(sizeof(uint16_t) * diff->pixelCount);
     clImagePrepareWritePixels(C, diff->image, CL_PIXELFORMAT_U16);
 
-    clProfilePrimaries primaries;
-    clProfileCurve curve;
-    int luminance = CL_LUMINANCE_UNSPECIFIED;
-    clProfileQuery(C, image1->profile, &primaries, &curve, &luminance);
-    if (luminance == CL_LUMINANCE_UNSPECIFIED) {
-        if (curve.type == CL_PCT_HLG) {
-            luminance = clTransformCalcHLGLuminance(C->defaultLuminance);
-        } else {
-            luminance = C->defaultLuminance;
-        }
-    }
-
-    clContextGetStockPrimaries(C, "bt709", &primaries);
-    curve.type = CL_PCT_GAMMA;
-    curve.implicitScale = 1.0f;
-    curve.gamma = 1.0f;
-    clProfile * intensityProfile = clProfileCreate(C, &primaries, &curve, C->defaultLuminance, NULL);
-    clProfileDestroy(C, intensityProfile);
+    int depthU16 = CL_CLAMP(image1->depth, 8, 16);
+    int maxChannel = (1 << depthU16) - 1;
+    diff->diffCountsSize = maxChannel + 1;
+    diff->diffCounts = clAllocate(sizeof(int) * diff->diffCountsSize);
 
     clImagePrepareReadPixels(C, image1, CL_PIXELFORMAT_U16);
-    clImagePrepareReadPixels(C, image1, CL_PIXELFORMAT_F32); // for intensity calculation
     clImagePrepareReadPixels(C, image2, CL_PIXELFORMAT_U16);
 
+    clDiffIntensityLUT lut;
+    diffIntensityLUTInit(&lut);
+
     float kr = 0.2126f;
     float kb = 0.0722f;
     float kg = 1.0f - kr - kb;
-    for (int i = 0; i < diff->pixelCount; ++i) {
-        uint16_t * p1 = &image1->pixelsU16[i * CL_CHANNELS_PER_PIXEL];
-        uint16_t * p2 = &image2->pixelsU16[i * CL_CHANNELS_PER_PIXEL];
-        uint16_t * diffPixel = &diff->image->pixelsU16[i * CL_CHANNELS_PER_PIXEL];
 
-        float * intensityPixel = &image1->pixelsF32[i * CL_CHANNELS_PER_PIXEL];
-        float intensity = (intensityPixel[0] * kr) + (intensityPixel[1] * kg) + (intensityPixel[2] * kb);
-        intensity = CL_CLAMP(intensity + diff->minIntensity, 0.0f, 1.0f);
-        diff->intensities[i] = (uint16_t)clPixelMathRoundf(255.0f * powf(intensity, 1.0f / 2.2f));
+    int rowsPerTask;
+    int taskCount = diffTaskCount(C, diff, &rowsPerTask);
+    clDiffCreateTask * infos = clAllocate(taskCount * sizeof(clDiffCreateTask));
+    int * histograms = clAllocate(taskCount * diff->diffCountsSize * sizeof(int));
+    memset(histograms, 0, taskCount * diff->diffCountsSize * sizeof(int));
+    for (int i = 0; i < taskCount; ++i) {
+        int firstRow = i * rowsPerTask;
+        int rowCount = (i == (taskCount - 1)) ? (image1->height - firstRow) : rowsPerTask;
+        infos[i].image1 = image1;
+        infos[i].image2 = image2;
+        infos[i].diff = diff;
+        infos[i].lut = &lut;
+        infos[i].intensityScale[0] = kr / (float)maxChannel;
+        infos[i].intensityScale[1] = kg / (float)maxChannel;
+        infos[i].intensityScale[2] = kb / (float)maxChannel;
+        infos[i].firstPixel = firstRow * image1->width;
+        infos[i].pixelCount = rowCount * image1->width;
+        infos[i].histogram = &histograms[i * diff->diffCountsSize];
+        infos[i].histogramMax = diff->diffCountsSize - 1;
+        infos[i].largestChannelDiff = 0;
+    }
+    clTaskRunAll(C, (clTaskFunc)diffCreateTaskFunc, infos, sizeof(clDiffCreateTask), taskCount);
 
-        int channelDiff;
-        int largestDiff = abs((int)p1[0] - (int)p2[0]);
-        channelDiff = abs((int)p1[1] - (int)p2[1]);
-        if (largestDiff < channelDiff) {
-            largestDiff = channelDiff;
-        }
-        channelDiff = abs((int)p1[2] - (int)p2[2]);
-        if (largestDiff < channelDiff) {
-            largestDiff = channelDiff;
-        }
-        channelDiff = abs((int)p1[3] - (int)p2[3]);
-        if (largestDiff < channelDiff) {
-            largestDiff = channelDiff;
+    // Merge the per-task histograms into running totals: diffCounts[i] = pixels with a diff <= i
+    int runningCount = 0;
+    for (int value = 0; value < diff->diffCountsSize; ++value) {
+        for (int i = 0; i < taskCount; ++i) {
+            runningCount += infos[i].histogram[value];
         }
-
-        diff->diffs[i] = (uint16_t)largestDiff;
-
-        if (diff->largestChannelDiff < largestDiff) {
-            diff->largestChannelDiff = largestDiff;
+        diff->diffCounts[value] = runningCount;
+    }
+    for (int i = 0; i < taskCount; ++i) {
+        if (diff->largestChannelDiff < infos[i].largestChannelDiff) {
+            diff->largestChannelDiff = infos[i].largestChannelDiff;
         }
-
-        diffPixel[3] = 255;
     }
+    clFree(histograms);
+    clFree(infos);
 
     clImageDiffUpdate(C, diff, threshold);
     return diff;
 }
 
-void clImageDiffUpdate(struct clContext * C, clImageDiff * diff, int threshold)
+void clImageDiffUpdateCounts(struct clContext * C, clImageDiff * diff, int threshold)
 {
     COLORIST_UNUSED(C);
-    COLORIST_UNUSED(threshold);
 
-    diff->matchCount = 0;
-    diff->underThresholdCount = 0;
-    diff->overThresholdCount = 0;
+    diff->matchCount = diff->pixelCount ? diff->diffCounts[0] : 0;
+    if (threshold < 0) {
+        diff->underThresholdCount = 0;
+    } else {
+        int clampedThreshold = CL_MIN(threshold, diff->diffCountsSize - 1);
+        diff->underThresholdCount = diff->diffCounts[clampedThreshold] - diff->matchCount;
+    }
+    diff->overThresholdCount = diff->pixelCount - diff->matchCount - diff->underThresholdCount;
+}
+
+void clImageDiffUpdate(struct clContext * C, clImageDiff * diff, int threshold)
+{
+    clImageDiffUpdateCounts(C, diff, threshold);
 
     clImagePrepareWritePixels(C, diff->image, CL_PIXELFORMAT_U16);
 
-    for (int i = 0; i < diff->pixelCount; ++i) {
-        uint16_t * diffPixel = &diff->image->pixelsU16[i * CL_CHANNELS_PER_PIXEL];
-
-        if (diff->diffs[i] == 0) {
-            ++diff->matchCount;
-            diffPixel[0] = diff->intensities[i];
-            diffPixel[1] = diff->intensities[i];
-            diffPixel[2] = diff->intensities[i];
-        } else if (diff->diffs[i] <= threshold) {
-            ++diff->underThresholdCount;
-            diffPixel[0] = diff->intensities[i] >> 4;
-            diffPixel[1] = diff->intensities[i] >> 4;
-            diffPixel[2] = diff->intensities[i];
-        } else {
-            ++diff->overThresholdCount;
-            diffPixel[0] = diff->intensities[i];
-            diffPixel[1] = diff->intensities[i] >> 4;
-            diffPixel[2] = diff->intensities[i] >> 4;
-        }
+    int rowsPerTask;
+    int taskCount = diffTaskCount(C, diff, &rowsPerTask);
+    clDiffPaintTask * infos = clAllocate(taskCount * sizeof(clDiffPaintTask));
+    for (int i = 0; i < taskCount; ++i) {
+        int firstRow = i * rowsPerTask;
+        int rowCount = (i == (taskCount - 1)) ? (diff->image->height - firstRow) : rowsPerTask;
+        infos[i].diff = diff;
+        infos[i].threshold = threshold;
+        infos[i].firstPixel = firstRow * diff->image->width;
+        infos[i].pixelCount = rowCount * diff->image->width;
     }
+    clTaskRunAll(C, (clTaskFunc)diffPaintTaskFunc, infos, sizeof(clDiffPaintTask), taskCount);
+    clFree(infos);
 }
 
 void clImageDiffDestroy(struct clContext * C, clImageDiff * diff)
@@ -133,5 +264,6 @@ void clImageDiffDestroy(struct clContext * C, clImageDiff * diff)
     clImageDestroy(C, diff->image);
     clFree(diff->diffs);
     clFree(diff->intensities);
+    clFree(diff->diffCounts);
     clFree(diff);
 }
@@ -0,0 +1,250 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/image.h"
+
+#include "colorist/context.h"
+#include "colorist/profile.h"
+#include "colorist/raw.h"
+#include "colorist/task.h"
+
+#include <string.h>
+
+typedef struct clSequenceConvertInfo
+{
+    clContext * C;
+    int depth;
+    clProfile * dstProfile;
+    clTonemap tonemap;
+    clTonemapParams tonemapParams;
+
+    // The frame currently being converted
+    clTask * task;
+    clMutex * logMutex; // installed as C->logMutex while task runs, unless C already has one
+    clImage * srcImage;
+    clImage * dstImage;
+    double duration;
+} clSequenceConvertInfo;
+
+static void sequenceConvertTaskFunc(clSequenceConvertInfo * info)
+{
+    info->dstImage = clImageConvert(info->C, info->srcImage, info->depth, info->dstProfile, info->tonemap, &info->tonemapParams);
+}
+
+// Kicks off conversion of info->srcImage; runs inline when there is only one job to go around.
+static void sequenceConvertStart(clContext * C, clSequenceConvertInfo * info)
+{
+    if (C->jobs > 1) {
+        // The task logs on C while this thread decodes (and logs) the next frame, so they take turns
+        if (!C->logMutex) {
+            if (!info->logMutex) {
+                info->logMutex = clMutexCreate(C);
+            }
+            C->logMutex = info->logMutex;
+        }
+        info->task = clTaskCreate(C, (clTaskFunc)sequenceConvertTaskFunc, info);
+    } else {
+        sequenceConvertTaskFunc(info);
+    }
+}
+
+static void sequenceConvertFinish(clContext * C, clSequenceConvertInfo * info)
+{
+    if (info->task) {
+        clTaskDestroy(C, info->task);
+        info->task = NULL;
+        if (info->logMutex && (C->logMutex == info->logMutex)) {
+            C->logMutex = NULL;
+        }
+    }
+    if (info->srcImage) {
+        clImageDestroy(C, info->srcImage);
+        info->srcImage = NULL;
+    }
+}
+
+static clBool formatReadsSequences(clFormat * format)
+{
+    return format->readSequenceBeginFunc && format->readSequenceFrameFunc && format->readSequenceEndFunc;
+}
+
+static clImage * sequenceDecodeFrame(clContext * C, clImageSequence * sequence, double * outDuration)
+{
+    *outDuration = 0.0;
+    if (sequence->failed || (sequence->decodedCount >= sequence->frameCount)) {
+        return NULL;
+    }
+
+    clImage * image;
+    if (formatReadsSequences(sequence->format)) {
+        image = sequence->format->readSequenceFrameFunc(C, sequence->decoderState, outDuration);
+    } else {
+        image = (clImage *)sequence->decoderState;
+        sequence->decoderState = NULL;
+    }
+
+    if (image) {
+        ++sequence->decodedCount;
+    } else {
+        sequence->failed = clTrue;
+    }
+    return image;
+}
+
+clImageSequence * clImageSequenceCreate(struct clContext * C, const char * filename, const char * iccOverride, const char ** outFormatName)
+{
+    const char * formatName = clFormatDetect(C, filename);
+    if (outFormatName)
+        *outFormatName = formatName;
+    if (!formatName || !strcmp(formatName, "icc")) {
+        return NULL;
+    }
+
+    clFormat * format = clContextFindFormat(C, formatName);
+    COLORIST_ASSERT(format);
+
+    clImageSequence * sequence = clAllocateStruct(clImageSequence);
+    sequence->format = format;
+    sequence->frameIndex = -1;
+
+    if (!formatReadsSequences(format)) {
+        // No native sequence support, present the whole image as a single frame
+        clImage * image = clContextRead(C, filename, iccOverride, NULL);
+        if (!image) {
+            clFree(sequence);
+            return NULL;
+        }
+        sequence->decoderState = image;
+        sequence->frameCount = 1;
+        return sequence;
+    }
+
+    if (iccOverride) {
+        sequence->overrideProfile = clProfileRead(C, iccOverride);
+        if (sequence->overrideProfile) {
+            clContextLog(C, "profile", 1, "Overriding src profile with file: %s", iccOverride);
+        } else {
+            clContextLogError(C, "Bad ICC override file [-i]: %s", iccOverride);
+            clImageSequenceDestroy(C, sequence);
+            return NULL;
+        }
+    }
+
+    sequence->input = clAllocateStruct(clRaw);
+    if (!clRawReadFile(C, sequence->input, filename)) {
+        clImageSequenceDestroy(C, sequence);
+        return NULL;
+    }
+
+    memset(&C->readExtraInfo, 0, sizeof(C->readExtraInfo));
+
+    sequence->decoderState = format->readSequenceBeginFunc(C, formatName, sequence->overrideProfile, sequence->input, &sequence->frameCount);
+    if (!sequence->decoderState) {
+        clImageSequenceDestroy(C, sequence);
+        return NULL;
+    }
+    return sequence;
+}
+
+void clImageSequenceSetConversion(struct clContext * C,
+                                  clImageSequence * sequence,
+                                  int depth,
+                                  struct clProfile * dstProfile,
+                                  clTonemap tonemap,
+                                  clTonemapParams * tonemapParams)
+{
+    COLORIST_ASSERT(sequence->frameIndex == -1);
+
+    clSequenceConvertInfo * info = sequence->convertInfo;
+    if (!info) {
+        info = clAllocateStruct(clSequenceConvertInfo);
+        sequence->convertInfo = info;
+    } else if (info->dstProfile) {
+        clProfileDestroy(C, info->dstProfile);
+    }
+    info->C = C;
+    info->depth = depth;
+    info->dstProfile = clProfileClone(C, dstProfile);
+    info->tonemap = tonemap;
+    if (tonemapParams) {
+        memcpy(&info->tonemapParams, tonemapParams, sizeof(clTonemapParams));
+    } else {
+        clTonemapParamsSetDefaults(C, &info->tonemapParams);
+    }
+}
+
+clImage * clImageSequenceNext(struct clContext * C, clImageSequence * sequence)
+{
+    clSequenceConvertInfo * info = sequence->convertInfo;
+    if (!info) {
+        clImage * image = sequenceDecodeFrame(C, sequence, &sequence->frameDuration);
+        if (image) {
+            ++sequence->frameIndex;
+        }
+        return image;
+    }
+
+    if (!info->srcImage) {
+        // First call, nothing is in flight yet
+        info->srcImage = sequenceDecodeFrame(C, sequence, &info->duration);
+        if (!info->srcImage) {
+            return NULL;
+        }
+        sequenceConvertStart(C, info);
+    }
+
+    // Decode the next frame while the current one is being converted
+    double nextDuration;
+    clImage * nextImage = sequenceDecodeFrame(C, sequence, &nextDuration);
+
+    sequenceConvertFinish(C, info);
+    clImage * image = info->dstImage;
+    info->dstImage = NULL;
+    sequence->frameDuration = info->duration;
+    ++sequence->frameIndex;
+
+    if (nextImage) {
+        info->srcImage = nextImage;
+        info->duration = nextDuration;
+        sequenceConvertStart(C, info);
+    }
+    return image;
+}
+
+void clImageSequenceDestroy(struct clContext * C, clImageSequence * sequence)
+{
+    clSequenceConvertInfo * info = sequence->convertInfo;
+    if (info) {
+        sequenceConvertFinish(C, info);
+        if (info->dstImage) {
+            clImageDestroy(C, info->dstImage);
+        }
+        if (info->dstProfile) {
+            clProfileDestroy(C, info->dstProfile);
+        }
+        if (info->logMutex) {
+            clMutexDestroy(C, info->logMutex);
+        }
+        clFree(info);
+    }
+
+    if (sequence->decoderState) {
+        if (formatReadsSequences(sequence->format)) {
+            sequence->format->readSequenceEndFunc(C, sequence->decoderState);
+        } else {
+            clImageDestroy(C, (clImage *)sequence->decoderState);
+        }
+    }
+    if (sequence->input) {
+        clRawFree(C, sequence->input);
+        clFree(sequence->input);
+    }
+    if (sequence->overrideProfile) {
+        clProfileDestroy(C, sequence->overrideProfile);
+    }
+    clFree(sequence);
+}
@@ -9,10 +9,202 @@
 
 #include "colorist/context.h"
 #include "colorist/profile.h"
+#include "colorist/task.h"
 #include "colorist/transform.h"
 
 #include <string.h>
 
+// Pixels transformed to XYZ at a time per task. Both scratch tiles (src+dst) stay comfortably in L2.
+#define SIGNALS_TILE_PIXELS 4096
+
+// 1/2.2 curve LUT (linearly interpolated). The curve is too steep near black to interpolate
+// accurately, so anything darker than SIGNALS_G22_LUT_MIN still goes through powf().
+#define SIGNALS_G22_LUT_SIZE 4096
+#define SIGNALS_G22_LUT_MIN (1.0f / 256.0f)
+
+// SSIM is calculated on 8x8 windows of 2.2g luma, stepping 4 pixels at a time
+#define SSIM_WINDOW_SIZE 8
+#define SSIM_WINDOW_STEP 4
+#define SSIM_C1 (0.01 * 0.01)
+#define SSIM_C2 (0.03 * 0.03)
+
+static float g22FromLUT(const float * lut, float v)
+{
+    if (v < SIGNALS_G22_LUT_MIN) {
+        return powf(v, 1.0f / 2.2f);
+    }
+
+    float scaled = v * (float)(SIGNALS_G22_LUT_SIZE - 1);
+    int index = (int)scaled;
+    if (index >= (SIGNALS_G22_LUT_SIZE - 1)) {
+        return lut[SIGNALS_G22_LUT_SIZE - 1];
+    }
+    float t = scaled - (float)index;
+    return lut[index] + ((lut[index + 1] - lut[index]) * t);
+}
+
+// Unspecified luminance falls back to the same default clTransformPrepare() scales XYZ by
+static int signalsLuminance(clContext * C, clProfile * profile)
+{
+    int luminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, profile, NULL, NULL, &luminance);
+    if (luminance == CL_LUMINANCE_UNSPECIFIED) {
+        luminance = C->defaultLuminance;
+    }
+    return luminance;
+}
+
+typedef struct clSignalsTask
+{
+    clContext * C;
+    clTransform * srcToXYZ;
+    clTransform * dstToXYZ;
+    float * srcPixels; // RGBA, already offset to this task's first pixel
+    float * dstPixels; // RGBA, already offset to this task's first pixel
+    int pixelCount;
+    float invMaxLuminance;
+    const float * g22LUT;
+    float * srcLuma; // 2.2g Y per pixel (SSIM only, otherwise NULL)
+    float * dstLuma; // 2.2g Y per pixel (SSIM only, otherwise NULL)
+
+    // output
+    double errorSquaredSumLinear;
+    double errorSquaredSumG22;
+} clSignalsTask;
+
+static void signalsTaskFunc(clSignalsTask * info)
+{
+    clContext * C = info->C;
+
+    float * srcXYZ = clAllocate(2 * 3 * sizeof(float) * SIGNALS_TILE_PIXELS);
+    float * dstXYZ = &srcXYZ[3 * SIGNALS_TILE_PIXELS];
+
+    double errorSquaredSumLinear = 0.0;
+    double errorSquaredSumG22 = 0.0;
+    for (int tileStart = 0; tileStart < info->pixelCount; tileStart += SIGNALS_TILE_PIXELS) {
+        int tilePixelCount = CL_MIN(SIGNALS_TILE_PIXELS, info->pixelCount - tileStart);
+        clTransformRunSerial(C, info->srcToXYZ, &info->srcPixels[4 * tileStart], srcXYZ, tilePixelCount);
+        clTransformRunSerial(C, info->dstToXYZ, &info->dstPixels[4 * tileStart], dstXYZ, tilePixelCount);
+
+        for (int i = 0; i < tilePixelCount; ++i) {
+            float * srcPixel = &srcXYZ[3 * i];
+            float * dstPixel = &dstXYZ[3 * i];
+
+            float pixelErrorLinear = 0.0f;
+            float pixelErrorG22 = 0.0f;
+            for (int c = 0; c < 3; ++c) {
+                float normLinearSrc = srcPixel[c] * info->invMaxLuminance;
+                normLinearSrc = CL_CLAMP(normLinearSrc, 0.0f, 1.0f);
+                float normLinearDst = dstPixel[c] * info->invMaxLuminance;
+                normLinearDst = CL_CLAMP(normLinearDst, 0.0f, 1.0f);
+                float normLinearDiff = normLinearDst - normLinearSrc;
+                pixelErrorLinear += normLinearDiff * normLinearDiff;
+
+                float normG22Src = g22FromLUT(info->g22LUT, normLinearSrc);
+                float normG22Dst = g22FromLUT(info->g22LUT, normLinearDst);
+                float normG22Diff = normG22Dst - normG22Src;
+                pixelErrorG22 += normG22Diff * normG22Diff;
+
+                if ((c == 1) && info->srcLuma) {
+                    info->srcLuma[tileStart + i] = normG22Src;
+                    info->dstLuma[tileStart + i] = normG22Dst;
+                }
+            }
+            errorSquaredSumLinear += (double)pixelErrorLinear;
+            errorSquaredSumG22 += (double)pixelErrorG22;
+        }
+    }
+
+    info->errorSquaredSumLinear = errorSquaredSumLinear;
+    info->errorSquaredSumG22 = errorSquaredSumG22;
+    clFree(srcXYZ);
+}
+
+typedef struct clSSIMTask
+{
+    const float * srcLuma;
+    const float * dstLuma;
+    int width;
+    int windowWidth;
+    int windowHeight;
+    int windowsPerRow;
+    int firstWindowRow;
+    int windowRowCount;
+
+    // output
+    double ssimSum;
+} clSSIMTask;
+
+static void ssimTaskFunc(clSSIMTask * info)
+{
+    const double sampleCount = (double)(info->windowWidth * info->windowHeight);
+
+    double ssimSum = 0.0;
+    for (int windowRow = info->firstWindowRow; windowRow < (info->firstWindowRow + info->windowRowCount); ++windowRow) {
+        int top = windowRow * SSIM_WINDOW_STEP;
+        for (int windowCol = 0; windowCol < info->windowsPerRow; ++windowCol) {
+            int left = windowCol * SSIM_WINDOW_STEP;
+
+            double sumSrc = 0.0, sumDst = 0.0;
+            double sumSrcSq = 0.0, sumDstSq = 0.0, sumSrcDst = 0.0;
+            for (int j = 0; j < info->windowHeight; ++j) {
+                const float * srcRow = &info->srcLuma[((top + j) * info->width) + left];
+                const float * dstRow = &info->dstLuma[((top + j) * info->width) + left];
+                for (int i = 0; i < info->windowWidth; ++i) {
+                    double s = (double)srcRow[i];
+                    double d = (double)dstRow[i];
+                    sumSrc += s;
+                    sumDst += d;
+                    sumSrcSq += s * s;
+                    sumDstSq += d * d;
+                    sumSrcDst += s * d;
+                }
+            }
+
+            double meanSrc = sumSrc / sampleCount;
+            double meanDst = sumDst / sampleCount;
+            double varSrc = (sumSrcSq / sampleCount) - (meanSrc * meanSrc);
+            double varDst = (sumDstSq / sampleCount) - (meanDst * meanDst);
+            double covariance = (sumSrcDst / sampleCount) - (meanSrc * meanDst);
+            double numerator = ((2.0 * meanSrc * meanDst) + SSIM_C1) * ((2.0 * covariance) + SSIM_C2);
+            double denominator = ((meanSrc * meanSrc) + (meanDst * meanDst) + SSIM_C1) * (varSrc + varDst + SSIM_C2);
+            ssimSum += numerator / denominator;
+        }
+    }
+    info->ssimSum = ssimSum;
+}
+
+static float calcSSIM(clContext * C, const float * srcLuma, const float * dstLuma, int width, int height)
+{
+    int windowWidth = CL_MIN(SSIM_WINDOW_SIZE, width);
+    int windowHeight = CL_MIN(SSIM_WINDOW_SIZE, height);
+    int windowsPerRow = ((width - windowWidth) / SSIM_WINDOW_STEP) + 1;
+    int windowRows = ((height - windowHeight) / SSIM_WINDOW_STEP) + 1;
+
+    int taskCount = CL_CLAMP(C->jobs, 1, windowRows);
+    int rowsPerTask = windowRows / taskCount;
+    clSSIMTask * infos = clAllocate(taskCount * sizeof(clSSIMTask));
+    for (int i = 0; i < taskCount; ++i) {
+        infos[i].srcLuma = srcLuma;
+        infos[i].dstLuma = dstLuma;
+        infos[i].width = width;
+        infos[i].windowWidth = windowWidth;
+        infos[i].windowHeight = windowHeight;
+        infos[i].windowsPerRow = windowsPerRow;
+        infos[i].firstWindowRow = i * rowsPerTask;
+        infos[i].windowRowCount = (i == (taskCount - 1)) ? (windowRows - (i * rowsPerTask)) : rowsPerTask;
+        infos[i].ssimSum = 0.0;
+    }
+    clTaskRunAll(C, (clTaskFunc)ssimTaskFunc, infos, sizeof(clSSIMTask), taskCount);
+
+    double ssimSum = 0.0;
+    for (int i = 0; i < taskCount; ++i) {
+        ssimSum += infos[i].ssimSum;
+    }
+    clFree(infos);
+    return (float)(ssimSum / (double)(windowsPerRow * windowRows));
+}
+
 clBool clImageCalcSignals(struct clContext * C, clImage * srcImage, clImage * dstImage, clImageSignals * signals)
 {
     memset(signals, 0, sizeof(*signals));
@@ -24,88 +216,84 @@ clBool clImageCalcSignals(struct clContext * C, clImage * srcImage, clImage * ds
 
     int pixelCount = srcImage->width * srcImage->height;
 
-    int srcLuminance, dstLuminance;
-    clProfileQuery(C, srcImage->profile, NULL, NULL, &srcLuminance);
-    clProfileQuery(C, dstImage->profile, NULL, NULL, &dstLuminance);
+    int srcLuminance = signalsLuminance(C, srcImage->profile);
+    int dstLuminance = signalsLuminance(C, dstImage->profile);
     int maxLuminance = srcLuminance;
     if (maxLuminance < dstLuminance) {
         maxLuminance = dstLuminance;
     }
-    float maxLuminanceF = (float)maxLuminance;
 
-    clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_F32);
-    clTransform * srcToXYZ = clTransformCreate(C, srcImage->profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
-    float * srcXYZ = clAllocate(3 * sizeof(float) * pixelCount);
-    clTransformRun(C, srcToXYZ, srcImage->pixelsF32, srcXYZ, pixelCount);
-    clTransformDestroy(C, srcToXYZ);
+    float g22LUT[SIGNALS_G22_LUT_SIZE];
+    for (int i = 0; i < SIGNALS_G22_LUT_SIZE; ++i) {
+        g22LUT[i] = powf((float)i / (float)(SIGNALS_G22_LUT_SIZE - 1), 1.0f / 2.2f);
+    }
 
+    clImagePrepareReadPixels(C, srcImage, CL_PIXELFORMAT_F32);
     clImagePrepareReadPixels(C, dstImage, CL_PIXELFORMAT_F32);
+    clTransform * srcToXYZ = clTransformCreate(C, srcImage->profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
     clTransform * dstToXYZ = clTransformCreate(C, dstImage->profile, CL_XF_RGBA, NULL, CL_XF_XYZ, CL_TONEMAP_OFF);
-    float * dstXYZ = clAllocate(3 * sizeof(float) * pixelCount);
-    clTransformRun(C, dstToXYZ, dstImage->pixelsF32, dstXYZ, pixelCount);
+
+    // Prepare on this thread; the tasks below share these transforms
+    clTransformPrepare(C, srcToXYZ);
+    clTransformPrepare(C, dstToXYZ);
+
+    float * srcLuma = NULL;
+    float * dstLuma = NULL;
+    if (C->params.ssim) {
+        srcLuma = clAllocate(2 * sizeof(float) * pixelCount);
+        dstLuma = &srcLuma[pixelCount];
+    }
+
+    // Split on tile boundaries so every task (but the last) only ever transforms full tiles
+    int tileCount = (pixelCount + SIGNALS_TILE_PIXELS - 1) / SIGNALS_TILE_PIXELS;
+    int taskCount = CL_CLAMP(C->jobs, 1, CL_MAX(tileCount, 1));
+    int pixelsPerTask = (tileCount / taskCount) * SIGNALS_TILE_PIXELS;
+    clSignalsTask * infos = clAllocate(taskCount * sizeof(clSignalsTask));
+    for (int i = 0; i < taskCount; ++i) {
+        int firstPixel = i * pixelsPerTask;
+        infos[i].C = C;
+        infos[i].srcToXYZ = srcToXYZ;
+        infos[i].dstToXYZ = dstToXYZ;
+        infos[i].srcPixels = &srcImage->pixelsF32[4 * firstPixel];
+        infos[i].dstPixels = &dstImage->pixelsF32[4 * firstPixel];
+        infos[i].pixelCount = (i == (taskCount - 1)) ? (pixelCount - firstPixel) : pixelsPerTask;
+        infos[i].invMaxLuminance = 1.0f / (float)maxLuminance;
+        infos[i].g22LUT = g22LUT;
+        infos[i].srcLuma = srcLuma ? &srcLuma[firstPixel] : NULL;
+        infos[i].dstLuma = dstLuma ? &dstLuma[firstPixel] : NULL;
+        infos[i].errorSquaredSumLinear = 0.0;
+        infos[i].errorSquaredSumG22 = 0.0;
+    }
+    clTaskRunAll(C, (clTaskFunc)signalsTaskFunc, infos, sizeof(clSignalsTask), taskCount);
+
+    double errorSquaredSumLinear = 0.0;
+    double errorSquaredSumG22 = 0.0;
+    for (int i = 0; i < taskCount; ++i) {
+        errorSquaredSumLinear += infos[i].errorSquaredSumLinear;
+        errorSquaredSumG22 += infos[i].errorSquaredSumG22;
+    }
+    clFree(infos);
+    clTransformDestroy(C, srcToXYZ);
     clTransformDestroy(C, dstToXYZ);
 
-    float errorSquaredSumLinear = 0.0f;
-    float errorSquaredSumG22 = 0.0f;
-    float gamma = 1.0f / 2.2f;
-    for (int i = 0; i < pixelCount; ++i) {
-        float * srcPixel = &srcXYZ[3 * i];
-        float * dstPixel = &dstXYZ[3 * i];
-
-        float normLinearSrcXYZ[3];
-        normLinearSrcXYZ[0] = srcPixel[0] / maxLuminanceF;
-        normLinearSrcXYZ[0] = CL_CLAMP(normLinearSrcXYZ[0], 0.0f, 1.0f);
-        normLinearSrcXYZ[1] = srcPixel[1] / maxLuminanceF;
-        normLinearSrcXYZ[1] = CL_CLAMP(normLinearSrcXYZ[1], 0.0f, 1.0f);
-        normLinearSrcXYZ[2] = srcPixel[2] / maxLuminanceF;
-        normLinearSrcXYZ[2] = CL_CLAMP(normLinearSrcXYZ[2], 0.0f, 1.0f);
-
-        float normLinearDstXYZ[3];
-        normLinearDstXYZ[0] = dstPixel[0] / maxLuminanceF;
-        normLinearDstXYZ[0] = CL_CLAMP(normLinearDstXYZ[0], 0.0f, 1.0f);
-        normLinearDstXYZ[1] = dstPixel[1] / maxLuminanceF;
-        normLinearDstXYZ[1] = CL_CLAMP(normLinearDstXYZ[1], 0.0f, 1.0f);
-        normLinearDstXYZ[2] = dstPixel[2] / maxLuminanceF;
-        normLinearDstXYZ[2] = CL_CLAMP(normLinearDstXYZ[2], 0.0f, 1.0f);
-
-        float normLinearDiff[3];
-        normLinearDiff[0] = normLinearDstXYZ[0] - normLinearSrcXYZ[0];
-        normLinearDiff[1] = normLinearDstXYZ[1] - normLinearSrcXYZ[1];
-        normLinearDiff[2] = normLinearDstXYZ[2] - normLinearSrcXYZ[2];
-        errorSquaredSumLinear += (normLinearDiff[0] * normLinearDiff[0]) + (normLinearDiff[1] * normLinearDiff[1]) +
-                                 (normLinearDiff[2] * normLinearDiff[2]);
-
-        float normG22SrcXYZ[3];
-        normG22SrcXYZ[0] = powf(normLinearSrcXYZ[0], gamma);
-        normG22SrcXYZ[1] = powf(normLinearSrcXYZ[1], gamma);
-        normG22SrcXYZ[2] = powf(normLinearSrcXYZ[2], gamma);
-
-        float normG22DstXYZ[3];
-        normG22DstXYZ[0] = powf(normLinearDstXYZ[0], gamma);
-        normG22DstXYZ[1] = powf(normLinearDstXYZ[1], gamma);
-        normG22DstXYZ[2] = powf(normLinearDstXYZ[2], gamma);
-
-        float normG22Diff[3];
-        normG22Diff[0] = normG22DstXYZ[0] - normG22SrcXYZ[0];
-        normG22Diff[1] = normG22DstXYZ[1] - normG22SrcXYZ[1];
-        normG22Diff[2] = normG22DstXYZ[2] - normG22SrcXYZ[2];
-        errorSquaredSumG22 += (normG22Diff[0] * normG22Diff[0]) + (normG22Diff[1] * normG22Diff[1]) + (normG22Diff[2] * normG22Diff[2]);
-    }
-
-    if (errorSquaredSumLinear > 0.0f) {
-        signals->mseLinear = errorSquaredSumLinear / (float)pixelCount;
-        signals->psnrLinear = 10.0f * log10f(1.0f / signals->mseLinear);
+    if (errorSquaredSumLinear > 0.0) {
+        double mse = errorSquaredSumLinear / (double)pixelCount;
+        signals->mseLinear = (float)mse;
+        signals->psnrLinear = (float)(10.0 * log10(1.0 / mse));
     } else {
         signals->psnrLinear = INFINITY;
     }
-    if (errorSquaredSumG22 > 0.0f) {
-        signals->mseG22 = errorSquaredSumG22 / (float)pixelCount;
-        signals->psnrG22 = 10.0f * log10f(1.0f / signals->mseG22);
+    if (errorSquaredSumG22 > 0.0) {
+        double mse = errorSquaredSumG22 / (double)pixelCount;
+        signals->mseG22 = (float)mse;
+        signals->psnrG22 = (float)(10.0 * log10(1.0 / mse));
     } else {
         signals->psnrG22 = INFINITY;
     }
 
-    clFree(srcXYZ);
-    clFree(dstXYZ);
+    if (srcLuma) {
+        signals->ssimG22 = calcSSIM(C, srcLuma, dstLuma, srcImage->width, srcImage->height);
+        clFree(srcLuma);
+    }
     return clTrue;
 }
@@ -11,10 +11,10 @@
 #include "colorist/embedded.h"
 #include "colorist/pixelmath.h"
 #include "colorist/raw.h"
+#include "colorist/task.h"
 #include "colorist/transform.h"
 
 #include "lcms2_plugin.h"
-#include "md5.h"
 
 #include "gb_math.h"
 
@@ -26,6 +26,10 @@
 // from cmsio1.c
 extern cmsBool _cmsReadCHAD(cmsMAT3 * Dest, cmsHPROFILE hProfile);
 
+static clBool calcPrimaries(struct clContext * C, clProfile * profile, clProfilePrimaries * primaries);
+static clBool calcCurve(struct clContext * C, clProfile * profile, clProfileCurve * curve);
+static int calcLuminance(struct clContext * C, clProfile * profile);
+
 const char * clProfileCurveTypeToString(struct clContext * C, clProfileCurveType curveType)
 {
     COLORIST_UNUSED(C);
@@ -70,6 +74,93 @@ const char * clProfileCurveTypeToLowercaseString(struct clContext * C, clProfile
     return "unknown";
 }
 
+static clProfile * createProfile(struct clContext * C,
+                                 clProfilePrimaries * primaries,
+                                 clProfileCurve * curve,
+                                 int maxLuminance,
+                                 const char * description);
+
+// Returns a clone of the interned profile made from these arguments, or NULL if there isn't one yet
+static clProfile * findProfileRecord(struct clContext * C,
+                                     clBool stock,
+                                     clProfilePrimaries * primaries,
+                                     clProfileCurve * curve,
+                                     int maxLuminance,
+                                     const char * description)
+{
+    clProfileRecord * prev = NULL;
+    for (clProfileRecord * record = C->profiles; record != NULL; prev = record, record = record->next) {
+        if ((record->stock != stock) || (record->curveType != curve->type) || (record->gamma != curve->gamma) ||
+            (record->maxLuminance != maxLuminance)) {
+            continue;
+        }
+        if (memcmp(&record->primaries, primaries, sizeof(clProfilePrimaries)) != 0) {
+            continue;
+        }
+        if ((record->description == NULL) != (description == NULL)) {
+            continue;
+        }
+        if (description && strcmp(record->description, description)) {
+            continue;
+        }
+        if (prev) {
+            // Move to the front so the least recently used record is the one evicted
+            prev->next = record->next;
+            record->next = C->profiles;
+            C->profiles = record;
+        }
+        return clProfileClone(C, record->profile);
+    }
+    return NULL;
+}
+
+static void destroyProfileRecords(struct clContext * C, clProfileRecord * record)
+{
+    while (record != NULL) {
+        clProfileRecord * freeme = record;
+        record = record->next;
+        clProfileDestroy(C, freeme->profile);
+        clFree(freeme->description);
+        clFree(freeme);
+    }
+}
+
+static void addProfileRecord(struct clContext * C,
+                             clBool stock,
+                             clProfilePrimaries * primaries,
+                             clProfileCurve * curve,
+                             int maxLuminance,
+                             const char * description,
+                             clProfile * profile)
+{
+    clProfileRecord * record = clAllocateStruct(clProfileRecord);
+    record->stock = stock;
+    memcpy(&record->primaries, primaries, sizeof(clProfilePrimaries));
+    record->curveType = curve->type;
+    record->gamma = curve->gamma;
+    record->maxLuminance = maxLuminance;
+    record->description = description ? clContextStrdup(C, description) : NULL;
+    record->profile = clProfileClone(C, profile);
+    record->next = C->profiles;
+    C->profiles = record;
+
+    // Evict whatever falls past the cap
+    int count = 1;
+    for (; record->next != NULL; record = record->next, ++count) {
+        if (count == CL_PROFILE_RECORDS_MAX) {
+            destroyProfileRecords(C, record->next);
+            record->next = NULL;
+            break;
+        }
+    }
+}
+
+void clProfileRecordsDestroy(struct clContext * C)
+{
+    destroyProfileRecords(C, C->profiles);
+    C->profiles = NULL;
+}
+
 clProfile * clProfileCreateStock(struct clContext * C, clProfileStock stock)
 {
     clProfilePrimaries primaries;
@@ -90,21 +181,60 @@ clProfile * clProfileCreateStock(struct clContext * C, clProfileStock stock)
             break;
     }
 
-    clProfile * profile = clProfileCreate(C, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
-    clProfileSetMLU(C, profile, "desc", "en", "US", "Colorist SRGB");
+    clProfile * profile = findProfileRecord(C, clTrue, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
+    if (profile) {
+        return profile;
+    }
+
+    profile = createProfile(C, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL);
+    if (profile) {
+        clProfileSetMLU(C, profile, "desc", "en", "US", "Colorist SRGB");
+        addProfileRecord(C, clTrue, &primaries, &curve, CL_LUMINANCE_UNSPECIFIED, NULL, profile);
+    }
     return profile;
 }
 
 clProfile * clProfileClone(struct clContext * C, clProfile * profile)
 {
+    clProfile * clone = clAllocateStruct(clProfile);
+    memcpy(clone, profile, sizeof(clProfile));
+    clAtomicIncrement(profile->refCount);
+    return clone;
+}
+
+// Drops profile's reference to its shared contents, freeing them if it was the last one
+static void clProfileRelease(struct clContext * C, clProfile * profile)
+{
+    if (clAtomicDecrement(profile->refCount) == 0) {
+        clFree(profile->description);
+        cmsCloseProfile(profile->handle);
+        clRawFree(C, &profile->raw);
+        clFree(profile->refCount);
+    }
+}
+
+clBool clProfileDetach(struct clContext * C, clProfile * profile)
+{
+    if (*profile->refCount == 1) {
+        return clTrue;
+    }
+
     clRaw packed = CL_RAW_EMPTY;
     if (!clProfilePack(C, profile, &packed)) {
-        return NULL;
+        return clFalse;
     }
-
-    clProfile * clone = clProfileParse(C, packed.ptr, packed.size, profile->description);
+    clProfile * copy = clProfileParse(C, packed.ptr, packed.size, profile->description);
     clRawFree(C, &packed);
-    return clone;
+    if (!copy) {
+        return clFalse;
+    }
+
+    clProfile shared;
+    memcpy(&shared, profile, sizeof(clProfile));
+    memcpy(profile, copy, sizeof(clProfile));
+    clFree(copy);
+    clProfileRelease(C, &shared);
+    return clTrue;
 }
 
 clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t iccLen, const char * description)
@@ -115,6 +245,8 @@ clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t icc
         clFree(profile);
         return NULL;
     }
+    profile->refCount = clAllocate(sizeof(int));
+    *profile->refCount = 1;
     if (description && description[0]) {
         profile->description = clContextStrdup(C, description);
     } else {
@@ -130,34 +262,59 @@ clProfile * clProfileParse(struct clContext * C, const uint8_t * icc, size_t icc
     // Save copy of packed data to keep a byte-for-byte payload unless the profile is modified
     clRawSet(C, &profile->raw, icc, iccLen);
 
-    // Calculate signature
-    {
-        MD5_CTX ctx;
-        MD5_Init(&ctx);
-        MD5_Update(&ctx, icc, (unsigned long)iccLen);
-        MD5_Final(profile->signature, &ctx);
-    }
+    profile->hash = clHash64(icc, iccLen);
+
+    // Cache everything clProfileQuery() reports, it is asked for constantly during conversion
+    if (!clProfileCacheLookup(C, profile)) {
+        profile->queryPrimariesValid = calcPrimaries(C, profile, &profile->queryPrimaries);
+        profile->queryCurveValid = calcCurve(C, profile, &profile->queryCurve);
+        profile->queryLuminance = calcLuminance(C, profile);
+        if (profile->queryPrimariesValid) {
+            gbMat3 toXYZ, fromXYZ;
+            clTransformDeriveXYZMatrix(C, &profile->queryPrimaries, &toXYZ);
+            gb_mat3_inverse(&fromXYZ, &toXYZ);
+            gb_mat3_transpose(&fromXYZ);
+            memcpy(profile->queryToXYZ, toXYZ.e, sizeof(profile->queryToXYZ));
+            memcpy(profile->queryFromXYZ, fromXYZ.e, sizeof(profile->queryFromXYZ));
+        }
 
-    // See if colorist CMM can handle this profile
-    {
-        clProfilePrimaries primaries;
-        clProfileCurve curve;
-        int luminance = 0;
+        // See if colorist CMM can handle this profile
+        clProfileCurveType curveType = profile->queryCurve.type;
         profile->ccmm = clFalse; // Start with unfriendly
         if (clProfileHasPQSignature(C, profile, NULL)) {
             // CCMM specifically supports any special profiles recognized as PQ
             profile->ccmm = clTrue;
-        } else if (clProfileQuery(C, profile, &primaries, &curve, &luminance)) {
+        } else if (profile->queryPrimariesValid && profile->queryCurveValid) {
             // TODO: Be way more restrictive here
-            if ((curve.type == CL_PCT_GAMMA) || (curve.type == CL_PCT_HLG) || (curve.type == CL_PCT_PQ) || (curve.type == CL_PCT_SRGB)) {
+            if ((curveType == CL_PCT_GAMMA) || (curveType == CL_PCT_HLG) || (curveType == CL_PCT_PQ) || (curveType == CL_PCT_SRGB)) {
                 profile->ccmm = clTrue;
             }
         }
+
+        clProfileCacheStore(C, profile);
     }
     return profile;
 }
 
 clProfile * clProfileCreate(struct clContext * C, clProfilePrimaries * primaries, clProfileCurve * curve, int maxLuminance, const char * description)
+{
+    clProfile * profile = findProfileRecord(C, clFalse, primaries, curve, maxLuminance, description);
+    if (profile) {
+        return profile;
+    }
+
+    profile = createProfile(C, primaries, curve, maxLuminance, description);
+    if (profile) {
+        addProfileRecord(C, clFalse, primaries, curve, maxLuminance, description, profile);
+    }
+    return profile;
+}
+
+static clProfile * createProfile(struct clContext * C,
+                                 clProfilePrimaries * primaries,
+                                 clProfileCurve * curve,
+                                 int maxLuminance,
+                                 const char * description)
 {
     clProfile * profile = clAllocateStruct(clProfile);
     cmsToneCurve * curves[3];
@@ -196,6 +353,8 @@ clProfile * clProfileCreate(struct clContext * C, clProfilePrimaries * primaries
         clFree(profile);
         return NULL;
     }
+    profile->refCount = clAllocate(sizeof(int));
+    *profile->refCount = 1;
 
     if (curve->type == CL_PCT_HLG) {
         cmsWriteRawTag(profile->handle, cmsSigRedTRCTag, hlgCurveBinaryData, hlgCurveBinarySize);
@@ -320,6 +479,9 @@ clBool clProfileWrite(struct clContext * C, clProfile * profile, const char * fi
 
 clBool clProfileReload(struct clContext * C, clProfile * profile)
 {
+    if (!clProfileDetach(C, profile)) {
+        return clFalse;
+    }
     clRawFree(C, &profile->raw); // clProfilePack will use this if it isn't cleared
 
     clRaw raw = CL_RAW_EMPTY;
@@ -346,227 +508,247 @@ clBool clProfileReload(struct clContext * C, clProfile * profile)
 
 void clProfileDestroy(struct clContext * C, clProfile * profile)
 {
-    clFree(profile->description);
-    cmsCloseProfile(profile->handle);
-    clRawFree(C, &profile->raw);
+    clProfileRelease(C, profile);
     clFree(profile);
 }
 
 clBool clProfileQuery(struct clContext * C, clProfile * profile, clProfilePrimaries * primaries, clProfileCurve * curve, int * luminance)
 {
+    COLORIST_UNUSED(C);
+
     if (primaries) {
-        cmsMAT3 chad;
-        cmsMAT3 invChad;
-        cmsMAT3 tmpColorants;
-        cmsMAT3 colorants;
-        cmsCIEXYZ src;
-        cmsCIExyY dst;
-        cmsCIEXYZ adaptedWhiteXYZ;
-        const cmsCIEXYZ * redXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigRedColorantTag);
-        const cmsCIEXYZ * greenXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigGreenColorantTag);
-        const cmsCIEXYZ * blueXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigBlueColorantTag);
-        const cmsCIEXYZ * whiteXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigMediaWhitePointTag);
-        if (whiteXYZ == NULL)
+        if (!profile->queryPrimariesValid) {
             return clFalse;
+        }
+        memcpy(primaries, &profile->queryPrimaries, sizeof(clProfilePrimaries));
+    }
+    if (curve) {
+        if (!profile->queryCurveValid) {
+            return clFalse;
+        }
+        memcpy(curve, &profile->queryCurve, sizeof(clProfileCurve));
+    }
+    if (luminance) {
+        *luminance = profile->queryLuminance;
+    }
+    return clTrue;
+}
 
-        memset(&tmpColorants, 0, sizeof(tmpColorants)); // This exists to avoid a warning; this should always be set in the following conditional
-
-        if ((redXYZ == NULL) || (greenXYZ == NULL) || (blueXYZ == NULL)) {
-            // No colorant tags. See if we can harvest them (poorly) from the A2B0 tag. (yuck)
-            cmsUInt32Number aToBTagSize = cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0);
-            if (aToBTagSize >= 32) { // A2B0 tag is present. Allow it to override primaries and tone curves.
-                int i;
-                float matrix[9];
-                uint32_t matrixOffset = 0;
-                uint8_t * rawA2B0 = clAllocate(aToBTagSize);
-                cmsReadRawTag(profile->handle, cmsSigAToB0Tag, rawA2B0, aToBTagSize);
-
-                memcpy(&matrixOffset, rawA2B0 + 16, sizeof(matrixOffset));
-                matrixOffset = clNTOHL(matrixOffset);
-                if (matrixOffset == 0) {
-                    // No matrix present
-                    clFree(rawA2B0);
-                    return clFalse;
-                }
-                if ((matrixOffset + 18) > aToBTagSize) {
-                    // No room to read matrix
-                    clFree(rawA2B0);
-                    return clFalse;
-                }
+static clBool calcPrimaries(struct clContext * C, clProfile * profile, clProfilePrimaries * primaries)
+{
+    cmsMAT3 chad;
+    cmsMAT3 invChad;
+    cmsMAT3 tmpColorants;
+    cmsMAT3 colorants;
+    cmsCIEXYZ src;
+    cmsCIExyY dst;
+    cmsCIEXYZ adaptedWhiteXYZ;
+    const cmsCIEXYZ * redXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigRedColorantTag);
+    const cmsCIEXYZ * greenXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigGreenColorantTag);
+    const cmsCIEXYZ * blueXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigBlueColorantTag);
+    const cmsCIEXYZ * whiteXYZ = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigMediaWhitePointTag);
+    if (whiteXYZ == NULL)
+        return clFalse;
 
-                for (i = 0; i < 9; ++i) {
-                    cmsS15Fixed16Number e;
-                    memcpy(&e, &rawA2B0[matrixOffset + (i * 4)], 4);
-                    matrix[i] = (float)_cms15Fixed16toDouble(clNTOHL(e));
-                }
-                _cmsVEC3init(&tmpColorants.v[0], matrix[0], matrix[1], matrix[2]);
-                _cmsVEC3init(&tmpColorants.v[1], matrix[3], matrix[4], matrix[5]);
-                _cmsVEC3init(&tmpColorants.v[2], matrix[6], matrix[7], matrix[8]);
+    memset(&tmpColorants, 0, sizeof(tmpColorants)); // This exists to avoid a warning; this should always be set in the following conditional
+
+    if ((redXYZ == NULL) || (greenXYZ == NULL) || (blueXYZ == NULL)) {
+        // No colorant tags. See if we can harvest them (poorly) from the A2B0 tag. (yuck)
+        cmsUInt32Number aToBTagSize = cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0);
+        if (aToBTagSize >= 32) { // A2B0 tag is present. Allow it to override primaries and tone curves.
+            int i;
+            float matrix[9];
+            uint32_t matrixOffset = 0;
+            uint8_t * rawA2B0 = clAllocate(aToBTagSize);
+            cmsReadRawTag(profile->handle, cmsSigAToB0Tag, rawA2B0, aToBTagSize);
+
+            memcpy(&matrixOffset, rawA2B0 + 16, sizeof(matrixOffset));
+            matrixOffset = clNTOHL(matrixOffset);
+            if (matrixOffset == 0) {
+                // No matrix present
                 clFree(rawA2B0);
+                return clFalse;
             }
-        } else {
-            // Found rXYZ, gXYZ, bXYZ. Pull out the colorants from them.
-            _cmsVEC3init(&tmpColorants.v[0], redXYZ->X, greenXYZ->X, blueXYZ->X);
-            _cmsVEC3init(&tmpColorants.v[1], redXYZ->Y, greenXYZ->Y, blueXYZ->Y);
-            _cmsVEC3init(&tmpColorants.v[2], redXYZ->Z, greenXYZ->Z, blueXYZ->Z);
+            if ((matrixOffset + 18) > aToBTagSize) {
+                // No room to read matrix
+                clFree(rawA2B0);
+                return clFalse;
+            }
+
+            for (i = 0; i < 9; ++i) {
+                cmsS15Fixed16Number e;
+                memcpy(&e, &rawA2B0[matrixOffset + (i * 4)], 4);
+                matrix[i] = (float)_cms15Fixed16toDouble(clNTOHL(e));
+            }
+            _cmsVEC3init(&tmpColorants.v[0], matrix[0], matrix[1], matrix[2]);
+            _cmsVEC3init(&tmpColorants.v[1], matrix[3], matrix[4], matrix[5]);
+            _cmsVEC3init(&tmpColorants.v[2], matrix[6], matrix[7], matrix[8]);
+            clFree(rawA2B0);
         }
+    } else {
+        // Found rXYZ, gXYZ, bXYZ. Pull out the colorants from them.
+        _cmsVEC3init(&tmpColorants.v[0], redXYZ->X, greenXYZ->X, blueXYZ->X);
+        _cmsVEC3init(&tmpColorants.v[1], redXYZ->Y, greenXYZ->Y, blueXYZ->Y);
+        _cmsVEC3init(&tmpColorants.v[2], redXYZ->Z, greenXYZ->Z, blueXYZ->Z);
+    }
 
-        if (_cmsReadCHAD(&chad, profile->handle) && _cmsMAT3inverse(&chad, &invChad)) {
-            // Always adapt the colorants with the chad tag (if wtpt is D50, it'll be identity)
-            _cmsMAT3per(&colorants, &invChad, &tmpColorants);
+    if (_cmsReadCHAD(&chad, profile->handle) && _cmsMAT3inverse(&chad, &invChad)) {
+        // Always adapt the colorants with the chad tag (if wtpt is D50, it'll be identity)
+        _cmsMAT3per(&colorants, &invChad, &tmpColorants);
 
-            if (cmsGetEncodedICCversion(profile->handle) >= 0x4000000) {
-                // v4+ ICC profiles *must* have D50 as the pre-chad whitepoint. Enforce this here.
-                whiteXYZ = cmsD50_XYZ();
-            }
+        if (cmsGetEncodedICCversion(profile->handle) >= 0x4000000) {
+            // v4+ ICC profiles *must* have D50 as the pre-chad whitepoint. Enforce this here.
+            whiteXYZ = cmsD50_XYZ();
+        }
 
-            if (cmsIsTag(profile->handle, cmsSigChromaticAdaptationTag)) {
-                // chad exists, adapt white point
-                cmsVEC3 srcWP, dstWP;
-                cmsCIExyY whiteXYY;
-                cmsXYZ2xyY(&whiteXYY, whiteXYZ);
-                srcWP.n[VX] = whiteXYZ->X;
-                srcWP.n[VY] = whiteXYZ->Y;
-                srcWP.n[VZ] = whiteXYZ->Z;
-                _cmsMAT3eval(&dstWP, &invChad, &srcWP);
-                adaptedWhiteXYZ.X = dstWP.n[VX];
-                adaptedWhiteXYZ.Y = dstWP.n[VY];
-                adaptedWhiteXYZ.Z = dstWP.n[VZ];
-            } else {
-                // no chad tag, leave wtpt alone
-                adaptedWhiteXYZ = *whiteXYZ;
-            }
+        if (cmsIsTag(profile->handle, cmsSigChromaticAdaptationTag)) {
+            // chad exists, adapt white point
+            cmsVEC3 srcWP, dstWP;
+            cmsCIExyY whiteXYY;
+            cmsXYZ2xyY(&whiteXYY, whiteXYZ);
+            srcWP.n[VX] = whiteXYZ->X;
+            srcWP.n[VY] = whiteXYZ->Y;
+            srcWP.n[VZ] = whiteXYZ->Z;
+            _cmsMAT3eval(&dstWP, &invChad, &srcWP);
+            adaptedWhiteXYZ.X = dstWP.n[VX];
+            adaptedWhiteXYZ.Y = dstWP.n[VY];
+            adaptedWhiteXYZ.Z = dstWP.n[VZ];
         } else {
-            colorants = tmpColorants;
+            // no chad tag, leave wtpt alone
             adaptedWhiteXYZ = *whiteXYZ;
         }
+    } else {
+        colorants = tmpColorants;
+        adaptedWhiteXYZ = *whiteXYZ;
+    }
 
-        src.X = colorants.v[0].n[VX];
-        src.Y = colorants.v[1].n[VX];
-        src.Z = colorants.v[2].n[VX];
-        cmsXYZ2xyY(&dst, &src);
-        primaries->red[0] = (float)dst.x;
-        primaries->red[1] = (float)dst.y;
-        src.X = colorants.v[0].n[VY];
-        src.Y = colorants.v[1].n[VY];
-        src.Z = colorants.v[2].n[VY];
-        cmsXYZ2xyY(&dst, &src);
-        primaries->green[0] = (float)dst.x;
-        primaries->green[1] = (float)dst.y;
-        src.X = colorants.v[0].n[VZ];
-        src.Y = colorants.v[1].n[VZ];
-        src.Z = colorants.v[2].n[VZ];
-        cmsXYZ2xyY(&dst, &src);
-        primaries->blue[0] = (float)dst.x;
-        primaries->blue[1] = (float)dst.y;
-        cmsXYZ2xyY(&dst, &adaptedWhiteXYZ);
-        primaries->white[0] = (float)dst.x;
-        primaries->white[1] = (float)dst.y;
-
-        if (primaries->red[0] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->red[0] = 0.0f;
-        }
-        if (primaries->red[1] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->red[1] = 0.0f;
-        }
-        if (primaries->green[0] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->green[0] = 0.0f;
-        }
-        if (primaries->green[1] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->green[1] = 0.0f;
-        }
-        if (primaries->blue[0] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->blue[0] = 0.0f;
-        }
-        if (primaries->blue[1] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->blue[1] = 0.0f;
-        }
-        if (primaries->white[0] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->white[0] = 0.0f;
-        }
-        if (primaries->white[1] < CLOSE_ENOUGH_TO_ZERO) {
-            primaries->white[1] = 0.0f;
-        }
+    src.X = colorants.v[0].n[VX];
+    src.Y = colorants.v[1].n[VX];
+    src.Z = colorants.v[2].n[VX];
+    cmsXYZ2xyY(&dst, &src);
+    primaries->red[0] = (float)dst.x;
+    primaries->red[1] = (float)dst.y;
+    src.X = colorants.v[0].n[VY];
+    src.Y = colorants.v[1].n[VY];
+    src.Z = colorants.v[2].n[VY];
+    cmsXYZ2xyY(&dst, &src);
+    primaries->green[0] = (float)dst.x;
+    primaries->green[1] = (float)dst.y;
+    src.X = colorants.v[0].n[VZ];
+    src.Y = colorants.v[1].n[VZ];
+    src.Z = colorants.v[2].n[VZ];
+    cmsXYZ2xyY(&dst, &src);
+    primaries->blue[0] = (float)dst.x;
+    primaries->blue[1] = (float)dst.y;
+    cmsXYZ2xyY(&dst, &adaptedWhiteXYZ);
+    primaries->white[0] = (float)dst.x;
+    primaries->white[1] = (float)dst.y;
+
+    if (primaries->red[0] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->red[0] = 0.0f;
+    }
+    if (primaries->red[1] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->red[1] = 0.0f;
+    }
+    if (primaries->green[0] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->green[0] = 0.0f;
+    }
+    if (primaries->green[1] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->green[1] = 0.0f;
+    }
+    if (primaries->blue[0] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->blue[0] = 0.0f;
+    }
+    if (primaries->blue[1] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->blue[1] = 0.0f;
+    }
+    if (primaries->white[0] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->white[0] = 0.0f;
+    }
+    if (primaries->white[1] < CLOSE_ENOUGH_TO_ZERO) {
+        primaries->white[1] = 0.0f;
     }
+    return clTrue;
+}
 
-    if (curve) {
-        clProfileCurveType curveSignature = clProfileCurveSignature(C, profile);
-        if (clProfileHasPQSignature(C, profile, NULL) || (curveSignature == CL_PCT_PQ)) {
-            curve->type = CL_PCT_PQ;
-            curve->gamma = 1.0f;
-        } else if (curveSignature == CL_PCT_HLG) {
-            curve->type = CL_PCT_HLG;
-            curve->gamma = 1.0f;
-        } else if (curveSignature == CL_PCT_SRGB) {
-            curve->type = CL_PCT_SRGB;
-            curve->gamma = 1.0f;
+static clBool calcCurve(struct clContext * C, clProfile * profile, clProfileCurve * curve)
+{
+    memset(curve, 0, sizeof(clProfileCurve));
+    clProfileCurveType curveSignature = clProfileCurveSignature(C, profile);
+    if (clProfileHasPQSignature(C, profile, NULL) || (curveSignature == CL_PCT_PQ)) {
+        curve->type = CL_PCT_PQ;
+        curve->gamma = 1.0f;
+    } else if (curveSignature == CL_PCT_HLG) {
+        curve->type = CL_PCT_HLG;
+        curve->gamma = 1.0f;
+    } else if (curveSignature == CL_PCT_SRGB) {
+        curve->type = CL_PCT_SRGB;
+        curve->gamma = 1.0f;
+    } else {
+        cmsToneCurve * toneCurve = (cmsToneCurve *)cmsReadTag(profile->handle, cmsSigRedTRCTag);
+        if (toneCurve) {
+            int curveType = cmsGetToneCurveParametricType(toneCurve);
+            float gamma = (float)cmsEstimateGamma(toneCurve, 1.0f);
+            curve->type = (curveType == 1) ? CL_PCT_GAMMA : CL_PCT_COMPLEX;
+            curve->gamma = gamma;
         } else {
-            cmsToneCurve * toneCurve = (cmsToneCurve *)cmsReadTag(profile->handle, cmsSigRedTRCTag);
-            if (toneCurve) {
-                int curveType = cmsGetToneCurveParametricType(toneCurve);
-                float gamma = (float)cmsEstimateGamma(toneCurve, 1.0f);
-                curve->type = (curveType == 1) ? CL_PCT_GAMMA : CL_PCT_COMPLEX;
-                curve->gamma = gamma;
+            if (cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0) > 0) {
+                curve->type = CL_PCT_COMPLEX;
+                curve->gamma = -1.0f;
             } else {
-                if (cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0) > 0) {
-                    curve->type = CL_PCT_COMPLEX;
-                    curve->gamma = -1.0f;
-                } else {
-                    curve->type = CL_PCT_UNKNOWN;
-                    curve->gamma = 0.0f;
-                }
+                curve->type = CL_PCT_UNKNOWN;
+                curve->gamma = 0.0f;
             }
         }
+    }
 
-        // Check for A2B0 implicit scale in the matrix curve, for reporting purposes
-        curve->implicitScale = 1.0f;
-        {
-            cmsUInt32Number aToBTagSize = cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0);
-            if (aToBTagSize >= 32) { // A2B0 tag is present. Check for a matrix scale on para curve types 1 and above
-                uint8_t * rawA2B0 = clAllocate(aToBTagSize);
-                uint32_t matrixCurveOffset = 0;
-
-                cmsReadRawTag(profile->handle, cmsSigAToB0Tag, rawA2B0, aToBTagSize);
-                memcpy(&matrixCurveOffset, rawA2B0 + 20, sizeof(matrixCurveOffset));
-                matrixCurveOffset = clNTOHL(matrixCurveOffset);
-                if (matrixCurveOffset == 0) {
-                    // No matrix curve present
-                    clFree(rawA2B0);
-                    return clFalse;
-                }
-
-                if (!memcmp(&rawA2B0[matrixCurveOffset], "para", 4)) {
-                    uint16_t curveType;
-                    memcpy(&curveType, &rawA2B0[matrixCurveOffset + 8], 2);
-                    curveType = clNTOHS(curveType);
-                    if ((curveType > 0) && (curveType <= 4)) {
-                        // Guaranteed to have a g(0) argument and an a(1) argument. a^g is the scale.
-                        float g, a;
-                        cmsS15Fixed16Number e;
-                        memcpy(&e, &rawA2B0[matrixCurveOffset + 12], 4);
-                        g = (float)_cms15Fixed16toDouble(clNTOHL(e));
-                        memcpy(&e, &rawA2B0[matrixCurveOffset + 16], 4);
-                        a = (float)_cms15Fixed16toDouble(clNTOHL(e));
-                        curve->implicitScale = clPixelMathRoundf(powf(a, g) * 100.0f) /
-                                               100.0f; // Round to 0.01, otherwise you get stuff like 100.0000019x
-                    }
-                }
+    // Check for A2B0 implicit scale in the matrix curve, for reporting purposes
+    curve->implicitScale = 1.0f;
+    {
+        cmsUInt32Number aToBTagSize = cmsReadRawTag(profile->handle, cmsSigAToB0Tag, NULL, 0);
+        if (aToBTagSize >= 32) { // A2B0 tag is present. Check for a matrix scale on para curve types 1 and above
+            uint8_t * rawA2B0 = clAllocate(aToBTagSize);
+            uint32_t matrixCurveOffset = 0;
+
+            cmsReadRawTag(profile->handle, cmsSigAToB0Tag, rawA2B0, aToBTagSize);
+            memcpy(&matrixCurveOffset, rawA2B0 + 20, sizeof(matrixCurveOffset));
+            matrixCurveOffset = clNTOHL(matrixCurveOffset);
+            if (matrixCurveOffset == 0) {
+                // No matrix curve present
                 clFree(rawA2B0);
+                return clFalse;
             }
-        }
-    }
 
-    if (luminance) {
-        cmsCIEXYZ * lumi = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigLuminanceTag);
-        if (lumi) {
-            *luminance = (int)lumi->Y;
-        } else {
-            *luminance = 0;
+            if (!memcmp(&rawA2B0[matrixCurveOffset], "para", 4)) {
+                uint16_t curveType;
+                memcpy(&curveType, &rawA2B0[matrixCurveOffset + 8], 2);
+                curveType = clNTOHS(curveType);
+                if ((curveType > 0) && (curveType <= 4)) {
+                    // Guaranteed to have a g(0) argument and an a(1) argument. a^g is the scale.
+                    float g, a;
+                    cmsS15Fixed16Number e;
+                    memcpy(&e, &rawA2B0[matrixCurveOffset + 12], 4);
+                    g = (float)_cms15Fixed16toDouble(clNTOHL(e));
+                    memcpy(&e, &rawA2B0[matrixCurveOffset + 16], 4);
+                    a = (float)_cms15Fixed16toDouble(clNTOHL(e));
+                    curve->implicitScale = clPixelMathRoundf(powf(a, g) * 100.0f) /
+                                           100.0f; // Round to 0.01, otherwise you get stuff like 100.0000019x
+                }
+            }
+            clFree(rawA2B0);
         }
     }
     return clTrue;
 }
 
+static int calcLuminance(struct clContext * C, clProfile * profile)
+{
+    COLORIST_UNUSED(C);
+
+    cmsCIEXYZ * lumi = (cmsCIEXYZ *)cmsReadTag(profile->handle, cmsSigLuminanceTag);
+    return lumi ? (int)lumi->Y : 0;
+}
+
 void clProfileYUVCoefficientsSetDefaults(struct clContext * C, clProfileYUVCoefficients * yuv)
 {
     COLORIST_UNUSED(C);
@@ -666,16 +848,22 @@ clBool clProfileSetMLU(struct clContext * C,
     rawTagPtr[1] = tag[2];
     rawTagPtr[2] = tag[1];
     rawTagPtr[3] = tag[0];
+    if (!clProfileDetach(C, profile)) {
+        return clFalse;
+    }
     mlu = cmsMLUalloc(C->lcms, 1);
     cmsMLUsetASCII(mlu, languageCode, countryCode, ascii);
     cmsWriteTag(profile->handle, tagSignature, mlu);
     cmsMLUfree(mlu);
-    clProfileReload(C, profile); // Rebuild raw and signature
+    clProfileReload(C, profile); // Rebuild raw and hash
     return clTrue;
 }
 
 clBool clProfileSetGamma(struct clContext * C, clProfile * profile, float gamma)
 {
+    if (!clProfileDetach(C, profile)) {
+        return clFalse;
+    }
     cmsToneCurve * gammaCurve = cmsBuildGamma(C->lcms, gamma);
 
     if (!cmsWriteTag(profile->handle, cmsSigRedTRCTag, (void *)gammaCurve)) {
@@ -689,7 +877,7 @@ clBool clProfileSetGamma(struct clContext * C, clProfile * profile, float gamma)
     }
 cleanup:
     cmsFreeToneCurve(gammaCurve);
-    clProfileReload(C, profile); // Rebuild raw and signature
+    clProfileReload(C, profile); // Rebuild raw and hash
     return clTrue;
 }
 
@@ -697,11 +885,14 @@ clBool clProfileSetLuminance(struct clContext * C, clProfile * profile, int lumi
 {
     clBool ret;
     cmsCIEXYZ lumi;
+    if (!clProfileDetach(C, profile)) {
+        return clFalse;
+    }
     lumi.X = 0.0f;
     lumi.Y = (cmsFloat64Number)luminance;
     lumi.Z = 0.0f;
     ret = cmsWriteTag(profile->handle, cmsSigLuminanceTag, &lumi) ? clTrue : clFalse;
-    clProfileReload(C, profile); // Rebuild raw and signature
+    clProfileReload(C, profile); // Rebuild raw and hash
     return ret;
 }
 
@@ -713,8 +904,11 @@ clBool clProfileRemoveTag(struct clContext * C, clProfile * profile, char * tag,
         if (reason) {
             clContextLog(C, "modify", 0, "WARNING: Removing tag \"%s\" (%s)", tag, reason);
         }
+        if (!clProfileDetach(C, profile)) {
+            return clFalse;
+        }
         cmsWriteTag(profile->handle, sig, NULL);
-        clProfileReload(C, profile); // Rebuild raw and signature
+        clProfileReload(C, profile); // Rebuild raw and hash
         return clTrue;
     }
     return clFalse;
@@ -732,19 +926,11 @@ clBool clProfileMatches(struct clContext * C, clProfile * profile1, clProfile *
         return clFalse;
     }
 
-    // Make sure one of them actually has a signature
-    int i;
-    for (i = 0; i < 16; ++i) {
-        if (profile1->signature[i] != 0)
-            break;
-        if (profile2->signature[i] != 0)
-            break;
-    }
-    if (i == 16) {
-        // No signatures, consider them not a match for now
+    // raw is always populated after clProfileParse(), so the hash and a byte compare settle it
+    if ((profile1->raw.size == 0) || (profile1->raw.size != profile2->raw.size) || (profile1->hash != profile2->hash)) {
         return clFalse;
     }
-    if (!memcmp(profile1->signature, profile2->signature, 16)) {
+    if ((profile1->raw.ptr == profile2->raw.ptr) || !memcmp(profile1->raw.ptr, profile2->raw.ptr, profile1->raw.size)) {
         return clTrue;
     }
     // TODO: fallback to doing a double clProfilePack and comparison? tag comparisons?
@@ -753,24 +939,20 @@ clBool clProfileMatches(struct clContext * C, clProfile * profile1, clProfile *
 
 clBool clProfileComponentsMatch(struct clContext * C, clProfile * profile1, clProfile * profile2)
 {
-    clProfilePrimaries primaries1, primaries2;
-    clProfileCurve curve1, curve2;
-    int luminance1, luminance2;
-
-    if (!clProfileQuery(C, profile1, &primaries1, &curve1, &luminance1)) {
+    if (!profile1->queryPrimariesValid || !profile1->queryCurveValid) {
         return clFalse;
     }
-    if (!clProfileQuery(C, profile2, &primaries2, &curve2, &luminance2)) {
+    if (!profile2->queryPrimariesValid || !profile2->queryCurveValid) {
         return clFalse;
     }
 
-    if (!clProfilePrimariesMatch(C, &primaries1, &primaries2)) {
+    if (!clProfilePrimariesMatch(C, &profile1->queryPrimaries, &profile2->queryPrimaries)) {
         return clFalse;
     }
-    if (memcmp(&curve1, &curve2, sizeof(curve1)) != 0) {
+    if (memcmp(&profile1->queryCurve, &profile2->queryCurve, sizeof(clProfileCurve)) != 0) {
         return clFalse;
     }
-    if (luminance1 != luminance2) {
+    if (profile1->queryLuminance != profile2->queryLuminance) {
         return clFalse;
     }
 
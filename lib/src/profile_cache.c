@@ -0,0 +1,350 @@
+// ---------------------------------------------------------------------------
+//                         Copyright Joe Drago 2018.
+//         Distributed under the Boost Software License, Version 1.0.
+//            (See accompanying file LICENSE_1_0.txt or copy at
+//                  http://www.boost.org/LICENSE_1_0.txt)
+// ---------------------------------------------------------------------------
+
+#include "colorist/profile.h"
+
+#include "colorist/context.h"
+
+#include "md5.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The file is a clProfileCacheHeader followed by count clProfileCacheEntry structs sorted by hash,
+// written in native byte order. It is only ever read by the machine that wrote it, so a header that
+// doesn't match exactly just means the cache gets rebuilt. Entries are found by the profile's XXH64
+// hash and size, and only trusted if the MD5 of its payload matches too.
+#define CACHE_MAGIC "clpc"
+#define CACHE_VERSION 2 // Bump whenever clProfileParse() derives anything differently
+
+#define CACHE_FLAG_PRIMARIES_VALID (1 << 0)
+#define CACHE_FLAG_CURVE_VALID (1 << 1)
+#define CACHE_FLAG_CCMM (1 << 2)
+
+typedef struct clProfileCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entrySize;
+    uint32_t count;
+} clProfileCacheHeader;
+
+typedef struct clProfileCacheEntry
+{
+    uint64_t hash;
+    uint64_t size;
+    uint8_t md5[16];
+    clProfilePrimaries primaries;
+    clProfileCurve curve;
+    int32_t luminance;
+    uint32_t flags;
+    float toXYZ[9];
+    float fromXYZ[9];
+} clProfileCacheEntry;
+
+typedef struct clProfileCache
+{
+    uint8_t * mapping; // The whole file, NULL if it didn't exist or wasn't usable
+    size_t mappingSize;
+    const clProfileCacheEntry * entries; // Points into mapping
+    uint32_t count;
+
+    clProfileCacheEntry * added; // Entries not in the file yet
+    int addedCount;
+    int addedCapacity;
+} clProfileCache;
+
+static void mapCache(struct clContext * C, clProfileCache * cache)
+{
+#if defined(_WIN32)
+    clRaw contents = CL_RAW_EMPTY;
+    if (!clRawReadFile(C, &contents, C->profileCacheFilename)) {
+        return;
+    }
+    cache->mapping = contents.ptr;
+    cache->mappingSize = contents.size;
+#else
+    int fd = open(C->profileCacheFilename, O_RDONLY);
+    if (fd < 0) {
+        return; // Nothing cached yet
+    }
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        void * mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            cache->mapping = (uint8_t *)mapping;
+            cache->mappingSize = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+#endif
+}
+
+static void unmapCache(struct clContext * C, clProfileCache * cache)
+{
+    if (cache->mapping) {
+#if defined(_WIN32)
+        clFree(cache->mapping);
+#else
+        COLORIST_UNUSED(C);
+        munmap(cache->mapping, cache->mappingSize);
+#endif
+    }
+    cache->mapping = NULL;
+    cache->mappingSize = 0;
+    cache->entries = NULL;
+    cache->count = 0;
+}
+
+static void loadCache(struct clContext * C, clProfileCache * cache)
+{
+    mapCache(C, cache);
+    if (cache->mapping) {
+        clProfileCacheHeader header;
+        clBool valid = clFalse;
+        if (cache->mappingSize >= sizeof(header)) {
+            memcpy(&header, cache->mapping, sizeof(header));
+            valid = !memcmp(header.magic, CACHE_MAGIC, 4) && (header.version == CACHE_VERSION) &&
+                    (header.entrySize == sizeof(clProfileCacheEntry)) &&
+                    (cache->mappingSize == sizeof(header) + ((size_t)header.count * sizeof(clProfileCacheEntry)));
+        }
+        if (valid) {
+            cache->entries = (const clProfileCacheEntry *)(cache->mapping + sizeof(header));
+            cache->count = header.count;
+        } else {
+            clContextLog(C, "cache", 0, "WARNING: Ignoring unrecognized profile cache: %s", C->profileCacheFilename);
+            unmapCache(C, cache);
+        }
+    }
+}
+
+static clProfileCache * getCache(struct clContext * C)
+{
+    if (!C->profileCacheFilename) {
+        return NULL;
+    }
+    if (!C->profileCache) {
+        C->profileCache = clAllocateStruct(clProfileCache);
+        loadCache(C, C->profileCache);
+    }
+    return C->profileCache;
+}
+
+static void profileMD5(clProfile * profile, uint8_t md5[16])
+{
+    MD5_CTX ctx;
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, profile->raw.ptr, (unsigned long)profile->raw.size);
+    MD5_Final(md5, &ctx);
+}
+
+static clBool entryMatches(const clProfileCacheEntry * entry, uint64_t hash, uint64_t size, const uint8_t md5[16])
+{
+    return (entry->hash == hash) && (entry->size == size) && !memcmp(entry->md5, md5, sizeof(entry->md5));
+}
+
+static const clProfileCacheEntry * findMappedEntry(clProfileCache * cache, uint64_t hash, uint64_t size, const uint8_t md5[16])
+{
+    // Binary search to the first entry with this hash, then check each entry sharing it
+    uint32_t lo = 0;
+    uint32_t hi = cache->count;
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2);
+        if (cache->entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; (lo < cache->count) && (cache->entries[lo].hash == hash); ++lo) {
+        if (entryMatches(&cache->entries[lo], hash, size, md5)) {
+            return &cache->entries[lo];
+        }
+    }
+    return NULL;
+}
+
+static const clProfileCacheEntry * findEntry(clProfileCache * cache, uint64_t hash, uint64_t size, const uint8_t md5[16])
+{
+    const clProfileCacheEntry * entry = findMappedEntry(cache, hash, size, md5);
+    if (entry) {
+        return entry;
+    }
+    for (int i = 0; i < cache->addedCount; ++i) {
+        if (entryMatches(&cache->added[i], hash, size, md5)) {
+            return &cache->added[i];
+        }
+    }
+    return NULL;
+}
+
+clBool clProfileCacheLookup(struct clContext * C, clProfile * profile)
+{
+    clProfileCache * cache = getCache(C);
+    if (!cache || (profile->raw.size == 0)) {
+        return clFalse;
+    }
+
+    uint8_t md5[16];
+    profileMD5(profile, md5);
+    const clProfileCacheEntry * entry = findEntry(cache, profile->hash, profile->raw.size, md5);
+    if (!entry) {
+        return clFalse;
+    }
+    memcpy(&profile->queryPrimaries, &entry->primaries, sizeof(clProfilePrimaries));
+    memcpy(&profile->queryCurve, &entry->curve, sizeof(clProfileCurve));
+    profile->queryLuminance = entry->luminance;
+    profile->queryPrimariesValid = (entry->flags & CACHE_FLAG_PRIMARIES_VALID) ? clTrue : clFalse;
+    profile->queryCurveValid = (entry->flags & CACHE_FLAG_CURVE_VALID) ? clTrue : clFalse;
+    profile->ccmm = (entry->flags & CACHE_FLAG_CCMM) ? clTrue : clFalse;
+    memcpy(profile->queryToXYZ, entry->toXYZ, sizeof(entry->toXYZ));
+    memcpy(profile->queryFromXYZ, entry->fromXYZ, sizeof(entry->fromXYZ));
+    return clTrue;
+}
+
+void clProfileCacheStore(struct clContext * C, clProfile * profile)
+{
+    clProfileCache * cache = getCache(C);
+    if (!cache || (profile->raw.size == 0)) {
+        return;
+    }
+    uint8_t md5[16];
+    profileMD5(profile, md5);
+    if (findEntry(cache, profile->hash, profile->raw.size, md5)) {
+        return;
+    }
+
+    if (cache->addedCount == cache->addedCapacity) {
+        int newCapacity = cache->addedCapacity ? (cache->addedCapacity * 2) : 16;
+        clProfileCacheEntry * newAdded = clAllocate(sizeof(clProfileCacheEntry) * newCapacity);
+        if (cache->added) {
+            memcpy(newAdded, cache->added, sizeof(clProfileCacheEntry) * cache->addedCount);
+            clFree(cache->added);
+        }
+        cache->added = newAdded;
+        cache->addedCapacity = newCapacity;
+    }
+
+    clProfileCacheEntry * entry = &cache->added[cache->addedCount++];
+    memset(entry, 0, sizeof(clProfileCacheEntry)); // Keep padding deterministic on disk
+    entry->hash = profile->hash;
+    entry->size = profile->raw.size;
+    memcpy(entry->md5, md5, sizeof(entry->md5));
+    memcpy(&entry->primaries, &profile->queryPrimaries, sizeof(clProfilePrimaries));
+    memcpy(&entry->curve, &profile->queryCurve, sizeof(clProfileCurve));
+    entry->luminance = profile->queryLuminance;
+    entry->flags = (profile->queryPrimariesValid ? CACHE_FLAG_PRIMARIES_VALID : 0) |
+                   (profile->queryCurveValid ? CACHE_FLAG_CURVE_VALID : 0) | (profile->ccmm ? CACHE_FLAG_CCMM : 0);
+    memcpy(entry->toXYZ, profile->queryToXYZ, sizeof(entry->toXYZ));
+    memcpy(entry->fromXYZ, profile->queryFromXYZ, sizeof(entry->fromXYZ));
+}
+
+static int compareEntries(const void * a, const void * b)
+{
+    const clProfileCacheEntry * e1 = (const clProfileCacheEntry *)a;
+    const clProfileCacheEntry * e2 = (const clProfileCacheEntry *)b;
+    if (e1->hash != e2->hash) {
+        return (e1->hash < e2->hash) ? -1 : 1;
+    }
+    if (e1->size != e2->size) {
+        return (e1->size < e2->size) ? -1 : 1;
+    }
+    return memcmp(e1->md5, e2->md5, sizeof(e1->md5));
+}
+
+clBool clProfileCacheFlush(struct clContext * C)
+{
+    clProfileCache * cache = C->profileCache;
+    if (!cache || (cache->addedCount == 0)) {
+        return clTrue;
+    }
+
+    // Pick up whatever other contexts (batch workers) or processes flushed since this one loaded the
+    // file, so this write keeps their entries; anything they already wrote drops out of added.
+    unmapCache(C, cache);
+    loadCache(C, cache);
+    int addedCount = 0;
+    for (int i = 0; i < cache->addedCount; ++i) {
+        if (!findMappedEntry(cache, cache->added[i].hash, cache->added[i].size, cache->added[i].md5)) {
+            cache->added[addedCount++] = cache->added[i];
+        }
+    }
+    cache->addedCount = addedCount;
+    if (cache->addedCount == 0) {
+        return clTrue;
+    }
+
+    // Merge what is in the file with what was added, which are now disjoint
+    clProfileCacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.entrySize = sizeof(clProfileCacheEntry);
+    header.count = cache->count + (uint32_t)cache->addedCount;
+
+    clRaw contents = CL_RAW_EMPTY;
+    clRawRealloc(C, &contents, sizeof(header) + ((size_t)header.count * sizeof(clProfileCacheEntry)));
+    clProfileCacheEntry * entries = (clProfileCacheEntry *)(contents.ptr + sizeof(header));
+    memcpy(contents.ptr, &header, sizeof(header));
+    if (cache->count > 0) {
+        memcpy(entries, cache->entries, sizeof(clProfileCacheEntry) * cache->count);
+    }
+    memcpy(entries + cache->count, cache->added, sizeof(clProfileCacheEntry) * cache->addedCount);
+    qsort(entries, header.count, sizeof(clProfileCacheEntry), compareEntries);
+
+    // Write next to the real file and swap it in, so concurrent readers only ever see a whole cache.
+    // If two processes flush at the same moment, the last one wins; the loser's entries are simply rebuilt later.
+    char tmpFilename[1024];
+#if defined(_WIN32)
+    snprintf(tmpFilename, sizeof(tmpFilename), "%s.%d.tmp", C->profileCacheFilename, _getpid());
+#else
+    snprintf(tmpFilename, sizeof(tmpFilename), "%s.%d.tmp", C->profileCacheFilename, (int)getpid());
+#endif
+    clBool ret = clRawWriteFile(C, &contents, tmpFilename);
+    clRawFree(C, &contents);
+    if (ret) {
+#if defined(_WIN32)
+        ret = MoveFileExA(tmpFilename, C->profileCacheFilename, MOVEFILE_REPLACE_EXISTING) ? clTrue : clFalse;
+#else
+        ret = (rename(tmpFilename, C->profileCacheFilename) == 0) ? clTrue : clFalse;
+#endif
+        if (!ret) {
+            clContextLogError(C, "Failed to update profile cache: %s", C->profileCacheFilename);
+            remove(tmpFilename);
+        }
+    }
+    if (ret) {
+        // Everything added is on disk now, switch over to the merged file
+        cache->addedCount = 0;
+        unmapCache(C, cache);
+        loadCache(C, cache);
+    }
+    return ret;
+}
+
+void clProfileCacheDestroy(struct clContext * C)
+{
+    clProfileCache * cache = C->profileCache;
+    if (!cache) {
+        return;
+    }
+    clProfileCacheFlush(C);
+    unmapCache(C, cache);
+    clFree(cache->added);
+    clFree(cache);
+    C->profileCache = NULL;
+}
@@ -15,33 +15,38 @@
 
 #include <string.h>
 
-struct CurveSignature
+// Known PQ profiles, recognized by the MD5 of the whole ICC payload. The size is checked first so
+// that only candidate profiles get hashed.
+struct ProfileSignature
 {
-    uint8_t signature[16];
+    size_t size;
+    uint8_t md5[16];
 };
 
-static struct CurveSignature pqProfiles_[] = {
-    { { 0x59, 0x53, 0xac, 0x21, 0x04, 0x41, 0x70, 0xc4, 0x7c, 0x98, 0x9e, 0xa6, 0x27, 0x11, 0x42, 0xd9 } }, // HDR_HD_ST2084.icc
-    { { 0x57, 0x15, 0xa6, 0x9d, 0xc0, 0xc9, 0x89, 0x16, 0x1e, 0x3f, 0x71, 0x6a, 0xe3, 0x72, 0xa0, 0x1d } }, // HDR_P3_D65_ST2084.icc
-    { { 0xbf, 0x0c, 0x50, 0x8c, 0x59, 0xaa, 0xfc, 0xa1, 0x17, 0xc3, 0xcf, 0xce, 0xd6, 0xf3, 0xe3, 0x07 } } // HDR_UHD_ST2084.icc
+static struct ProfileSignature pqProfiles_[] = {
+    { 20052, { 0x59, 0x53, 0xac, 0x21, 0x04, 0x41, 0x70, 0xc4, 0x7c, 0x98, 0x9e, 0xa6, 0x27, 0x11, 0x42, 0xd9 } }, // HDR_HD_ST2084.icc
+    { 20052, { 0x57, 0x15, 0xa6, 0x9d, 0xc0, 0xc9, 0x89, 0x16, 0x1e, 0x3f, 0x71, 0x6a, 0xe3, 0x72, 0xa0, 0x1d } }, // HDR_P3_D65_ST2084.icc
+    { 20056, { 0xbf, 0x0c, 0x50, 0x8c, 0x59, 0xaa, 0xfc, 0xa1, 0x17, 0xc3, 0xcf, 0xce, 0xd6, 0xf3, 0xe3, 0x07 } } // HDR_UHD_ST2084.icc
 };
 static const int pqProfileCount = sizeof(pqProfiles_) / sizeof(pqProfiles_[0]);
 
-static struct CurveSignature sentinelHLGCurve_ = {
-    { 0x68, 0x88, 0x4e, 0xc0, 0xd3, 0x82, 0xe4, 0x43, 0xcd, 0x03, 0x91, 0xfd, 0xb9, 0x17, 0x8e, 0x94 }
-}; // hlgCurve.bin
-static struct CurveSignature sentinelPQCurve_ = {
-    { 0x40, 0xb8, 0xbe, 0x41, 0x32, 0xd9, 0x58, 0x33, 0x1c, 0xaa, 0xc1, 0x20, 0x4c, 0x72, 0xdc, 0xae }
-}; // pqCurve.bin
-static struct CurveSignature sentinelSRGBCurve_ = {
-    { 0x84, 0x1c, 0x15, 0x83, 0x44, 0x34, 0x06, 0x7e, 0x6a, 0x13, 0xf2, 0x50, 0xdf, 0xc4, 0x29, 0x20 }
-}; // srgbCurve.bin
-
 clBool clProfileHasPQSignature(struct clContext * C, clProfile * profile, clProfilePrimaries * primaries)
 {
+    clBool md5Calculated = clFalse;
+    uint8_t md5[16];
     for (int i = 0; i < pqProfileCount; ++i) {
-        struct CurveSignature * pqProfile = &pqProfiles_[i];
-        if (!memcmp(pqProfile->signature, profile->signature, sizeof(struct CurveSignature))) {
+        struct ProfileSignature * pqProfile = &pqProfiles_[i];
+        if (pqProfile->size != profile->raw.size) {
+            continue;
+        }
+        if (!md5Calculated) {
+            MD5_CTX ctx;
+            MD5_Init(&ctx);
+            MD5_Update(&ctx, profile->raw.ptr, (unsigned long)profile->raw.size);
+            MD5_Final(md5, &ctx);
+            md5Calculated = clTrue;
+        }
+        if (!memcmp(pqProfile->md5, md5, sizeof(md5))) {
             if (primaries) {
                 clProfileQuery(C, profile, primaries, NULL, NULL);
             }
@@ -51,31 +56,30 @@ clBool clProfileHasPQSignature(struct clContext * C, clProfile * profile, clProf
     return clFalse;
 }
 
+// The sentinel curves are the ones colorist embeds (see clProfileCreate()), so an exact compare
+// against those bytes identifies them; memcmp bails at the first differing byte.
+static clBool matchesCurve(const uint8_t * rawCurve, int rawCurveSize, const uint8_t * curve, unsigned int curveSize)
+{
+    return ((rawCurveSize == (int)curveSize) && !memcmp(rawCurve, curve, curveSize)) ? clTrue : clFalse;
+}
+
 clProfileCurveType clProfileCurveSignature(struct clContext * C, clProfile * profile)
 {
+    clProfileCurveType curveType = CL_PCT_UNKNOWN;
     cmsInt32Number redTRCTagSize = cmsReadRawTag(profile->handle, cmsSigRedTRCTag, NULL, 0);
     if ((redTRCTagSize == (int)pqCurveBinarySize) || (redTRCTagSize == (int)hlgCurveBinarySize) ||
         (redTRCTagSize == (int)srgbCurveBinarySize)) {
-        struct CurveSignature curveSignature;
         uint8_t * rawCurve = clAllocate(redTRCTagSize);
         cmsReadRawTag(profile->handle, cmsSigRedTRCTag, rawCurve, redTRCTagSize);
 
-        MD5_CTX ctx;
-        MD5_Init(&ctx);
-        MD5_Update(&ctx, rawCurve, (unsigned long)redTRCTagSize);
-        MD5_Final(curveSignature.signature, &ctx);
-
-        clFree(rawCurve);
-
-        if (!memcmp(&sentinelHLGCurve_, &curveSignature, sizeof(struct CurveSignature))) {
-            return CL_PCT_HLG;
-        }
-        if (!memcmp(&sentinelPQCurve_, &curveSignature, sizeof(struct CurveSignature))) {
-            return CL_PCT_PQ;
-        }
-        if (!memcmp(&sentinelSRGBCurve_, &curveSignature, sizeof(struct CurveSignature))) {
-            return CL_PCT_SRGB;
+        if (matchesCurve(rawCurve, redTRCTagSize, hlgCurveBinaryData, hlgCurveBinarySize)) {
+            curveType = CL_PCT_HLG;
+        } else if (matchesCurve(rawCurve, redTRCTagSize, pqCurveBinaryData, pqCurveBinarySize)) {
+            curveType = CL_PCT_PQ;
+        } else if (matchesCurve(rawCurve, redTRCTagSize, srgbCurveBinaryData, srgbCurveBinarySize)) {
+            curveType = CL_PCT_SRGB;
         }
+        clFree(rawCurve);
     }
-    return CL_PCT_UNKNOWN;
+    return curveType;
 }
@@ -13,6 +13,7 @@
 
 #include "cJSON.h"
 #include "lcms2.h"
+#include "md5.h"
 
 #include <string.h>
 
@@ -86,7 +87,12 @@ void clProfileDebugDump(struct clContext * C, clProfile * profile, clBool dumpTa
         }
         clContextLog(C, "profile", 1 + extraIndent, "CCMM friendly: %s", profile->ccmm ? "true" : "false");
 
-        uint8_t * s = profile->signature;
+        // The MD5 is only needed here (and for the known PQ profiles), so it isn't kept on clProfile
+        uint8_t s[16];
+        MD5_CTX ctx;
+        MD5_Init(&ctx);
+        MD5_Update(&ctx, profile->raw.ptr, (unsigned long)profile->raw.size);
+        MD5_Final(s, &ctx);
         clContextLog(C,
                      "profile",
                      1 + extraIndent,
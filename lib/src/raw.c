@@ -14,6 +14,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 void clRawRealloc(struct clContext * C, clRaw * raw, size_t newSize)
 {
@@ -222,19 +223,101 @@ clBool clRawWriteFile(struct clContext * C, clRaw * raw, const char * filename)
     return clTrue;
 }
 
-int clFileSize(const char * filename)
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t xxhRotl64(uint64_t x, int r)
 {
-    // TODO: reimplement as fstat()
-    long bytes;
+    return (x << r) | (x >> (64 - r));
+}
 
-    FILE * f;
-    f = fopen(filename, "rb");
-    if (!f) {
+static uint64_t xxhRead64(const uint8_t * p)
+{
+    // Little endian regardless of host, so hashes are stable across machines
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) |
+           ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t xxhRead32(const uint8_t * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxhRotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxhMergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= xxhRound(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t clHash64(const uint8_t * data, size_t len)
+{
+    const uint8_t * p = data;
+    const uint8_t * end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        const uint8_t * limit = end - 32;
+        uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = XXH_PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - XXH_PRIME64_1;
+        do {
+            v1 = xxhRound(v1, xxhRead64(p));
+            v2 = xxhRound(v2, xxhRead64(p + 8));
+            v3 = xxhRound(v3, xxhRead64(p + 16));
+            v4 = xxhRound(v4, xxhRead64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = xxhRotl64(v1, 1) + xxhRotl64(v2, 7) + xxhRotl64(v3, 12) + xxhRotl64(v4, 18);
+        h = xxhMergeRound(h, v1);
+        h = xxhMergeRound(h, v2);
+        h = xxhMergeRound(h, v3);
+        h = xxhMergeRound(h, v4);
+    } else {
+        h = XXH_PRIME64_5;
+    }
+    h += (uint64_t)len;
+
+    while ((p + 8) <= end) {
+        h ^= xxhRound(0, xxhRead64(p));
+        h = xxhRotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if ((p + 4) <= end) {
+        h ^= (uint64_t)xxhRead32(p) * XXH_PRIME64_1;
+        h = xxhRotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxhRotl64(h, 11) * XXH_PRIME64_1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+int clFileSize(const char * filename)
+{
+    // stat() instead of opening the file; this is only ever used for logging
+    struct stat st;
+    if (stat(filename, &st) != 0) {
         return -1;
     }
-    fseek(f, 0, SEEK_END);
-    bytes = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    fclose(f);
-    return (int)bytes;
+    return (int)st.st_size;
 }
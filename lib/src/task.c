@@ -11,6 +11,10 @@
 
 static void nativeTaskStart(clContext * C, clTask * task);
 static void nativeTaskJoin(clContext * C, clTask * task);
+static void nativeMutexCreate(clContext * C, clMutex * mutex);
+static void nativeMutexDestroy(clContext * C, clMutex * mutex);
+static void nativeConditionCreate(clContext * C, clCondition * condition);
+static void nativeConditionDestroy(clContext * C, clCondition * condition);
 
 clTask * clTaskCreate(struct clContext * C, clTaskFunc func, void * userData)
 {
@@ -39,6 +43,50 @@ void clTaskDestroy(struct clContext * C, clTask * task)
     clFree(task);
 }
 
+void clTaskRunAll(struct clContext * C, clTaskFunc func, void * infos, size_t infoSize, int taskCount)
+{
+    if (taskCount == 1) {
+        // Don't bother making any new threads
+        func(infos);
+        return;
+    }
+
+    clTask ** tasks = clAllocate(taskCount * sizeof(clTask *));
+    for (int i = 0; i < taskCount; ++i) {
+        tasks[i] = clTaskCreate(C, func, (uint8_t *)infos + (i * infoSize));
+    }
+    for (int i = 0; i < taskCount; ++i) {
+        clTaskDestroy(C, tasks[i]);
+    }
+    clFree(tasks);
+}
+
+clMutex * clMutexCreate(struct clContext * C)
+{
+    clMutex * mutex = clAllocateStruct(clMutex);
+    nativeMutexCreate(C, mutex);
+    return mutex;
+}
+
+void clMutexDestroy(struct clContext * C, clMutex * mutex)
+{
+    nativeMutexDestroy(C, mutex);
+    clFree(mutex);
+}
+
+clCondition * clConditionCreate(struct clContext * C)
+{
+    clCondition * condition = clAllocateStruct(clCondition);
+    nativeConditionCreate(C, condition);
+    return condition;
+}
+
+void clConditionDestroy(struct clContext * C, clCondition * condition)
+{
+    nativeConditionDestroy(C, condition);
+    clFree(condition);
+}
+
 #ifdef _WIN32
 
 #pragma warning(disable : 5031)
@@ -59,6 +107,16 @@ typedef struct clNativeTask
     HANDLE hThread;
 } clNativeTask;
 
+int clAtomicIncrement(int * value)
+{
+    return (int)InterlockedIncrement((LONG volatile *)value);
+}
+
+int clAtomicDecrement(int * value)
+{
+    return (int)InterlockedDecrement((LONG volatile *)value);
+}
+
 static DWORD WINAPI taskThreadProc(LPVOID lpParameter)
 {
     clTask * task = (clTask *)lpParameter;
@@ -83,6 +141,54 @@ static void nativeTaskJoin(clContext * C, clTask * task)
     task->nativeData = NULL;
 }
 
+static void nativeMutexCreate(clContext * C, clMutex * mutex)
+{
+    CRITICAL_SECTION * criticalSection = clAllocateStruct(CRITICAL_SECTION);
+    InitializeCriticalSection(criticalSection);
+    mutex->nativeData = criticalSection;
+}
+
+static void nativeMutexDestroy(clContext * C, clMutex * mutex)
+{
+    DeleteCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+    clFree(mutex->nativeData);
+    mutex->nativeData = NULL;
+}
+
+void clMutexLock(clMutex * mutex)
+{
+    EnterCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+}
+
+void clMutexUnlock(clMutex * mutex)
+{
+    LeaveCriticalSection((CRITICAL_SECTION *)mutex->nativeData);
+}
+
+static void nativeConditionCreate(clContext * C, clCondition * condition)
+{
+    CONDITION_VARIABLE * conditionVariable = clAllocateStruct(CONDITION_VARIABLE);
+    InitializeConditionVariable(conditionVariable);
+    condition->nativeData = conditionVariable;
+}
+
+static void nativeConditionDestroy(clContext * C, clCondition * condition)
+{
+    // CONDITION_VARIABLEs have nothing to tear down
+    clFree(condition->nativeData);
+    condition->nativeData = NULL;
+}
+
+void clConditionWait(clCondition * condition, clMutex * mutex)
+{
+    SleepConditionVariableCS((CONDITION_VARIABLE *)condition->nativeData, (CRITICAL_SECTION *)mutex->nativeData, INFINITE);
+}
+
+void clConditionBroadcast(clCondition * condition)
+{
+    WakeAllConditionVariable((CONDITION_VARIABLE *)condition->nativeData);
+}
+
 #else /* ifdef _WIN32 */
 
 #ifdef __APPLE__
@@ -127,6 +233,16 @@ int clTaskLimit()
 
 #include <pthread.h>
 
+int clAtomicIncrement(int * value)
+{
+    return __sync_add_and_fetch(value, 1);
+}
+
+int clAtomicDecrement(int * value)
+{
+    return __sync_sub_and_fetch(value, 1);
+}
+
 typedef struct clNativeTask
 {
     pthread_t pthread;
@@ -154,4 +270,52 @@ static void nativeTaskJoin(clContext * C, clTask * task)
     task->nativeData = NULL;
 }
 
+static void nativeMutexCreate(clContext * C, clMutex * mutex)
+{
+    pthread_mutex_t * pmutex = clAllocateStruct(pthread_mutex_t);
+    pthread_mutex_init(pmutex, NULL);
+    mutex->nativeData = pmutex;
+}
+
+static void nativeMutexDestroy(clContext * C, clMutex * mutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t *)mutex->nativeData);
+    clFree(mutex->nativeData);
+    mutex->nativeData = NULL;
+}
+
+void clMutexLock(clMutex * mutex)
+{
+    pthread_mutex_lock((pthread_mutex_t *)mutex->nativeData);
+}
+
+void clMutexUnlock(clMutex * mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex->nativeData);
+}
+
+static void nativeConditionCreate(clContext * C, clCondition * condition)
+{
+    pthread_cond_t * cond = clAllocateStruct(pthread_cond_t);
+    pthread_cond_init(cond, NULL);
+    condition->nativeData = cond;
+}
+
+static void nativeConditionDestroy(clContext * C, clCondition * condition)
+{
+    pthread_cond_destroy((pthread_cond_t *)condition->nativeData);
+    clFree(condition->nativeData);
+    condition->nativeData = NULL;
+}
+
+void clConditionWait(clCondition * condition, clMutex * mutex)
+{
+    pthread_cond_wait((pthread_cond_t *)condition->nativeData, (pthread_mutex_t *)mutex->nativeData);
+}
+
+void clConditionBroadcast(clCondition * condition)
+{
+    pthread_cond_broadcast((pthread_cond_t *)condition->nativeData);
+}
+
 #endif /* ifdef _WIN32 */
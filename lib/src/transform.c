@@ -316,32 +316,31 @@ void clTransformPrepare(struct clContext * C, struct clTransform * transform)
         if (!transform->ccmmReady) {
             clProfilePrimaries srcPrimaries;
             clProfilePrimaries dstPrimaries;
-            gbMat3 dstToXYZ;
 
             derivePrimariesAndXTF(C, transform->srcProfile, &srcPrimaries, &transform->ccmmSrcEOTF, &transform->ccmmSrcGamma);
             derivePrimariesAndXTF(C, transform->dstProfile, &dstPrimaries, &transform->ccmmDstOETF, &transform->ccmmDstInvGamma);
 
-            if (clProfilePrimariesMatch(C, &srcPrimaries, &dstPrimaries)) {
+            // Both profiles carry their clTransformDeriveXYZMatrix() results (see clProfileParse())
+            struct clProfile * srcMatrixProfile = transform->srcProfile;
+            if (srcMatrixProfile && transform->dstProfile && clProfilePrimariesMatch(C, &srcPrimaries, &dstPrimaries)) {
                 // if the src/dst primaries are close enough, make them match exactly to help roundtripping
                 // by making the SrcToXYZ and XYZtoDst matrices as close to true inverses of one another as possible.
-                memcpy(&srcPrimaries, &dstPrimaries, sizeof(srcPrimaries));
+                srcMatrixProfile = transform->dstProfile;
             }
 
-            if (transform->srcProfile) {
-                clTransformDeriveXYZMatrix(C, &srcPrimaries, &transform->ccmmSrcToXYZ);
+            if (srcMatrixProfile) {
+                memcpy(transform->ccmmSrcToXYZ.e, srcMatrixProfile->queryToXYZ, sizeof(transform->ccmmSrcToXYZ.e));
             } else {
                 gb_mat3_identity(&transform->ccmmSrcToXYZ);
             }
-            if (transform->dstProfile) {
-                clTransformDeriveXYZMatrix(C, &dstPrimaries, &dstToXYZ);
-            } else {
-                gb_mat3_identity(&dstToXYZ);
-            }
             if ((transform->ccmmDstOETF == CL_XTF_GAMMA) && (transform->ccmmDstInvGamma != 0.0f)) {
                 transform->ccmmDstInvGamma = 1.0f / transform->ccmmDstInvGamma;
             }
-            gb_mat3_inverse(&transform->ccmmXYZToDst, &dstToXYZ);
-            gb_mat3_transpose(&transform->ccmmXYZToDst);
+            if (transform->dstProfile) {
+                memcpy(transform->ccmmXYZToDst.e, transform->dstProfile->queryFromXYZ, sizeof(transform->ccmmXYZToDst.e));
+            } else {
+                gb_mat3_identity(&transform->ccmmXYZToDst);
+            }
 
             DEBUG_PRINT_MATRIX("XYZtoDst", &transform->ccmmXYZToDst);
             DEBUG_PRINT_MATRIX("MA", &transform->ccmmSrcToXYZ);
@@ -773,6 +772,12 @@ static void transformTaskFunc(clTransformTask * info)
     clCCMMTransform(info->C, info->transform, info->useCCMM, info->inPixels, info->outPixels, info->pixelCount);
 }
 
+void clTransformRunSerial(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount)
+{
+    clTransformPrepare(C, transform);
+    clCCMMTransform(C, transform, clTransformUsesCCMM(C, transform), srcPixels, dstPixels, pixelCount);
+}
+
 void clTransformRun(struct clContext * C, clTransform * transform, float * srcPixels, float * dstPixels, int pixelCount)
 {
     int srcChannelCount = clTransformFormatToChannelCount(C, transform->srcFormat);